@@ -0,0 +1,356 @@
+// portable benchmark for the walks QUERY /s, QUERY /f and EXPORT make, over the in-memory registry backend
+// build: g++ -O2 -std=c++17 -pthread reg/bench-backend.cpp -o bench-backend   (or clang-cl -O2 -std:c++17 -DUNICODE)
+// usage: bench-backend [-keys count] [-delay microseconds] [-threads count] [-win32 KeyName] [file.reg ...]
+//	the tree is loaded from the .reg files, or else made up roughly like HKLM\SOFTWARE
+//	-delay adds latency to every call, to see how a walk scales with the cost of the registry rather than its own
+//	-win32 (Windows only) walks KeyName in the registry itself, for comparison
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include "reg-doc.h"
+#include "reg-backend.h"
+#include <stdio.h>
+
+using clock_type = std::chrono::steady_clock;
+
+//-----------------------------------------------------------------------------
+//	Walk
+//	visits every key under one, reading each value as QUERY /s does, and optionally
+//	matching a pattern against names and strings (QUERY /f) or writing .reg text (EXPORT)
+//-----------------------------------------------------------------------------
+
+struct Walk {
+	Backend::Registry			&r;
+	const char16_t				*pattern	= nullptr;
+	uint32_t					pattern_n	= 0;
+	bool						write		= false;
+	uint64_t					keys = 0, values = 0, bytes = 0, matches = 0, calls = 0;
+	RegFile::Array<char16_t>	path;
+	RegFile::Array<char>		text;
+
+	Walk(Backend::Registry &r) : r(r) {}
+
+	bool	contains(const char16_t *s, uint32_t n) const {
+		for (uint32_t i = 0; i + pattern_n <= n; i++) {
+			uint32_t	j = 0;
+			while (j < pattern_n && RegFile::fold(s[i + j]) == RegFile::fold(pattern[j]))
+				++j;
+			if (j == pattern_n)
+				return true;
+		}
+		return false;
+	}
+
+	void	put(const char *s)	{ while (*s) text.push(*s++); }
+	void	put(const char16_t *s, uint32_t n) {
+		for (uint32_t i = 0; i < n; i++)
+			text.push(s[i] < 0x80 ? char(s[i]) : '?');
+	}
+	void	put_value(const char16_t *name, uint32_t n, uint32_t type, const uint8_t *data, uint32_t size) {
+		char	prefix[16];
+		put("\"");
+		put(name, n);
+		snprintf(prefix, sizeof(prefix), "\"=hex(%x):", type);
+		put(prefix);
+		for (uint32_t i = 0; i < size; i++) {
+			text.push("0123456789abcdef"[data[i] >> 4]);
+			text.push("0123456789abcdef"[data[i] & 15]);
+			if (i + 1 < size)
+				text.push(',');
+		}
+		put("\r\n");
+	}
+
+	// with defer, subkeys are opened and left there rather than walked
+	void	key(Backend::Key k, RegFile::Array<Backend::Key> *defer = nullptr) {
+		++keys;
+		Backend::Info	info;
+		++calls;
+		if (r.info(k, info))
+			return;
+
+		if (write) {
+			put("\r\n[");
+			put(path.p, path.n);
+			put("]\r\n");
+		}
+
+		auto	name	= (char16_t*)malloc(((info.max_value > info.max_subkey ? info.max_value : info.max_subkey) + 1) * 2);
+		auto	data	= (uint8_t*)malloc(info.max_data + 1);
+		for (uint32_t i = 0;; i++) {
+			uint32_t	n = info.max_value + 1, type, size = info.max_data;
+			++calls;
+			if (r.enum_value(k, i, name, n, type, data, size))
+				break;
+			++values;
+			bytes += size;
+			if (pattern && (contains(name, n) || ((type == 1 || type == 2 || type == 7) && contains((const char16_t*)data, size / 2))))
+				++matches;
+			if (write)
+				put_value(name, n, type, data, size);
+		}
+		free(data);
+
+		for (uint32_t i = 0;; i++) {
+			uint32_t	n = info.max_subkey + 1;
+			++calls;
+			if (r.enum_key(k, i, name, n))
+				break;
+			Backend::Key	sub;
+			++calls;
+			if (r.open(k, name, n, Backend::OPEN_READ, sub))
+				continue;
+			if (defer) {
+				defer->push(sub);
+				continue;
+			}
+			auto	at = path.n;
+			path.push('\\');
+			for (uint32_t j = 0; j < n; j++)
+				path.push(name[j]);
+			key(sub);
+			path.n = at;
+			r.close(sub);
+		}
+		free(name);
+	}
+
+	void	add(const Walk &b) {
+		keys	+= b.keys;
+		values	+= b.values;
+		bytes	+= b.bytes;
+		matches	+= b.matches;
+		calls	+= b.calls;
+	}
+};
+
+//-----------------------------------------------------------------------------
+//	trees
+//-----------------------------------------------------------------------------
+
+struct Names {
+	char16_t	p[256];
+	uint32_t	n = 0;
+	uint32_t	seed = 12345;
+
+	uint32_t rand() { seed = seed * 1103515245 + 12345; return seed >> 8; }
+	Names&	put(const char *s) { while (*s) p[n++] = *s++; return *this; }
+	Names&	hex(uint32_t v, int digits) {
+		for (int i = digits; i--;)
+			p[n++] = "0123456789abcdef"[(v >> (i * 4)) & 15];
+		return *this;
+	}
+	Names&	guid() {
+		return hex(rand(), 8).put("-").hex(rand(), 4).put("-").hex(rand(), 4).put("-").hex(rand(), 4).put("-").hex(rand(), 8).hex(rand(), 4);
+	}
+};
+
+// roughly the mix of HKLM\SOFTWARE, as bench-lz makes
+void generate(Backend::Memory &m, uint32_t count) {
+	static const char *roots[]	= {"Microsoft\\Windows\\CurrentVersion\\Uninstall", "Classes\\CLSID", "Microsoft\\Windows NT\\CurrentVersion\\Fonts", "Policies\\Microsoft\\Windows"};
+	static const char *names[]	= {"DisplayName", "InstallLocation", "Version", "Publisher", "EstimatedSize", "NoModify", "InprocServer32", "ThreadingModel"};
+
+	Names	g;
+	for (uint32_t i = 0; i < count; i++) {
+		g.n = 0;
+		g.put("HKEY_LOCAL_MACHINE\\SOFTWARE\\").put(roots[g.rand() % 4]).put("\\{").guid().put("}");
+		if (g.rand() % 4 == 0)
+			g.put("\\InprocServer32");
+
+		Backend::Key	k;
+		if (m.open(0, g.p, g.n, Backend::OPEN_CREATE, k))
+			continue;
+		for (int v = g.rand() % 8; v--;) {
+			Names	name, data;
+			name.put(names[g.rand() % 8]);
+			switch (g.rand() % 3) {
+				case 0:
+					data.put("C:\\Program Files\\").put(names[g.rand() % 8]).put("\\").hex(g.rand(), 6).put(".dll");
+					data.p[data.n++] = 0;
+					m.set_value(k, name.p, name.n, 1, (const uint8_t*)data.p, data.n * 2);
+					break;
+				case 1: {
+					uint32_t	dword = g.rand() % 4096;
+					m.set_value(k, name.p, name.n, 4, (const uint8_t*)&dword, 4);
+					break;
+				}
+				default: {
+					uint8_t	bytes[72];
+					auto	size = g.rand() % 64 + 8;
+					for (uint32_t j = 0; j < size; j++)
+						bytes[j] = uint8_t(g.rand());
+					m.set_value(k, name.p, name.n, 3, bytes, size);
+					break;
+				}
+			}
+		}
+		m.close(k);
+	}
+}
+
+bool load(Backend::Memory &m, const char *filename) {
+	FILE	*f = fopen(filename, "rb");
+	if (!f)
+		return false;
+	fseek(f, 0, SEEK_END);
+	auto	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	auto	data = (uint8_t*)malloc(size > 0 ? size : 1);
+	bool	ok	 = size > 0 && fread(data, 1, size, f) == (size_t)size;
+	fclose(f);
+
+	RegFile::Document	doc;
+	if (ok && (ok = doc.open(data, size)))
+		m.load(doc);
+	free(data);
+	return ok;
+}
+
+//-----------------------------------------------------------------------------
+//	runs
+//-----------------------------------------------------------------------------
+
+double seconds(clock_type::time_point t0) {
+	return std::chrono::duration<double>(clock_type::now() - t0).count();
+}
+
+void report(const char *label, const Walk &w, double t) {
+	printf("%-10s %8.3f s  %9llu keys  %9llu values  %6.1f MB  %10llu calls  %7.2f us/call",
+		label, t, (unsigned long long)w.keys, (unsigned long long)w.values, w.bytes / 1048576.0, (unsigned long long)w.calls, t * 1e6 / (w.calls ? w.calls : 1)
+	);
+	if (w.matches)
+		printf("  %llu matches", (unsigned long long)w.matches);
+	if (w.text.n)
+		printf("  %.1f MB written", w.text.n / 1048576.0);
+	printf("\n");
+}
+
+// keys near the root are read level by level until there are enough subtrees to share out between threads, as HASH and STATS do
+void parallel(Walk &total, Backend::Key root, uint32_t num_threads) {
+	auto	&r = total.r;
+	RegFile::Array<Backend::Key>	a, b, *work = &a, *next = &b;
+	work->push(root);
+	while (work->n && work->n < num_threads * 4) {
+		next->n = 0;
+		for (uint32_t i = 0; i < work->n; i++) {
+			total.key((*work)[i], next);
+			if ((*work)[i] != root)
+				r.close((*work)[i]);
+		}
+		std::swap(work, next);
+	}
+
+	std::atomic<uint32_t>	index{0};
+	auto	workers	= new Walk*[num_threads];
+	auto	threads	= new std::thread[num_threads];
+	for (uint32_t t = 0; t < num_threads; t++) {
+		workers[t] = new Walk(r);
+		threads[t] = std::thread([&, w = workers[t]]() {
+			for (uint32_t i; (i = index++) < work->n;) {
+				w->key((*work)[i]);
+				r.close((*work)[i]);
+			}
+		});
+	}
+	for (uint32_t t = 0; t < num_threads; t++) {
+		threads[t].join();
+		total.add(*workers[t]);
+		delete workers[t];
+	}
+	delete[] threads;
+	delete[] workers;
+}
+
+void run(Backend::Registry &r, const char16_t *start, uint32_t length, uint32_t num_threads) {
+	Backend::Key	root;
+	if (r.open(0, start, length, Backend::OPEN_READ, root)) {
+		printf("key not found\n");
+		return;
+	}
+
+	static const char16_t	pattern[] = u"program files";
+	auto	t0 = clock_type::now();
+	{
+		Walk	w(r);
+		w.key(root);
+		report("traverse", w, seconds(t0));
+	}
+	t0 = clock_type::now();
+	{
+		Walk	w(r);
+		w.pattern	= pattern;
+		w.pattern_n	= sizeof(pattern) / 2 - 1;
+		w.key(root);
+		report("search", w, seconds(t0));
+	}
+	t0 = clock_type::now();
+	{
+		Walk	w(r);
+		w.write	= true;
+		for (uint32_t i = 0; i < length; i++)
+			w.path.push(start[i]);
+		w.key(root);
+		report("export", w, seconds(t0));
+	}
+	if (num_threads > 1) {
+		char	label[16];
+		snprintf(label, sizeof(label), "x%u", num_threads);
+		t0 = clock_type::now();
+		Walk	w(r);
+		parallel(w, root, num_threads);
+		report(label, w, seconds(t0));
+	}
+	r.close(root);
+}
+
+int main(int argc, char *argv[]) {
+	uint32_t	count		= 100000;
+	uint32_t	delay		= 0;
+	uint32_t	num_threads	= std::thread::hardware_concurrency();
+	const char	*win32		= nullptr;
+	int			num_files	= 0;
+	Backend::Memory	memory;
+
+	auto	t0 = clock_type::now();
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-keys") == 0 && i + 1 < argc) {
+			count = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-delay") == 0 && i + 1 < argc) {
+			delay = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+			num_threads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-win32") == 0 && i + 1 < argc) {
+			win32 = argv[++i];
+		} else if (load(memory, argv[i])) {
+			++num_files;
+		} else {
+			printf("failed to load %s\n", argv[i]);
+			return 1;
+		}
+	}
+	if (!num_files)
+		generate(memory, count);
+	printf("loaded      %u keys in %.3f s, delay %u us, %u threads\n", memory.nodes.n - 1, seconds(t0), delay, num_threads);
+
+	memory.delay_us = delay;
+	memory.calls	= 0;
+	static const char16_t	top[] = u"HKEY_LOCAL_MACHINE";
+	run(memory, top, sizeof(top) / 2 - 1, num_threads);
+	printf("backend     %llu calls\n", (unsigned long long)memory.calls.load());
+
+#ifdef _WIN32
+	if (win32) {
+		Backend::Win32			registry;
+		RegFile::Array<char16_t>	start;
+		for (auto p = win32; *p; p++)
+			start.push(*p);
+		printf("win32       %s\n", win32);
+		run(registry, start.p, start.n, num_threads);
+	}
+#else
+	if (win32)
+		printf("-win32 needs Windows\n");
+#endif
+	return 0;
+}
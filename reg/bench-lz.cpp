@@ -0,0 +1,206 @@
+// portable benchmark for the /z export compressor
+// build: g++ -O2 -std=c++17 reg/bench-lz.cpp -o bench-lz   (or clang-cl -O2 -std:c++17)
+// usage: bench-lz [megabytes | file.reg]
+//	with a number, a .reg export of about that size is generated; with a file name, that export (say from REG EXPORT HKLM\SOFTWARE) is used
+
+#include "reg-lz.h"
+#include <chrono>
+
+using clock_type = std::chrono::steady_clock;
+
+struct Corpus {
+	uint8_t	*p;
+	size_t	size = 0, capacity;
+	uint32_t seed = 12345;
+
+	Corpus(size_t capacity) : p((uint8_t*)malloc(capacity + 65536)), capacity(capacity) {}
+	~Corpus() { free(p); }
+
+	// an existing export, read whole
+	bool	load(const char *filename) {
+		FILE	*f = fopen(filename, "rb");
+		if (!f)
+			return false;
+		size = fread(p, 1, capacity, f);
+		fclose(f);
+		return size > 0;
+	}
+
+	uint32_t rand() { seed = seed * 1103515245 + 12345; return seed >> 8; }
+	void	put(const char *s) { while (*s) p[size++] = *s++; }
+	void	put(const uint8_t *s, size_t n) { memcpy(p + size, s, n); size += n; }
+	void	hex(uint32_t v, int digits) {
+		for (int i = digits; i--;)
+			p[size++] = "0123456789abcdef"[(v >> (i * 4)) & 15];
+	}
+	void	hex_byte(uint8_t b, int &column) {
+		if (column) {
+			put(",");
+			if (column % 25 == 0)
+				put("\\\r\n  ");
+		}
+		hex(b, 2);
+		++column;
+	}
+
+	// a registry refers to the same few hundred class ids over and over
+	uint32_t	guids[256][4];
+	int		guid(char *to) {
+		auto	g = guids[rand() % 256];
+		return snprintf(to, 40, "{%08x-%04x-%04x-%04x-%08x%04x}", g[0], g[1] & 0xffff, g[2] & 0xffff, g[2] >> 16, g[3], g[1] >> 16);
+	}
+	void	guid() {
+		char	g[40];
+		put((const uint8_t*)g, guid(g));
+	}
+	// as REG_EXPAND_SZ and REG_MULTI_SZ are written: UTF-16 bytes
+	void	utf16(const char *s, int &column) {
+		for (; *s; s++) {
+			hex_byte(*s, column);
+			hex_byte(0, column);
+		}
+	}
+
+	const char *pick(const char *const *words, size_t n) { return words[rand() % n]; }
+
+	void	value() {
+		static const char *names[]	= {"DisplayName", "DisplayVersion", "InstallLocation", "Publisher", "UninstallString", "EstimatedSize", "NoModify", "ThreadingModel", "Start", "Type", "ErrorControl", "ImagePath", "Description", "ObjectName", "Flags", "Version"};
+		static const char *dlls[]	= {"shell32.dll", "ole32.dll", "kernel32.dll", "user32.dll", "combase.dll", "windows.storage.dll", "ntdll.dll", "mscoree.dll"};
+		static const char *words[]	= {"Both", "Apartment", "Free", "Microsoft Corporation", "LocalSystem", "NT AUTHORITY\\\\LocalService", "10.0.19041.1", "Windows", "Default"};
+		static const char *dirs[]	= {"%SystemRoot%\\System32\\", "%ProgramFiles%\\Common Files\\", "%SystemRoot%\\SysWOW64\\"};
+
+		auto	name = pick(names, 16);
+		if (rand() % 8 == 0)
+			put("@=");
+		else {
+			put("\""); put(name); put("\"=");
+		}
+		switch (rand() % 6) {
+			case 0:
+				put("\"C:\\\\Windows\\\\System32\\\\"); put(pick(dlls, 8)); put("\"\r\n");
+				break;
+			case 1:
+				put("\""); put(pick(words, 9)); put("\"\r\n");
+				break;
+			case 2:
+				put("dword:"); hex(rand() % 4 ? rand() % 4 : rand() % 65536, 8); put("\r\n");
+				break;
+			case 3:
+				put("\""); guid(); put("\"\r\n");
+				break;
+			case 4: {
+				put("hex(2):");
+				int		column	= 0;
+				utf16(pick(dirs, 3), column);
+				utf16(pick(dlls, 8), column);
+				hex_byte(0, column);
+				hex_byte(0, column);
+				put("\r\n");
+				break;
+			}
+			default: {
+				// binary values are mostly small structures: flags, sizes and padding
+				put("hex:");
+				int		column	= 0;
+				for (int i = (rand() % 4 + 1) * 8; i--;)
+					hex_byte(rand() % 3 ? 0 : rand() % 4 ? 1 : rand() & 0xff, column);
+				put("\r\n");
+				break;
+			}
+		}
+	}
+
+	// a key, its values, then its subkeys depth first, as EXPORT writes them
+	void	key(char *path, size_t len, int depth) {
+		static const char *children[] = {"Shell", "Open", "Command", "DefaultIcon", "InprocServer32", "ProgID", "Parameters", "Enum", "Settings", "Properties", "Security", "TypeLib", "0000", "0001", "0002"};
+
+		put("[HKEY_LOCAL_MACHINE\\SOFTWARE\\"); put((const uint8_t*)path, len); put("]\r\n");
+		for (int n = rand() % 6; n--;)
+			value();
+		put("\r\n");
+
+		for (int n = depth < 4 ? rand() % 5 : 0; n-- && size < capacity;) {
+			auto	child	= path + len + 1;
+			path[len]		= '\\';
+			key(path, len + 1 + (rand() % 3 == 0 ? guid(child) : sprintf(child, "%s", pick(children, 15))), depth + 1);
+		}
+	}
+
+	// roughly the shape of an HKLM\SOFTWARE export: deep trees of shared names and class ids, small values
+	void	generate() {
+		static const char *roots[]	= {"Microsoft\\Windows\\CurrentVersion\\Uninstall", "Classes\\CLSID", "Microsoft\\Windows NT\\CurrentVersion\\Fonts", "Policies\\Microsoft\\Windows", "Classes\\Interface", "Microsoft\\Windows\\CurrentVersion\\Explorer"};
+
+		for (auto &g : guids)
+			for (auto &w : g)
+				w = rand();
+
+		put("\xef\xbb\xbfWindows Registry Editor Version 5.00\r\n\r\n");
+		char	path[1024];
+		while (size < capacity) {
+			auto	root	= pick(roots, 6);
+			auto	len		= strlen(root);
+			memcpy(path, root, len);
+			key(path, len, 0);
+		}
+	}
+};
+
+int main(int argc, char *argv[]) {
+	auto	arg			= argc > 1 ? argv[1] : "64";
+	size_t	megabytes	= atoi(arg);
+	Corpus	corpus(megabytes ? megabytes << 20 : size_t(1) << 30);
+	if (!megabytes) {
+		if (!corpus.load(arg)) {
+			printf("cannot read %s\n", arg);
+			return 1;
+		}
+	} else {
+		corpus.generate();
+	}
+
+	auto	n		= corpus.size;
+	auto	packed	= (uint8_t*)malloc(LZ::bound(n) + n / LZ::BLOCK * 8 + 16);
+	auto	back	= (uint8_t*)malloc(n);
+	auto	table	= (uint32_t*)malloc(sizeof(uint32_t) << LZ::HASH_BITS);
+	auto	offsets	= (size_t*)malloc((n / LZ::BLOCK + 2) * sizeof(size_t));
+	size_t	nblocks = 0, total = 0;
+
+	auto	t0 = clock_type::now();
+	for (size_t i = 0; i < n; i += LZ::BLOCK) {
+		size_t	len		= n - i < LZ::BLOCK ? n - i : LZ::BLOCK;
+		offsets[nblocks++] = total;
+		total	+= LZ::compress(corpus.p + i, len, packed + total, table);
+	}
+	offsets[nblocks] = total;
+
+	auto	t1 = clock_type::now();
+	size_t	unpacked = 0;
+	for (size_t b = 0; b < nblocks; b++) {
+		auto	r = LZ::decompress(packed + offsets[b], offsets[b + 1] - offsets[b], back + unpacked, n - unpacked);
+		if (r < 0) {
+			printf("decompress failed at block %zu\n", b);
+			return 1;
+		}
+		unpacked += r;
+	}
+	auto	t2 = clock_type::now();
+
+	if (unpacked != n || memcmp(back, corpus.p, n) != 0) {
+		printf("round trip mismatch\n");
+		return 1;
+	}
+
+	double	mb		= n / 1048576.0;
+	double	tc		= std::chrono::duration<double>(t1 - t0).count();
+	double	td		= std::chrono::duration<double>(t2 - t1).count();
+	printf("corpus      %.1f MB in %zu blocks of %u KB\n", mb, nblocks, LZ::BLOCK >> 10);
+	printf("compressed  %.1f MB (ratio %.2f:1)\n", total / 1048576.0, double(n) / total);
+	printf("compress    %.0f MB/s\n", mb / tc);
+	printf("decompress  %.0f MB/s\n", mb / td);
+
+	free(packed);
+	free(back);
+	free(table);
+	free(offsets);
+	return 0;
+}
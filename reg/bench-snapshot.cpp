@@ -0,0 +1,397 @@
+// portable benchmark for SNAPSHOT and SNAPSHOT /base, over the in-memory registry backend
+// build: g++ -O2 -std=c++17 -pthread reg/bench-snapshot.cpp -o bench-snapshot   (or clang-cl -O2 -std:c++17 -DUNICODE)
+// usage: bench-snapshot [-keys count] [-change percent] [file.reg ...]
+//	writes a full snapshot of the tree, changes a share of its keys, writes a delta against the snapshot,
+//	then reads the chain back and checks it holds what the tree does
+//	the tree is loaded from the .reg files, or else made up roughly like HKLM\SOFTWARE
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include "reg-doc.h"
+#include "reg-backend.h"
+#include "reg-snapshot.h"
+#include <stdio.h>
+
+using clock_type = std::chrono::steady_clock;
+
+#ifdef _WIN32
+#define FILE_NAME(s)	L##s
+#else
+#define FILE_NAME(s)	s
+#endif
+
+static const Snapshot::path_char	full_file[]		= FILE_NAME("bench-snapshot.full");
+static const Snapshot::path_char	delta_file[]	= FILE_NAME("bench-snapshot.delta");
+
+FILE *create(const Snapshot::path_char *filename) {
+#ifdef _WIN32
+	return _wfopen(filename, L"wb");
+#else
+	return fopen(filename, "wb");
+#endif
+}
+
+//-----------------------------------------------------------------------------
+//	Shot
+//	the walks SNAPSHOT makes, as snapshot_key and delta_key do in reg.cpp, but through a Backend::Registry
+//-----------------------------------------------------------------------------
+
+struct Shot {
+	Backend::Registry	&r;
+	Snapshot::Writer	&out;
+	uint64_t			calls = 0;
+
+	Shot(Backend::Registry &r, Snapshot::Writer &out) : r(r), out(out) {}
+
+	struct Buffers {
+		char16_t	*name;
+		uint8_t		*data;
+		Buffers(const Backend::Info &info) :
+			name((char16_t*)malloc(((info.max_value > info.max_subkey ? info.max_value : info.max_subkey) + 1) * 2)),
+			data((uint8_t*)malloc(info.max_data + 1)) {}
+		~Buffers() { free(name); free(data); }
+	};
+
+	uint64_t	full(Backend::Key k, const char16_t *name, uint32_t n) {
+		Backend::Info	info;
+		++calls;
+		if (r.info(k, info))
+			return 0;
+
+		Buffers	b(info);
+		Snapshot::Array<Snapshot::Value>	values;
+		for (uint32_t i = 0;; i++) {
+			uint32_t	len = info.max_value + 1, type, size = info.max_data;
+			++calls;
+			if (r.enum_value(k, i, b.name, len, type, b.data, size))
+				break;
+			values.push({out.intern(b.name, len), type, size, 0, out.blob(b.data, size)});
+		}
+
+		Snapshot::Array<Snapshot::Child>	children;
+		for (uint32_t i = 0;; i++) {
+			uint32_t	len = info.max_subkey + 1;
+			++calls;
+			if (r.enum_key(k, i, b.name, len))
+				break;
+			Backend::Key	sub;
+			++calls;
+			if (r.open(k, b.name, len, Backend::OPEN_READ, sub))
+				continue;
+			auto	id	= out.intern(b.name, len);
+			children.push({id, 0, full(sub, b.name, len)});
+			r.close(sub);
+		}
+		return out.key(out.intern(name, n), info.last_write, children.p, children.n, values.p, values.n, Snapshot::COMPLETE);
+	}
+
+	// returns 0 if nothing under k changed (and !force)
+	uint64_t	delta(const Snapshot::Chain &chain, const Snapshot::Chain::Node &base, Backend::Key k, const char16_t *name, uint32_t n, bool force = false) {
+		Backend::Info	info;
+		++calls;
+		if (r.info(k, info))
+			return 0;
+
+		auto	changed	= !base || info.last_write != base.last_write();
+		Snapshot::Array<Snapshot::Child>	children;
+		Snapshot::Array<Snapshot::Value>	values;
+
+		if (!changed) {
+			chain.subkeys(base, [&](Snapshot::Reader::Name sub_name) {
+				Backend::Key	sub;
+				++calls;
+				if (r.open(k, sub_name.p, uint32_t(sub_name.length), Backend::OPEN_READ, sub)) {
+					children.push({out.intern(sub_name.p, sub_name.length), Snapshot::REMOVED, 0});
+					return;
+				}
+				if (auto offset = delta(chain, chain.subkey(base, sub_name), sub, sub_name.p, uint32_t(sub_name.length)))
+					children.push({out.intern(sub_name.p, sub_name.length), 0, offset});
+				r.close(sub);
+			});
+
+		} else {
+			Buffers	b(info);
+			for (uint32_t i = 0;; i++) {
+				uint32_t	len = info.max_value + 1, type, size = info.max_data;
+				++calls;
+				if (r.enum_value(k, i, b.name, len, type, b.data, size))
+					break;
+				auto	prev	= chain.value(base, b.name, len);
+				auto	same	= prev && prev.value->type == type && prev.value->size == size && memcmp(prev.data(), b.data, size) == 0;
+				values.push({out.intern(b.name, len), type, size, same ? uint32_t(Snapshot::REMOVED) : 0u, same ? 0 : out.blob(b.data, size)});
+			}
+
+			out.sort(values.p, values.n);
+			Snapshot::Array<Snapshot::Value>	removed;
+			chain.values(base, [&](Snapshot::Reader::Name value_name, Snapshot::Chain::ValueRef) {
+				if (!out.find(values.p, values.n, value_name.p, value_name.length))
+					removed.push({out.intern(value_name.p, value_name.length), 0, 0, Snapshot::REMOVED, 0});
+			});
+			uint32_t	nv = 0;
+			for (uint32_t i = 0; i < values.n; i++) {
+				if (!(values.p[i].flags & Snapshot::REMOVED))
+					values.p[nv++] = values.p[i];
+			}
+			values.n = nv;
+			for (uint32_t i = 0; i < removed.n; i++)
+				values.push(removed.p[i]);
+
+			for (uint32_t i = 0;; i++) {
+				uint32_t	len = info.max_subkey + 1;
+				++calls;
+				if (r.enum_key(k, i, b.name, len))
+					break;
+				Backend::Key	sub;
+				++calls;
+				if (r.open(k, b.name, len, Backend::OPEN_READ, sub))
+					continue;
+				auto	prev	= chain.subkey(base, b.name, len);
+				auto	offset	= prev ? delta(chain, prev, sub, b.name, len) : full(sub, b.name, len);
+				if (offset)
+					children.push({out.intern(b.name, len), 0, offset});
+				r.close(sub);
+			}
+			chain.subkeys(base, [&](Snapshot::Reader::Name sub_name) {
+				Backend::Key	sub;
+				++calls;
+				if (r.open(k, sub_name.p, uint32_t(sub_name.length), Backend::OPEN_READ, sub))
+					children.push({out.intern(sub_name.p, sub_name.length), Snapshot::REMOVED, 0});
+				else
+					r.close(sub);
+			});
+		}
+
+		if (!changed && !children.n && !force)
+			return 0;
+		return out.key(out.intern(name, n), info.last_write, children.p, children.n, values.p, values.n);
+	}
+};
+
+//-----------------------------------------------------------------------------
+//	trees
+//-----------------------------------------------------------------------------
+
+struct Random {
+	uint32_t	seed = 12345;
+	uint32_t	operator()() { seed = seed * 1103515245 + 12345; return seed >> 8; }
+};
+
+struct Names {
+	char16_t	p[256];
+	uint32_t	n = 0;
+
+	Names&	put(const char *s) { while (*s) p[n++] = *s++; return *this; }
+	Names&	hex(uint32_t v, int digits) {
+		for (int i = digits; i--;)
+			p[n++] = "0123456789abcdef"[(v >> (i * 4)) & 15];
+		return *this;
+	}
+};
+
+// roughly the mix of HKLM\SOFTWARE, as bench-backend makes
+void generate(Backend::Memory &m, uint32_t count, Random &rand) {
+	static const char *roots[]	= {"Microsoft\\Windows\\CurrentVersion\\Uninstall", "Classes\\CLSID", "Microsoft\\Windows NT\\CurrentVersion\\Fonts", "Policies\\Microsoft\\Windows"};
+	static const char *names[]	= {"DisplayName", "InstallLocation", "Version", "Publisher", "EstimatedSize", "NoModify", "InprocServer32", "ThreadingModel"};
+
+	for (uint32_t i = 0; i < count; i++) {
+		Names	g;
+		g.put("HKEY_LOCAL_MACHINE\\SOFTWARE\\").put(roots[rand() % 4]).put("\\{").hex(rand(), 8).put("-").hex(rand(), 4).put("-").hex(rand(), 8).put("}");
+		if (rand() % 4 == 0)
+			g.put("\\InprocServer32");
+
+		Backend::Key	k;
+		if (m.open(0, g.p, g.n, Backend::OPEN_CREATE, k))
+			continue;
+		for (int v = rand() % 8; v--;) {
+			Names	name;
+			uint8_t	bytes[72];
+			auto	size = rand() % 64 + 8;
+			for (uint32_t j = 0; j < size; j++)
+				bytes[j] = uint8_t(rand());
+			name.put(names[rand() % 8]);
+			m.set_value(k, name.p, name.n, v & 1 ? 3 : 1, bytes, size & ~1u);
+		}
+		m.close(k);
+	}
+}
+
+// sets, adds and removes values, adds keys and removes childless ones, in about percent of the keys
+void change(Backend::Memory &m, uint32_t percent, Random &rand) {
+	static const char16_t	changed[] = u"Changed", added[] = u"Added";
+	for (uint32_t i = 2, n = m.nodes.n; i < n; i++) {
+		auto	&node = m.nodes[i];
+		if (node.deleted || rand() % 100 >= percent)
+			continue;
+		switch (rand() % 4) {
+			case 0: {
+				uint32_t	dword = rand();
+				m.set_value(i, changed, 7, 4, (const uint8_t*)&dword, 4);
+				break;
+			}
+			case 1:
+				if (node.num_values)
+					m.delete_value(i, m.names.p + node.values[0].name, node.values[0].length);
+				break;
+			case 2: {
+				Backend::Key	k;
+				m.open(i, added, 5, Backend::OPEN_CREATE, k);
+				break;
+			}
+			default:
+				if (!node.num_children)
+					m.delete_key(node.parent, m.names.p + node.name, node.length);
+				break;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	checks
+//-----------------------------------------------------------------------------
+
+struct Count {
+	uint64_t	keys = 0, values = 0, bytes = 0;
+	bool operator==(const Count &b) const { return keys == b.keys && values == b.values && bytes == b.bytes; }
+};
+
+void count(const Backend::Memory &m, uint32_t i, Count &c) {
+	auto	&node = m.nodes[i];
+	++c.keys;
+	c.values += node.num_values;
+	for (uint32_t j = 0; j < node.num_values; j++)
+		c.bytes += node.values[j].size;
+	for (uint32_t j = 0; j < node.num_children; j++)
+		count(m, node.children[j], c);
+}
+
+void count(const Snapshot::Chain &chain, const Snapshot::Chain::Node &node, Count &c) {
+	++c.keys;
+	chain.values(node, [&](Snapshot::Reader::Name, Snapshot::Chain::ValueRef v) {
+		++c.values;
+		c.bytes += v.value->size;
+	});
+	chain.subkeys(node, [&](Snapshot::Reader::Name name) {
+		count(chain, chain.subkey(node, name), c);
+	});
+}
+
+//-----------------------------------------------------------------------------
+//	runs
+//-----------------------------------------------------------------------------
+
+double seconds(clock_type::time_point t0) {
+	return std::chrono::duration<double>(clock_type::now() - t0).count();
+}
+
+void report(const char *label, const Snapshot::Writer &w, uint64_t calls, double t) {
+	printf("%-10s %8.3f s  %9llu keys  %9llu values  %7u names  %6.1f MB  %10llu calls\n",
+		label, t, (unsigned long long)w.header.num_keys, (unsigned long long)w.header.num_values, w.header.num_strings, w.pos / 1048576.0, (unsigned long long)calls
+	);
+}
+
+bool load(Backend::Memory &m, const char *filename) {
+	FILE	*f = fopen(filename, "rb");
+	if (!f)
+		return false;
+	fseek(f, 0, SEEK_END);
+	auto	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	auto	data = (uint8_t*)malloc(size > 0 ? size : 1);
+	bool	ok	 = size > 0 && fread(data, 1, size, f) == (size_t)size;
+	fclose(f);
+
+	RegFile::Document	doc;
+	if (ok && (ok = doc.open(data, size)))
+		m.load(doc);
+	free(data);
+	return ok;
+}
+
+int main(int argc, char *argv[]) {
+	uint32_t	count_keys	= 100000;
+	uint32_t	percent		= 5;
+	int			num_files	= 0;
+	Random		rand;
+	Backend::Memory	memory;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-keys") == 0 && i + 1 < argc) {
+			count_keys = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-change") == 0 && i + 1 < argc) {
+			percent = atoi(argv[++i]);
+		} else if (load(memory, argv[i])) {
+			++num_files;
+		} else {
+			printf("failed to load %s\n", argv[i]);
+			return 1;
+		}
+	}
+	if (!num_files)
+		generate(memory, count_keys, rand);
+
+	static const char16_t	top[] = u"HKEY_LOCAL_MACHINE\\SOFTWARE";
+	Backend::Key	root;
+	if (memory.open(0, top, sizeof(top) / 2 - 1, Backend::OPEN_READ, root)) {
+		printf("no HKEY_LOCAL_MACHINE\\SOFTWARE\n");
+		return 1;
+	}
+	printf("loaded      %u keys, changing %u%%\n", memory.nodes.n - 1, percent);
+
+	auto	t0	= clock_type::now();
+	{
+		FILE	*f	= create(full_file);
+		if (!f) {
+			printf("failed to create snapshot\n");
+			return 1;
+		}
+		Snapshot::Writer	w(f);
+		Shot	shot(memory, w);
+		w.finish(shot.full(root, u"SOFTWARE", 8));
+		fclose(f);
+		report("snapshot", w, shot.calls, seconds(t0));
+	}
+
+	change(memory, percent, rand);
+
+	t0	= clock_type::now();
+	{
+		Snapshot::Chain	chain(full_file);
+		if (!chain || !chain.root()) {
+			printf("failed to read snapshot\n");
+			return 1;
+		}
+		FILE	*f	= create(delta_file);
+		if (!f) {
+			printf("failed to create delta\n");
+			return 1;
+		}
+		Snapshot::Writer	w(f);
+		Shot	shot(memory, w);
+		static const char16_t	base[] = u"bench-snapshot.full";
+		w.header.flags		= Snapshot::DELTA;
+		w.header.base		= w.intern(base, sizeof(base) / 2 - 1);
+		w.header.base_size	= chain.files[0]->size;
+		w.finish(shot.delta(chain, chain.root(), root, u"SOFTWARE", 8, true));
+		fclose(f);
+		report("delta", w, shot.calls, seconds(t0));
+	}
+
+	t0	= clock_type::now();
+	Snapshot::Chain	chain(delta_file);
+	if (!chain || !chain.root()) {
+		printf("failed to read delta\n");
+		return 1;
+	}
+	Count	expect, got;
+	count(chain, chain.root(), got);
+	auto	t	= seconds(t0);
+	count(memory, uint32_t(root), expect);
+	printf("read       %8.3f s  %9llu keys  %9llu values  %6.1f MB of data\n", t, (unsigned long long)got.keys, (unsigned long long)got.values, got.bytes / 1048576.0);
+
+	if (!(got == expect)) {
+		printf("chain mismatch: expected %llu keys, %llu values\n", (unsigned long long)expect.keys, (unsigned long long)expect.values);
+		return 1;
+	}
+	return 0;
+}
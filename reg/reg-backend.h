@@ -0,0 +1,733 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include "reg-doc.h"
+#include "reg-hive.h"
+
+//-----------------------------------------------------------------------------
+//	Backend
+//	the calls REG makes on the registry, behind one interface: Win32 passes them to advapi32,
+//	Memory answers them from a tree held in memory (loaded from .reg files), so every operation can run
+//	off Windows and be measured at memory speed, with an optional latency added to each call,
+//	and HiveFile reads a hive file in place
+//	results are Win32 error codes; names are UTF-16, counted, and returned null-terminated
+//	Key 0 stands above the predefined keys, so a path from it starts with one (HKEY_LOCAL_MACHINE\...)
+//-----------------------------------------------------------------------------
+
+namespace Backend {
+
+enum Error : int {
+	SUCCESS			= 0,
+	NOT_FOUND		= 2,
+	DENIED			= 5,
+	NOT_SUPPORTED	= 50,
+	BAD_PARAMETER	= 87,
+	MORE_DATA		= 234,
+	NO_MORE_ITEMS	= 259,
+	KEY_DELETED		= 1018,
+	TIMED_OUT		= 1460,
+};
+
+enum Access {
+	OPEN_READ		= 0,
+	OPEN_WRITE		= 1,
+	OPEN_CREATE		= 2,	// and any missing keys on the way
+};
+
+typedef uintptr_t	Key;
+
+struct Info {
+	uint32_t	num_subkeys	= 0, max_subkey = 0;		// lengths in characters
+	uint32_t	num_values	= 0, max_value = 0, max_data = 0;
+	uint64_t	last_write	= 0;					// FILETIME
+};
+
+struct Registry {
+	virtual ~Registry() {}
+	virtual int		open(Key parent, const char16_t *path, uint32_t n, Access access, Key &key) = 0;
+	virtual void	close(Key key) = 0;
+	virtual int		info(Key key, Info &info) = 0;
+	// n is the capacity of name, terminator included, and comes back as the length; a null data just sizes the value
+	virtual int		enum_key(Key key, uint32_t i, char16_t *name, uint32_t &n) = 0;
+	virtual int		enum_value(Key key, uint32_t i, char16_t *name, uint32_t &n, uint32_t &type, uint8_t *data, uint32_t &size) = 0;
+	virtual int		query_value(Key key, const char16_t *name, uint32_t n, uint32_t &type, uint8_t *data, uint32_t &size) = 0;
+	virtual int		set_value(Key key, const char16_t *name, uint32_t n, uint32_t type, const uint8_t *data, uint32_t size) = 0;
+	virtual int		delete_value(Key key, const char16_t *name, uint32_t n) = 0;
+	virtual int		delete_key(Key parent, const char16_t *path, uint32_t n) = 0;	// with everything under it
+	// waits for a change to the key (or with subtree, anything under it) after the call is made
+	virtual int		notify(Key key, bool subtree, uint32_t timeout_ms) = 0;
+	// hive files mounted by the backend itself, where it can
+	virtual int		load_hive(const char16_t */*file*/, Key &/*key*/)				{ return NOT_SUPPORTED; }
+	virtual int		unload_hive(Key /*parent*/, const char16_t */*path*/, uint32_t /*n*/)	{ return NOT_SUPPORTED; }
+};
+
+//-----------------------------------------------------------------------------
+//	Memory
+//	a key is its node's index; subkeys are kept sorted by folded name, as the registry enumerates them,
+//	and values in the order they were first set
+//	calls share a lock, so many threads can walk while one writes
+//-----------------------------------------------------------------------------
+
+struct Memory : Registry {
+	static const uint32_t	NONE = ~0u;
+
+	struct Value {
+		uint32_t	name, length;		// in names
+		uint32_t	type, size;
+		uint8_t		*data;
+	};
+	struct Node {
+		uint32_t	name, length;		// in names
+		uint32_t	parent;
+		uint32_t	*children;			// sorted by folded name
+		uint32_t	num_children, max_children;
+		Value		*values;
+		uint32_t	num_values, max_values;
+		uint64_t	last_write;
+		uint64_t	changed, subtree_changed;	// writes when the key, or anything under it, last changed
+		bool		deleted;
+	};
+
+	RegFile::Array<Node>		nodes;				// nodes[0] stands above the predefined keys
+	RegFile::Array<char16_t>	names;
+	std::shared_mutex			lock;
+	std::condition_variable_any	changes;
+	uint64_t					writes		= 0;
+	uint32_t					delay_us	= 0;	// added to every call
+	std::atomic<uint64_t>		calls{0};
+
+	Memory() {
+		auto	&top = nodes.push();
+		memset(&top, 0, sizeof(top));
+		top.parent = NONE;
+	}
+	Memory(const Memory&) = delete;
+	~Memory() {
+		for (uint32_t i = 0; i < nodes.n; i++)
+			release(nodes[i]);
+	}
+
+	static void		release(Node &node) {
+		for (uint32_t i = 0; i < node.num_values; i++)
+			free(node.values[i].data);
+		free(node.values);
+		free(node.children);
+		node.values		= nullptr;
+		node.children	= nullptr;
+		node.num_values	= node.num_children = 0;
+	}
+	static uint64_t	now() {
+		// FILETIME counts 100ns from 1601
+		auto	t = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		return uint64_t(t) * 10 + 116444736000000000ull;
+	}
+	void			pause() {
+		++calls;
+		if (delay_us)
+			std::this_thread::sleep_for(std::chrono::microseconds(delay_us));
+	}
+	bool			live(Key key) const {
+		return key < nodes.n && !nodes[key].deleted;
+	}
+
+	int				compare(uint32_t name, uint32_t length, const char16_t *s, uint32_t n) const {
+		for (uint32_t i = 0; i < length && i < n; i++) {
+			auto	a = RegFile::fold(names[name + i]), b = RegFile::fold(s[i]);
+			if (a != b)
+				return a < b ? -1 : 1;
+		}
+		return length < n ? -1 : length > n ? 1 : 0;
+	}
+	// the child called s, or NONE with at set to where it would go
+	uint32_t		child(uint32_t i, const char16_t *s, uint32_t n, uint32_t &at) const {
+		auto		&node	= nodes[i];
+		uint32_t	lo = 0, hi = node.num_children;
+		while (lo < hi) {
+			auto	mid = (lo + hi) / 2;
+			auto	&c	= nodes[node.children[mid]];
+			auto	r	= compare(c.name, c.length, s, n);
+			if (r == 0) {
+				at = mid;
+				return node.children[mid];
+			}
+			if (r < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		at = lo;
+		return NONE;
+	}
+	uint32_t		find_value(const Node &node, const char16_t *s, uint32_t n) const {
+		for (uint32_t i = 0; i < node.num_values; i++) {
+			if (compare(node.values[i].name, node.values[i].length, s, n) == 0)
+				return i;
+		}
+		return NONE;
+	}
+	uint32_t		store(const char16_t *s, uint32_t n) {
+		auto	at = names.n;
+		for (uint32_t i = 0; i < n; i++)
+			names.push(s[i]);
+		return at;
+	}
+
+	void			touch(uint32_t i) {
+		++writes;
+		nodes[i].changed	= writes;
+		nodes[i].last_write	= now();
+		for (auto j = i; j != NONE; j = nodes[j].parent)
+			nodes[j].subtree_changed = writes;
+		changes.notify_all();
+	}
+
+	//-------------------------------------------------------------------------
+	//	unlocked
+	//-------------------------------------------------------------------------
+
+	int				walk(Key parent, const char16_t *path, uint32_t n, bool create, Key &key) {
+		if (!live(parent))
+			return KEY_DELETED;
+		uint32_t	i = uint32_t(parent);
+		for (uint32_t a = 0; a < n;) {
+			auto	e = a;
+			while (e < n && path[e] != '\\')
+				++e;
+			if (e > a) {
+				uint32_t	at;
+				auto		c = child(i, path + a, e - a, at);
+				if (c == NONE) {
+					if (!create)
+						return NOT_FOUND;
+					c = nodes.n;
+					auto	&node = nodes.push();
+					memset(&node, 0, sizeof(node));
+					node.name	= store(path + a, e - a);
+					node.length	= e - a;
+					node.parent	= i;
+
+					auto	&p = nodes[i];
+					if (p.num_children == p.max_children) {
+						p.max_children	= p.max_children ? p.max_children * 2 : 4;
+						p.children		= (uint32_t*)realloc(p.children, p.max_children * sizeof(uint32_t));
+					}
+					memmove(p.children + at + 1, p.children + at, (p.num_children - at) * sizeof(uint32_t));
+					p.children[at] = c;
+					++p.num_children;
+					touch(i);
+					touch(c);
+				}
+				i = c;
+			}
+			a = e + 1;
+		}
+		key = i;
+		return SUCCESS;
+	}
+
+	int				set(Key key, const char16_t *name, uint32_t n, uint32_t type, const uint8_t *data, uint32_t size) {
+		if (!key || !live(key))
+			return key ? KEY_DELETED : BAD_PARAMETER;
+		auto	&node	= nodes[key];
+		auto	i		= find_value(node, name, n);
+		if (i == NONE) {
+			if (node.num_values == node.max_values) {
+				node.max_values	= node.max_values ? node.max_values * 2 : 4;
+				node.values		= (Value*)realloc(node.values, node.max_values * sizeof(Value));
+			}
+			i = node.num_values++;
+			auto	&v = node.values[i];
+			v.length	= n;
+			v.name		= store(name, n);
+			v.data		= nullptr;
+		}
+		auto	&v = node.values[i];
+		v.type	= type;
+		v.size	= size;
+		v.data	= (uint8_t*)realloc(v.data, size ? size : 1);
+		memcpy(v.data, data, size);
+		touch(key);
+		return SUCCESS;
+	}
+
+	int				unset(Key key, const char16_t *name, uint32_t n) {
+		if (!key || !live(key))
+			return key ? KEY_DELETED : BAD_PARAMETER;
+		auto	&node	= nodes[key];
+		auto	i		= find_value(node, name, n);
+		if (i == NONE)
+			return NOT_FOUND;
+		free(node.values[i].data);
+		memmove(node.values + i, node.values + i + 1, (node.num_values - i - 1) * sizeof(Value));
+		--node.num_values;
+		touch(key);
+		return SUCCESS;
+	}
+
+	void			kill(uint32_t i) {
+		auto	&node = nodes[i];
+		for (uint32_t c = 0; c < node.num_children; c++)
+			kill(node.children[c]);
+		release(node);
+		node.deleted = true;
+	}
+	int				remove(Key parent, const char16_t *path, uint32_t n) {
+		Key		key;
+		if (auto ret = walk(parent, path, n, false, key))
+			return ret;
+		if (!key)
+			return BAD_PARAMETER;
+		auto	p		= nodes[key].parent;
+		auto	&pn		= nodes[p];
+		uint32_t	at;
+		child(p, names.p + nodes[key].name, nodes[key].length, at);
+		memmove(pn.children + at, pn.children + at + 1, (pn.num_children - at - 1) * sizeof(uint32_t));
+		--pn.num_children;
+		kill(uint32_t(key));
+		touch(p);
+		return SUCCESS;
+	}
+
+	// applies a .reg file as IMPORT would
+	void			load(const RegFile::Document &doc) {
+		std::unique_lock<std::shared_mutex>	hold(lock);
+		RegFile::Array<char16_t>	path, name;
+		RegFile::Array<uint8_t>		data;
+		for (uint32_t s = 0; s < doc.sections.n; s++) {
+			if (doc.sections[s].implied())
+				continue;
+			doc.path(s, path);
+			if (doc.sections[s].removed) {
+				remove(0, path.p, path.n);
+				continue;
+			}
+			Key		key;
+			if (walk(0, path.p, path.n, true, key) || !key)
+				continue;
+			doc.section_values(s, [&](const RegFile::Value &v) {
+				doc.name(v, name);
+				if (v.removed) {
+					unset(key, name.p, name.n);
+				} else {
+					auto	type = doc.data(v, data);
+					if (type != RegFile::NONE)	// IMPORT ignores bad data too
+						set(key, name.p, name.n, type, data.p, data.n);
+				}
+			});
+		}
+	}
+
+	//-------------------------------------------------------------------------
+	//	Registry
+	//-------------------------------------------------------------------------
+
+	int		open(Key parent, const char16_t *path, uint32_t n, Access access, Key &key) override {
+		pause();
+		if (access == OPEN_CREATE) {
+			std::unique_lock<std::shared_mutex>	hold(lock);
+			return walk(parent, path, n, true, key);
+		}
+		std::shared_lock<std::shared_mutex>	hold(lock);
+		return walk(parent, path, n, false, key);
+	}
+	void	close(Key) override {}
+
+	int		info(Key key, Info &info) override {
+		pause();
+		std::shared_lock<std::shared_mutex>	hold(lock);
+		if (!live(key))
+			return KEY_DELETED;
+		auto	&node = nodes[key];
+		info = Info();
+		info.num_subkeys	= node.num_children;
+		info.num_values		= node.num_values;
+		info.last_write		= node.last_write;
+		for (uint32_t i = 0; i < node.num_children; i++) {
+			if (nodes[node.children[i]].length > info.max_subkey)
+				info.max_subkey = nodes[node.children[i]].length;
+		}
+		for (uint32_t i = 0; i < node.num_values; i++) {
+			auto	&v = node.values[i];
+			if (v.length > info.max_value)
+				info.max_value = v.length;
+			if (v.size > info.max_data)
+				info.max_data = v.size;
+		}
+		return SUCCESS;
+	}
+
+	int		enum_key(Key key, uint32_t i, char16_t *name, uint32_t &n) override {
+		pause();
+		std::shared_lock<std::shared_mutex>	hold(lock);
+		if (!live(key))
+			return KEY_DELETED;
+		auto	&node = nodes[key];
+		if (i >= node.num_children)
+			return NO_MORE_ITEMS;
+		auto	&c = nodes[node.children[i]];
+		if (c.length >= n)
+			return MORE_DATA;
+		memcpy(name, names.p + c.name, c.length * 2);
+		name[n = c.length] = 0;
+		return SUCCESS;
+	}
+
+	int		get(const Value &v, char16_t *name, uint32_t &n, uint32_t &type, uint8_t *data, uint32_t &size) const {
+		if (name) {
+			if (v.length >= n)
+				return MORE_DATA;
+			memcpy(name, names.p + v.name, v.length * 2);
+			name[n = v.length] = 0;
+		}
+		type = v.type;
+		if (data && size < v.size) {
+			size = v.size;
+			return MORE_DATA;
+		}
+		if (data)
+			memcpy(data, v.data, v.size);
+		size = v.size;
+		return SUCCESS;
+	}
+	int		enum_value(Key key, uint32_t i, char16_t *name, uint32_t &n, uint32_t &type, uint8_t *data, uint32_t &size) override {
+		pause();
+		std::shared_lock<std::shared_mutex>	hold(lock);
+		if (!live(key))
+			return KEY_DELETED;
+		auto	&node = nodes[key];
+		if (i >= node.num_values)
+			return NO_MORE_ITEMS;
+		return get(node.values[i], name, n, type, data, size);
+	}
+	int		query_value(Key key, const char16_t *name, uint32_t n, uint32_t &type, uint8_t *data, uint32_t &size) override {
+		pause();
+		std::shared_lock<std::shared_mutex>	hold(lock);
+		if (!live(key))
+			return KEY_DELETED;
+		auto	&node	= nodes[key];
+		auto	i		= find_value(node, name, n);
+		if (i == NONE)
+			return NOT_FOUND;
+		return get(node.values[i], nullptr, n, type, data, size);
+	}
+
+	int		set_value(Key key, const char16_t *name, uint32_t n, uint32_t type, const uint8_t *data, uint32_t size) override {
+		pause();
+		std::unique_lock<std::shared_mutex>	hold(lock);
+		return set(key, name, n, type, data, size);
+	}
+	int		delete_value(Key key, const char16_t *name, uint32_t n) override {
+		pause();
+		std::unique_lock<std::shared_mutex>	hold(lock);
+		return unset(key, name, n);
+	}
+	int		delete_key(Key parent, const char16_t *path, uint32_t n) override {
+		pause();
+		std::unique_lock<std::shared_mutex>	hold(lock);
+		return remove(parent, path, n);
+	}
+
+	int		notify(Key key, bool subtree, uint32_t timeout_ms) override {
+		pause();
+		std::unique_lock<std::shared_mutex>	hold(lock);
+		if (!live(key))
+			return KEY_DELETED;
+		auto	since	= subtree ? nodes[key].subtree_changed : nodes[key].changed;
+		bool	changed	= changes.wait_for(hold, std::chrono::milliseconds(timeout_ms), [&]() {
+			return !live(key) || (subtree ? nodes[key].subtree_changed : nodes[key].changed) != since;
+		});
+		return !changed ? TIMED_OUT : live(key) ? SUCCESS : KEY_DELETED;
+	}
+};
+
+//-----------------------------------------------------------------------------
+//	HiveFile
+//	a hive file read in place: a key is its nk cell, and nothing can be written
+//	key 0 stands above the root, so the first component of a path from it names the root whatever it says
+//	(HKLM\Software and X\Software are the same)
+//-----------------------------------------------------------------------------
+
+struct HiveFile : Registry {
+	const Hive::Reader	&hive;
+
+	HiveFile(const Hive::Reader &hive) : hive(hive) {}
+
+	static int	copy_name(Hive::Reader::Name name, char16_t *dest, uint32_t &n) {
+		if (name.length >= n)
+			return MORE_DATA;
+		name.copy(dest);
+		dest[n = name.length] = 0;
+		return SUCCESS;
+	}
+
+	int		open(Key parent, const char16_t *path, uint32_t n, Access access, Key &key) override {
+		if (access != OPEN_READ)
+			return DENIED;
+		uint32_t	a = 0, cell = uint32_t(parent);
+		if (!parent) {
+			while (a < n && path[a] != '\\')
+				++a;
+			cell = hive.root;
+		}
+		while (a < n) {
+			if (path[a] == '\\') {
+				++a;
+				continue;
+			}
+			auto	e = a;
+			while (e < n && path[e] != '\\')
+				++e;
+			auto	k = hive.key(cell);
+			if (!k || (cell = hive.find_subkey(k, path + a, e - a)) == Hive::NONE)
+				return NOT_FOUND;
+			a = e;
+		}
+		if (!hive.key(cell))
+			return NOT_FOUND;
+		key = cell;
+		return SUCCESS;
+	}
+	void	close(Key) override {}
+
+	// name and data sizes come from the value cells, as the key's maxima may be stale
+	int		info(Key key, Info &info) override {
+		auto	k = hive.key(uint32_t(key));
+		if (!k)
+			return KEY_DELETED;
+		info = Info();
+		info.num_subkeys	= hive.num_subkeys(k);
+		info.max_subkey		= (k->max_subkey & 0xffff) / 2;
+		info.num_values		= hive.num_values(k);
+		info.last_write		= k->last_write;
+		for (uint32_t i = 0; i < info.num_values; i++) {
+			if (auto v = hive.value(k, i)) {
+				auto	name	= hive.name(v).length;
+				auto	size	= hive.data_size(v);
+				if (name > info.max_value)
+					info.max_value = name;
+				if (size > info.max_data)
+					info.max_data = size;
+			}
+		}
+		return SUCCESS;
+	}
+
+	int		enum_key(Key key, uint32_t i, char16_t *name, uint32_t &n) override {
+		auto	k = hive.key(uint32_t(key));
+		if (!k)
+			return KEY_DELETED;
+		if (i >= hive.num_subkeys(k))
+			return NO_MORE_ITEMS;
+		auto	sub = hive.key(hive.subkey(k, i));
+		return sub ? copy_name(hive.name(sub), name, n) : NOT_FOUND;
+	}
+
+	int		get(const Hive::VK *v, char16_t *name, uint32_t &n, uint32_t &type, uint8_t *data, uint32_t &size) const {
+		if (!v)
+			return NOT_FOUND;
+		if (name) {
+			if (auto ret = copy_name(hive.name(v), name, n))
+				return ret;
+		}
+		auto	need = Hive::Reader::data_size(v);
+		type = v->type;
+		if (data && size < need) {
+			size = need;
+			return MORE_DATA;
+		}
+		size = need;
+		return !data || hive.data(v, data) ? SUCCESS : NOT_FOUND;
+	}
+	int		enum_value(Key key, uint32_t i, char16_t *name, uint32_t &n, uint32_t &type, uint8_t *data, uint32_t &size) override {
+		auto	k = hive.key(uint32_t(key));
+		if (!k)
+			return KEY_DELETED;
+		if (i >= hive.num_values(k))
+			return NO_MORE_ITEMS;
+		return get(hive.value(k, i), name, n, type, data, size);
+	}
+	int		query_value(Key key, const char16_t *name, uint32_t n, uint32_t &type, uint8_t *data, uint32_t &size) override {
+		auto	k = hive.key(uint32_t(key));
+		if (!k)
+			return KEY_DELETED;
+		return get(hive.find_value(k, name, n), nullptr, n, type, data, size);
+	}
+
+	int		set_value(Key, const char16_t*, uint32_t, uint32_t, const uint8_t*, uint32_t) override	{ return DENIED; }
+	int		delete_value(Key, const char16_t*, uint32_t) override								{ return DENIED; }
+	int		delete_key(Key, const char16_t*, uint32_t) override									{ return DENIED; }
+	int		notify(Key, bool, uint32_t) override												{ return NOT_SUPPORTED; }
+};
+
+//-----------------------------------------------------------------------------
+//	Win32
+//-----------------------------------------------------------------------------
+
+#ifdef _WIN32
+struct Win32 : Registry {
+	static const int	NUM_ROOTS = 7;
+	REGSAM		view = 0;					// KEY_WOW64_32KEY or KEY_WOW64_64KEY
+	wchar_t		*host = nullptr;			// another machine, connected to as each root is first used
+	HKEY		remote[NUM_ROOTS] = {};
+
+	Win32(const wchar_t *host = nullptr, REGSAM view = 0) : view(view), host(host ? _wcsdup(host) : nullptr) {}
+	Win32(const Win32&) = delete;
+	~Win32() {
+		for (auto h : remote) {
+			if (h)
+				::RegCloseKey(h);
+		}
+		free(host);
+	}
+
+	// a null-terminated copy of a counted name
+	struct Name {
+		wchar_t	*p;
+		Name(const char16_t *s, uint32_t n) : p((wchar_t*)malloc((n + 1) * sizeof(wchar_t))) {
+			memcpy(p, s, n * sizeof(wchar_t));
+			p[n] = 0;
+		}
+		~Name() { free(p); }
+		operator const wchar_t*() const { return p; }
+	};
+
+	// key 0: the first component of path names a predefined key, which becomes the parent
+	int		split(Key &parent, const char16_t *&path, uint32_t &n) {
+		if (parent)
+			return SUCCESS;
+		static const struct { const char *name; HKEY h; } roots[NUM_ROOTS] = {
+			{"HKEY_CLASSES_ROOT",		HKEY_CLASSES_ROOT},
+			{"HKEY_CURRENT_USER",		HKEY_CURRENT_USER},
+			{"HKEY_LOCAL_MACHINE",		HKEY_LOCAL_MACHINE},
+			{"HKEY_USERS",				HKEY_USERS},
+			{"HKEY_CURRENT_CONFIG",		HKEY_CURRENT_CONFIG},
+			{"HKEY_PERFORMANCE_DATA",	HKEY_PERFORMANCE_DATA},
+			{"HKEY_PERFORMANCE_TEXT",	HKEY_PERFORMANCE_TEXT},
+		};
+		uint32_t	e = 0;
+		while (e < n && path[e] != '\\')
+			++e;
+		for (int r = 0; r < NUM_ROOTS; r++) {
+			auto		name = roots[r].name;
+			uint32_t	i = 0;
+			while (i < e && name[i] && RegFile::fold(path[i]) == (uint8_t)name[i])
+				++i;
+			if (i == e && !name[i]) {
+				HKEY	h = roots[r].h;
+				if (host) {
+					if (!remote[r]) {
+						if (auto ret = ::RegConnectRegistry(host, h, &remote[r]))
+							return ret;
+					}
+					h = remote[r];
+				}
+				parent	= (Key)h;
+				path	+= e + (e < n);
+				n		-= e + (e < n);
+				return SUCCESS;
+			}
+		}
+		return NOT_FOUND;
+	}
+
+	// a predefined key named alone is handed out as it is (HKEY_PERFORMANCE_DATA is read that way, and closed when done)
+	int		open(Key parent, const char16_t *path, uint32_t n, Access access, Key &key) override {
+		bool	root = !parent;
+		if (auto ret = split(parent, path, n))
+			return ret;
+		if (root && !n && !host) {
+			key = parent;
+			return SUCCESS;
+		}
+		Name	sub(path, n);
+		HKEY	h;
+		auto	sam	= (access == OPEN_READ ? KEY_READ : KEY_ALL_ACCESS) | view;
+		auto	ret	= access == OPEN_CREATE
+			? ::RegCreateKeyEx((HKEY)parent, sub, 0, nullptr, REG_OPTION_NON_VOLATILE, sam, nullptr, &h, nullptr)
+			: ::RegOpenKeyEx((HKEY)parent, sub, 0, sam, &h);
+		if (ret == ERROR_SUCCESS)
+			key = (Key)h;
+		return ret;
+	}
+	void	close(Key key) override {
+		::RegCloseKey((HKEY)key);
+	}
+	int		info(Key key, Info &info) override {
+		FILETIME	last_write;
+		DWORD		num_subkeys, max_subkey, num_values, max_value, max_data;
+		auto		ret = ::RegQueryInfoKey((HKEY)key, nullptr, nullptr, nullptr, &num_subkeys, &max_subkey, nullptr, &num_values, &max_value, &max_data, nullptr, &last_write);
+		if (ret == ERROR_SUCCESS) {
+			info.num_subkeys	= num_subkeys;
+			info.max_subkey		= max_subkey;
+			info.num_values		= num_values;
+			info.max_value		= max_value;
+			info.max_data		= max_data;
+			info.last_write		= (uint64_t(last_write.dwHighDateTime) << 32) | last_write.dwLowDateTime;
+		}
+		return ret;
+	}
+	int		enum_key(Key key, uint32_t i, char16_t *name, uint32_t &n) override {
+		DWORD	size	= n;
+		auto	ret		= ::RegEnumKeyEx((HKEY)key, i, (wchar_t*)name, &size, nullptr, nullptr, nullptr, nullptr);
+		n = size;
+		return ret;
+	}
+	int		enum_value(Key key, uint32_t i, char16_t *name, uint32_t &n, uint32_t &type, uint8_t *data, uint32_t &size) override {
+		DWORD	name_size = n, t = 0, data_size = size;
+		auto	ret		= ::RegEnumValue((HKEY)key, i, (wchar_t*)name, &name_size, nullptr, &t, data, &data_size);
+		n		= name_size;
+		type	= t;
+		size	= data_size;
+		return ret;
+	}
+	int		query_value(Key key, const char16_t *name, uint32_t n, uint32_t &type, uint8_t *data, uint32_t &size) override {
+		DWORD	t = 0, data_size = size;
+		auto	ret		= ::RegQueryValueEx((HKEY)key, Name(name, n), nullptr, &t, data, &data_size);
+		type	= t;
+		size	= data_size;
+		return ret;
+	}
+	int		set_value(Key key, const char16_t *name, uint32_t n, uint32_t type, const uint8_t *data, uint32_t size) override {
+		return ::RegSetValueEx((HKEY)key, Name(name, n), 0, type, data, size);
+	}
+	int		delete_value(Key key, const char16_t *name, uint32_t n) override {
+		return ::RegDeleteValue((HKEY)key, Name(name, n));
+	}
+	int		delete_key(Key parent, const char16_t *path, uint32_t n) override {
+		if (auto ret = split(parent, path, n))
+			return ret;
+		return ::RegDeleteTree((HKEY)parent, Name(path, n));
+	}
+	int		notify(Key key, bool subtree, uint32_t timeout_ms) override {
+		auto	event	= CreateEvent(nullptr, FALSE, FALSE, nullptr);
+		auto	ret		= ::RegNotifyChangeKeyValue((HKEY)key, subtree, REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET, event, TRUE);
+		if (ret == ERROR_SUCCESS && WaitForSingleObject(event, timeout_ms) == WAIT_TIMEOUT)
+			ret = TIMED_OUT;
+		CloseHandle(event);
+		return ret;
+	}
+
+	// an application hive, private to this process
+	int		load_hive(const char16_t *file, Key &key) override {
+		HKEY	h;
+		auto	ret = ::RegLoadAppKey((const wchar_t*)file, &h, KEY_ALL_ACCESS | view, 0, 0);
+		if (ret == ERROR_SUCCESS)
+			key = (Key)h;
+		return ret;
+	}
+	int		unload_hive(Key parent, const char16_t *path, uint32_t n) override {
+		if (auto ret = split(parent, path, n))
+			return ret;
+		return ::RegUnLoadKey((HKEY)parent, Name(path, n));
+	}
+};
+#endif
+
+} // namespace Backend
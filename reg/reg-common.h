@@ -0,0 +1,156 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+//-----------------------------------------------------------------------------
+//	Common
+//	the pieces every format header needs: unaligned little-endian reads, a growable array of records,
+//	and the case folding registry names compare under
+//-----------------------------------------------------------------------------
+
+namespace Common {
+
+inline uint16_t	get16(const uint8_t *p)	{ uint16_t v; memcpy(&v, p, 2); return v; }
+inline uint32_t	get32(const uint8_t *p)	{ uint32_t v; memcpy(&v, p, 4); return v; }
+inline uint64_t	get64(const uint8_t *p)	{ uint64_t v; memcpy(&v, p, 8); return v; }
+
+// registry names compare and hash in upper case (as RtlUpcaseUnicodeChar has it);
+// this covers Latin-1, Latin Extended-A, Greek, Cyrillic and fullwidth Latin, so every platform orders names alike
+inline uint32_t fold(uint32_t c) {
+	if (c < 0x80)
+		return c >= 'a' && c <= 'z' ? c - 0x20 : c;
+	if (c < 0x100)
+		return c == 0xff ? 0x178 : c >= 0xe0 && c != 0xf7 ? c - 0x20 : c;
+	if (c < 0x180) {
+		if ((c < 0x130 || (c >= 0x132 && c < 0x138)) || (c >= 0x14a && c < 0x178))
+			return c & ~1u;			// pairs with the capital even
+		if ((c >= 0x139 && c < 0x149) || (c >= 0x179 && c < 0x17f))
+			return c & 1 ? c : c - 1;	// pairs with the capital odd
+		return c;
+	}
+	if (c >= 0x3ac && c < 0x3cf) {
+		return	c == 0x3ac ? 0x386
+			:	c < 0x3b0 ? c - 0x25
+			:	c == 0x3b0 ? c
+			:	c == 0x3c2 ? 0x3a3
+			:	c < 0x3cc ? c - 0x20
+			:	c == 0x3cc ? 0x38c
+			:	c - 0x3f;
+	}
+	if (c >= 0x430 && c < 0x530) {
+		return	c < 0x450 ? c - 0x20
+			:	c < 0x460 ? c - 0x50
+			:	c < 0x482 || (c >= 0x48a && c < 0x4c0) || c >= 0x4d0 ? c & ~1u
+			:	c > 0x4c0 && c < 0x4cf && !(c & 1) ? c - 1
+			:	c;
+	}
+	return c >= 0xff41 && c <= 0xff5a ? c - 0x20 : c;
+}
+
+// the lower case of a folded character, where it has one
+inline uint32_t unfold(uint32_t c) {
+	static const uint32_t	deltas[] = {0x20, 1, 0x50, 0x25, 0x26, 0x3f, 0x40};
+	if (c == 0x178)
+		return 0xff;
+	for (auto d : deltas) {
+		if (fold(c + d) == c)
+			return c + d;
+	}
+	return c;
+}
+
+inline int fold_compare(const char16_t *a, size_t na, const char16_t *b, size_t nb) {
+	for (size_t i = 0; i < na && i < nb; i++) {
+		auto	ca = fold(a[i]), cb = fold(b[i]);
+		if (ca != cb)
+			return ca < cb ? -1 : 1;
+	}
+	return na < nb ? -1 : na > nb ? 1 : 0;
+}
+
+// a character as UTF-8, into at least 4 bytes; returns the end
+inline uint8_t *put_utf8(uint8_t *p, uint32_t c) {
+	if (c < 0x80) {
+		*p++ = uint8_t(c);
+	} else if (c < 0x800) {
+		*p++ = uint8_t(0xc0 | (c >> 6));
+		*p++ = uint8_t(0x80 | (c & 0x3f));
+	} else if (c < 0x10000) {
+		*p++ = uint8_t(0xe0 | (c >> 12));
+		*p++ = uint8_t(0x80 | ((c >> 6) & 0x3f));
+		*p++ = uint8_t(0x80 | (c & 0x3f));
+	} else {
+		*p++ = uint8_t(0xf0 | (c >> 18));
+		*p++ = uint8_t(0x80 | ((c >> 12) & 0x3f));
+		*p++ = uint8_t(0x80 | ((c >> 6) & 0x3f));
+		*p++ = uint8_t(0x80 | (c & 0x3f));
+	}
+	return p;
+}
+
+// a null-terminated UTF-16 string (or UTF-32, where wchar_t is that wide) as UTF-8, for the caller to free
+template<typename C> char *to_utf8(const C *s) {
+	size_t	n = 0;
+	while (s[n])
+		++n;
+	auto	r = (uint8_t*)malloc(n * 4 + 1), p = r;
+	for (size_t i = 0; i < n; i++) {
+		uint32_t	c = s[i];
+		if (c >= 0xd800 && c < 0xdc00 && uint32_t(s[i + 1]) >= 0xdc00 && uint32_t(s[i + 1]) < 0xe000)
+			c = 0x10000 + ((c - 0xd800) << 10) + (s[++i] - 0xdc00);
+		p = put_utf8(p, c);
+	}
+	*p = 0;
+	return (char*)r;
+}
+
+// growable array of trivially copyable records
+template<typename T> struct Array {
+	T			*p	= nullptr;
+	uint32_t	n	= 0, capacity = 0;
+
+	Array() {}
+	Array(const Array&) = delete;
+	~Array() { free(p); }
+
+	T&		operator[](uint32_t i) const { return p[i]; }
+	T&		push() {
+		if (n == capacity) {
+			capacity	= capacity ? capacity * 2 : 64;
+			p			= (T*)realloc(p, capacity * sizeof(T));
+		}
+		return p[n++];
+	}
+	void	push(const T &t) { push() = t; }
+	void	resize(uint32_t size) {
+		if (size > capacity) {
+			capacity	= size;
+			p			= (T*)realloc(p, capacity * sizeof(T));
+		}
+		n = size;
+	}
+};
+
+// stable, so equal keys keep the order they came in
+template<typename T, typename L> void sort(T *p, uint32_t n, L less) {
+	if (n < 2)
+		return;
+	auto	t = (T*)malloc(n * sizeof(T));
+	for (uint64_t w = 1; w < n; w *= 2) {
+		for (uint64_t a = 0; a < n; a += w * 2) {
+			auto	m = a + w < n ? a + w : n, e = a + w * 2 < n ? a + w * 2 : n;
+			auto	i = a, j = m, k = a;
+			while (i < m && j < e)
+				t[k++] = less(p[j], p[i]) ? p[j++] : p[i++];
+			while (i < m)
+				t[k++] = p[i++];
+			while (j < e)
+				t[k++] = p[j++];
+		}
+		memcpy(p, t, n * sizeof(T));
+	}
+	free(t);
+}
+
+} // namespace Common
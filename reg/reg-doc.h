@@ -0,0 +1,1191 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reg-common.h"
+
+//-----------------------------------------------------------------------------
+//	RegFile
+//	read-only model of a .reg file held in memory, UTF-16LE or UTF-8 (as regedit and EXPORT write them)
+//	open finds every section in one pass and indexes them by path; a section's values are only split out,
+//	and their data only decoded, when asked for
+//-----------------------------------------------------------------------------
+
+namespace RegFile {
+
+static const uint32_t	NONE		= ~0u;
+
+// registry value types, as in winnt.h
+enum : uint32_t {
+	TYPE_SZ			= 1,
+	TYPE_BINARY		= 3,
+	TYPE_DWORD		= 4,
+	TYPE_QWORD		= 11,
+};
+
+using Common::fold;
+using Common::Array;
+using Common::sort;
+
+// whether path is key or one of its subkeys
+inline bool under(const char16_t *path, uint32_t n, const char16_t *key, uint32_t k) {
+	if (n < k || (n > k && path[k] != '\\'))
+		return false;
+	for (uint32_t i = 0; i < k; i++) {
+		if (fold(path[i]) != fold(key[i]))
+			return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+//	Chars
+//	UTF-16 code units of a span of the file, whichever encoding it is in
+//-----------------------------------------------------------------------------
+
+struct Chars {
+	const uint8_t	*p, *e;
+	bool			utf16;
+	uint32_t		low = 0;		// pending low surrogate
+
+	Chars(const uint8_t *p, const uint8_t *e, bool utf16) : p(p), e(e), utf16(utf16) {}
+
+	// -1 at the end; bytes that are not valid UTF-8 pass through as Latin-1
+	int		next() {
+		if (low)
+			return exchange_low();
+		if (utf16) {
+			if (e - p < 2)
+				return -1;
+			auto	c = p[0] | (p[1] << 8);
+			p += 2;
+			return c;
+		}
+		if (p == e)
+			return -1;
+		uint32_t	c = *p++;
+		if (c >= 0xc0) {
+			int	extra = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : 1;
+			if (e - p < extra)
+				return c;
+			uint32_t	v = c & (0x3f >> extra);
+			for (int i = 0; i < extra; i++) {
+				if ((p[i] & 0xc0) != 0x80)
+					return c;
+				v = (v << 6) | (p[i] & 0x3f);
+			}
+			p += extra;
+			c = v;
+			if (c >= 0x10000) {
+				low	= 0xdc00 + ((c - 0x10000) & 0x3ff);
+				c	= 0xd800 + ((c - 0x10000) >> 10);
+			}
+		}
+		return c;
+	}
+	int		exchange_low() {
+		auto	c = low;
+		low = 0;
+		return c;
+	}
+};
+
+// \\ and \" are the only escapes in names; data strings also allow \0, \n, \r and \t
+inline int unescape(Chars &c, int u, bool data) {
+	if (u != '\\')
+		return u;
+	auto	save	= c;
+	auto	n		= c.next();
+	switch (n) {
+		case '\\': case '"':	return n;
+		case '0':	if (data) return 0;		break;
+		case 'n':	if (data) return '\n';	break;
+		case 'r':	if (data) return '\r';	break;
+		case 't':	if (data) return '\t';	break;
+	}
+	c = save;		// not an escape: keep the backslash, and the next character as it is
+	return '\\';
+}
+
+// the type and data of a value from what follows its =, continuation lines included; NONE if the data is malformed
+// IMPORT decodes the lines it reads with this too
+inline uint32_t decode(const uint8_t *p, const uint8_t *e, bool utf16, Array<uint8_t> &out) {
+	out.n = 0;
+	if (p == e)
+		return NONE;
+
+	auto	step	= utf16 ? 2 : 1;
+	auto	unit	= [utf16](const uint8_t *i) { return utf16 ? i[0] | (i[1] << 8) : i[0]; };
+	Chars	c(p, e, utf16);
+	auto	prefix	= [&](const char *s) {
+		auto	save = c;
+		while (*s) {
+			if (c.next() != *s++) {
+				c = save;
+				return false;
+			}
+		}
+		return true;
+	};
+	auto	digit	= [](int u) {
+		return u >= '0' && u <= '9' ? u - '0' : u >= 'a' && u <= 'f' ? u - 'a' + 10 : u >= 'A' && u <= 'F' ? u - 'A' + 10 : -1;
+	};
+	auto	number	= [&](uint64_t &x) {
+		x = 0;
+		int	u, d, n = 0;
+		auto	save = c;
+		while ((u = c.next()) >= 0 && (d = digit(u)) >= 0) {
+			x = x << 4 | d;
+			save = c;
+			++n;
+		}
+		c = save;
+		return n > 0;
+	};
+
+	if (unit(p) == '"') {
+		// the string runs to the last quote
+		while (e > p + step && unit(e - step) != '"')
+			e -= step;
+		if (e <= p + step)
+			return NONE;
+		Chars	s(p + step, e - step, utf16);
+		for (int u; (u = s.next()) >= 0;) {
+			u = unescape(s, u, true);
+			out.push(uint8_t(u));
+			out.push(uint8_t(u >> 8));
+		}
+		out.push(0);
+		out.push(0);
+		return TYPE_SZ;
+	}
+
+	uint64_t	x;
+	if (prefix("dword:")) {
+		number(x);
+		for (int i = 0; i < 4; i++)
+			out.push(uint8_t(x >> (i * 8)));
+		return TYPE_DWORD;
+	}
+	if (prefix("qword:")) {
+		number(x);
+		for (int i = 0; i < 8; i++)
+			out.push(uint8_t(x >> (i * 8)));
+		return TYPE_QWORD;
+	}
+	if (!prefix("hex"))
+		return NONE;
+
+	uint32_t	type = TYPE_BINARY;
+	if (prefix("(")) {
+		if (!number(x) || !prefix(")"))
+			return NONE;
+		type = uint32_t(x);
+	}
+	if (!prefix(":"))
+		return NONE;
+	// bytes separated by commas, with continuation backslashes, line breaks and indents between
+	int		hi = -1;
+	for (int u; (u = c.next()) >= 0;) {
+		auto	d = digit(u);
+		if (d >= 0) {
+			if (hi < 0) {
+				hi = d;
+			} else {
+				out.push(uint8_t(hi << 4 | d));
+				hi = -1;
+			}
+		} else if (u == ',') {
+			if (hi >= 0)
+				out.push(uint8_t(hi));
+			hi = -1;
+		} else if (u != '\\' && u != ' ' && u != '\t' && u != '\r' && u != '\n') {
+			return NONE;
+		}
+	}
+	if (hi >= 0)
+		out.push(uint8_t(hi));
+	return type;
+}
+
+//-----------------------------------------------------------------------------
+//	Document
+//-----------------------------------------------------------------------------
+
+struct Section {
+	size_t		header, body, end;		// byte offsets: the [ line, the line after it, and the next section or end of file
+	size_t		name, name_end;			// the path inside the brackets
+	uint64_t	hash;					// of the folded path
+	uint32_t	same;					// next section with the same path, or NONE
+	uint32_t	parent;					// first section of the parent path, if the file has one
+	uint32_t	first_child, last_child, next_sibling;	// between first sections of each path
+	uint32_t	implied_by;				// for a parent the file has not named when a section needs it: that section, else NONE
+	bool		removed;				// [-path]
+	bool		implied() const { return implied_by != NONE; }
+};
+
+struct Value {
+	size_t		name, name_end;			// inside the quotes; empty for @
+	size_t		data, data_end;			// after the =, continuation lines included
+	bool		quoted, removed;		// "name"=-
+};
+
+struct Document {
+	const uint8_t	*p		= nullptr;
+	size_t			size	= 0;
+	size_t			start	= 0;		// past any byte order mark
+	bool			utf16	= false;
+	Array<Section>	sections;			// in file order
+	uint32_t		*table	= nullptr;	// first section of each path + 1, open addressing
+	uint32_t		table_size = 0, num_paths = 0;
+	bool			removals = false;	// whether any section is [-path]
+
+	Document() {}
+	Document(const Document&) = delete;
+	~Document() { free(table); }
+
+	size_t		step()					const { return utf16 ? 2 : 1; }
+	uint32_t	unit(size_t i)			const { return utf16 ? p[i] | (p[i + 1] << 8) : p[i]; }
+	Chars		chars(size_t a, size_t b) const { return Chars(p + a, p + b, utf16); }
+
+	// the start of the line after the one at i
+	size_t		next_line(size_t i) const {
+		while (i < size) {
+			auto	q = (const uint8_t*)memchr(p + i, '\n', size - i);
+			if (!q)
+				return size;
+			i = q - p + 1;
+			if (!utf16)
+				return i;
+			if ((i - 1 - start) % 2 == 0 && i < size && p[i] == 0)
+				return i + 1;
+		}
+		return size;
+	}
+	// the end of the line at i, without the line break or trailing blanks
+	size_t		line_end(size_t i, size_t next) const {
+		auto	w = step();
+		while (next >= i + w) {
+			auto	c = unit(next - w);
+			if (c != '\n' && c != '\r' && c != ' ' && c != '\t' && c != 0)
+				break;
+			next -= w;
+		}
+		return next;
+	}
+	size_t		skip_blanks(size_t i, size_t e) const {
+		while (i < e && (unit(i) == ' ' || unit(i) == '\t'))
+			i += step();
+		return i;
+	}
+
+	static uint64_t	hash(Chars c) {
+		uint64_t	h = 14695981039346656037ull;
+		for (int u; (u = c.next()) >= 0;)
+			h = (h ^ fold(u)) * 1099511628211ull;
+		return h;
+	}
+	static bool		equal(Chars a, Chars b) {
+		for (;;) {
+			auto	ca = a.next(), cb = b.next();
+			if (ca < 0 || cb < 0)
+				return ca == cb;
+			if (fold(ca) != fold(cb))
+				return false;
+		}
+	}
+
+	// first section with the given path (in the file's encoding)
+	uint32_t	find(size_t name, size_t name_end, uint64_t h) const {
+		if (!table_size)
+			return NONE;
+		for (auto j = uint32_t(h) & (table_size - 1); table[j]; j = (j + 1) & (table_size - 1)) {
+			auto	&s = sections[table[j] - 1];
+			if (s.hash == h && equal(chars(s.name, s.name_end), chars(name, name_end)))
+				return table[j] - 1;
+		}
+		return NONE;
+	}
+
+	// false if this is not a .reg file
+	bool	header(const uint8_t *data, size_t n) {
+		p		= data;
+		size	= n;
+		start	= 0;
+		utf16	= false;
+		if (n >= 2 && p[0] == 0xff && p[1] == 0xfe) {
+			utf16	= true;
+			start	= 2;
+			size	-= n % 2;
+		} else if (n >= 3 && p[0] == 0xef && p[1] == 0xbb && p[2] == 0xbf) {
+			start	= 3;
+		}
+
+		static const char	*signatures[] = {"Windows Registry Editor Version 5.00", "REGEDIT4"};
+		for (auto sig : signatures) {
+			size_t	i = start, j = 0;
+			while (sig[j] && i < size && unit(i) == (uint8_t)sig[j]) {
+				i += step();
+				++j;
+			}
+			if (!sig[j])
+				return true;
+		}
+		return false;
+	}
+
+	// the section whose [ line starts at at, if it is one; it runs to the end of the file until told otherwise
+	bool	add_section(size_t at, size_t next) {
+		auto	i = skip_blanks(at, next);
+		if (i == next || unit(i) != '[')
+			return false;
+
+		// the path runs to the last ] on the line, as names may hold brackets
+		auto	e = line_end(i, next);
+		if (e <= i + step() || unit(e - step()) != ']')
+			return false;
+
+		auto	&s		= sections.push();
+		s.header		= at;
+		s.body			= next;
+		s.end			= size;
+		s.removed		= unit(i + step()) == '-';
+		s.name			= i + step() * (1 + s.removed);
+		s.name_end		= e - step();
+		s.hash			= hash(chars(s.name, s.name_end));
+		s.same			= s.parent = s.first_child = s.last_child = s.next_sibling = s.implied_by = NONE;
+		return true;
+	}
+
+	bool	open(const uint8_t *data, size_t n) {
+		if (!header(data, n))
+			return false;
+		for (size_t at = next_line(start), next; at < size; at = next) {
+			next	= next_line(at);
+			auto	prev = sections.n;
+			if (add_section(at, next) && prev)
+				sections[prev - 1].end = at;
+		}
+		link();
+		return true;
+	}
+
+	// only the sections of path, its subkeys and its ancestors, found through a sidecar index and read in place;
+	// false if the index does not describe this file
+	bool	open(const uint8_t *data, size_t n, const struct SectionIndex &index, const char16_t *path, uint32_t length);
+
+	void	clear() {
+		sections.n	= 0;
+		free(table);
+		table		= nullptr;
+		table_size	= num_paths = 0;
+	}
+
+	// index the sections by path, give each one any parent the file leaves out, and link each path's first section under its parent's
+	void	link() {
+		table_size = 1024;
+		while (table_size < sections.n * 2)
+			table_size *= 2;
+		table		= (uint32_t*)calloc(table_size, sizeof(uint32_t));
+		num_paths	= 0;
+		removals	= false;
+
+		auto	n = sections.n;
+		for (uint32_t i = 0; i < n; i++) {
+			auto	&s = sections[i];
+			removals |= s.removed;
+			auto	j = uint32_t(s.hash) & (table_size - 1);
+			for (; table[j]; j = (j + 1) & (table_size - 1)) {
+				auto	first = table[j] - 1;
+				if (sections[first].hash == s.hash && equal(chars(sections[first].name, sections[first].name_end), chars(s.name, s.name_end))) {
+					while (sections[first].same != NONE)
+						first = sections[first].same;
+					sections[first].same = i;
+					break;
+				}
+			}
+			if (!table[j]) {
+				table[j] = i + 1;
+				++num_paths;
+			}
+		}
+
+		// importing [a\b\c] creates a and a\b too
+		for (uint32_t i = 0; i < n; i++) {
+			auto	&s = sections[i];
+			auto	slash = parent_end(s.name, s.name_end);
+			if (!s.removed && slash != NONE)
+				imply(s.name, slash, i);
+		}
+
+		for (uint32_t i = 0; i < sections.n; i++) {
+			auto	&s = sections[i];
+			if (first(i) != i)
+				continue;
+			auto	slash = parent_end(s.name, s.name_end);
+			if (slash == NONE)
+				continue;
+			auto	parent = find(s.name, slash, hash(chars(s.name, slash)));
+			if (parent == NONE)
+				continue;
+			s.parent = parent;
+			auto	&ps = sections[parent];
+			if (ps.last_child == NONE)
+				ps.first_child = i;
+			else
+				sections[ps.last_child].next_sibling = i;
+			ps.last_child = i;
+		}
+	}
+
+	// where sections fall as the file is applied: an implied one just before the section that needs it
+	uint64_t	order(uint32_t i) const {
+		return sections[i].implied() ? 2ull * sections[i].implied_by : 2ull * i + 1;
+	}
+
+	// make sure the path (part of section at's) exists when section at is applied, adding an empty section for it, and its parents, if not
+	void	imply(size_t name, size_t name_end, uint32_t at) {
+		auto		h		= hash(chars(name, name_end));
+		auto		bound	= 2ull * at;
+		auto		head	= find(name, name_end, h);
+		uint32_t	latest	= NONE;
+		for (auto a = head; a != NONE && order(a) < bound; a = sections[a].same)
+			latest = a;
+		if (latest != NONE && !sections[latest].removed) {
+			auto	w = removals ? wiped(name, name_end, bound) : NONE;
+			if (w == NONE || order(w) < order(latest))
+				return;
+		}
+
+		auto	slash = parent_end(name, name_end);
+		if (slash != NONE)
+			imply(name, slash, at);
+
+		if (head == NONE && (num_paths + 1) * 2 > table_size)
+			grow();
+
+		uint32_t	i		= sections.n;
+		auto		header	= sections[at].header;
+		auto		&s		= sections.push();
+		s.header	= s.body = s.end = header;
+		s.name		= name;
+		s.name_end	= name_end;
+		s.hash		= h;
+		s.removed	= false;
+		s.implied_by = at;
+		s.parent	= s.first_child = s.last_child = s.next_sibling = NONE;
+
+		if (latest != NONE) {
+			s.same = sections[latest].same;
+			sections[latest].same = i;
+			return;
+		}
+		// it goes first: the table holds the head of each path's chain
+		s.same = head;
+		auto	j = uint32_t(h) & (table_size - 1);
+		while (table[j] && table[j] != head + 1)
+			j = (j + 1) & (table_size - 1);
+		if (!table[j])
+			++num_paths;
+		table[j] = i + 1;
+	}
+
+	void	grow() {
+		auto	old = table;
+		auto	old_size = table_size;
+		table_size *= 2;
+		table = (uint32_t*)calloc(table_size, sizeof(uint32_t));
+		for (uint32_t k = 0; k < old_size; k++) {
+			if (old[k]) {
+				auto	j = uint32_t(sections[old[k] - 1].hash) & (table_size - 1);
+				while (table[j])
+					j = (j + 1) & (table_size - 1);
+				table[j] = old[k];
+			}
+		}
+		free(old);
+	}
+
+	// where the last \ of a path is, or NONE for a root
+	size_t		parent_end(size_t name, size_t name_end) const {
+		for (auto i = name_end; i > name;) {
+			i -= step();
+			if (unit(i) == '\\')
+				return i;
+		}
+		return NONE;
+	}
+	uint32_t	first(uint32_t i) const {
+		auto	&s = sections[i];
+		return find(s.name, s.name_end, s.hash);
+	}
+
+	//-------------------------------------------------------------------------
+	//	lookup and enumeration
+	//-------------------------------------------------------------------------
+
+	// first section of a path, or NONE
+	uint32_t	find(const char16_t *path, size_t n) const {
+		if (!table_size)
+			return NONE;
+		uint64_t	h = 14695981039346656037ull;
+		for (size_t i = 0; i < n; i++)
+			h = (h ^ fold(path[i])) * 1099511628211ull;
+		for (auto j = uint32_t(h) & (table_size - 1); table[j]; j = (j + 1) & (table_size - 1)) {
+			auto	&s	= sections[table[j] - 1];
+			if (s.hash != h)
+				continue;
+			auto	c	= chars(s.name, s.name_end);
+			size_t	k	= 0;
+			int		u;
+			while (k < n && (u = c.next()) >= 0 && fold(u) == fold(path[k]))
+				++k;
+			if (k == n && c.next() < 0)
+				return table[j] - 1;
+		}
+		return NONE;
+	}
+
+	// whether the file leaves the path in place: its last section is not [-path], and no later [-ancestor] removes it
+	bool	live(uint32_t i) const {
+		auto	last = i;
+		while (sections[last].same != NONE)
+			last = sections[last].same;
+		if (sections[last].removed)
+			return false;
+		auto	w = wiped(i, ~0ull);
+		return w == NONE || order(w) < order(last);
+	}
+
+	// the last [-ancestor] of the path ordered before before, or NONE
+	uint32_t	wiped(size_t name, size_t name_end, uint64_t before) const {
+		uint32_t	latest = NONE;
+		for (auto slash = parent_end(name, name_end); slash != NONE; slash = parent_end(name, slash)) {
+			for (auto a = find(name, slash, hash(chars(name, slash))); a != NONE && order(a) < before; a = sections[a].same) {
+				if (sections[a].removed && (latest == NONE || order(a) > order(latest)))
+					latest = a;
+			}
+		}
+		return latest;
+	}
+	uint32_t	wiped(uint32_t i, uint64_t before) const {
+		return wiped(sections[i].name, sections[i].name_end, before);
+	}
+
+	template<typename F> void subkeys(uint32_t i, F f) const {
+		for (auto c = sections[first(i)].first_child; c != NONE; c = sections[c].next_sibling)
+			f(c);
+	}
+
+	// the path, or just its last component
+	void	path(uint32_t i, Array<char16_t> &out, bool leaf = false) const {
+		auto	&s = sections[i];
+		auto	a = s.name;
+		if (leaf) {
+			auto	slash = parent_end(s.name, s.name_end);
+			if (slash != NONE)
+				a = slash + step();
+		}
+		out.n = 0;
+		auto	c = chars(a, s.name_end);
+		for (int u; (u = c.next()) >= 0;)
+			out.push(char16_t(u));
+	}
+
+	// every value line of one section, in file order
+	template<typename F> void section_values(uint32_t i, F f) const {
+		auto	&s = sections[i];
+		for (size_t at = s.body, next; at < s.end; at = next) {
+			next	= next_line(at);
+			auto	e = line_end(at, next);
+			auto	j = skip_blanks(at, e);
+			if (j == e)
+				continue;
+
+			Value	v;
+			v.quoted = unit(j) == '"';
+			if (v.quoted) {
+				v.name = j += step();
+				while (j < e && unit(j) != '"')
+					j += step() * (unit(j) == '\\' && j + step() < e ? 2 : 1);
+				if (j >= e)
+					continue;
+				v.name_end = j;
+				j += step();
+			} else if (unit(j) == '@') {
+				v.name = v.name_end = j;
+				j += step();
+			} else {
+				continue;
+			}
+			j = skip_blanks(j, e);
+			if (j == e || unit(j) != '=')
+				continue;
+			v.data		= skip_blanks(j + step(), e);
+			v.data_end	= e;
+			v.removed	= v.data + step() == e && unit(v.data) == '-';
+
+			// hex data continues over lines ending in a backslash
+			while (v.data_end > v.data && unit(v.data_end - step()) == '\\' && unit(v.data) == 'h' && next < s.end) {
+				v.data_end	= line_end(next, next_line(next));
+				next		= next_line(next);
+			}
+			f(v);
+		}
+	}
+
+	// the values a path is left with: later sections and assignments win, and [-path], [-ancestor] or "name"=- remove
+	void	values(uint32_t i, Array<Value> &out) const {
+		Array<uint32_t>	slots;			// value in out + 1, open addressing by folded name
+		Array<uint64_t>	hashes;			// of each value in out
+		auto	reset = [&]() {
+			out.n = hashes.n = 0;
+			if (slots.n)
+				memset(slots.p, 0, slots.n * sizeof(uint32_t));
+		};
+		auto	slot = [&](uint64_t h) {
+			auto	j = uint32_t(h) & (slots.n - 1);
+			while (slots[j] && hashes[slots[j] - 1] != h)
+				j = (j + 1) & (slots.n - 1);
+			return j;
+		};
+
+		out.n = 0;
+		for (auto s = first(i), prev = NONE; s != NONE; prev = s, s = sections[s].same) {
+			auto	w = removals ? wiped(i, order(s)) : NONE;
+			if (w != NONE && (prev == NONE || order(w) > order(prev)))
+				reset();
+			if (sections[s].removed) {
+				reset();
+				continue;
+			}
+			section_values(s, [&](const Value &v) {
+				if (hashes.n * 2 >= slots.n) {
+					slots.resize(slots.n ? slots.n * 2 : 64);
+					memset(slots.p, 0, slots.n * sizeof(uint32_t));
+					for (uint32_t k = 0; k < hashes.n; k++)
+						slots[slot(hashes[k])] = k + 1;
+				}
+				auto	h = name_hash(v);
+				auto	j = slot(h);
+				while (slots[j] && !same_name(out[slots[j] - 1], v)) {
+					// a different name with the same hash
+					do
+						j = (j + 1) & (slots.n - 1);
+					while (slots[j] && hashes[slots[j] - 1] != h);
+				}
+				if (slots[j]) {
+					out[slots[j] - 1] = v;		// "name"=- stays as a marker, so a later assignment is not a duplicate
+				} else {
+					slots[j] = out.n + 1;
+					hashes.push(h);
+					out.push(v);
+				}
+			});
+		}
+
+		uint32_t	k = 0;
+		for (uint32_t j = 0; j < out.n; j++) {
+			if (!out[j].removed)
+				out[k++] = out[j];
+		}
+		out.n = k;
+	}
+
+	//-------------------------------------------------------------------------
+	//	decoding
+	//-------------------------------------------------------------------------
+
+	void	name(const Value &v, Array<char16_t> &out) const {
+		out.n = 0;
+		auto	c = chars(v.name, v.name_end);
+		for (int u; (u = c.next()) >= 0;)
+			out.push(char16_t(v.quoted ? unescape(c, u, false) : u));
+	}
+	uint64_t	name_hash(const Value &v) const {
+		uint64_t	h = 14695981039346656037ull ^ v.quoted;
+		auto		c = chars(v.name, v.name_end);
+		for (int u; (u = c.next()) >= 0;)
+			h = (h ^ fold(unescape(c, u, false))) * 1099511628211ull;
+		return h;
+	}
+	bool	same_name(const Value &a, const Value &b) const {
+		if (a.quoted != b.quoted)
+			return false;
+		auto	ca = chars(a.name, a.name_end), cb = chars(b.name, b.name_end);
+		for (;;) {
+			auto	ua = ca.next(), ub = cb.next();
+			if (ua < 0 || ub < 0)
+				return ua == ub;
+			if (fold(unescape(ca, ua, false)) != fold(unescape(cb, ub, false)))
+				return false;
+		}
+	}
+
+	// the value's type and data; NONE if the data is malformed
+	uint32_t	data(const Value &v, Array<uint8_t> &out) const {
+		if (v.removed) {
+			out.n = 0;
+			return NONE;
+		}
+		return decode(p + v.data, p + v.data_end, utf16, out);
+	}
+};
+
+//-----------------------------------------------------------------------------
+//	SectionIndex
+//	sidecar for a .reg file, so one key can be read from a large export without scanning it
+//	file layout:
+//		"REGX"
+//		uint64 size						of the .reg file described
+//		uint32 count
+//		{ uint64 offset, uint64 bytes, uint32 name, uint32 length }[count]	each section's byte range, and its path in names
+//		char16 names[]
+//	entries are sorted by folded path with \ lowest, so a key is directly followed by its subkeys;
+//	sections of the same path stay in file order
+//-----------------------------------------------------------------------------
+
+struct SectionIndex {
+	static constexpr uint8_t	magic[4] = {'R', 'E', 'G', 'X'};
+	static const size_t			HEADER	= 4 + 8 + 4;
+	static const size_t			ENTRY	= 8 + 8 + 4 + 4;
+
+	struct Entry {
+		uint64_t		offset, bytes;
+		const char16_t	*name;
+		uint32_t		length;
+	};
+
+	uint8_t			*data		= nullptr;
+	size_t			data_size	= 0;
+	uint64_t		size		= 0;
+	uint32_t		count		= 0;
+	const char16_t	*names		= nullptr;
+	size_t			num_names	= 0;
+
+	SectionIndex() {}
+	SectionIndex(const SectionIndex&) = delete;
+	~SectionIndex() { free(data); }
+
+	static uint32_t	order(char16_t c)	{ return c == '\\' ? 0 : fold(c); }
+	static int		compare(const char16_t *a, uint32_t na, const char16_t *b, uint32_t nb) {
+		for (uint32_t i = 0; i < na && i < nb; i++) {
+			auto	ca = order(a[i]), cb = order(b[i]);
+			if (ca != cb)
+				return ca < cb ? -1 : 1;
+		}
+		return na < nb ? -1 : na > nb ? 1 : 0;
+	}
+
+	// a missing or malformed file just leaves the index empty
+	bool	load(FILE *f) {
+		fseek(f, 0, SEEK_END);
+		auto	n = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		if (n < (long)HEADER || n >= 0x7fffffff)
+			return false;
+		data		= (uint8_t*)malloc(n);
+		data_size	= fread(data, 1, n, f);
+		if (data_size < HEADER || memcmp(data, magic, sizeof(magic)) != 0)
+			return false;
+		memcpy(&size, data + 4, 8);
+		memcpy(&count, data + 12, 4);
+		if (count > (data_size - HEADER) / ENTRY) {
+			count = 0;
+			return false;
+		}
+		names		= (const char16_t*)(data + HEADER + count * ENTRY);
+		num_names	= (data_size - HEADER - count * ENTRY) / 2;
+		return true;
+	}
+
+	bool	get(uint32_t i, Entry &e) const {
+		auto		p = data + HEADER + i * ENTRY;
+		uint32_t	name;
+		memcpy(&e.offset, p, 8);
+		memcpy(&e.bytes, p + 8, 8);
+		memcpy(&name, p + 16, 4);
+		memcpy(&e.length, p + 20, 4);
+		e.name = names + name;
+		return name <= num_names && e.length <= num_names - name;
+	}
+
+	// every section of path, and with subtree those of its subkeys too
+	template<typename F> void find(const char16_t *path, uint32_t n, bool subtree, F f) const {
+		Entry		e;
+		uint32_t	lo = 0, hi = count;
+		while (lo < hi) {
+			auto	mid = lo + (hi - lo) / 2;
+			if (get(mid, e) && compare(e.name, e.length, path, n) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for (; lo < count && get(lo, e) && under(e.name, e.length, path, n); lo++) {
+			if (subtree || e.length == n)
+				f(e);
+			else
+				break;
+		}
+	}
+
+	static bool	write(FILE *f, const struct Document &doc);
+};
+
+//-----------------------------------------------------------------------------
+//	Merged
+//	documents applied one after another, as importing each in turn would: later assignments win,
+//	and [-path] or "name"=- remove what came before them
+//	removals are kept (and written) only where the key or value might already exist in the registry,
+//	i.e. where no removal further up has been written before them
+//-----------------------------------------------------------------------------
+
+struct Merged {
+	struct Node {
+		uint32_t	name, length;			// in names
+		uint32_t	parent, first_child, next_sibling;
+		uint32_t	first_value;
+		uint64_t	hash;					// of the parent and the folded name
+		bool		present;				// a section sets the key, so it is written
+		bool		removed;				// [-path] is written before it
+		bool		dead;					// removed after it was created, so no longer reachable
+	};
+	struct Entry {
+		uint32_t		name, length;		// in names
+		uint32_t		next;
+		const Document	*doc;
+		Value			v;					// v.removed for "name"=-
+	};
+
+	Array<Node>		nodes;					// nodes[0] stands above the roots
+	Array<Entry>	entries;
+	Array<char16_t>	names;
+	uint32_t		*table	= nullptr;		// node + 1, open addressing
+	uint32_t		table_size = 0, table_used = 0;
+
+	Merged() {
+		auto	&root = nodes.push();
+		memset(&root, 0, sizeof(root));
+		root.parent = root.first_child = root.next_sibling = root.first_value = NONE;
+	}
+	Merged(const Merged&) = delete;
+	~Merged() { free(table); }
+
+	const char16_t	*name(uint32_t at) const { return names.p + at; }
+
+	uint32_t	store(const char16_t *s, uint32_t n) {
+		auto	at = names.n;
+		for (uint32_t i = 0; i < n; i++)
+			names.push(s[i]);
+		return at;
+	}
+	bool		same(uint32_t at, uint32_t length, const char16_t *s, uint32_t n) const {
+		if (length != n)
+			return false;
+		for (uint32_t i = 0; i < n; i++) {
+			if (fold(names[at + i]) != fold(s[i]))
+				return false;
+		}
+		return true;
+	}
+	static uint64_t	hash(uint32_t parent, const char16_t *s, uint32_t n) {
+		uint64_t	h = 14695981039346656037ull ^ parent;
+		for (uint32_t i = 0; i < n; i++)
+			h = (h ^ fold(s[i])) * 1099511628211ull;
+		return h;
+	}
+
+	//-------------------------------------------------------------------------
+	//	keys
+	//-------------------------------------------------------------------------
+
+	void		insert(uint32_t i) {
+		auto	j = uint32_t(nodes[i].hash) & (table_size - 1);
+		while (table[j])
+			j = (j + 1) & (table_size - 1);
+		table[j] = i + 1;
+		++table_used;
+	}
+	uint32_t	child(uint32_t parent, const char16_t *s, uint32_t n) const {
+		if (!table_size)
+			return NONE;
+		auto	h = hash(parent, s, n);
+		for (auto j = uint32_t(h) & (table_size - 1); table[j]; j = (j + 1) & (table_size - 1)) {
+			auto	&c = nodes[table[j] - 1];
+			if (c.hash == h && !c.dead && c.parent == parent && same(c.name, c.length, s, n))
+				return table[j] - 1;
+		}
+		return NONE;
+	}
+	uint32_t	add_child(uint32_t parent, const char16_t *s, uint32_t n) {
+		if (table_used * 2 >= table_size) {
+			// rebuild without the dead
+			free(table);
+			table_size	= table_size ? table_size * 2 : 1024;
+			table		= (uint32_t*)calloc(table_size, sizeof(uint32_t));
+			table_used	= 0;
+			for (uint32_t i = 1; i < nodes.n; i++) {
+				if (!nodes[i].dead)
+					insert(i);
+			}
+		}
+		uint32_t	i = nodes.n;
+		auto		&c = nodes.push();
+		c.name			= store(s, n);
+		c.length		= n;
+		c.parent		= parent;
+		c.first_child	= c.first_value = NONE;
+		c.hash			= hash(parent, s, n);
+		c.present		= c.removed = c.dead = false;
+		c.next_sibling	= nodes[parent].first_child;
+		nodes[parent].first_child = i;
+		insert(i);
+		return i;
+	}
+
+	// whether the merged file wipes the key (or one above it) before anything under it is written
+	bool		covered(uint32_t i) const {
+		for (; i; i = nodes[i].parent) {
+			if (nodes[i].removed)
+				return true;
+		}
+		return false;
+	}
+
+	void		kill(uint32_t i) {
+		auto	&n = nodes[i];
+		n.dead = true;
+		for (auto c = n.first_child; c != NONE; c = nodes[c].next_sibling)
+			kill(c);
+		auto	*link = &nodes[n.parent].first_child;
+		while (*link != i)
+			link = &nodes[*link].next_sibling;
+		*link = n.next_sibling;
+	}
+
+	//-------------------------------------------------------------------------
+	//	applying a document
+	//-------------------------------------------------------------------------
+
+	// the node for a path, created if need be; NONE if create is false and it is not there
+	uint32_t	find(const char16_t *path, uint32_t n, bool create) {
+		uint32_t	i = 0;
+		for (uint32_t a = 0; a < n;) {
+			auto	e = a;
+			while (e < n && path[e] != '\\')
+				++e;
+			if (e > a) {
+				auto	c = child(i, path + a, e - a);
+				if (c == NONE) {
+					if (!create)
+						return NONE;
+					c = add_child(i, path + a, e - a);
+				}
+				i = c;
+			}
+			a = e + 1;
+		}
+		return i ? i : NONE;
+	}
+
+	void		remove_key(const char16_t *path, uint32_t n) {
+		auto	i = find(path, n, false);
+		if (i != NONE) {
+			auto	parent = nodes[i].parent;
+			kill(i);
+			if (covered(parent))
+				return;
+		} else {
+			// an unknown key under a wiped one cannot exist
+			uint32_t	j = 0;
+			for (uint32_t a = 0; a < n && j != NONE;) {
+				auto	e = a;
+				while (e < n && path[e] != '\\')
+					++e;
+				if (e > a) {
+					if (nodes[j].removed)
+						return;
+					j = child(j, path + a, e - a);
+				}
+				a = e + 1;
+			}
+		}
+		if ((i = find(path, n, true)) != NONE)
+			nodes[i].removed = true;
+	}
+
+	void		set_value(uint32_t i, const Document &doc, const Value &v, const char16_t *s, uint32_t n) {
+		uint32_t	prev = NONE, e = nodes[i].first_value;
+		while (e != NONE && !same(entries[e].name, entries[e].length, s, n)) {
+			prev	= e;
+			e		= entries[e].next;
+		}
+
+		if (v.removed && covered(i)) {
+			if (e != NONE)
+				(prev == NONE ? nodes[i].first_value : entries[prev].next) = entries[e].next;
+			return;
+		}
+		if (e == NONE) {
+			e = entries.n;
+			auto	&x = entries.push();
+			x.name		= store(s, n);
+			x.length	= n;
+			x.next		= NONE;
+			(prev == NONE ? nodes[i].first_value : entries[prev].next) = e;
+		}
+		entries[e].doc	= &doc;
+		entries[e].v	= v;
+	}
+
+	void		apply(const Document &doc) {
+		Array<char16_t>	path, value;
+		for (uint32_t s = 0; s < doc.sections.n; s++) {
+			if (doc.sections[s].implied())
+				continue;
+			doc.path(s, path);
+			if (doc.sections[s].removed) {
+				remove_key(path.p, path.n);
+				continue;
+			}
+			auto	i = find(path.p, path.n, true);
+			if (i == NONE)
+				continue;
+			nodes[i].present = true;
+			doc.section_values(s, [&](const Value &v) {
+				doc.name(v, value);
+				set_value(i, doc, v, value.p, value.n);
+			});
+		}
+	}
+
+	//-------------------------------------------------------------------------
+	//	output
+	//-------------------------------------------------------------------------
+
+	// live children, sorted by folded name
+	void		children(uint32_t i, Array<uint32_t> &out) const {
+		out.n = 0;
+		for (auto c = nodes[i].first_child; c != NONE; c = nodes[c].next_sibling)
+			out.push(c);
+		// insertion sort: children were mostly added in order
+		for (uint32_t a = 1; a < out.n; a++) {
+			auto	c = out[a];
+			auto	b = a;
+			while (b > 0 && compare(out[b - 1], c) > 0) {
+				out[b] = out[b - 1];
+				--b;
+			}
+			out[b] = c;
+		}
+	}
+	int			compare(uint32_t a, uint32_t b) const {
+		auto	&na = nodes[a], &nb = nodes[b];
+		for (uint32_t i = 0; i < na.length && i < nb.length; i++) {
+			auto	ca = fold(names[na.name + i]), cb = fold(names[nb.name + i]);
+			if (ca != cb)
+				return ca < cb ? -1 : 1;
+		}
+		return na.length < nb.length ? -1 : na.length > nb.length ? 1 : 0;
+	}
+
+	// depth first, parents before children; f(node, path) is called for every node with something to write
+	template<typename F> void each(F f) const {
+		Array<char16_t>	path;
+		each(0, path, f);
+	}
+	template<typename F> void each(uint32_t i, Array<char16_t> &path, F f) const {
+		auto	length = path.n;
+		if (i) {
+			if (path.n)
+				path.push('\\');
+			for (uint32_t k = 0; k < nodes[i].length; k++)
+				path.push(names[nodes[i].name + k]);
+			if (nodes[i].removed || nodes[i].present)
+				f(nodes[i], path);
+		}
+		Array<uint32_t>	sorted;
+		children(i, sorted);
+		for (uint32_t c = 0; c < sorted.n; c++)
+			each(sorted[c], path, f);
+		path.n = length;
+	}
+};
+
+//-----------------------------------------------------------------------------
+//	Document and SectionIndex, together
+//-----------------------------------------------------------------------------
+
+inline bool Document::open(const uint8_t *data, size_t n, const SectionIndex &index, const char16_t *path, uint32_t length) {
+	if (!header(data, n) || index.size != size)
+		return false;
+
+	Array<SectionIndex::Entry>	found;
+	auto	add = [&](const SectionIndex::Entry &e) { found.push(e); };
+	index.find(path, length, true, add);
+	// the ancestors are needed too, for any [-ancestor] that removes path
+	for (uint32_t k = 0; k < length; k++) {
+		if (path[k] == '\\')
+			index.find(path, k, false, add);
+	}
+	sort(found.p, found.n, [](const SectionIndex::Entry &a, const SectionIndex::Entry &b) { return a.offset < b.offset; });
+
+	// every entry must still be the [ line of the section it names
+	for (uint32_t i = 0; i < found.n; i++) {
+		auto	&e = found[i];
+		if (e.offset < start || e.offset > size || e.bytes > size - e.offset || (utf16 && (e.offset - start) % 2)
+		||	!add_section(e.offset, next_line(e.offset))
+		) {
+			clear();
+			return false;
+		}
+		auto	&s	= sections[sections.n - 1];
+		s.end		= e.offset + e.bytes;
+		auto	c	= chars(s.name, s.name_end);
+		uint32_t	k = 0;
+		int		u;
+		while (k < e.length && (u = c.next()) >= 0 && fold(u) == fold(e.name[k]))
+			++k;
+		if (k != e.length || c.next() >= 0 || s.end < s.body) {
+			clear();
+			return false;
+		}
+	}
+	link();
+	return true;
+}
+
+inline bool SectionIndex::write(FILE *f, const Document &doc) {
+	struct Item {
+		uint64_t	offset, bytes;
+		uint32_t	name, length;
+	};
+	Array<Item>		items;
+	Array<char16_t>	names;
+	for (uint32_t i = 0; i < doc.sections.n; i++) {
+		auto	&s	= doc.sections[i];
+		if (s.implied())
+			continue;
+		auto	&t	= items.push();
+		t.offset	= s.header;
+		t.bytes		= s.end - s.header;
+		t.name		= names.n;
+		auto	c	= doc.chars(s.name, s.name_end);
+		for (int u; (u = c.next()) >= 0;)
+			names.push(char16_t(u));
+		t.length	= names.n - t.name;
+	}
+	sort(items.p, items.n, [&](const Item &a, const Item &b) {
+		return compare(names.p + a.name, a.length, names.p + b.name, b.length) < 0;
+	});
+
+	uint64_t	size	= doc.size;
+	bool		ok		= fwrite(magic, 1, sizeof(magic), f) == sizeof(magic)
+						&& fwrite(&size, 8, 1, f) == 1
+						&& fwrite(&items.n, 4, 1, f) == 1;
+	static_assert(sizeof(Item) == ENTRY, "entries are written as they are");
+	return ok && fwrite(items.p, ENTRY, items.n, f) == items.n && fwrite(names.p, 2, names.n, f) == names.n;
+}
+
+} // namespace RegFile
@@ -0,0 +1,131 @@
+#pragma once
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+//-----------------------------------------------------------------------------
+//	Governor
+//	paces registry calls made during a traversal:
+//	- token bucket limits calls per second (rate 0 = unlimited)
+//	- at most max_inflight calls outstanding at once (0 = unlimited)
+//	- when smoothed call latency rises above latency_target the duty cycle is
+//	  cut multiplicatively, and recovers additively once latency falls again
+//-----------------------------------------------------------------------------
+
+struct Governor {
+	using clock		= std::chrono::steady_clock;
+	using seconds	= std::chrono::duration<double>;
+
+	struct Stats {
+		uint64_t	calls			= 0;
+		uint64_t	rate_waits		= 0;	// calls delayed by the token bucket
+		uint64_t	inflight_waits	= 0;	// calls delayed by the concurrency ceiling
+		uint64_t	backoffs		= 0;	// times the duty cycle was cut
+		uint32_t	peak_inflight	= 0;
+		double		waited			= 0;	// seconds spent throttled
+		double		latency			= 0;	// smoothed per-call latency, seconds
+		double		duty			= 1;	// current duty cycle
+	};
+
+	double		rate			= 0;
+	double		burst			= 1;
+	uint32_t	max_inflight	= 0;
+	double		latency_target	= 0;
+
+	std::mutex				m;
+	std::condition_variable	cv;
+	double				tokens		= 0;
+	clock::time_point	last		= clock::now();
+	uint32_t			inflight	= 0;
+	uint64_t			adjusted	= 0;	// call count at the last duty change
+	Stats				stats;
+
+	Governor(double rate = 0, uint32_t max_inflight = 0, double latency_target = 0) : max_inflight(max_inflight), latency_target(latency_target) {
+		set_rate(rate);
+	}
+
+	// the bucket starts full and holds a tenth of a second of calls
+	void set_rate(double r) {
+		rate	= r;
+		burst	= tokens = r > 1 ? r / 10 + 1 : 1;
+	}
+
+	bool active() const { return rate > 0 || max_inflight > 0 || latency_target > 0; }
+
+	void acquire() {
+		std::unique_lock<std::mutex>	lock(m);
+		auto	start	= clock::now();
+
+		if (max_inflight && inflight >= max_inflight) {
+			++stats.inflight_waits;
+			cv.wait(lock, [this] { return inflight < max_inflight; });
+		}
+
+		if (rate > 0) {
+			for (bool waited = false;; waited = true) {
+				auto	now	= clock::now();
+				tokens	+= seconds(now - last).count() * rate;
+				last	= now;
+				if (tokens > burst)
+					tokens = burst;
+				if (tokens >= 1)
+					break;
+				stats.rate_waits += !waited;
+				auto	wait = seconds((1 - tokens) / rate);
+				lock.unlock();
+				std::this_thread::sleep_for(wait);
+				lock.lock();
+			}
+			tokens -= 1;
+		}
+
+		// keep the target idle for (1 / duty - 1) times the typical call latency
+		if (stats.duty < 1) {
+			auto	pause = seconds(stats.latency * (1 / stats.duty - 1));
+			lock.unlock();
+			std::this_thread::sleep_for(pause);
+			lock.lock();
+		}
+
+		++stats.calls;
+		if (++inflight > stats.peak_inflight)
+			stats.peak_inflight = inflight;
+		stats.waited += seconds(clock::now() - start).count();
+	}
+
+	void release(double latency) {
+		std::lock_guard<std::mutex>	lock(m);
+		--inflight;
+		stats.latency = stats.calls == 1 ? latency : stats.latency * 0.875 + latency * 0.125;
+
+		// re-evaluate at most every 16 calls so one slow call can't collapse the duty cycle
+		if (latency_target > 0 && stats.calls - adjusted >= 16) {
+			adjusted = stats.calls;
+			if (stats.latency > latency_target) {
+				if (stats.duty > 1 / 64.0) {
+					stats.duty /= 2;
+					++stats.backoffs;
+				}
+			} else if (stats.duty < 1 && stats.latency < latency_target / 2) {
+				stats.duty = stats.duty + 1 / 32.0 < 1 ? stats.duty + 1 / 32.0 : 1;
+			}
+		}
+		cv.notify_one();
+	}
+
+	struct Call {
+		Governor			*g;
+		clock::time_point	start;
+		Call(Governor *g) : g(g && g->active() ? g : nullptr) {
+			if (this->g) {
+				this->g->acquire();
+				start = clock::now();
+			}
+		}
+		~Call() {
+			if (g)
+				g->release(seconds(clock::now() - start).count());
+		}
+	};
+};
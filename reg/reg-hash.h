@@ -0,0 +1,197 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//-----------------------------------------------------------------------------
+//	SHA256
+//-----------------------------------------------------------------------------
+
+struct SHA256 {
+	enum { DIGEST = 32 };
+	struct Digest {
+		uint8_t	b[DIGEST];
+		bool operator==(const Digest &d) const { return memcmp(b, d.b, DIGEST) == 0; }
+	};
+
+	uint32_t	h[8]	= {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+	uint8_t		block[64];
+	uint32_t	used	= 0;
+	uint64_t	total	= 0;
+
+	static uint32_t	ror(uint32_t x, int n)	{ return (x >> n) | (x << (32 - n)); }
+
+	void	compress(const uint8_t *p) {
+		static const uint32_t k[64] = {
+			0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+			0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+			0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+			0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+			0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+			0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+			0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+			0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+		};
+		uint32_t	w[64];
+		for (int i = 0; i < 16; i++)
+			w[i] = (p[i * 4] << 24) | (p[i * 4 + 1] << 16) | (p[i * 4 + 2] << 8) | p[i * 4 + 3];
+		for (int i = 16; i < 64; i++)
+			w[i] = w[i - 16] + (ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3)) + w[i - 7] + (ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10));
+
+		uint32_t	a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+		for (int i = 0; i < 64; i++) {
+			uint32_t	t1 = hh + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+			uint32_t	t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			hh = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+		h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+		h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+	}
+
+	void	add(const void *data, size_t n) {
+		auto	p = (const uint8_t*)data;
+		total += n;
+		if (used) {
+			size_t	chunk = 64 - used < n ? 64 - used : n;
+			memcpy(block + used, p, chunk);
+			used	+= chunk;
+			p		+= chunk;
+			n		-= chunk;
+			if (used < 64)
+				return;
+			compress(block);
+			used = 0;
+		}
+		for (; n >= 64; p += 64, n -= 64)
+			compress(p);
+		memcpy(block, p, n);
+		used = n;
+	}
+	template<typename T> void add(const T &t) { add(&t, sizeof(t)); }
+
+	Digest	finish() {
+		uint64_t	bits = total * 8;
+		uint8_t		pad = 0x80;
+		add(&pad, 1);
+		pad = 0;
+		while (used != 56)
+			add(&pad, 1);
+		uint8_t		len[8];
+		for (int i = 0; i < 8; i++)
+			len[i] = uint8_t(bits >> (56 - i * 8));
+		add(len, 8);
+
+		Digest	d;
+		for (int i = 0; i < 8; i++) {
+			d.b[i * 4 + 0] = uint8_t(h[i] >> 24);
+			d.b[i * 4 + 1] = uint8_t(h[i] >> 16);
+			d.b[i * 4 + 2] = uint8_t(h[i] >> 8);
+			d.b[i * 4 + 3] = uint8_t(h[i]);
+		}
+		return d;
+	}
+};
+
+//-----------------------------------------------------------------------------
+//	DigestCache
+//	digests from a previous run, keyed by path and last write time
+//	file layout:
+//		"REGH"
+//		{ uint64 last_write, digest[32], uint32 length, char16 path[length] }...
+//	read whole into memory; lookups are lock-free so worker threads can share it
+//-----------------------------------------------------------------------------
+
+struct DigestCache {
+	static constexpr uint8_t	magic[4] = {'R', 'E', 'G', 'H'};
+	static const size_t			FIXED	= 8 + SHA256::DIGEST + 4;
+
+	uint8_t		*data	= nullptr;
+	size_t		size	= 0;
+	uint32_t	*table	= nullptr;		// record offset + 1, open addressing
+	uint32_t	table_size = 0;
+
+	DigestCache() {}
+	DigestCache(const DigestCache&) = delete;
+	~DigestCache() {
+		free(data);
+		free(table);
+	}
+
+	static uint32_t	hash(const char16_t *s, size_t n) {
+		uint32_t	h = 2166136261u;
+		while (n--)
+			h = (h ^ *s++) * 16777619u;
+		return h;
+	}
+
+	// a missing or malformed file just leaves the cache empty
+	bool	load(FILE *f) {
+		fseek(f, 0, SEEK_END);
+		auto	n = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		if (n < (long)sizeof(magic) || n >= 0x7fffffff)
+			return false;
+		data	= (uint8_t*)malloc(n);
+		size	= fread(data, 1, n, f);
+		if (size < sizeof(magic) || memcmp(data, magic, sizeof(magic)) != 0)
+			return false;
+
+		// records stop at the first one cut short
+		uint32_t	count = 0;
+		for (size_t p = sizeof(magic), r; (r = record(p)); p += r)
+			++count;
+
+		table_size = 1024;
+		while (table_size < count * 2)
+			table_size *= 2;
+		table = (uint32_t*)calloc(table_size, sizeof(uint32_t));
+
+		for (size_t p = sizeof(magic), r; (r = record(p)); p += r) {
+			auto	j = hash(path(p), length(p)) & (table_size - 1);
+			while (table[j])
+				j = (j + 1) & (table_size - 1);
+			table[j] = uint32_t(p + 1);
+		}
+		return true;
+	}
+
+	size_t			length(size_t p)	const { uint32_t n; memcpy(&n, data + p + 8 + SHA256::DIGEST, 4); return n; }
+	// the size of the record at p, or 0 if the file ends before it does; in size_t, as a damaged length can be anything
+	size_t			record(size_t p)	const {
+		if (size - p < FIXED)
+			return 0;
+		auto	n = length(p);
+		return n <= (size - p - FIXED) / 2 ? FIXED + n * 2 : 0;
+	}
+	const char16_t	*path(size_t p)		const { return (const char16_t*)(data + p + FIXED); }
+
+	bool	find(const char16_t *s, size_t n, uint64_t last_write, SHA256::Digest &digest) const {
+		if (!table)
+			return false;
+		for (auto j = hash(s, n) & (table_size - 1); table[j]; j = (j + 1) & (table_size - 1)) {
+			size_t	p = table[j] - 1;
+			if (length(p) == n && memcmp(path(p), s, n * 2) == 0) {
+				uint64_t	t;
+				memcpy(&t, data + p, 8);
+				if (t != last_write)
+					return false;
+				memcpy(digest.b, data + p + 8, SHA256::DIGEST);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static void	write_header(FILE *f) {
+		fwrite(magic, 1, sizeof(magic), f);
+	}
+	static void	write(FILE *f, const char16_t *s, size_t n, uint64_t last_write, const SHA256::Digest &digest) {
+		uint32_t	len = (uint32_t)n;
+		fwrite(&last_write, 8, 1, f);
+		fwrite(digest.b, 1, SHA256::DIGEST, f);
+		fwrite(&len, 4, 1, f);
+		fwrite(s, 2, n, f);
+	}
+};
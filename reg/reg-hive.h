@@ -0,0 +1,1574 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reg-common.h"
+
+//-----------------------------------------------------------------------------
+//	Hive
+//	the registry hive file format (regf), read in place without any Win32
+//		base block		4096 bytes: signature, sequence numbers, root cell
+//		hive bins		"hbin" headers, each followed by cells
+//	a cell is int32 size (negative when allocated) then data; cell offsets are
+//	relative to the first hbin; all integers little-endian
+//-----------------------------------------------------------------------------
+
+namespace Hive {
+
+static const uint32_t	BASE_BLOCK	= 4096;
+static const uint32_t	PAGE		= 4096;
+static const uint32_t	NONE		= 0xffffffff;
+static const uint32_t	BIG_DATA_SEGMENT = 16344;	// largest piece of a db value
+
+static const uint32_t	KEY_HIVE_EXIT	= 0x0002;
+static const uint32_t	KEY_HIVE_ENTRY	= 0x0004;	// root key
+static const uint32_t	KEY_NO_DELETE	= 0x0008;
+static const uint32_t	KEY_SYM_LINK	= 0x0010;
+static const uint32_t	KEY_COMP_NAME	= 0x0020;	// name is Latin-1
+static const uint32_t	VALUE_COMP_NAME	= 0x0001;
+static const uint32_t	DATA_INLINE		= 0x80000000;	// VK::size: data (up to 4 bytes) is held in VK::data
+
+#pragma pack(push, 1)
+struct BaseBlock {
+	char		signature[4];		// "regf"
+	uint32_t	sequence1;			// equal to sequence2 when the file is consistent
+	uint32_t	sequence2;
+	uint64_t	last_write;
+	uint32_t	major, minor;
+	uint32_t	type;				// 0 primary, 1 log, 2 log (new format)
+	uint32_t	format;				// 1
+	uint32_t	root;
+	uint32_t	bins_size;
+	uint32_t	clustering;
+	char16_t	name[32];
+	uint8_t		reserved[396];
+	uint32_t	checksum;			// xor of the dwords before it
+};
+
+struct Bin {
+	char		signature[4];		// "hbin"
+	uint32_t	offset;				// from the first hbin
+	uint32_t	size;
+	uint32_t	reserved[2];
+	uint64_t	timestamp;
+	uint32_t	spare;
+};
+
+struct NK {
+	char		signature[2];		// "nk"
+	uint16_t	flags;
+	uint64_t	last_write;
+	uint32_t	access;
+	uint32_t	parent;
+	uint32_t	num_subkeys, num_volatile;
+	uint32_t	subkeys, volatile_subkeys;
+	uint32_t	num_values, values;
+	uint32_t	security, class_name;
+	uint32_t	max_subkey;			// bytes, in the low 16 bits
+	uint32_t	max_class, max_value, max_data;
+	uint32_t	work;
+	uint16_t	name_length;		// bytes
+	uint16_t	class_length;
+//	name
+};
+
+struct VK {
+	char		signature[2];		// "vk"
+	uint16_t	name_length;
+	uint32_t	size;				// DATA_INLINE may be set
+	uint32_t	data;
+	uint32_t	type;
+	uint16_t	flags;
+	uint16_t	spare;
+//	name
+};
+
+struct SK {
+	char		signature[2];		// "sk"
+	uint16_t	reserved;
+	uint32_t	flink, blink;		// circular list of all security cells
+	uint32_t	refs;
+	uint32_t	size;
+//	descriptor
+};
+
+struct DB {
+	char		signature[2];		// "db"
+	uint16_t	count;
+	uint32_t	segments;			// cell of uint32 offsets
+	uint32_t	padding;
+};
+
+struct List {
+	char		signature[2];		// "li", "lf", "lh" or "ri"
+	uint16_t	count;
+//	li, ri: uint32 offsets; lf: {uint32 offset, char hint[4]}; lh: {uint32 offset, uint32 hash}
+};
+#pragma pack(pop)
+
+using Common::get16;
+using Common::get32;
+using Common::fold;
+using Common::fold_compare;
+using Common::Array;
+
+// the lh list hash
+inline uint32_t name_hash(const char16_t *s, size_t n) {
+	uint32_t	h = 0;
+	while (n--)
+		h = h * 37 + fold(*s++);
+	return h;
+}
+inline uint32_t checksum(const BaseBlock *b) {
+	uint32_t	x = 0;
+	auto		p = (const uint8_t*)b;
+	for (int i = 0; i < 0x1fc; i += 4)
+		x ^= get32(p + i);
+	return x == 0 ? 1 : x == 0xffffffff ? 0xfffffffe : x;
+}
+
+// Marvin32, as used for the hashes of log entries
+inline uint64_t marvin32(const uint8_t *p, size_t n, uint64_t seed = 0x82EF4D887A4E55C5ull) {
+	uint32_t	p0 = uint32_t(seed), p1 = uint32_t(seed >> 32);
+	auto		rotl = [](uint32_t x, int r) { return (x << r) | (x >> (32 - r)); };
+	auto		block = [&]() {
+		p1 ^= p0; p0 = rotl(p0, 20);
+		p0 += p1; p1 = rotl(p1, 9);
+		p1 ^= p0; p0 = rotl(p0, 27);
+		p0 += p1; p1 = rotl(p1, 19);
+	};
+	for (; n >= 4; p += 4, n -= 4) {
+		p0 += get32(p);
+		block();
+	}
+	switch (n) {
+		case 0: p0 += 0x80u; break;
+		case 1: p0 += 0x8000u | p[0]; break;
+		case 2: p0 += 0x800000u | get16(p); break;
+		case 3: p0 += 0x80000000u | (uint32_t(p[2]) << 16) | get16(p); break;
+	}
+	block();
+	block();
+	return (uint64_t(p1) << 32) | p0;
+}
+
+//-----------------------------------------------------------------------------
+//	log entries (.LOG1/.LOG2, Windows 8.1 and later)
+//	the log starts with a copy of the base block cut to 512 bytes, then
+//		"HvLE", uint32 size, flags, sequence, bins_size, num_pages,
+//		uint64 hash1 (of the rest of the entry), hash2 (of the 32 bytes before it)
+//		{ uint32 offset, size } pages[num_pages]
+//		page data
+//-----------------------------------------------------------------------------
+
+static const uint32_t	LOG_HEADER	= 512;
+
+struct LogEntry {
+	char		signature[4];		// "HvLE"
+	uint32_t	size;				// whole entry, a multiple of 512
+	uint32_t	flags;
+	uint32_t	sequence;
+	uint32_t	bins_size;
+	uint32_t	num_pages;
+	uint64_t	hash1, hash2;
+};
+
+//-----------------------------------------------------------------------------
+//	Reader
+//	the bins are reached through a table of 4K pages, so a page can be
+//	supplied from somewhere other than the mapped file: replaying logs
+//	copies only the pages they touch, leaving the rest mapped
+//-----------------------------------------------------------------------------
+
+struct Reader {
+	struct Name {
+		const uint8_t	*p		= nullptr;
+		uint32_t		length	= 0;		// characters
+		bool			latin1	= false;
+
+		char16_t	operator[](uint32_t i) const { return latin1 ? p[i] : get16(p + i * 2); }
+		void		copy(char16_t *dest) const {
+			for (uint32_t i = 0; i < length; i++)
+				dest[i] = (*this)[i];
+		}
+		bool		equals(const char16_t *s, size_t n) const {
+			if (n != length)
+				return false;
+			for (uint32_t i = 0; i < length; i++) {
+				if (fold((*this)[i]) != fold(s[i]))
+					return false;
+			}
+			return true;
+		}
+		int			compare(const char16_t *s, size_t n) const {
+			for (uint32_t i = 0; i < length && i < n; i++) {
+				auto	a = fold((*this)[i]), b = fold(s[i]);
+				if (a != b)
+					return a < b ? -1 : 1;
+			}
+			return length < n ? -1 : length > n ? 1 : 0;
+		}
+	};
+
+	const BaseBlock	*header		= nullptr;
+	const uint8_t	**pages		= nullptr;
+	uint32_t		num_pages	= 0;
+	uint32_t		bins_size	= 0;
+	uint32_t		root		= NONE;
+	uint32_t		sequence	= 0;		// of the next log entry to apply
+	Array<uint8_t*>	overlay;				// pages replaced from logs
+	uint8_t			*owned		= nullptr;	// per page: set when it is in overlay
+	uint8_t			*overlay_header	= nullptr;
+
+	Reader() {}
+	Reader(const uint8_t *p, size_t size) { open(p, size); }
+	Reader(const Reader&) = delete;
+	~Reader() {
+		for (uint32_t i = 0; i < overlay.n; i++)
+			free(overlay[i]);
+		free(overlay_header);
+		free(owned);
+		free(pages);
+	}
+
+	// logs start with a base block too, but are not primary files
+	bool	open(const uint8_t *p, size_t size) {
+		if (size < BASE_BLOCK || memcmp(p, "regf", 4) != 0 || ((const BaseBlock*)p)->type != 0)
+			return false;
+		header		= (const BaseBlock*)p;
+		bins_size	= header->bins_size < size - BASE_BLOCK ? header->bins_size : uint32_t(size - BASE_BLOCK);
+		bins_size	&= ~(PAGE - 1);
+		num_pages	= bins_size / PAGE;
+		pages		= (const uint8_t**)malloc(sizeof(uint8_t*) * (num_pages + 1));
+		for (uint32_t i = 0; i < num_pages; i++)
+			pages[i] = p + BASE_BLOCK + i * PAGE;
+		root		= header->root;
+		sequence	= header->sequence2;
+		return true;
+	}
+	// primary and secondary sequence numbers differ while a write is incomplete
+	bool	dirty() const { return header && header->sequence1 != header->sequence2; }
+
+	//-------------------------------------------------------------------------
+	// log replay
+	//-------------------------------------------------------------------------
+
+	uint8_t	*own(uint32_t page) {
+		if (owned[page])
+			return (uint8_t*)pages[page];
+		auto	p = (uint8_t*)malloc(PAGE);
+		if (pages[page])
+			memcpy(p, pages[page], PAGE);
+		else
+			memset(p, 0, PAGE);
+		overlay.push()	= p;
+		pages[page]		= p;
+		owned[page]		= 1;
+		return p;
+	}
+	void	grow(uint32_t size) {
+		auto	n = (size + PAGE - 1) / PAGE;
+		if (!owned)
+			owned = (uint8_t*)calloc(num_pages + 1, 1);
+		if (n > num_pages) {
+			pages = (const uint8_t**)realloc(pages, sizeof(uint8_t*) * (n + 1));
+			owned = (uint8_t*)realloc(owned, n + 1);
+			memset(pages + num_pages, 0, sizeof(uint8_t*) * (n - num_pages));
+			memset(owned + num_pages, 0, n - num_pages);
+			num_pages = n;
+		}
+	}
+	void	apply(uint32_t offset, const uint8_t *p, uint32_t size) {
+		grow(offset + size);
+		while (size) {
+			auto	in		= offset % PAGE;
+			auto	chunk	= PAGE - in < size ? PAGE - in : size;
+			memcpy(own(offset / PAGE) + in, p, chunk);
+			offset	+= chunk;
+			p		+= chunk;
+			size	-= chunk;
+		}
+	}
+
+	static bool	valid_entry(const uint8_t *p, size_t left) {
+		auto	e = (const LogEntry*)p;
+		if (left < sizeof(LogEntry) || memcmp(e->signature, "HvLE", 4) != 0 || e->size < sizeof(LogEntry) || e->size > left || e->size % 512)
+			return false;
+		if (e->num_pages > (e->size - sizeof(LogEntry)) / 8)
+			return false;
+		return marvin32(p, 32) == e->hash2 && marvin32(p + sizeof(LogEntry), e->size - sizeof(LogEntry)) == e->hash1;
+	}
+
+	// applies the entries of one log, which must not predate what is already applied; returns how many
+	// entries are numbered on from the log's own base block and replay stops at the first gap or bad hash
+	uint32_t	replay(const uint8_t *log, size_t size) {
+		auto	base = (const BaseBlock*)log;
+		if (size < LOG_HEADER || memcmp(base->signature, "regf", 4) != 0 || checksum(base) != base->checksum || base->sequence1 < sequence)
+			return 0;
+
+		uint32_t	applied = 0;
+		sequence = base->sequence1;
+		for (size_t pos = LOG_HEADER; valid_entry(log + pos, size - pos);) {
+			auto	e		= (const LogEntry*)(log + pos);
+			auto	refs	= log + pos + sizeof(LogEntry);
+			auto	data	= refs + e->num_pages * 8;
+			auto	end		= log + pos + e->size;
+			pos += e->size;
+			if (e->sequence != sequence)
+				break;
+
+			for (uint32_t i = 0; i < e->num_pages; i++) {
+				auto	offset	= get32(refs + i * 8);
+				auto	n		= get32(refs + i * 8 + 4);
+				if (n > uint32_t(end - data) || offset + n > e->bins_size)
+					return applied;
+				apply(offset, data, n);
+				data += n;
+			}
+			bins_size	= e->bins_size & ~(PAGE - 1);
+			grow(bins_size);		// pages no entry has written stay null
+			++sequence;
+			++applied;
+		}
+
+		if (applied) {
+			if (!overlay_header)
+				overlay_header = (uint8_t*)malloc(BASE_BLOCK);
+			memcpy(overlay_header, header, BASE_BLOCK);
+			memcpy(overlay_header, log, LOG_HEADER);
+			auto	h	= (BaseBlock*)overlay_header;
+			h->sequence1 = h->sequence2 = sequence - 1;
+			h->bins_size = bins_size;
+			header	= h;
+			root	= h->root;
+		}
+		return applied;
+	}
+
+	// replays both logs, older first; either may be null
+	uint32_t	replay(const uint8_t *log1, size_t size1, const uint8_t *log2, size_t size2) {
+		auto	seq = [](const uint8_t *log, size_t size) {
+			return log && size >= LOG_HEADER ? ((const BaseBlock*)log)->sequence1 : 0;
+		};
+		if (seq(log2, size2) < seq(log1, size1)) {
+			auto t = log1; log1 = log2; log2 = t;
+			auto n = size1; size1 = size2; size2 = n;
+		}
+		uint32_t	applied = 0;
+		if (log1)
+			applied += replay(log1, size1);
+		if (log2)
+			applied += replay(log2, size2);
+		if (applied)
+			join_bins();
+		return applied;
+	}
+
+	// cells may cross pages inside a bin, so a bin with replaced pages is copied whole to keep it contiguous
+	void	join_bins() {
+		for (uint32_t o = 0; o < bins_size;) {
+			auto	first	= o / PAGE;
+			auto	size	= bin_size(o);
+			if (!size) {
+				o += PAGE;
+				continue;
+			}
+			uint32_t	n = size / PAGE, j = 1;
+			while (j < n && pages[first + j] == pages[first] + j * PAGE)
+				++j;
+			if (j < n) {
+				auto	bin = (uint8_t*)malloc(size);
+				for (j = 0; j < n; j++) {
+					memcpy(bin + j * PAGE, pages[first + j], PAGE);
+					pages[first + j] = bin + j * PAGE;
+				}
+				overlay.push() = bin;
+			}
+			o += size;
+		}
+	}
+
+	// size of the bin starting at offset, or 0 if there is no valid bin there (or a log left a page of it unwritten)
+	uint32_t	bin_size(uint32_t offset) const {
+		auto	first	= offset / PAGE;
+		auto	bin		= (const Bin*)pages[first];
+		if (!bin || memcmp(bin->signature, "hbin", 4) != 0 || bin->size < PAGE || bin->size % PAGE != 0 || bin->size > bins_size - offset)
+			return 0;
+		for (uint32_t i = 1; i < bin->size / PAGE; i++) {
+			if (!pages[first + i])
+				return 0;
+		}
+		return bin->size;
+	}
+	// the bytes at offset, if all size of them can be read in one piece; a cell in a bin join_bins passed over may not be
+	const uint8_t	*span(uint32_t offset, uint32_t size) const {
+		auto	first	= offset / PAGE;
+		auto	p		= pages[first];
+		if (!p)
+			return nullptr;
+		for (uint32_t i = first + 1; i <= (offset + size - 1) / PAGE; i++) {
+			if (pages[i] != p + (i - first) * PAGE)
+				return nullptr;
+		}
+		return p + offset % PAGE;
+	}
+
+	// calls f(offset, data, length, allocated) for every cell, allocated or free, in file order
+	template<typename F> void cells(F f) const {
+		for (uint32_t o = 0; o < bins_size;) {
+			auto	size = bin_size(o);
+			if (!size) {
+				o += PAGE;
+				continue;
+			}
+			auto	base = pages[o / PAGE];
+			for (uint32_t c = sizeof(Bin); c + 4 <= size;) {
+				auto		n	= (int32_t)get32(base + c);
+				uint32_t	len	= n < 0 ? 0u - n : n;
+				if (len < 8 || len > size - c)
+					break;
+				f(o + c, base + c + 4, len - 4, n < 0);
+				c += len;
+			}
+			o += size;
+		}
+	}
+	explicit operator bool() const { return num_pages && key(root); }
+
+	// data of an allocated cell, or nullptr
+	const uint8_t	*cell(uint32_t offset, uint32_t *length = nullptr) const {
+		if (offset >= bins_size || bins_size - offset < 8)
+			return nullptr;
+		auto	p		= span(offset, 4);
+		auto	size	= p ? -(int32_t)get32(p) : 0;
+		if (size < 8 || (uint32_t)size > bins_size - offset || !span(offset, size))
+			return nullptr;
+		if (length)
+			*length = size - 4;
+		return p + 4;
+	}
+	template<typename T> const T *get(uint32_t offset, const char *signature, uint32_t *length = nullptr) const {
+		uint32_t	len;
+		auto		p = cell(offset, &len);
+		if (!p || len < sizeof(T) || memcmp(p, signature, 2) != 0)
+			return nullptr;
+		if (length)
+			*length = len;
+		return (const T*)p;
+	}
+
+	// any cell, allocated or free, for looking into deleted data
+	const uint8_t	*raw_cell(uint32_t offset, uint32_t *length, bool *allocated = nullptr) const {
+		if (offset >= bins_size || bins_size - offset < 8)
+			return nullptr;
+		auto		p		= span(offset, 4);
+		if (!p)
+			return nullptr;
+		auto		size	= (int32_t)get32(p);
+		uint32_t	len		= size < 0 ? 0u - size : size;
+		if (len < 8 || len > bins_size - offset || !span(offset, len))
+			return nullptr;
+		*length = len - 4;
+		if (allocated)
+			*allocated = size < 0;
+		return p + 4;
+	}
+	template<typename T> const T *raw(uint32_t offset, const char *signature, bool *allocated = nullptr) const {
+		uint32_t	len;
+		auto		p = raw_cell(offset, &len, allocated);
+		return p && len >= sizeof(T) && memcmp(p, signature, 2) == 0 && sizeof(T) + ((const T*)p)->name_length <= len ? (const T*)p : nullptr;
+	}
+
+	const NK	*key(uint32_t offset) const {
+		uint32_t	len;
+		auto		k = get<NK>(offset, "nk", &len);
+		return k && sizeof(NK) + k->name_length <= len ? k : nullptr;
+	}
+	const VK	*value_cell(uint32_t offset) const {
+		uint32_t	len;
+		auto		v = get<VK>(offset, "vk", &len);
+		return v && sizeof(VK) + v->name_length <= len ? v : nullptr;
+	}
+
+	const uint8_t	*security(const NK *k, uint32_t &size) const {
+		uint32_t	len;
+		auto		sk = get<SK>(k->security, "sk", &len);
+		if (!sk || sk->size > len - sizeof(SK))
+			return nullptr;
+		size = sk->size;
+		return (const uint8_t*)(sk + 1);
+	}
+	// class name as UTF-16, n characters
+	const uint8_t	*class_name(const NK *k, uint32_t &n) const {
+		uint32_t	len;
+		auto		p = k->class_length ? cell(k->class_name, &len) : nullptr;
+		if (!p || k->class_length > len)
+			return nullptr;
+		n = k->class_length / 2;
+		return p;
+	}
+
+	static Name	name(const NK *k) {
+		bool	latin1 = !!(k->flags & KEY_COMP_NAME);
+		return {(const uint8_t*)(k + 1), latin1 ? k->name_length : k->name_length / 2u, latin1};
+	}
+	static Name	name(const VK *v) {
+		bool	latin1 = !!(v->flags & VALUE_COMP_NAME);
+		return {(const uint8_t*)(v + 1), latin1 ? v->name_length : v->name_length / 2u, latin1};
+	}
+
+	// entry i of a subkey list, going through an ri index; i is reduced by the entries skipped
+	uint32_t	list_entry(uint32_t list, uint32_t &i, bool nested = false) const {
+		uint32_t	len;
+		auto		p = cell(list, &len);
+		if (!p || len < 4)
+			return NONE;
+		uint32_t	count	= get16(p + 2);
+		if (p[0] == 'r' && p[1] == 'i') {
+			for (uint32_t j = 0; j < count && !nested && 8 + j * 4 <= len; j++) {
+				auto	r = list_entry(get32(p + 4 + j * 4), i, true);
+				if (r != NONE)
+					return r;
+			}
+			return NONE;
+		}
+		uint32_t	stride	= p[0] == 'l' && p[1] == 'i' ? 4 : p[0] == 'l' && (p[1] == 'f' || p[1] == 'h') ? 8 : 0;
+		if (!stride)
+			return NONE;
+		if (count > (len - 4) / stride)
+			count = (len - 4) / stride;
+		if (i >= count) {
+			i -= count;
+			return NONE;
+		}
+		return get32(p + 4 + i * stride);
+	}
+	// the entries a subkey list holds, through an ri index, counted as list_entry counts them
+	uint32_t	list_count(uint32_t list, bool nested = false) const {
+		uint32_t	len;
+		auto		p = cell(list, &len);
+		if (!p || len < 4)
+			return 0;
+		uint32_t	count	= get16(p + 2);
+		if (p[0] == 'r' && p[1] == 'i') {
+			uint32_t	total = 0;
+			for (uint32_t j = 0; j < count && !nested && 8 + j * 4 <= len; j++)
+				total += list_count(get32(p + 4 + j * 4), true);
+			return total;
+		}
+		uint32_t	stride	= p[0] == 'l' && p[1] == 'i' ? 4 : p[0] == 'l' && (p[1] == 'f' || p[1] == 'h') ? 8 : 0;
+		if (!stride)
+			return 0;
+		return count < (len - 4) / stride ? count : (len - 4) / stride;
+	}
+
+	// a key's counts, held to what its lists actually hold: a damaged key can claim billions
+	uint32_t	num_subkeys(const NK *k) const {
+		if (!k->num_subkeys)
+			return 0;
+		auto	n = list_count(k->subkeys);
+		return k->num_subkeys < n ? k->num_subkeys : n;
+	}
+	uint32_t	num_values(const NK *k) const {
+		uint32_t	len;
+		auto		list = k->num_values ? cell(k->values, &len) : nullptr;
+		if (!list)
+			return 0;
+		return k->num_values < len / 4 ? k->num_values : len / 4;
+	}
+
+	uint32_t	subkey(const NK *k, uint32_t i) const {
+		return i < k->num_subkeys ? list_entry(k->subkeys, i) : NONE;
+	}
+
+	// the subkey called s in one li, lf or lh leaf, bisected as the kernel does, since leaves are kept sorted by upcased name;
+	// when it is not there, side says whether s sorts before the whole leaf (< 0), after it (> 0) or within it
+	uint32_t	find_in_leaf(uint32_t list, const char16_t *s, size_t n, int &side) const {
+		uint32_t	len;
+		auto		p = cell(list, &len);
+		side = 0;
+		if (!p || len < 4)
+			return NONE;
+		uint32_t	stride	= p[0] == 'l' && p[1] == 'i' ? 4 : p[0] == 'l' && (p[1] == 'f' || p[1] == 'h') ? 8 : 0;
+		if (!stride)
+			return NONE;
+		uint32_t	count	= get16(p + 2);
+		if (count > (len - 4) / stride)
+			count = (len - 4) / stride;
+
+		uint32_t	a = 0, b = count;
+		while (a < b) {
+			auto	m	= (a + b) / 2;
+			auto	c	= get32(p + 4 + m * stride);
+			auto	sub	= key(c);
+			if (!sub)
+				return NONE;
+			auto	r	= name(sub).compare(s, n);
+			if (r == 0)
+				return c;
+			if (r < 0)
+				a = m + 1;
+			else
+				b = m;
+		}
+		side = a == count ? 1 : a == 0 ? -1 : 0;
+		return NONE;
+	}
+	uint32_t	find_subkey(const NK *k, const char16_t *s, size_t n) const {
+		uint32_t	len;
+		auto		p = k->num_subkeys ? cell(k->subkeys, &len) : nullptr;
+		if (!p || len < 4)
+			return NONE;
+		int		side;
+		if (!(p[0] == 'r' && p[1] == 'i'))
+			return find_in_leaf(k->subkeys, s, n, side);
+
+		// the leaves of an ri follow each other in order too
+		uint32_t	count = get16(p + 2);
+		for (uint32_t j = 0; j < count && 8 + j * 4 <= len; j++) {
+			auto	c = find_in_leaf(get32(p + 4 + j * 4), s, n, side);
+			if (c != NONE || side <= 0)
+				return c;
+		}
+		return NONE;
+	}
+
+	const VK	*value(const NK *k, uint32_t i) const {
+		uint32_t	len;
+		auto		list = i < k->num_values ? cell(k->values, &len) : nullptr;
+		return list && i < len / 4 ? value_cell(get32(list + i * 4)) : nullptr;
+	}
+	const VK	*find_value(const NK *k, const char16_t *s, size_t n) const {
+		for (uint32_t i = 0, count = num_values(k); i < count; i++) {
+			auto	v = value(k, i);
+			if (v && name(v).equals(s, n))
+				return v;
+		}
+		return nullptr;
+	}
+
+	static uint32_t	data_size(const VK *v) {
+		return v->size & ~DATA_INLINE;
+	}
+	// the most data the cells behind v can hold, to check data_size(v) against before making room for it
+	uint32_t	data_room(const VK *v) const {
+		if (v->size & DATA_INLINE)
+			return 4;
+		uint32_t	len;
+		auto		p = data_size(v) ? cell(v->data, &len) : nullptr;
+		if (!p)
+			return 0;
+		if (data_size(v) > BIG_DATA_SEGMENT && header->minor >= 4 && len >= sizeof(DB) && p[0] == 'd' && p[1] == 'b')
+			return ((const DB*)p)->count * BIG_DATA_SEGMENT;
+		return len;
+	}
+	// copies data_size(v) bytes to dest; false if the cells are damaged
+	bool	data(const VK *v, uint8_t *dest) const {
+		auto	size = data_size(v);
+		if (v->size & DATA_INLINE) {
+			if (size > 4)
+				return false;
+			memcpy(dest, &v->data, size);
+			return true;
+		}
+		if (!size)
+			return true;
+
+		uint32_t	len;
+		auto		p = cell(v->data, &len);
+		if (!p)
+			return false;
+
+		if (size > BIG_DATA_SEGMENT && header->minor >= 4 && len >= sizeof(DB) && p[0] == 'd' && p[1] == 'b') {
+			auto		db	= (const DB*)p;
+			uint32_t	list_len;
+			auto		list = cell(db->segments, &list_len);
+			uint32_t	done = 0;
+			for (uint32_t i = 0; list && i < db->count && (i + 1) * 4 <= list_len && done < size; i++) {
+				uint32_t	seg_len;
+				auto		seg		= cell(get32(list + i * 4), &seg_len);
+				uint32_t	chunk	= size - done < BIG_DATA_SEGMENT ? size - done : BIG_DATA_SEGMENT;
+				if (!seg || seg_len < chunk)
+					return false;
+				memcpy(dest + done, seg, chunk);
+				done += chunk;
+			}
+			return done == size;
+		}
+
+		if (len < size)
+			return false;
+		memcpy(dest, p, size);
+		return true;
+	}
+
+	// path below the root, components separated by '\'
+	uint32_t	lookup(const char16_t *path, size_t len) const {
+		auto	c	= root;
+		auto	end	= path + len;
+		while (c != NONE && path < end) {
+			auto	sep = path;
+			while (sep < end && *sep != '\\')
+				++sep;
+			if (sep > path) {
+				auto	k = key(c);
+				c = k ? find_subkey(k, path, sep - path) : NONE;
+			}
+			path = sep + 1;
+		}
+		return c;
+	}
+};
+
+//-----------------------------------------------------------------------------
+//	Writer
+//	builds a tree in memory, then writes it as a hive in two passes over the
+//	same cell order: the first places every cell, the second fills and streams
+//	them out a bin at a time. Keys are laid out breadth first, each followed
+//	by its subkey list, value list, value cells and data; security
+//	descriptors are shared, and come first
+//-----------------------------------------------------------------------------
+
+struct Writer {
+	static const uint32_t	MAX_LEAF	= 1012;		// entries in one lh list before an ri index is needed
+
+	struct Key {
+		uint32_t	parent;
+		uint32_t	name, name_length;		// pool offset, characters
+		uint32_t	hash;
+		uint32_t	values, last_value;		// singly linked, in the order set
+		uint32_t	security;
+		uint32_t	class_name, class_length;	// pool offset, characters
+		uint32_t	flags;						// KEY_NO_DELETE, KEY_SYM_LINK
+		uint64_t	last_write;
+		bool		removed;
+		// filled in by layout
+		uint32_t	cell, class_cell, list, leaves, value_list;
+		uint32_t	children, num_children, num_values;	// children index the breadth first order
+	};
+	struct Value {
+		uint32_t	next;
+		uint32_t	name, name_length;
+		uint32_t	type, size;
+		size_t		data;
+		bool		removed;
+		uint32_t	cell, data_cell, segments, pieces;	// big data: list cell, and where its pieces are in list_cells
+	};
+	struct Security {
+		size_t		data;
+		uint32_t	size, refs, cell;
+	};
+
+	uint8_t			*pool		= nullptr;
+	size_t			pool_size	= 0, pool_capacity = 0;
+	Array<Key>		keys;
+	Array<Value>	values;
+	Array<Security>	securities;
+	uint32_t		*sd_table	= nullptr;		// security index + 1 by hash of the descriptor
+	uint32_t		sd_table_size = 0;
+	uint32_t		*table		= nullptr;		// key index + 1 by (parent, name), open addressing
+	uint32_t		table_size	= 0, table_used = 0;
+	uint64_t		timestamp;
+
+	Array<uint32_t>	order;			// keys breadth first
+	Array<uint32_t>	list_cells;		// entries of ri indexes and big data lists, known after the first pass
+	uint32_t		bins_size	= 0;
+
+	// a descriptor granting full control to SYSTEM and Administrators and read to Everyone, inherited by subkeys
+	static const uint8_t *default_security(uint32_t &size) {
+		static const uint8_t sd[] = {
+			1, 0, 0x04, 0x80,	20, 0, 0, 0,	36, 0, 0, 0,	0, 0, 0, 0,		48, 0, 0, 0,
+			1, 2, 0, 0, 0, 0, 0, 5,		32, 0, 0, 0,	32, 2, 0, 0,		// owner: Administrators
+			1, 1, 0, 0, 0, 0, 0, 5,		18, 0, 0, 0,						// group: SYSTEM
+			2, 0, 72, 0, 3, 0, 0, 0,										// DACL
+			0, 2, 20, 0, 0x3f, 0, 0x0f, 0,	1, 1, 0, 0, 0, 0, 0, 5,		18, 0, 0, 0,
+			0, 2, 24, 0, 0x3f, 0, 0x0f, 0,	1, 2, 0, 0, 0, 0, 0, 5,		32, 0, 0, 0,	32, 2, 0, 0,
+			0, 2, 20, 0, 0x19, 0, 0x02, 0,	1, 1, 0, 0, 0, 0, 0, 1,		0, 0, 0, 0,
+		};
+		size = sizeof(sd);
+		return sd;
+	}
+
+	Writer(const char16_t *root_name, size_t n, uint64_t timestamp) : timestamp(timestamp) {
+		uint32_t	sd_size;
+		auto		sd = default_security(sd_size);
+		security(sd, sd_size);
+		add_key(NONE, root_name, n);
+	}
+	Writer(const Writer&) = delete;
+	~Writer() {
+		free(pool);
+		free(sd_table);
+		free(table);
+	}
+
+	// names are read back as char16_t, so everything is kept 2-byte aligned
+	size_t	store(const void *p, size_t n) {
+		pool_size = (pool_size + 1) & ~size_t(1);
+		if (pool_size + n > pool_capacity) {
+			pool_capacity	= (pool_size + n) * 2;
+			pool			= (uint8_t*)realloc(pool, pool_capacity);
+		}
+		memcpy(pool + pool_size, p, n);
+		pool_size += n;
+		return pool_size - n;
+	}
+	const char16_t	*chars(uint32_t name) const { return (const char16_t*)(pool + name); }
+
+	uint32_t	slot(uint32_t parent, uint32_t hash) const { return (parent * 0x9e3779b1u ^ hash) & (table_size - 1); }
+
+	uint32_t	add_key(uint32_t parent, const char16_t *name, size_t n) {
+		auto	&k		= keys.push();
+		memset(&k, 0, sizeof(k));
+		k.parent		= parent;
+		k.name			= (uint32_t)store(name, n * 2);
+		k.name_length	= (uint32_t)n;
+		k.hash			= name_hash(name, n);
+		k.values		= k.last_value = NONE;
+		k.last_write	= timestamp;
+		auto	i		= keys.n - 1;
+		if (parent != NONE) {
+			if ((table_used + 1) * 2 > table_size)
+				rehash();
+			auto	j = slot(parent, k.hash);
+			while (table[j])
+				j = (j + 1) & (table_size - 1);
+			table[j] = i + 1;
+			++table_used;
+		}
+		return i;
+	}
+	void	rehash() {
+		free(table);
+		table_size	= table_size ? table_size * 2 : 1024;
+		table		= (uint32_t*)calloc(table_size, sizeof(uint32_t));
+		for (uint32_t i = 1; i < keys.n; i++) {
+			auto	j = slot(keys[i].parent, keys[i].hash);
+			while (table[j])
+				j = (j + 1) & (table_size - 1);
+			table[j] = i + 1;
+		}
+	}
+
+	uint32_t	root() const { return 0; }
+
+	// the live subkey of parent with this name, or NONE
+	uint32_t	find_key(uint32_t parent, const char16_t *name, size_t n) const {
+		if (!table)
+			return NONE;
+		auto	hash = name_hash(name, n);
+		for (auto j = slot(parent, hash); table[j]; j = (j + 1) & (table_size - 1)) {
+			auto	&k = keys[table[j] - 1];
+			if (k.parent == parent && k.hash == hash && !k.removed && fold_compare(chars(k.name), k.name_length, name, n) == 0)
+				return table[j] - 1;
+		}
+		return NONE;
+	}
+	uint32_t	key(uint32_t parent, const char16_t *name, size_t n) {
+		auto	i = find_key(parent, name, n);
+		return i != NONE ? i : add_key(parent, name, n);
+	}
+	// path below the root, components separated by '\'; missing keys are created
+	uint32_t	path(const char16_t *p, size_t len) {
+		uint32_t	k	= root();
+		auto		end	= p + len;
+		while (p < end) {
+			auto	sep = p;
+			while (sep < end && *sep != '\\')
+				++sep;
+			if (sep > p)
+				k = key(k, p, sep - p);
+			p = sep + 1;
+		}
+		return k;
+	}
+	// a later key of the same name starts empty
+	void	remove_key(uint32_t k) {
+		if (k != root())
+			keys[k].removed = true;
+	}
+
+	void	set_value(uint32_t k, const char16_t *name, size_t n, uint32_t type, const void *data, uint32_t size) {
+		remove_value(k, name, n);
+		auto	&v		= values.push();
+		memset(&v, 0, sizeof(v));
+		v.next			= NONE;
+		v.name			= (uint32_t)store(name, n * 2);
+		v.name_length	= (uint32_t)n;
+		v.type			= type;
+		v.size			= size;
+		v.data			= store(data, size);
+		auto	i		= values.n - 1;
+		auto	&key	= keys[k];
+		if (key.last_value == NONE)
+			key.values = i;
+		else
+			values[key.last_value].next = i;
+		key.last_value = i;
+	}
+	void	remove_value(uint32_t k, const char16_t *name, size_t n) {
+		for (auto i = keys[k].values; i != NONE; i = values[i].next) {
+			auto	&v = values[i];
+			if (!v.removed && fold_compare(chars(v.name), v.name_length, name, n) == 0)
+				v.removed = true;
+		}
+	}
+
+	// identical descriptors share one cell
+	uint32_t	security(const void *sd, uint32_t size) {
+		if ((securities.n + 1) * 2 > sd_table_size) {
+			free(sd_table);
+			sd_table_size	= sd_table_size ? sd_table_size * 2 : 64;
+			sd_table		= (uint32_t*)calloc(sd_table_size, sizeof(uint32_t));
+			for (uint32_t i = 0; i < securities.n; i++) {
+				auto	j = uint32_t(marvin32(pool + securities[i].data, securities[i].size)) & (sd_table_size - 1);
+				while (sd_table[j])
+					j = (j + 1) & (sd_table_size - 1);
+				sd_table[j] = i + 1;
+			}
+		}
+		auto	j = uint32_t(marvin32((const uint8_t*)sd, size)) & (sd_table_size - 1);
+		for (; sd_table[j]; j = (j + 1) & (sd_table_size - 1)) {
+			auto	&s = securities[sd_table[j] - 1];
+			if (s.size == size && memcmp(pool + s.data, sd, size) == 0)
+				return sd_table[j] - 1;
+		}
+		auto	&s	= securities.push();
+		s.data		= store(sd, size);
+		s.size		= size;
+		s.refs		= 0;
+		sd_table[j]	= securities.n;
+		return securities.n - 1;
+	}
+	void	set_class(uint32_t k, const char16_t *name, size_t n) {
+		keys[k].class_name		= (uint32_t)store(name, n * 2);
+		keys[k].class_length	= (uint32_t)n;
+	}
+
+	//-------------------------------------------------------------------------
+	// layout
+	//-------------------------------------------------------------------------
+
+	static bool	latin1(const char16_t *s, uint32_t n) {
+		for (uint32_t i = 0; i < n; i++) {
+			if (s[i] > 0xff)
+				return false;
+		}
+		return true;
+	}
+	uint32_t	name_bytes(uint32_t name, uint32_t n) const { return latin1(chars(name), n) ? n : n * 2; }
+	void		put_name(uint8_t *dest, uint32_t name, uint32_t n) const {
+		auto	s = chars(name);
+		if (latin1(s, n)) {
+			for (uint32_t i = 0; i < n; i++)
+				dest[i] = uint8_t(s[i]);
+		} else {
+			memcpy(dest, s, n * 2);
+		}
+	}
+
+	bool	less(uint32_t a, uint32_t b) const {
+		return fold_compare(chars(keys[a].name), keys[a].name_length, chars(keys[b].name), keys[b].name_length) < 0;
+	}
+	void	sift(uint32_t *p, uint32_t i, uint32_t n) const {
+		for (uint32_t c; (c = i * 2 + 1) < n; i = c) {
+			if (c + 1 < n && less(p[c], p[c + 1]))
+				++c;
+			if (!less(p[i], p[c]))
+				break;
+			auto t = p[i]; p[i] = p[c]; p[c] = t;
+		}
+	}
+	void	sort(uint32_t *p, uint32_t n) const {
+		for (uint32_t i = n / 2; i--;)
+			sift(p, i, n);
+		while (n > 1) {
+			--n;
+			auto t = p[0]; p[0] = p[n]; p[n] = t;
+			sift(p, 0, n);
+		}
+	}
+
+	// breadth first order of the live keys, each key's children contiguous and sorted
+	void	order_keys() {
+		Array<uint32_t>	start, by_parent;
+		start.resize(keys.n + 1);
+		memset(start.p, 0, sizeof(uint32_t) * start.n);
+		for (uint32_t i = 1; i < keys.n; i++) {
+			if (!keys[i].removed)
+				++start[keys[i].parent + 1];
+		}
+		for (uint32_t i = 0; i < keys.n; i++)
+			start[i + 1] += start[i];
+		by_parent.resize(start[keys.n]);
+		for (uint32_t i = 1; i < keys.n; i++) {
+			if (!keys[i].removed)
+				by_parent[start[keys[i].parent]++] = i;
+		}
+		// start[k] now ends the children of k
+
+		order.n = 0;
+		order.push() = root();
+		for (uint32_t o = 0; o < order.n; o++) {
+			auto	k		= order[o];
+			auto	first	= k ? start[k - 1] : 0;
+			auto	n		= start[k] - first;
+			sort(by_parent.p + first, n);
+			keys[k].children		= order.n;
+			keys[k].num_children	= n;
+			for (uint32_t i = 0; i < n; i++)
+				order.push() = by_parent[first + i];
+		}
+	}
+
+	// places cells in hbins; in the second pass also fills and streams them
+	struct Bins {
+		FILE		*f		= nullptr;		// null while placing
+		uint8_t		*bin	= nullptr;
+		uint32_t	start	= 0, size = 0, used = 0;
+		uint64_t	timestamp;
+		bool		failed	= false;
+
+		Bins(FILE *f, uint64_t timestamp) : f(f), timestamp(timestamp) {}
+		~Bins() { free(bin); }
+
+		void	flush() {
+			if (!size)
+				return;
+			if (f) {
+				if (used < size) {
+					int32_t	free_size = size - used;
+					memcpy(bin + used, &free_size, 4);
+				}
+				failed |= fwrite(bin, 1, size, f) != size;
+			}
+			start	+= size;
+			size	= used = 0;
+		}
+		// cell of n data bytes; returns its offset, and sets p to where its data goes when writing
+		uint32_t	alloc(uint32_t n, uint8_t *&p) {
+			uint32_t	total = (n + 4 + 7) & ~7u;
+			if (used + total > size) {
+				flush();
+				size	= (total + sizeof(Bin) + PAGE - 1) & ~(PAGE - 1);
+				used	= sizeof(Bin);
+				if (f) {
+					bin = (uint8_t*)realloc(bin, size);
+					memset(bin, 0, size);
+					auto	h	= (Bin*)bin;
+					memcpy(h->signature, "hbin", 4);
+					h->offset	= start;
+					h->size		= size;
+					h->timestamp = timestamp;
+				}
+			}
+			auto	offset = start + used;
+			p = nullptr;
+			if (f) {
+				int32_t	cell_size = -(int32_t)total;
+				memcpy(bin + used, &cell_size, 4);
+				p = bin + used + 4;
+			}
+			used += total;
+			return offset;
+		}
+	};
+
+	void	place(Bins &b) {
+		uint8_t	*p;
+
+		// descriptors no key uses are left out of the circular list
+		uint32_t	first = NONE, last = NONE;
+		for (uint32_t i = 0; i < securities.n; i++) {
+			if (securities[i].refs) {
+				if (first == NONE)
+					first = i;
+				last = i;
+			}
+		}
+		for (uint32_t i = 0, prev = last; i < securities.n; i++) {
+			auto	&s	= securities[i];
+			if (!s.refs)
+				continue;
+			uint32_t	next = i + 1;
+			while (next < securities.n && !securities[next].refs)
+				++next;
+			s.cell		= b.alloc(sizeof(SK) + s.size, p);
+			if (p) {
+				auto	sk	= (SK*)p;
+				memcpy(sk->signature, "sk", 2);
+				sk->flink	= securities[next < securities.n ? next : first].cell;
+				sk->blink	= securities[prev].cell;
+				sk->refs	= s.refs;
+				sk->size	= s.size;
+				memcpy(sk + 1, pool + s.data, s.size);
+			}
+			prev = i;
+		}
+
+		for (uint32_t o = 0; o < order.n; o++) {
+			auto	&k		= keys[order[o]];
+			auto	bytes	= name_bytes(k.name, k.name_length);
+			k.cell			= b.alloc(sizeof(NK) + bytes, p);
+			if (p) {
+				auto	nk	= (NK*)p;
+				memcpy(nk->signature, "nk", 2);
+				nk->flags		= (o == 0 ? KEY_HIVE_ENTRY | KEY_NO_DELETE : 0) | (bytes == k.name_length ? KEY_COMP_NAME : 0) | (k.flags & (KEY_NO_DELETE | KEY_SYM_LINK));
+				nk->last_write	= k.last_write;
+				nk->parent		= o == 0 ? 0 : keys[k.parent].cell;
+				nk->num_subkeys	= k.num_children;
+				nk->subkeys		= k.num_children ? k.list : NONE;
+				nk->volatile_subkeys = NONE;
+				nk->num_values	= k.num_values;
+				nk->values		= k.num_values ? k.value_list : NONE;
+				nk->security	= securities[k.security].cell;
+				nk->class_name	= k.class_length ? k.class_cell : NONE;
+				nk->class_length = uint16_t(k.class_length * 2);
+				uint32_t	max_subkey = 0, max_class = 0, max_value = 0, max_data = 0;
+				for (uint32_t i = 0; i < k.num_children; i++) {
+					auto	&c = keys[order[k.children + i]];
+					if (c.name_length * 2 > max_subkey)
+						max_subkey = c.name_length * 2;
+					if (c.class_length * 2 > max_class)
+						max_class = c.class_length * 2;
+				}
+				for (auto i = k.values; i != NONE; i = values[i].next) {
+					auto	&v = values[i];
+					if (!v.removed) {
+						if (v.name_length * 2 > max_value)
+							max_value = v.name_length * 2;
+						if (v.size > max_data)
+							max_data = v.size;
+					}
+				}
+				nk->max_subkey	= max_subkey;
+				nk->max_class	= max_class;
+				nk->max_value	= max_value;
+				nk->max_data	= max_data;
+				nk->name_length	= uint16_t(bytes);
+				put_name((uint8_t*)(nk + 1), k.name, k.name_length);
+			}
+			if (k.class_length) {
+				k.class_cell = b.alloc(k.class_length * 2, p);
+				if (p)
+					memcpy(p, pool + k.class_name, k.class_length * 2);
+			}
+
+			// subkey list, split into leaves under an ri when long
+			if (auto n = k.num_children) {
+				auto	put_leaf = [&](uint32_t first, uint32_t count) {
+					auto	cell = b.alloc(4 + count * 8, p);
+					if (p) {
+						memcpy(p, "lh", 2);
+						memcpy(p + 2, &count, 2);
+						for (uint32_t i = 0; i < count; i++) {
+							auto	&c = keys[order[k.children + first + i]];
+							memcpy(p + 4 + i * 8, &c.cell, 4);
+							memcpy(p + 8 + i * 8, &c.hash, 4);
+						}
+					}
+					return cell;
+				};
+				if (n <= MAX_LEAF) {
+					k.list = put_leaf(0, n);
+				} else {
+					uint32_t	num_leaves = (n + MAX_LEAF - 1) / MAX_LEAF;
+					if (!b.f) {
+						k.leaves = list_cells.n;
+						for (uint32_t i = 0; i < num_leaves; i++)
+							list_cells.push();
+					}
+					k.list = b.alloc(4 + num_leaves * 4, p);
+					if (p) {
+						memcpy(p, "ri", 2);
+						memcpy(p + 2, &num_leaves, 2);
+						memcpy(p + 4, list_cells.p + k.leaves, num_leaves * 4);
+					}
+					for (uint32_t i = 0; i < num_leaves; i++) {
+						auto	first = i * MAX_LEAF;
+						list_cells[k.leaves + i] = put_leaf(first, n - first < MAX_LEAF ? n - first : MAX_LEAF);
+					}
+				}
+			}
+
+			// value list, then each value followed by its data
+			k.num_values = 0;
+			for (auto i = k.values; i != NONE; i = values[i].next)
+				k.num_values += !values[i].removed;
+			if (!k.num_values)
+				continue;
+
+			k.value_list	= b.alloc(k.num_values * 4, p);
+			if (p) {
+				uint32_t	j = 0;
+				for (auto i = k.values; i != NONE; i = values[i].next) {
+					if (!values[i].removed)
+						memcpy(p + j++ * 4, &values[i].cell, 4);
+				}
+			}
+			for (auto i = k.values; i != NONE; i = values[i].next) {
+				auto	&v = values[i];
+				if (v.removed)
+					continue;
+				auto	bytes	= name_bytes(v.name, v.name_length);
+				v.cell			= b.alloc(sizeof(VK) + bytes, p);
+				if (p) {
+					auto	vk	= (VK*)p;
+					memcpy(vk->signature, "vk", 2);
+					vk->name_length	= uint16_t(bytes);
+					vk->type		= v.type;
+					vk->flags		= bytes == v.name_length ? VALUE_COMP_NAME : 0;
+					if (v.size <= 4) {
+						vk->size	= v.size | DATA_INLINE;
+						memcpy(&vk->data, pool + v.data, v.size);
+					} else {
+						vk->size	= v.size;
+						vk->data	= v.data_cell;
+					}
+					put_name((uint8_t*)(vk + 1), v.name, v.name_length);
+				}
+				if (v.size <= 4)
+					continue;
+
+				if (v.size <= BIG_DATA_SEGMENT) {
+					v.data_cell = b.alloc(v.size, p);
+					if (p)
+						memcpy(p, pool + v.data, v.size);
+					continue;
+				}
+
+				// big data: db cell, the list of its pieces, then the pieces
+				uint32_t	count = (v.size + BIG_DATA_SEGMENT - 1) / BIG_DATA_SEGMENT;
+				v.data_cell = b.alloc(sizeof(DB), p);
+				if (p) {
+					auto	db	= (DB*)p;
+					memcpy(db->signature, "db", 2);
+					db->count		= uint16_t(count);
+					db->segments	= v.segments;
+				}
+				if (!b.f) {
+					v.pieces = list_cells.n;
+					for (uint32_t s = 0; s < count; s++)
+						list_cells.push();
+				}
+				v.segments	= b.alloc(count * 4, p);
+				if (p)
+					memcpy(p, list_cells.p + v.pieces, count * 4);
+				for (uint32_t s = 0; s < count; s++) {
+					uint32_t	done	= s * BIG_DATA_SEGMENT;
+					uint32_t	chunk	= v.size - done < BIG_DATA_SEGMENT ? v.size - done : BIG_DATA_SEGMENT;
+					list_cells[v.pieces + s] = b.alloc(chunk, p);
+					if (p)
+						memcpy(p, pool + v.data + done, chunk);
+				}
+			}
+		}
+		b.flush();
+	}
+
+	// returns false if the file could not be written
+	bool	write(FILE *f, const char16_t *file_name = nullptr) {
+		order_keys();
+		list_cells.n = 0;
+		for (uint32_t i = 0; i < securities.n; i++)
+			securities[i].refs = 0;
+		for (uint32_t o = 0; o < order.n; o++)
+			++securities[keys[order[o]].security].refs;
+
+		Bins	placing(nullptr, timestamp);
+		place(placing);
+		bins_size = placing.start;
+
+		BaseBlock	base;
+		uint8_t		block[BASE_BLOCK] = {0};
+		memset(&base, 0, sizeof(base));
+		memcpy(base.signature, "regf", 4);
+		base.sequence1	= base.sequence2 = 1;
+		base.last_write	= timestamp;
+		base.major		= 1;
+		base.minor		= 5;
+		base.format		= 1;
+		base.root		= keys[root()].cell;
+		base.bins_size	= bins_size;
+		base.clustering	= 1;
+		for (int i = 0; file_name && file_name[i] && i < 31; i++)
+			base.name[i] = file_name[i];
+		base.checksum	= checksum(&base);
+		memcpy(block, &base, sizeof(base));
+		if (fwrite(block, 1, BASE_BLOCK, f) != BASE_BLOCK)
+			return false;
+
+		Bins	writing(f, timestamp);
+		place(writing);
+		return !writing.failed;
+	}
+};
+
+//-----------------------------------------------------------------------------
+//	Search
+//	finds any of a set of patterns in raw bytes, as Latin-1 and as UTF-16LE;
+//	memchr on the first character (in both cases) skips ahead, so the C
+//	runtime's vectorised search sets the pace
+//-----------------------------------------------------------------------------
+
+struct Search {
+	struct Pattern {
+		const char16_t	*s;		// kept by the caller
+		uint32_t		n;
+		bool			latin1;
+	};
+	Array<Pattern>	patterns;
+	bool			case_sensitive	= false;
+
+	void	add(const char16_t *s, uint32_t n) {
+		if (!n)
+			return;
+		bool	latin1 = true;
+		for (uint32_t i = 0; i < n; i++)
+			latin1 &= s[i] <= 0xff;
+		patterns.push() = {s, n, latin1};
+	}
+
+	bool	equal(uint32_t a, uint32_t b) const { return a == b || (!case_sensitive && fold(a) == fold(b)); }
+
+	bool	at(const Pattern &pat, const uint8_t *q, int width) const {
+		for (uint32_t i = 0; i < pat.n; i++) {
+			if (!equal(width == 1 ? q[i] : get16(q + i * 2), pat.s[i]))
+				return false;
+		}
+		return true;
+	}
+
+	// characters are width bytes apart
+	bool	find(const Pattern &pat, const uint8_t *p, size_t n, int width) const {
+		if (size_t(pat.n) * width > n)
+			return false;
+		size_t	starts	= n - size_t(pat.n) * width + 1;
+		auto	end		= p + starts;
+		auto	c		= pat.s[0];
+		uint8_t	a		= uint8_t(case_sensitive ? c : fold(c));
+		uint8_t	b		= uint8_t(case_sensitive ? c : Common::unfold(c));
+		auto	next	= [end](const uint8_t *from, uint8_t ch) { return (const uint8_t*)memchr(from, ch, end - from); };
+		auto	qa		= next(p, a);
+		auto	qb		= a == b ? nullptr : next(p, b);
+		while (qa || qb) {
+			auto	q = !qb || (qa && qa < qb) ? qa : qb;
+			if (at(pat, q, width))
+				return true;
+			if (q == qa)
+				qa = q + 1 < end ? next(q + 1, a) : nullptr;
+			else
+				qb = q + 1 < end ? next(q + 1, b) : nullptr;
+		}
+		return false;
+	}
+
+	// index of the first pattern found, or -1
+	int		match(const uint8_t *p, size_t n) const {
+		for (uint32_t i = 0; i < patterns.n; i++) {
+			auto	&pat = patterns[i];
+			if ((pat.latin1 && find(pat, p, n, 1)) || find(pat, p, n, 2))
+				return i;
+		}
+		return -1;
+	}
+};
+
+//-----------------------------------------------------------------------------
+//	Scan
+//	searches every cell in file order, free ones included, without walking
+//	the tree; afterwards matches in value cells and data are tied to their
+//	keys through the value lists of every nk cell seen, and keys to their
+//	paths through parent offsets
+//-----------------------------------------------------------------------------
+
+struct Scan {
+	enum KIND : uint8_t { KEY_NAME, VALUE_NAME, DATA, OTHER };
+	struct Match {
+		uint32_t	cell;
+		uint32_t	key, value;		// NONE when not known
+		int			pattern;
+		KIND		kind;
+		bool		deleted;		// some cell involved is free
+	};
+
+	const Reader	&r;
+	Array<Match>	matches;
+	Array<uint32_t>	keys;			// every nk cell, free or not
+
+	Scan(const Reader &r, const Search &search) : r(r) {
+		r.cells([&](uint32_t offset, const uint8_t *p, uint32_t len, bool allocated) {
+			bool	nk = len >= sizeof(NK) && p[0] == 'n' && p[1] == 'k';
+			if (nk)
+				keys.push() = offset;
+			int		i = search.match(p, len);
+			if (i >= 0) {
+				KIND	kind = nk ? KEY_NAME : len >= sizeof(VK) && p[0] == 'v' && p[1] == 'k' ? VALUE_NAME : OTHER;
+				matches.push() = {offset, kind == KEY_NAME ? offset : NONE, kind == VALUE_NAME ? offset : NONE, i, kind, !allocated};
+			}
+		});
+		if (matches.n)
+			resolve();
+	}
+
+	// which matches lie in the values of which keys
+	void	resolve() {
+		uint32_t	size = 64;
+		while (size < matches.n * 2)
+			size *= 2;
+		auto	table = (uint32_t*)calloc(size, sizeof(uint32_t));		// match index + 1 by cell
+		auto	slot = [size](uint32_t cell) { return (cell * 0x9e3779b1u) & (size - 1); };
+		for (uint32_t i = 0; i < matches.n; i++) {
+			auto	j = slot(matches[i].cell);
+			while (table[j])
+				j = (j + 1) & (size - 1);
+			table[j] = i + 1;
+		}
+		auto	claim = [&](uint32_t cell, uint32_t key, uint32_t value, bool deleted) {
+			for (auto j = slot(cell); table[j]; j = (j + 1) & (size - 1)) {
+				auto	&m = matches[table[j] - 1];
+				if (m.cell == cell && m.key == NONE) {
+					m.key		= key;
+					m.value		= value;
+					m.kind		= m.kind == OTHER ? DATA : m.kind;
+					m.deleted	|= deleted;
+				}
+			}
+		};
+
+		// live keys get first claim, then deleted ones
+		for (uint32_t i = 0, pass = 0; pass < 2; i = 0, pass++) for (; i < keys.n; i++) {
+			bool		key_live;
+			auto		k = r.raw<NK>(keys[i], "nk", &key_live);
+			if (!k || key_live == !!pass)
+				continue;
+			uint32_t	len;
+			bool		list_live;
+			auto		list = k && k->num_values ? r.raw_cell(k->values, &len, &list_live) : nullptr;
+			for (uint32_t v = 0; list && v < k->num_values && v < len / 4; v++) {
+				bool	value_live;
+				auto	offset	= get32(list + v * 4);
+				auto	vk		= r.raw<VK>(offset, "vk", &value_live);
+				if (!vk)
+					continue;
+				bool	deleted = !key_live || !list_live || !value_live;
+				claim(offset, keys[i], offset, deleted);
+				if (vk->size & DATA_INLINE)
+					continue;
+
+				claim(vk->data, keys[i], offset, deleted);
+				uint32_t	db_len, seg_len;
+				auto		db = r.data_size(vk) > BIG_DATA_SEGMENT ? r.raw_cell(vk->data, &db_len) : nullptr;
+				if (db && db_len >= sizeof(DB) && db[0] == 'd' && db[1] == 'b') {
+					auto	segments = r.raw_cell(((const DB*)db)->segments, &seg_len);
+					for (uint32_t s = 0; segments && s < ((const DB*)db)->count && (s + 1) * 4 <= seg_len; s++)
+						claim(get32(segments + s * 4), keys[i], offset, deleted);
+				}
+			}
+		}
+		free(table);
+	}
+
+	// path of a key below the root, written to dest (up to size characters); returns its length
+	// a chain that does not reach the root is shown starting with "?"
+	uint32_t	path(uint32_t key, char16_t *dest, uint32_t size, bool &deleted) const {
+		uint32_t	chain[512], n = 0;
+		bool		rooted = false;
+		for (auto c = key; c != NONE && n < 512;) {
+			bool	live;
+			auto	k = r.raw<NK>(c, "nk", &live);
+			if (!k)
+				break;
+			deleted |= !live;
+			if (k->flags & KEY_HIVE_ENTRY) {
+				rooted = true;
+				break;
+			}
+			chain[n++] = c;
+			c = k->parent;
+		}
+
+		uint32_t	len = 0;
+		auto		put = [&](char16_t c) {
+			if (len < size)
+				dest[len] = c;
+			++len;
+		};
+		if (!rooted) {
+			put('?');
+			if (n)
+				put('\\');
+		}
+		while (n--) {
+			auto	name = Reader::name(r.raw<NK>(chain[n], "nk"));
+			for (uint32_t i = 0; i < name.length; i++)
+				put(name[i]);
+			if (n)
+				put('\\');
+		}
+		return len < size ? len : size;
+	}
+};
+
+//-----------------------------------------------------------------------------
+//	Layout
+//	how well a hive is packed: slack in free cells, and how many 4K pages
+//	are touched to read each key (nk, class, lists, value cells and data,
+//	in that order; consecutive cells on one page count once)
+//-----------------------------------------------------------------------------
+
+struct Layout {
+	uint64_t	file_size	= 0;
+	uint32_t	bins_size	= 0;
+	uint64_t	used		= 0, free = 0;		// bytes in allocated and free cells
+	uint32_t	keys		= 0;
+	uint64_t	key_pages	= 0;
+
+	Layout(const Reader &r, uint64_t file_size) : file_size(file_size), bins_size(r.bins_size) {
+		r.cells([this](uint32_t, const uint8_t*, uint32_t len, bool allocated) {
+			(allocated ? used : free) += len + 4;
+		});
+
+		Array<uint32_t>	queue;
+		queue.push() = r.root;
+		for (uint32_t q = 0; q < queue.n; q++) {
+			auto	k = r.key(queue[q]);
+			if (!k)
+				continue;
+			uint32_t	page = NONE;
+			auto		touch = [&](uint32_t offset) {
+				if (offset != NONE && offset / PAGE != page) {
+					page = offset / PAGE;
+					++key_pages;
+				}
+			};
+			++keys;
+			touch(queue[q]);
+			if (k->class_length)
+				touch(k->class_name);
+			if (k->num_subkeys)
+				touch(k->subkeys);
+			if (k->num_values)
+				touch(k->values);
+			uint32_t	len;
+			auto		list = r.num_values(k) ? r.cell(k->values, &len) : nullptr;
+			for (uint32_t i = 0, count = list ? r.num_values(k) : 0; i < count; i++) {
+				touch(get32(list + i * 4));
+				if (auto v = r.value(k, i)) {
+					if (!(v->size & DATA_INLINE) && r.data_size(v))
+						touch(v->data);
+				}
+			}
+			// as many entries as the list holds, whatever the key claims, and no more keys than fit, in case of a cycle
+			for (uint32_t i = 0, count = r.num_subkeys(k); i < count && queue.n < bins_size / 80; i++) {
+				auto	c = r.subkey(k, i);
+				if (c != NONE)
+					queue.push() = c;
+			}
+		}
+	}
+	double	pages_per_key() const { return keys ? double(key_pages) / keys : 0; }
+};
+
+} // namespace Hive
@@ -0,0 +1,244 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reg-common.h"
+
+//-----------------------------------------------------------------------------
+//	Index
+//	trigrams of each key's value names and data strings, kept between runs of QUERY /f
+//	so keys that cannot hold the pattern are never read
+//	file layout:
+//		"REGI"
+//		uint32 length, char16 separator[length]		(data strings depend on it)
+//		records, each followed by the records of its subkeys:
+//		{ uint64 last_write, uint32 next, uint32 flags, uint32 length, uint32 count, char16 name[length], uint32 trigrams[count] }
+//	next is the offset, from the first record, just past the record's subtree
+//	trigrams are hashes of case-folded character triples, sorted and unique
+//-----------------------------------------------------------------------------
+
+namespace Index {
+
+static const uint8_t	magic[4]	= {'R', 'E', 'G', 'I'};
+static const size_t		FIXED		= 8 + 4 * 4;
+static const uint32_t	MAX_TRIGRAMS = 1 << 14;		// beyond this a key is always read
+static const size_t		NONE		= ~size_t(0);
+
+enum {
+	SUBKEYS		= 1,	// the key's subkeys follow it
+	ALL			= 2,	// too many trigrams were found, so every pattern may match
+};
+
+using Common::get32;
+
+inline uint32_t trigram(char16_t a, char16_t b, char16_t c) {
+	uint64_t	v = (uint64_t(a) << 32) | (uint32_t(b) << 16) | c;
+	return uint32_t((v * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+//-----------------------------------------------------------------------------
+//	Trigrams
+//	callers fold case before adding, the same way for keys and patterns
+//-----------------------------------------------------------------------------
+
+struct Trigrams {
+	uint32_t	*p	= nullptr;
+	uint32_t	n	= 0, capacity = 0;
+	bool		all	= false;
+
+	Trigrams() {}
+	Trigrams(const Trigrams&) = delete;
+	~Trigrams() { free(p); }
+
+	void	add(uint32_t t) {
+		if (all)
+			return;
+		if (n == capacity) {
+			if (capacity == MAX_TRIGRAMS * 2) {
+				// duplicates are only dropped by finish, so try that before giving up
+				finish();
+				if (all)
+					return;
+			} else {
+				capacity	= capacity ? capacity * 2 : 64;
+				p			= (uint32_t*)realloc(p, capacity * sizeof(uint32_t));
+			}
+		}
+		p[n++] = t;
+	}
+	void	add(const char16_t *s, size_t len) {
+		for (size_t i = 2; i < len; i++)
+			add(trigram(s[i - 2], s[i - 1], s[i]));
+	}
+
+	// sort and drop duplicates
+	void	finish() {
+		qsort(p, n, sizeof(uint32_t), [](const void *a, const void *b) {
+			auto	x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+			return x < y ? -1 : x > y ? 1 : 0;
+		});
+		uint32_t	j = 0;
+		for (uint32_t i = 0; i < n; i++) {
+			if (j == 0 || p[i] != p[j - 1])
+				p[j++] = p[i];
+		}
+		n = j;
+		if (n > MAX_TRIGRAMS) {
+			all = true;
+			n	= 0;
+		}
+	}
+};
+
+//-----------------------------------------------------------------------------
+//	File
+//	a previous index, read whole into memory
+//-----------------------------------------------------------------------------
+
+struct Record {
+	size_t			offset, next;
+	uint64_t		last_write;
+	uint32_t		flags, length, count;
+	const char16_t	*name;
+	const uint8_t	*trigrams;
+
+	size_t	end()		const { return offset + FIXED + length * 2 + count * 4; }	// first subkey, if any
+	bool	same_name(const char16_t *s, size_t n) const { return length == n && memcmp(name, s, n * 2) == 0; }
+
+	// could the key hold every one of the (sorted) trigrams?
+	bool	contains(const Trigrams &t) const {
+		if (flags & ALL)
+			return true;
+		uint32_t	lo = 0;
+		for (uint32_t i = 0; i < t.n; i++) {
+			uint32_t	hi = count;
+			while (lo < hi) {
+				auto	mid = (lo + hi) / 2;
+				if (get32(trigrams + mid * 4) < t.p[i])
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			if (lo == count || get32(trigrams + lo * 4) != t.p[i])
+				return false;
+		}
+		return true;
+	}
+};
+
+struct File {
+	uint8_t		*data		= nullptr;
+	size_t		size		= 0;
+	size_t		records		= 0;		// file offset of the first record
+
+	File() {}
+	File(const File&) = delete;
+	~File() { free(data); }
+
+	// a missing, malformed or differently separated file just leaves the index empty
+	bool	load(FILE *f, const char16_t *sep, uint32_t sep_length) {
+		fseek(f, 0, SEEK_END);
+		auto	n = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		if (n < (long)sizeof(magic) + 4 || n >= 0x7fffffff)
+			return false;
+		data	= (uint8_t*)malloc(n);
+		size	= fread(data, 1, n, f);
+		if (size < sizeof(magic) + 4 || memcmp(data, magic, sizeof(magic)) != 0
+		||	get32(data + 4) != sep_length || 8 + sep_length * 2 > size || memcmp(data + 8, sep, sep_length * 2) != 0
+		) {
+			size = 0;
+			return false;
+		}
+		records = 8 + sep_length * 2;
+		return true;
+	}
+
+	bool	get(size_t offset, Record &r) const {
+		if (offset == NONE || records + offset + FIXED > size)
+			return false;
+		auto	p = data + records + offset;
+		memcpy(&r.last_write, p, 8);
+		r.offset	= offset;
+		r.next		= get32(p + 8);
+		r.flags		= get32(p + 12);
+		r.length	= get32(p + 16);
+		r.count		= get32(p + 20);
+		r.name		= (const char16_t*)(p + FIXED);
+		r.trigrams	= p + FIXED + r.length * 2;
+		return r.length < 0x10000 && r.count <= MAX_TRIGRAMS && r.end() <= r.next && records + r.next <= size;
+	}
+
+	// subkey of parent called s, starting from cursor (just past the last one found) as subkeys usually come in the same order
+	size_t	find(const Record &parent, size_t &cursor, const char16_t *s, size_t n) const {
+		if (!(parent.flags & SUBKEYS))
+			return NONE;
+		Record	r;
+		for (int pass = 0; pass < 2; pass++) {
+			auto	start	= pass ? parent.end() : cursor;
+			auto	stop	= pass ? cursor : parent.next;
+			for (auto i = start; i < stop && get(i, r); i = r.next) {
+				if (r.same_name(s, n)) {
+					cursor = r.next;
+					return i;
+				}
+			}
+		}
+		return NONE;
+	}
+};
+
+//-----------------------------------------------------------------------------
+//	Builder
+//	a new index, written depth first as the tree is walked
+//-----------------------------------------------------------------------------
+
+struct Builder {
+	uint8_t		*p		= nullptr;
+	size_t		size	= 0, capacity = 0;
+
+	Builder() {}
+	Builder(const Builder&) = delete;
+	~Builder() { free(p); }
+
+	uint8_t	*alloc(size_t n) {
+		if (size + n > capacity) {
+			while (size + n > capacity)
+				capacity = capacity ? capacity * 2 : 1 << 16;
+			p = (uint8_t*)realloc(p, capacity);
+		}
+		auto	r = p + size;
+		size += n;
+		return r;
+	}
+
+	// returns the record's offset, to be passed to end once its subkeys are written
+	size_t	begin(uint64_t last_write, uint32_t flags, const char16_t *name, uint32_t length, const uint8_t *trigrams, uint32_t count) {
+		auto		offset	= size;
+		auto		d		= alloc(FIXED + length * 2 + count * 4);
+		uint32_t	fixed[4] = {0, flags, length, count};
+		memcpy(d, &last_write, 8);
+		memcpy(d + 8, fixed, sizeof(fixed));
+		memcpy(d + FIXED, name, length * 2);
+		if (count)
+			memcpy(d + FIXED + length * 2, trigrams, count * 4);
+		return offset;
+	}
+	size_t	begin(uint64_t last_write, uint32_t flags, const char16_t *name, uint32_t length, const Trigrams &t) {
+		return begin(last_write, flags | (t.all ? ALL : 0), name, length, (const uint8_t*)t.p, t.n);
+	}
+	void	end(size_t offset) {
+		uint32_t	next = (uint32_t)size;
+		memcpy(p + offset + 8, &next, 4);
+	}
+
+	bool	write(FILE *f, const char16_t *sep, uint32_t sep_length) const {
+		return fwrite(magic, 1, sizeof(magic), f) == sizeof(magic)
+			&& fwrite(&sep_length, 4, 1, f) == 1
+			&& fwrite(sep, 2, sep_length, f) == sep_length
+			&& fwrite(p, 1, size, f) == size;
+	}
+};
+
+} // namespace Index
@@ -0,0 +1,283 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//-----------------------------------------------------------------------------
+//	LZ
+//	LZ4 block format compressor, independent blocks so memory stays bounded
+//	stream layout:
+//		"REGZ"
+//		{ uint32 packed, uint32 raw, data[packed & ~STORED] }...
+//		uint32 0
+//	a block with STORED set in packed is kept uncompressed
+//-----------------------------------------------------------------------------
+
+namespace LZ {
+
+static const uint8_t	magic[4]	= {'R', 'E', 'G', 'Z'};
+static const uint32_t	BLOCK		= 1 << 18;
+static const uint32_t	STORED		= 1u << 31;
+static const int		MIN_MATCH	= 4;
+static const int		MF_LIMIT	= 12;	// no match may start within this many bytes of the end
+static const int		LAST_LITERALS = 5;	// the last bytes are always literals
+static const int		HASH_BITS	= 14;
+static const uint32_t	MAX_OFFSET	= 65535;
+
+inline uint32_t	read32(const uint8_t *p)	{ uint32_t v; memcpy(&v, p, 4); return v; }
+inline uint32_t	hash(uint32_t v)			{ return (v * 2654435761u) >> (32 - HASH_BITS); }
+inline size_t	bound(size_t n)				{ return n + n / 255 + 16; }
+
+inline uint8_t *put_length(uint8_t *d, size_t n) {
+	for (; n >= 255; n -= 255)
+		*d++ = 255;
+	*d++ = (uint8_t)n;
+	return d;
+}
+
+inline uint8_t *put_sequence(uint8_t *d, const uint8_t *literals, size_t num_literals, uint32_t offset, size_t match) {
+	auto	token = d++;
+	*token	= uint8_t((num_literals < 15 ? num_literals : 15) << 4);
+	if (num_literals >= 15)
+		d = put_length(d, num_literals - 15);
+	memcpy(d, literals, num_literals);
+	d += num_literals;
+
+	if (match) {
+		*d++	= uint8_t(offset);
+		*d++	= uint8_t(offset >> 8);
+		match	-= MIN_MATCH;
+		*token	|= match < 15 ? match : 15;
+		if (match >= 15)
+			d = put_length(d, match - 15);
+	}
+	return d;
+}
+
+// dst must hold bound(n) bytes; table must hold 1 << HASH_BITS entries
+inline size_t compress(const uint8_t *src, size_t n, uint8_t *dst, uint32_t *table) {
+	auto	d		= dst;
+	size_t	anchor	= 0;
+
+	if (n > MF_LIMIT) {
+		memset(table, 0, sizeof(uint32_t) << HASH_BITS);
+		size_t	limit		= n - MF_LIMIT;
+		size_t	match_limit	= n - LAST_LITERALS;
+
+		for (size_t ip = 0; ip < limit;) {
+			auto	seq	= read32(src + ip);
+			auto	h	= hash(seq);
+			size_t	ref	= table[h];
+			table[h]	= (uint32_t)ip;
+
+			if (ref < ip && ip - ref <= MAX_OFFSET && read32(src + ref) == seq) {
+				while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+					--ip;
+					--ref;
+				}
+				size_t	len = MIN_MATCH;
+				while (ip + len < match_limit && src[ip + len] == src[ref + len])
+					++len;
+
+				d		= put_sequence(d, src + anchor, ip - anchor, uint32_t(ip - ref), len);
+				ip		+= len;
+				anchor	= ip;
+			} else {
+				ip += 1 + ((ip - anchor) >> 6);	// step faster through incompressible data
+			}
+		}
+	}
+	d = put_sequence(d, src + anchor, n - anchor, 0, 0);
+	return d - dst;
+}
+
+// returns decompressed size, or -1 on malformed input
+inline intptr_t decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t capacity) {
+	auto	s		= src, se = src + n;
+	auto	d		= dst, de = dst + capacity;
+
+	auto	get_length = [&](size_t len) -> size_t {
+		if (len == 15) {
+			uint8_t	b;
+			do {
+				if (s == se)
+					return ~size_t(0);
+				len += b = *s++;
+			} while (b == 255);
+		}
+		return len;
+	};
+
+	while (s < se) {
+		auto	token	= *s++;
+		auto	lits	= get_length(token >> 4);
+		if (lits > size_t(se - s) || lits > size_t(de - d))
+			return -1;
+		memcpy(d, s, lits);
+		d += lits;
+		s += lits;
+		if (s == se)
+			break;
+
+		if (se - s < 2)
+			return -1;
+		size_t	offset	= s[0] | (s[1] << 8);
+		s += 2;
+		auto	len		= get_length(token & 15);
+		if (len == ~size_t(0) || offset == 0 || offset > size_t(d - dst) || len + MIN_MATCH > size_t(de - d))
+			return -1;
+
+		// overlapping matches repeat the last offset bytes, so copy those forwards a byte at a time
+		auto	m = d - offset;
+		len += MIN_MATCH;
+		if (offset >= len) {
+			memcpy(d, m, len);
+			d += len;
+		} else {
+			while (len--)
+				*d++ = *m++;
+		}
+	}
+	return d - dst;
+}
+
+//-----------------------------------------------------------------------------
+//	streams
+//-----------------------------------------------------------------------------
+
+struct WriteStream {
+	FILE		*h;
+	uint8_t		*in, *out;
+	uint32_t	*table;
+	size_t		used	= 0;
+	uint64_t	raw		= 0, packed = 0;
+
+	// header is false when appending blocks to an existing stream
+	WriteStream(FILE *h, bool header = true) : h(h),
+		in((uint8_t*)malloc(BLOCK)),
+		out((uint8_t*)malloc(bound(BLOCK))),
+		table((uint32_t*)malloc(sizeof(uint32_t) << HASH_BITS)) {
+		if (header) {
+			fwrite(magic, 1, sizeof(magic), h);
+			packed = sizeof(magic);
+		}
+	}
+	~WriteStream() {
+		finish();
+		free(in);
+		free(out);
+		free(table);
+	}
+
+	void	put(const void *p, size_t n) {
+		auto	b = (const uint8_t*)p;
+		while (n) {
+			size_t	chunk = BLOCK - used < n ? BLOCK - used : n;
+			memcpy(in + used, b, chunk);
+			used	+= chunk;
+			b		+= chunk;
+			n		-= chunk;
+			if (used == BLOCK)
+				flush_block();
+		}
+	}
+	void	put(uint8_t b) {
+		in[used++] = b;
+		if (used == BLOCK)
+			flush_block();
+	}
+
+	void	flush_block() {
+		if (!used)
+			return;
+		auto		size	= compress(in, used, out, table);
+		uint32_t	header[2];
+		if (size < used) {
+			header[0] = (uint32_t)size;
+			header[1] = (uint32_t)used;
+			fwrite(header, sizeof(header), 1, h);
+			fwrite(out, 1, size, h);
+		} else {
+			size		= used;
+			header[0]	= (uint32_t)used | STORED;
+			header[1]	= (uint32_t)used;
+			fwrite(header, sizeof(header), 1, h);
+			fwrite(in, 1, used, h);
+		}
+		raw		+= used;
+		packed	+= sizeof(header) + size;
+		used	= 0;
+	}
+
+	void	finish() {
+		if (h) {
+			flush_block();
+			uint32_t	end = 0;
+			fwrite(&end, sizeof(end), 1, h);
+			packed += sizeof(end);
+			h = nullptr;
+		}
+	}
+};
+
+struct ReadStream {
+	FILE		*h;
+	uint8_t		*in, *out;
+	size_t		pos = 0, size = 0;
+	bool		done = false, error = false;
+
+	// h must be positioned just after the magic
+	ReadStream(FILE *h) : h(h), in((uint8_t*)malloc(bound(BLOCK))), out((uint8_t*)malloc(BLOCK)) {}
+	~ReadStream() {
+		free(in);
+		free(out);
+	}
+
+	static bool	check_magic(const uint8_t *p) { return memcmp(p, magic, sizeof(magic)) == 0; }
+
+	// the stream must end with the zero trailer; running out of file first means it was cut short
+	bool	next_block() {
+		if (done)
+			return false;
+		uint32_t	header[2];
+		if (fread(header, sizeof(header[0]), 1, h) != 1 || (header[0] && fread(header + 1, sizeof(header[1]), 1, h) != 1)) {
+			done = error = true;
+			return false;
+		}
+		if (header[0] == 0) {
+			done = true;
+			return false;
+		}
+		auto	packed	= header[0] & ~STORED;
+		auto	raw		= header[1];
+		if (packed > bound(BLOCK) || raw > BLOCK || ((header[0] & STORED) && packed != raw) || fread(in, 1, packed, h) != packed) {
+			done = error = true;
+			return false;
+		}
+		if (header[0] & STORED) {
+			memcpy(out, in, packed);
+			size = packed;
+		} else {
+			auto	n = decompress(in, packed, out, BLOCK);
+			if (n != (intptr_t)raw) {
+				done = error = true;
+				return false;
+			}
+			size = n;
+		}
+		pos = 0;
+		return true;
+	}
+
+	int		getb() {
+		if (pos == size && !next_block())
+			return -1;
+		return out[pos++];
+	}
+	bool	eof() {
+		return pos == size && !next_block();
+	}
+};
+
+} // namespace LZ
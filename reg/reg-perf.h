@@ -0,0 +1,468 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reg-common.h"
+
+//-----------------------------------------------------------------------------
+//	Perf
+//	decoding of HKEY_PERFORMANCE_DATA blobs, without winperf.h so it builds anywhere
+//	a blob is a PERF_DATA_BLOCK followed by its objects; each object holds
+//		PERF_OBJECT_TYPE
+//		PERF_COUNTER_DEFINITION...							(from HeaderLength)
+//		PERF_COUNTER_BLOCK, or								(from DefinitionLength)
+//		{ PERF_INSTANCE_DEFINITION, name, PERF_COUNTER_BLOCK }...
+//	all integers little-endian and read with memcpy, as nothing in a blob is reliably aligned
+//-----------------------------------------------------------------------------
+
+namespace Perf {
+
+// counter type fields, as in winperf.h
+enum : uint32_t {
+	SIZE_MASK		= 0x00000300,
+	SIZE_DWORD		= 0x00000000,
+	SIZE_LARGE		= 0x00000100,
+	SIZE_ZERO		= 0x00000200,
+	SIZE_VARIABLE	= 0x00000300,
+
+	TYPE_MASK		= 0x00000c00,
+	TYPE_NUMBER		= 0x00000000,
+	TYPE_COUNTER	= 0x00000400,
+	TYPE_TEXT		= 0x00000800,
+
+	NUMBER_MASK		= 0x00030000,
+	NUMBER_DEC_1000	= 0x00020000,
+
+	SUBTYPE_MASK	= 0x00070000,
+	VALUE			= 0x00000000,
+	RATE			= 0x00010000,
+	FRACTION		= 0x00020000,
+	BASE			= 0x00030000,
+	ELAPSED			= 0x00040000,
+	QUEUELEN		= 0x00050000,
+	HISTOGRAM		= 0x00060000,
+	PRECISION		= 0x00070000,
+
+	TIMER_MASK		= 0x00300000,
+	TIMER_TICK		= 0x00000000,
+	TIMER_100NS		= 0x00100000,
+	TIMER_OBJECT	= 0x00200000,
+
+	DELTA_COUNTER	= 0x00400000,
+	DELTA_BASE		= 0x00800000,
+	INVERSE			= 0x01000000,
+	MULTI			= 0x02000000,
+
+	DISPLAY_MASK	= 0xf0000000,
+	PER_SEC			= 0x10000000,
+	PERCENT			= 0x20000000,
+	SECONDS			= 0x30000000,
+};
+
+static const int32_t	NO_INSTANCES	= -1;
+static const uint32_t	NONE			= ~0u;
+
+using Common::get32;
+using Common::get64;
+using Common::Array;
+
+//-----------------------------------------------------------------------------
+//	Names
+//	title indices to names, from the "Counter" value of HKEY_PERFORMANCE_TEXT:
+//	REG_MULTI_SZ pairs of decimal index and name
+//-----------------------------------------------------------------------------
+
+struct Names {
+	const char16_t	**names	= nullptr;
+	uint32_t		count	= 0;
+
+	Names() {}
+	Names(const Names&) = delete;
+	~Names() { free(names); }
+
+	// text must outlive the table
+	void	parse(const char16_t *text, size_t length) {
+		auto	end		= text + length;
+		auto	next	= [&](const char16_t *s) {
+			while (s < end && *s)
+				++s;
+			return s + 1;
+		};
+		for (auto s = text; s < end && *s;) {
+			uint32_t	index = 0;
+			for (auto d = s; d < end && *d >= '0' && *d <= '9'; ++d)
+				index = index * 10 + (*d - '0');
+			auto	name = next(s);
+			if (name >= end || !*name)
+				break;
+			if (index < 0x100000) {
+				if (index >= count) {
+					auto	n = count ? count : 1024;
+					while (n <= index)
+						n *= 2;
+					names = (const char16_t**)realloc(names, n * sizeof(*names));
+					memset(names + count, 0, (n - count) * sizeof(*names));
+					count = n;
+				}
+				names[index] = name;
+			}
+			s = next(name);
+		}
+	}
+	const char16_t	*operator[](uint32_t i) const { return i < count ? names[i] : nullptr; }
+
+	// first index from start with this name, ignoring ASCII case, or NONE
+	uint32_t	find(const char16_t *name, size_t length, uint32_t start = 0) const {
+		auto	fold = [](char16_t c) { return char16_t(c >= 'A' && c <= 'Z' ? c + 32 : c); };
+		for (uint32_t i = start; i < count; i++) {
+			if (auto s = names[i]) {
+				size_t	j = 0;
+				while (j < length && s[j] && fold(s[j]) == fold(name[j]))
+					++j;
+				if (j == length && !s[j])
+					return i;
+			}
+		}
+		return NONE;
+	}
+};
+
+//-----------------------------------------------------------------------------
+//	Sample
+//	one blob parsed into objects, counters and instances that point into it
+//-----------------------------------------------------------------------------
+
+struct Counter {
+	uint32_t	name, type, size, offset;
+	int32_t		scale;
+	uint32_t	base;			// index in the object of the counter holding the denominator, or NONE
+	bool	shown() const {
+		return (type & SIZE_MASK) != SIZE_ZERO && (type & SIZE_MASK) != SIZE_VARIABLE && (type & TYPE_MASK) != TYPE_TEXT
+			&& !((type & TYPE_MASK) == TYPE_COUNTER && (type & SUBTYPE_MASK) == BASE);
+	}
+};
+
+struct Instance {
+	const char16_t	*name;		// null for an object without instances
+	uint32_t		length;		// in characters, without the terminator
+	uint32_t		occurrence;	// earlier instances of the object with the same name
+	const uint8_t	*block;		// PERF_COUNTER_BLOCK
+	uint32_t		block_size;
+};
+
+struct Object {
+	uint32_t	name;
+	uint64_t	time, freq;
+	uint32_t	first_counter, num_counters;
+	uint32_t	first_instance, num_instances;
+};
+
+// what a counter's formula needs from one sample
+struct Reading {
+	uint64_t	value = 0, base = 0;
+	uint64_t	time = 0, freq = 0, time_100ns = 0;		// of the blob
+	uint64_t	object_time = 0, object_freq = 0;
+};
+
+struct Sample {
+	uint64_t			time = 0, freq = 0, time_100ns = 0;
+	Array<Object>		objects;
+	Array<Counter>		counters;
+	Array<Instance>		instances;
+
+	void	clear() {
+		objects.n = counters.n = instances.n = 0;
+		time = freq = time_100ns = 0;
+	}
+
+	// false if the blob is truncated or malformed; whatever parsed before the fault is kept
+	bool	parse(const uint8_t *p, size_t size) {
+		clear();
+		if (size < 88 || memcmp(p, u"PERF", 8) != 0)
+			return false;
+		uint32_t	total	= get32(p + 20);
+		uint32_t	header	= get32(p + 24);
+		uint32_t	num		= get32(p + 28);
+		time		= get64(p + 56);
+		freq		= get64(p + 64);
+		time_100ns	= get64(p + 72);
+		if (total > size || header > total)
+			return false;
+		size = total;
+
+		for (size_t o = header; num--; ) {
+			if (o + 64 > size)
+				return false;
+			auto		op		= p + o;
+			uint32_t	length	= get32(op);
+			uint32_t	defs	= get32(op + 4);
+			uint32_t	head	= get32(op + 8);
+			uint32_t	ncount	= get32(op + 32);
+			int32_t		ninst	= (int32_t)get32(op + 40);
+			if (length < 64 || o + length > size || defs > length || head > defs || head + uint64_t(ncount) * 40 > defs)
+				return false;
+
+			auto	&obj			= objects.push();
+			obj.name			= get32(op + 12);
+			obj.time			= get64(op + 48);
+			obj.freq			= get64(op + 56);
+			obj.first_counter	= counters.n;
+			obj.num_counters	= 0;
+			obj.first_instance	= instances.n;
+			obj.num_instances	= 0;
+
+			for (uint32_t c = head; c < defs && obj.num_counters < ncount;) {
+				auto	cp		= op + c;
+				auto	bytes	= get32(cp);
+				if (bytes < 40 || uint64_t(c) + bytes > defs)
+					return false;
+				auto	&ctr	= counters.push();
+				ctr.name	= get32(cp + 4);
+				ctr.scale	= (int32_t)get32(cp + 20);
+				ctr.type	= get32(cp + 28);
+				ctr.size	= get32(cp + 32);
+				ctr.offset	= get32(cp + 36);
+				ctr.base	= NONE;
+				++obj.num_counters;
+				c += bytes;
+			}
+			// fractions, averages and precision timers take their denominator from the next counter
+			for (uint32_t i = 0; i + 1 < obj.num_counters; i++) {
+				auto	&ctr	= counters[obj.first_counter + i];
+				auto	sub		= ctr.type & SUBTYPE_MASK;
+				if ((ctr.type & TYPE_MASK) == TYPE_COUNTER && (sub == FRACTION || sub == PRECISION))
+					ctr.base = i + 1;
+			}
+
+			auto	block = [&](size_t at, Instance &inst) {
+				if (at + 4 > o + length)
+					return false;
+				inst.block		= p + at;
+				inst.block_size	= get32(p + at);
+				return inst.block_size >= 4 && at + inst.block_size <= o + length;
+			};
+
+			if (ninst == NO_INSTANCES || ninst == 0) {
+				if (ninst == NO_INSTANCES) {
+					auto	&inst	= instances.push();
+					inst.name		= nullptr;
+					inst.length		= inst.occurrence = 0;
+					++obj.num_instances;
+					if (!block(o + defs, inst))
+						return false;
+				}
+			} else {
+				for (size_t i = o + defs; ninst--; ) {
+					if (i + 24 > o + length)
+						return false;
+					auto		ip		= p + i;
+					uint32_t	bytes	= get32(ip);
+					uint32_t	name	= get32(ip + 16);
+					uint32_t	len		= get32(ip + 20);
+					if (bytes < 24 || i + bytes > o + length || uint64_t(name) + len > bytes)
+						return false;
+					auto	&inst	= instances.push();
+					inst.name		= (const char16_t*)(ip + name);
+					inst.length		= len / 2;
+					while (inst.length && inst.name[inst.length - 1] == 0)
+						--inst.length;
+					inst.occurrence	= 0;
+					for (uint32_t j = obj.first_instance; j < instances.n - 1; j++) {
+						auto	&prev = instances[j];
+						if (prev.length == inst.length && memcmp(prev.name, inst.name, inst.length * 2) == 0)
+							++inst.occurrence;
+					}
+					++obj.num_instances;
+					if (!block(i + bytes, inst))
+						return false;
+					i += bytes + inst.block_size;
+				}
+			}
+			o += length;
+		}
+		return true;
+	}
+
+	uint64_t	raw(const Counter &c, const Instance &inst) const {
+		auto	size = c.type & SIZE_MASK;
+		if (size == SIZE_DWORD && c.offset + 4 <= inst.block_size)
+			return get32(inst.block + c.offset);
+		if (size == SIZE_LARGE && c.offset + 8 <= inst.block_size)
+			return get64(inst.block + c.offset);
+		return 0;
+	}
+
+	Reading		read(const Object &obj, uint32_t counter, const Instance &inst) const {
+		Reading	r;
+		auto	&c		= counters[obj.first_counter + counter];
+		r.value			= raw(c, inst);
+		if (c.base != NONE)
+			r.base		= raw(counters[obj.first_counter + c.base], inst);
+		r.time			= time;
+		r.freq			= freq;
+		r.time_100ns	= time_100ns;
+		r.object_time	= obj.time;
+		r.object_freq	= obj.freq;
+		return r;
+	}
+
+	// identifies the same counter of the same instance across samples
+	uint64_t	key(const Object &obj, uint32_t counter, const Instance &inst) const {
+		uint64_t	h = 14695981039346656037ull;
+		auto		mix = [&h](uint64_t v) { h = (h ^ v) * 1099511628211ull; };
+		mix(obj.name);
+		mix(counter);
+		mix(counters[obj.first_counter + counter].name);
+		mix(inst.occurrence);
+		for (uint32_t i = 0; i < inst.length; i++)
+			mix(inst.name[i]);
+		return h;
+	}
+};
+
+//-----------------------------------------------------------------------------
+//	value
+//	the displayed value of a counter, as perfmon computes it
+//	prev is the same counter in the previous sample, or null; false if the counter needs two samples
+//-----------------------------------------------------------------------------
+
+inline bool value(uint32_t type, const Reading &now, const Reading *prev, double &result) {
+	auto	size = type & SIZE_MASK;
+	if (size == SIZE_ZERO || size == SIZE_VARIABLE || (type & TYPE_MASK) == TYPE_TEXT)
+		return false;
+
+	if ((type & TYPE_MASK) == TYPE_NUMBER) {
+		result = size == SIZE_DWORD ? double(uint32_t(now.value)) : double(int64_t(now.value));	// DWORD counts are unsigned
+		if ((type & NUMBER_MASK) == NUMBER_DEC_1000)
+			result /= 1000;
+		return true;
+	}
+
+	// the clock the counter was sampled against
+	auto	clock = [type](const Reading &r, uint64_t &time, double &freq) {
+		switch (type & TIMER_MASK) {
+			case TIMER_100NS:	time = r.time_100ns;	freq = 1e7;				break;
+			case TIMER_OBJECT:	time = r.object_time;	freq = (double)r.object_freq;	break;
+			default:			time = r.time;			freq = (double)r.freq;	break;
+		}
+	};
+	uint64_t	t1, t0;
+	double		f, f0;
+	clock(now, t1, f);
+
+	// averages are deltas of both although their types do not say so
+	bool	percent			= (type & DISPLAY_MASK) == PERCENT;
+	bool	average			= (type & SUBTYPE_MASK) == FRACTION && !percent;
+	bool	delta_counter	= (type & DELTA_COUNTER) || average;
+	bool	delta_base		= (type & DELTA_BASE) || average;
+	if ((delta_counter || delta_base) && !prev)
+		return false;
+	if (prev)
+		clock(*prev, t0, f0);
+
+	// 32-bit counters wrap
+	auto	delta = [size](uint64_t a, uint64_t b) {
+		return size == SIZE_DWORD ? double(int32_t(uint32_t(a - b))) : double(int64_t(a - b));
+	};
+	double	n	= delta_counter ? delta(now.value, prev->value) : double(now.value);
+	double	dt	= prev ? double(int64_t(t1 - t0)) : 0;
+
+	switch (type & SUBTYPE_MASK) {
+		case VALUE:
+			result = n;
+			return true;
+
+		case RATE:
+			if (!prev || dt <= 0 || f <= 0)
+				return false;
+			if (percent) {
+				result = 100 * n / dt;
+				if (type & INVERSE)
+					result = 100 - result;
+			} else {
+				result = n / (dt / f);
+			}
+			return true;
+
+		case FRACTION: {
+			double	b = delta_base ? delta(now.base, prev->base) : double(now.base);
+			if (b == 0)
+				return false;
+			result = (type & DISPLAY_MASK) == SECONDS ? n / f / b : n / b;
+			if (percent)
+				result *= 100;
+			return true;
+		}
+
+		case ELAPSED:
+			if (f <= 0)
+				return false;
+			result = double(int64_t(t1 - now.value)) / f;
+			return true;
+
+		case QUEUELEN:
+			if (!prev || dt <= 0)
+				return false;
+			result = n / dt;
+			return true;
+
+		case PRECISION: {
+			if (!prev)
+				return false;
+			double	b = double(int64_t(now.base - prev->base));
+			if (b <= 0)
+				return false;
+			result = n / b;
+			if (percent)
+				result *= 100;
+			if (type & INVERSE)
+				result = 100 - result;
+			return true;
+		}
+
+		default:		// histograms
+			result = n;
+			return true;
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	History
+//	the readings of one sample and the value last shown for each, found by key
+//-----------------------------------------------------------------------------
+
+struct History {
+	struct Entry {
+		uint64_t	key;
+		Reading		reading;
+		double		shown;
+		bool		has_shown;
+	};
+	Array<Entry>	entries;
+
+	void	sort() {
+		qsort(entries.p, entries.n, sizeof(Entry), [](const void *a, const void *b) {
+			auto	x = ((const Entry*)a)->key, y = ((const Entry*)b)->key;
+			return x < y ? -1 : x > y ? 1 : 0;
+		});
+	}
+	const Entry	*find(uint64_t key) const {
+		uint32_t	lo = 0, hi = entries.n;
+		while (lo < hi) {
+			auto	mid = (lo + hi) / 2;
+			if (entries[mid].key < key)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return lo < entries.n && entries[lo].key == key ? &entries[lo] : nullptr;
+	}
+	void	swap(History &b) {
+		auto	p = entries.p;
+		auto	n = entries.n, capacity = entries.capacity;
+		entries.p = b.entries.p;	entries.n = b.entries.n;	entries.capacity = b.entries.capacity;
+		b.entries.p = p;			b.entries.n = n;			b.entries.capacity = capacity;
+	}
+};
+
+} // namespace Perf
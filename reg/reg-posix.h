@@ -0,0 +1,276 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include <wchar.h>
+#include <cwchar>
+#include <cstdlib>
+#include <string>
+#include "reg-common.h"
+
+//-----------------------------------------------------------------------------
+//	Posix
+//	what REG takes from Windows, for building it elsewhere: the Win32 types and error codes it returns,
+//	and the CRT and kernel32 calls it makes, done with libc
+//	built with -fshort-wchar, so wchar_t is UTF-16 as on Windows; libc's wide string functions expect 32 bits,
+//	so the ones REG uses are written here for 16, and REG calls them through Wide (reg-string.h)
+//	paths and arguments are UTF-8 outside, UTF-16 inside
+//-----------------------------------------------------------------------------
+
+static_assert(sizeof(wchar_t) == 2, "build with -fshort-wchar");
+
+typedef uint8_t		BYTE;
+typedef uint32_t	DWORD;
+typedef int32_t		LSTATUS;
+typedef uint64_t	ULONGLONG;
+typedef int			BOOL;
+typedef void		*HANDLE;
+
+struct FILETIME {
+	DWORD	dwLowDateTime, dwHighDateTime;
+};
+struct SYSTEMTIME {
+	uint16_t	wYear, wMonth, wDayOfWeek, wDay, wHour, wMinute, wSecond, wMilliseconds;
+};
+struct WIN32_FIND_DATAW {
+	DWORD	dwFileAttributes;
+	wchar_t	cFileName[260];
+};
+
+#define INVALID_HANDLE_VALUE		((HANDLE)(intptr_t)-1)
+#define FILE_ATTRIBUTE_DIRECTORY	0x10
+#define MOVEFILE_REPLACE_EXISTING	0x1
+#define _O_BINARY					0
+#define _O_U8TEXT					0
+
+#define ERROR_SUCCESS				0
+#define ERROR_INVALID_FUNCTION		1
+#define ERROR_FILE_NOT_FOUND		2
+#define ERROR_ACCESS_DENIED			5
+#define ERROR_INVALID_HANDLE		6
+#define ERROR_INVALID_DATA			13
+#define ERROR_WRITE_FAULT			29
+#define ERROR_BAD_NETPATH			53
+#define ERROR_INVALID_PARAMETER		87
+#define ERROR_ALREADY_EXISTS		183
+#define ERROR_MORE_DATA				234
+#define ERROR_BADDB					1009
+#define ERROR_TIMEOUT				1460
+
+namespace Posix {
+
+// a null-terminated UTF-8 string as UTF-16, for the caller to free
+inline wchar_t *to_utf16(const char *s) {
+	auto	p = (const uint8_t*)s;
+	auto	r = (wchar_t*)malloc((strlen(s) + 1) * sizeof(wchar_t)), d = r;
+	while (*p) {
+		uint32_t	c = *p++;
+		if (c >= 0xc0) {
+			int	extra = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : 1;
+			c &= 0x3f >> extra;
+			while (extra-- && (*p & 0xc0) == 0x80)
+				c = (c << 6) | (*p++ & 0x3f);
+		}
+		if (c >= 0x10000) {
+			*d++ = wchar_t(0xd800 + ((c - 0x10000) >> 10));
+			c	 = 0xdc00 + ((c - 0x10000) & 0x3ff);
+		}
+		*d++ = wchar_t(c);
+	}
+	*d = 0;
+	return r;
+}
+
+inline size_t wcslen(const wchar_t *s) {
+	size_t	n = 0;
+	while (s[n])
+		++n;
+	return n;
+}
+inline const wchar_t *wcschr(const wchar_t *s, wchar_t c) {
+	for (;; ++s) {
+		if (*s == c)
+			return s;
+		if (!*s)
+			return nullptr;
+	}
+}
+inline wchar_t *wcschr(wchar_t *s, wchar_t c) {
+	return const_cast<wchar_t*>(wcschr((const wchar_t*)s, c));
+}
+inline int wcscmp(const wchar_t *a, const wchar_t *b) {
+	while (*a && *a == *b)
+		++a, ++b;
+	return int(uint16_t(*a)) - int(uint16_t(*b));
+}
+// numbers are ASCII, so they are parsed by the narrow function from a narrowed copy
+template<typename R, typename F> R to_number(const wchar_t *s, wchar_t **end, F parse) {
+	char	buffer[128];
+	size_t	n = 0;
+	while (n < sizeof(buffer) - 1 && s[n] && s[n] < 0x80) {
+		buffer[n] = char(s[n]);
+		++n;
+	}
+	buffer[n]	= 0;
+	char	*e	= buffer;
+	R		r	= parse(buffer, &e);
+	if (end)
+		*end = const_cast<wchar_t*>(s) + (e - buffer);
+	return r;
+}
+inline unsigned long wcstoul(const wchar_t *s, wchar_t **end, int base) {
+	return to_number<unsigned long>(s, end, [base](const char *p, char **e) { return strtoul(p, e, base); });
+}
+inline unsigned long long wcstoull(const wchar_t *s, wchar_t **end, int base) {
+	return to_number<unsigned long long>(s, end, [base](const char *p, char **e) { return strtoull(p, e, base); });
+}
+inline long wcstol(const wchar_t *s, wchar_t **end, int base) {
+	return to_number<long>(s, end, [base](const char *p, char **e) { return strtol(p, e, base); });
+}
+inline long long wcstoll(const wchar_t *s, wchar_t **end, int base) {
+	return to_number<long long>(s, end, [base](const char *p, char **e) { return strtoll(p, e, base); });
+}
+inline double wcstod(const wchar_t *s, wchar_t **end) {
+	return to_number<double>(s, end, [](const char *p, char **e) { return strtod(p, e); });
+}
+
+// FindFirstFileW's handle: the matches of the pattern, and the next one to return
+struct Find {
+	glob_t	g		= {};
+	size_t	next	= 0;
+
+	bool	get(WIN32_FIND_DATAW *data) {
+		if (next >= g.gl_pathc)
+			return false;
+		auto	path	= g.gl_pathv[next++];
+		auto	name	= strrchr(path, '/');
+		struct stat	st;
+		data->dwFileAttributes = stat(path, &st) == 0 && S_ISDIR(st.st_mode) ? FILE_ATTRIBUTE_DIRECTORY : 0;
+
+		auto	wide	= to_utf16(name ? name + 1 : path);
+		size_t	n		= wcslen(wide);
+		if (n > 259)
+			n = 259;
+		memcpy(data->cFileName, wide, n * sizeof(wchar_t));
+		data->cFileName[n] = 0;
+		free(wide);
+		return true;
+	}
+};
+
+} // namespace Posix
+
+//-----------------------------------------------------------------------------
+//	CRT
+//-----------------------------------------------------------------------------
+
+inline int _wfopen_s(FILE **f, const wchar_t *filename, const wchar_t *mode) {
+	auto	name = Common::to_utf8(filename), m = Common::to_utf8(mode);
+	*f			= fopen(name, m);
+	int		err	= *f ? 0 : errno;
+	free(name);
+	free(m);
+	return err;
+}
+inline int _wfreopen_s(FILE **f, const wchar_t *filename, const wchar_t *mode, FILE *old) {
+	auto	name = Common::to_utf8(filename), m = Common::to_utf8(mode);
+	*f			= freopen(name, m, old);
+	int		err	= *f ? 0 : errno;
+	free(name);
+	free(m);
+	return err;
+}
+inline int _wremove(const wchar_t *filename) {
+	auto	name	= Common::to_utf8(filename);
+	int		r		= remove(name);
+	free(name);
+	return r;
+}
+inline int		_fileno(FILE *f)					{ return fileno(f); }
+inline int64_t	_telli64(int fd)					{ return lseek(fd, 0, SEEK_CUR); }
+inline int		_chsize_s(int fd, int64_t size)		{ return ftruncate(fd, size) == 0 ? 0 : errno; }
+inline int		_setmode(int, int)					{ return 0; }	// stdout is written as UTF-8 bytes anyway
+inline uint32_t	_byteswap_ulong(uint32_t x)			{ return __builtin_bswap32(x); }
+
+//-----------------------------------------------------------------------------
+//	kernel32
+//	a failed call leaves errno for GetLastError
+//-----------------------------------------------------------------------------
+
+inline DWORD	GetLastError()	{ return errno; }
+
+inline BOOL MoveFileExW(const wchar_t *from, const wchar_t *to, DWORD /*flags*/) {
+	auto	a = Common::to_utf8(from), b = Common::to_utf8(to);
+	bool	ok = rename(a, b) == 0;		// replaces any existing file
+	free(a);
+	free(b);
+	return ok;
+}
+
+inline void Sleep(DWORD ms) {
+	timespec	t = {time_t(ms / 1000), long(ms % 1000) * 1000000};
+	while (nanosleep(&t, &t) != 0 && errno == EINTR)
+		;
+}
+
+inline ULONGLONG GetTickCount64() {
+	timespec	t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return ULONGLONG(t.tv_sec) * 1000 + t.tv_nsec / 1000000;
+}
+
+// 100ns intervals since 1601
+inline void GetSystemTimeAsFileTime(FILETIME *ft) {
+	timespec	t;
+	clock_gettime(CLOCK_REALTIME, &t);
+	uint64_t	v = (uint64_t(t.tv_sec) + 11644473600ull) * 10000000 + t.tv_nsec / 100;
+	ft->dwLowDateTime	= DWORD(v);
+	ft->dwHighDateTime	= DWORD(v >> 32);
+}
+
+inline BOOL SystemTimeToFileTime(const SYSTEMTIME *st, FILETIME *ft) {
+	if (st->wMonth < 1 || st->wMonth > 12 || st->wDay < 1 || st->wDay > 31 || st->wHour > 23 || st->wMinute > 59 || st->wSecond > 59)
+		return false;
+	tm	t		= {};
+	t.tm_year	= st->wYear - 1900;
+	t.tm_mon	= st->wMonth - 1;
+	t.tm_mday	= st->wDay;
+	t.tm_hour	= st->wHour;
+	t.tm_min	= st->wMinute;
+	t.tm_sec	= st->wSecond;
+	int64_t		secs = timegm(&t);
+	if (secs < -11644473600ll)
+		return false;
+	uint64_t	v = uint64_t(secs + 11644473600ll) * 10000000 + uint64_t(st->wMilliseconds) * 10000;
+	ft->dwLowDateTime	= DWORD(v);
+	ft->dwHighDateTime	= DWORD(v >> 32);
+	return true;
+}
+
+inline HANDLE FindFirstFileW(const wchar_t *pattern, WIN32_FIND_DATAW *data) {
+	auto	find	= new Posix::Find;
+	auto	p		= Common::to_utf8(pattern);
+	int		r		= glob(p, 0, nullptr, &find->g);
+	free(p);
+	if (r != 0 || !find->get(data)) {
+		globfree(&find->g);
+		delete find;
+		return INVALID_HANDLE_VALUE;
+	}
+	return find;
+}
+inline BOOL FindNextFileW(HANDLE h, WIN32_FIND_DATAW *data) {
+	return ((Posix::Find*)h)->get(data);
+}
+inline BOOL FindClose(HANDLE h) {
+	auto	find = (Posix::Find*)h;
+	globfree(&find->g);
+	delete find;
+	return true;
+}
@@ -0,0 +1,627 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reg-common.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+//-----------------------------------------------------------------------------
+//	MappedFile
+//	read-only view of a whole file
+//-----------------------------------------------------------------------------
+
+struct MappedFile {
+	const uint8_t	*p		= nullptr;
+	size_t			size	= 0;
+
+#ifdef _WIN32
+	MappedFile(const wchar_t *filename) {
+		auto	h = CreateFileW(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (h == INVALID_HANDLE_VALUE)
+			return;
+		LARGE_INTEGER	len;
+		if (GetFileSizeEx(h, &len) && len.QuadPart) {
+			if (auto m = CreateFileMappingW(h, NULL, PAGE_READONLY, 0, 0, NULL)) {
+				p		= (const uint8_t*)MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+				size	= p ? (size_t)len.QuadPart : 0;
+				CloseHandle(m);
+			}
+		}
+		CloseHandle(h);
+	}
+	~MappedFile() { if (p) UnmapViewOfFile(p); }
+#else
+	MappedFile(const wchar_t *filename) {
+		auto	name = Common::to_utf8(filename);
+		map(name);
+		free(name);
+	}
+	MappedFile(const char *filename) { map(filename); }
+	void	map(const char *filename) {
+		int	fd = open(filename, O_RDONLY);
+		if (fd < 0)
+			return;
+		struct stat	st;
+		if (fstat(fd, &st) == 0 && st.st_size) {
+			auto	m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (m != MAP_FAILED) {
+				p		= (const uint8_t*)m;
+				size	= st.st_size;
+			}
+		}
+		close(fd);
+	}
+	~MappedFile() { if (p) munmap((void*)p, size); }
+#endif
+	MappedFile(const MappedFile&) = delete;
+	explicit operator bool() const { return !!p; }
+};
+
+//-----------------------------------------------------------------------------
+//	Snapshot
+//	binary image of a registry tree, read in place from a mapped file
+//	all integers little-endian, offsets from the start of the file
+//		Header
+//		key records and value blobs, each key written after its subkeys
+//		string table: { uint16 length, char16 chars[length] }... (interned)
+//	subkeys and values of a key are sorted by fold_compare so lookups can bisect
+//	a DELTA snapshot names its base file and holds only what changed (see Chain)
+//-----------------------------------------------------------------------------
+
+namespace Snapshot {
+
+static const char	magic[8]	= {'R', 'E', 'G', 'S', 'N', 'A', 'P', 0};
+static const uint32_t version	= 1;
+
+enum {
+	DELTA		= 1,		// Header: base names the snapshot this one applies to
+	COMPLETE	= 1,		// Key: subkeys and values are all listed, nothing is inherited
+	REMOVED		= 2,		// Child, Value: deleted since the base
+};
+
+struct Header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	num_strings;
+	uint64_t	root;			// key record
+	uint64_t	strings;		// string table
+	uint64_t	strings_size;
+	uint64_t	num_keys;
+	uint64_t	num_values;
+	uint32_t	flags;
+	uint32_t	base;			// string id of the base file name
+	uint64_t	base_size;		// size of the base file, to catch a mismatched chain
+};
+
+struct Child {
+	uint32_t	name;			// offset in the string table
+	uint32_t	flags;
+	uint64_t	key;			// key record
+};
+
+struct Value {
+	uint32_t	name;
+	uint32_t	type;
+	uint32_t	size;
+	uint32_t	flags;
+	uint64_t	data;			// blob
+};
+
+struct Key {
+	uint32_t	name;
+	uint32_t	num_subkeys;
+	uint32_t	num_values;
+	uint32_t	flags;
+	uint64_t	last_write;		// FILETIME
+//	Child		subkeys[num_subkeys];
+//	Value		values[num_values];
+	const Child	*subkeys()	const { return (const Child*)(this + 1); }
+	const Value	*values()	const { return (const Value*)(subkeys() + num_subkeys); }
+};
+
+using Common::fold;
+using Common::fold_compare;
+using Common::Array;
+
+//-----------------------------------------------------------------------------
+//	Writer
+//-----------------------------------------------------------------------------
+
+struct Writer {
+	FILE		*h;
+	uint64_t	pos		= sizeof(Header);
+	Header		header	= {};
+	bool		failed	= false;	// a write fell short, as on a full disk
+
+	// interned names: table holds string offset + 1, open addressing
+	uint8_t		*strings	= nullptr;
+	size_t		strings_size = 0, strings_capacity = 0;
+	uint32_t	*table		= nullptr;
+	uint32_t	table_size	= 0;
+
+	Writer(FILE *h) : h(h) {
+		failed = fwrite(&header, sizeof(header), 1, h) != 1;
+	}
+	~Writer() {
+		free(strings);
+		free(table);
+	}
+
+	const char16_t	*string_chars(uint32_t id, size_t &len) const {
+		uint16_t	n;
+		memcpy(&n, strings + id, 2);
+		len = n;
+		return (const char16_t*)(strings + id + 2);
+	}
+
+	static uint32_t	hash(const char16_t *s, size_t n) {
+		uint32_t	h = 2166136261u;
+		while (n--)
+			h = (h ^ *s++) * 16777619u;
+		return h;
+	}
+
+	uint32_t	intern(const char16_t *s, size_t n) {
+		if (table_size < (header.num_strings + 1) * 2) {
+			auto	old = table, old_end = table + table_size;
+			table_size	= table_size ? table_size * 2 : 1024;
+			table		= (uint32_t*)calloc(table_size, sizeof(uint32_t));
+			for (auto i = old; i < old_end; ++i) {
+				if (*i) {
+					size_t	len;
+					auto	chars = string_chars(*i - 1, len);
+					auto	j = hash(chars, len) & (table_size - 1);
+					while (table[j])
+						j = (j + 1) & (table_size - 1);
+					table[j] = *i;
+				}
+			}
+			free(old);
+		}
+
+		auto	j = hash(s, n) & (table_size - 1);
+		for (; table[j]; j = (j + 1) & (table_size - 1)) {
+			size_t	len;
+			auto	chars = string_chars(table[j] - 1, len);
+			if (len == n && memcmp(chars, s, n * 2) == 0)
+				return table[j] - 1;
+		}
+
+		auto	need = strings_size + 2 + n * 2;
+		if (need > strings_capacity) {
+			strings_capacity = need * 2 > 4096 ? need * 2 : 4096;
+			strings	= (uint8_t*)realloc(strings, strings_capacity);
+		}
+		auto	id	= (uint32_t)strings_size;
+		uint16_t len = (uint16_t)n;
+		memcpy(strings + id, &len, 2);
+		memcpy(strings + id + 2, s, n * 2);
+		strings_size = need;
+		++header.num_strings;
+		table[j] = id + 1;
+		return id;
+	}
+
+	int		compare(uint32_t a, uint32_t b) const {
+		size_t	na, nb;
+		auto	ca = string_chars(a, na), cb = string_chars(b, nb);
+		return fold_compare(ca, na, cb, nb);
+	}
+
+	void	write(const void *p, size_t n) {
+		if (fwrite(p, 1, n, h) != n)
+			failed = true;
+		pos += n;
+	}
+	void	align() {
+		static const uint8_t zeros[8] = {0};
+		if (pos & 7)
+			write(zeros, 8 - (pos & 7));
+	}
+
+	uint64_t	blob(const void *data, size_t size) {
+		auto	offset = pos;
+		write(data, size);
+		return offset;
+	}
+
+	// children and values are sorted here; returns the key record offset
+	uint64_t	key(uint32_t name, uint64_t last_write, Child *children, uint32_t num_children, Value *values, uint32_t num_values, uint32_t flags = 0) {
+		sort(children, num_children);
+		sort(values, num_values);
+
+		align();
+		auto	offset	= pos;
+		Key		k		= {name, num_children, num_values, flags, last_write};
+		write(&k, sizeof(k));
+		write(children, sizeof(Child) * num_children);
+		write(values, sizeof(Value) * num_values);
+		++header.num_keys;
+		header.num_values += num_values;
+		return offset;
+	}
+
+	// heapsort by name; needs the string table, so qsort can't be used
+	template<typename T> void sift(T *p, uint32_t i, uint32_t n) {
+		for (uint32_t c; (c = i * 2 + 1) < n; i = c) {
+			if (c + 1 < n && compare(p[c].name, p[c + 1].name) < 0)
+				++c;
+			if (compare(p[i].name, p[c].name) >= 0)
+				break;
+			auto t = p[i]; p[i] = p[c]; p[c] = t;
+		}
+	}
+	template<typename T> void sort(T *p, uint32_t n) {
+		for (uint32_t i = n / 2; i--;)
+			sift(p, i, n);
+		while (n > 1) {
+			--n;
+			auto t = p[0]; p[0] = p[n]; p[n] = t;
+			sift(p, 0, n);
+		}
+	}
+
+	// entries must already be sorted
+	template<typename T> T *find(T *p, uint32_t n, const char16_t *s, size_t len) const {
+		uint32_t	a = 0, b = n;
+		while (a < b) {
+			auto	m	= (a + b) / 2;
+			size_t	nm;
+			auto	cm	= string_chars(p[m].name, nm);
+			auto	c	= fold_compare(cm, nm, s, len);
+			if (c == 0)
+				return p + m;
+			if (c < 0)
+				a = m + 1;
+			else
+				b = m;
+		}
+		return nullptr;
+	}
+
+	// false if anything failed to reach the file
+	bool	finish(uint64_t root) {
+		align();
+		memcpy(header.magic, magic, sizeof(magic));
+		header.version		= version;
+		header.root			= root;
+		header.strings		= pos;
+		header.strings_size	= strings_size;
+		write(strings, strings_size);
+		if (fseek(h, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, h) != 1 || fflush(h) != 0)
+			failed = true;
+		return !failed;
+	}
+};
+
+//-----------------------------------------------------------------------------
+//	Reader
+//-----------------------------------------------------------------------------
+
+struct Reader {
+	const uint8_t	*base	= nullptr;
+	size_t			size	= 0;
+	const Header	*header	= nullptr;
+
+	Reader() {}
+	Reader(const uint8_t *p, size_t size) : base(p), size(size) {
+		if (size >= sizeof(Header) && memcmp(p, magic, sizeof(magic)) == 0) {
+			auto	h = (const Header*)p;
+			if (h->version == version && h->strings <= size && h->strings_size <= size - h->strings && h->root < h->strings)
+				header = h;
+		}
+	}
+	explicit operator bool() const { return !!header; }
+
+	struct Name {
+		const char16_t	*p;
+		size_t			length;
+	};
+
+	Name		name(uint32_t id) const {
+		uint16_t	n = 0;
+		if (id + 2 > header->strings_size)
+			return {u"", 0};
+		memcpy(&n, base + header->strings + id, 2);
+		if (id + 2 + n * 2 > header->strings_size)
+			n = 0;
+		return {(const char16_t*)(base + header->strings + id + 2), n};
+	}
+
+	const Key	*key(uint64_t offset) const {
+		if (offset + sizeof(Key) > header->strings)
+			return nullptr;
+		auto	k = (const Key*)(base + offset);
+		if (offset + sizeof(Key) + k->num_subkeys * sizeof(Child) + k->num_values * sizeof(Value) > header->strings)
+			return nullptr;
+		return k;
+	}
+	const Key	*root() const {
+		return key(header->root);
+	}
+
+	const uint8_t	*data(const Value &v) const {
+		return v.data + v.size <= size ? base + v.data : nullptr;
+	}
+
+	template<typename T> const T *find(const T *p, uint32_t n, const char16_t *s, size_t len) const {
+		uint32_t	a = 0, b = n;
+		while (a < b) {
+			auto	m	= (a + b) / 2;
+			auto	nm	= name(p[m].name);
+			auto	c	= fold_compare(nm.p, nm.length, s, len);
+			if (c == 0)
+				return p + m;
+			if (c < 0)
+				a = m + 1;
+			else
+				b = m;
+		}
+		return nullptr;
+	}
+
+	const Key	*subkey(const Key *k, const char16_t *s, size_t len) const {
+		auto	c = find(k->subkeys(), k->num_subkeys, s, len);
+		return c ? key(c->key) : nullptr;
+	}
+	const Value	*value(const Key *k, const char16_t *s, size_t len) const {
+		return find(k->values(), k->num_values, s, len);
+	}
+
+	// path is relative to the snapshot root, components separated by '\'
+	const Key	*lookup(const char16_t *path, size_t len) const {
+		auto	k	= root();
+		auto	end	= path + len;
+		while (k && path < end) {
+			auto	sep = path;
+			while (sep < end && *sep != '\\')
+				++sep;
+			if (sep > path)
+				k = subkey(k, path, sep - path);
+			path = sep + 1;
+		}
+		return k;
+	}
+};
+
+//-----------------------------------------------------------------------------
+//	Chain
+//	a full snapshot and the deltas taken after it, opened from the newest file
+//	each delta names its base, which is looked for in the delta's directory
+//	a delta key record lists only values and subkeys that changed, with REMOVED
+//	entries for deletions; anything else is inherited from the older layers
+//	unless the key is COMPLETE (new, or from a full snapshot)
+//	nothing is merged up front: a Node is the stack of records for one key
+//-----------------------------------------------------------------------------
+
+#ifdef _WIN32
+typedef wchar_t	path_char;
+#else
+typedef char	path_char;
+#endif
+
+struct Chain {
+	static const uint32_t MAX_LAYERS = 4096;
+
+	MappedFile	**files;
+	Reader		*layers;			// newest first; the last is a full snapshot
+	uint32_t	num_layers	= 0;
+	const wchar_t	*error		= nullptr;
+
+	struct Node {
+		struct Entry {
+			const Reader	*layer;
+			const Key		*key;
+		};
+		Entry		*p	= nullptr;	// newest first
+		uint32_t	n	= 0;
+
+		Node() {}
+		Node(Node &&b) : p(b.p), n(b.n) { b.p = nullptr; b.n = 0; }
+		Node(const Node&) = delete;
+		~Node() { free(p); }
+		Node& operator=(Node &&b) {
+			free(p);
+			p = b.p; n = b.n;
+			b.p = nullptr; b.n = 0;
+			return *this;
+		}
+		explicit operator bool() const { return n; }
+
+		uint64_t	last_write() const { return p[0].key->last_write; }
+		void		add(uint32_t max, const Reader *layer, const Key *key) {
+			if (!p)
+				p = (Entry*)malloc(sizeof(Entry) * max);
+			p[n++] = {layer, key};
+		}
+	};
+
+	struct ValueRef {
+		const Reader	*layer	= nullptr;
+		const Value		*value	= nullptr;
+		explicit operator bool() const { return !!value; }
+		const uint8_t	*data() const { return layer->data(*value); }
+	};
+
+	Chain(const path_char *filename) : files((MappedFile**)calloc(MAX_LAYERS, sizeof(MappedFile*))), layers(new Reader[MAX_LAYERS]) {
+		open(filename);
+	}
+#ifndef _WIN32
+	Chain(const wchar_t *filename) : files((MappedFile**)calloc(MAX_LAYERS, sizeof(MappedFile*))), layers(new Reader[MAX_LAYERS]) {
+		auto	name = Common::to_utf8(filename);
+		open(name);
+		free(name);
+	}
+#endif
+	void	open(const path_char *filename) {
+		auto		path	= copy(filename);
+		uint64_t	expect	= 0;
+		for (;;) {
+			if (num_layers == MAX_LAYERS) {
+				error = L"chain too long";
+				break;
+			}
+			auto	f = files[num_layers] = new MappedFile(path);
+			Reader	r(f->p, f->size);
+			if (!r) {
+				error = *f ? L"not a snapshot" : L"missing file";
+				break;
+			}
+			if (expect && f->size != expect) {
+				error = L"base does not match delta";
+				break;
+			}
+			layers[num_layers++] = r;
+			if (!(r.header->flags & DELTA))
+				break;
+
+			auto	next = sibling(path, r.name(r.header->base));
+			free(path);
+			path	= next;
+			expect	= r.header->base_size;
+		}
+		free(path);
+	}
+	~Chain() {
+		for (uint32_t i = 0; i < MAX_LAYERS && files[i]; i++)
+			delete files[i];
+		free(files);
+		delete[] layers;
+	}
+	explicit operator bool() const { return num_layers && !error; }
+
+	static path_char *copy(const path_char *s) {
+		size_t	n = 0;
+		while (s[n])
+			++n;
+		auto	r = (path_char*)malloc((n + 1) * sizeof(path_char));
+		memcpy(r, s, (n + 1) * sizeof(path_char));
+		return r;
+	}
+
+	// name in the same directory as path
+	static path_char *sibling(const path_char *path, Reader::Name name) {
+		size_t	dir = 0;
+		for (size_t i = 0; path[i]; i++) {
+			if (path[i] == '\\' || path[i] == '/')
+				dir = i + 1;
+		}
+		auto	r = (path_char*)malloc((dir + name.length * 3 + 1) * sizeof(path_char));
+		memcpy(r, path, dir * sizeof(path_char));
+		auto	d = r + dir;
+#ifdef _WIN32
+		for (size_t i = 0; i < name.length; i++)
+			*d++ = name.p[i];
+#else
+		for (size_t i = 0; i < name.length; i++) {
+			uint32_t	c = name.p[i];
+			if (c >= 0xd800 && c < 0xdc00 && i + 1 < name.length && name.p[i + 1] >= 0xdc00 && name.p[i + 1] < 0xe000)
+				c = 0x10000 + ((c - 0xd800) << 10) + (name.p[++i] - 0xdc00);
+			d = (char*)Common::put_utf8((uint8_t*)d, c);
+		}
+#endif
+		*d = 0;
+		return r;
+	}
+
+	Node	root() const {
+		Node	node;
+		for (uint32_t i = 0; i < num_layers; i++) {
+			auto	k = layers[i].root();
+			if (!k)
+				return Node();
+			node.add(num_layers, layers + i, k);
+			if (k->flags & COMPLETE)
+				break;
+		}
+		return node;
+	}
+
+	Node	subkey(const Node &node, const char16_t *s, size_t len) const {
+		Node	sub;
+		for (uint32_t i = 0; i < node.n; i++) {
+			auto	&e = node.p[i];
+			if (auto c = e.layer->find(e.key->subkeys(), e.key->num_subkeys, s, len)) {
+				auto	k = c->flags & REMOVED ? nullptr : e.layer->key(c->key);
+				if (!k)
+					break;
+				sub.add(num_layers, e.layer, k);
+				if (k->flags & COMPLETE)
+					break;
+			}
+		}
+		return sub;
+	}
+	Node	subkey(const Node &node, Reader::Name name) const {
+		return subkey(node, name.p, name.length);
+	}
+
+	ValueRef	value(const Node &node, const char16_t *s, size_t len) const {
+		for (uint32_t i = 0; i < node.n; i++) {
+			auto	&e = node.p[i];
+			if (auto v = e.layer->find(e.key->values(), e.key->num_values, s, len))
+				return v->flags & REMOVED ? ValueRef() : ValueRef{e.layer, v};
+		}
+		return ValueRef();
+	}
+
+	// path is relative to the root, components separated by '\'
+	Node	lookup(const char16_t *path, size_t len) const {
+		auto	node	= root();
+		auto	end		= path + len;
+		while (node && path < end) {
+			auto	sep = path;
+			while (sep < end && *sep != '\\')
+				++sep;
+			if (sep > path)
+				node = subkey(node, path, sep - path);
+			path = sep + 1;
+		}
+		return node;
+	}
+
+	// f(Reader::Name) for each live subkey; the newest layer that mentions a name decides it
+	template<typename F> void	subkeys(const Node &node, F f) const {
+		for (uint32_t i = 0; i < node.n; i++) {
+			auto	&e	= node.p[i];
+			auto	c	= e.key->subkeys();
+			for (uint32_t j = 0; j < e.key->num_subkeys; j++) {
+				auto	name = e.layer->name(c[j].name);
+				if (!(c[j].flags & REMOVED) && !shadowed(node, i, &Key::subkeys, &Key::num_subkeys, name))
+					f(name);
+			}
+		}
+	}
+	// f(Reader::Name, ValueRef) for each live value
+	template<typename F> void	values(const Node &node, F f) const {
+		for (uint32_t i = 0; i < node.n; i++) {
+			auto	&e	= node.p[i];
+			auto	v	= e.key->values();
+			for (uint32_t j = 0; j < e.key->num_values; j++) {
+				auto	name = e.layer->name(v[j].name);
+				if (!(v[j].flags & REMOVED) && !shadowed(node, i, &Key::values, &Key::num_values, name))
+					f(name, ValueRef{e.layer, v + j});
+			}
+		}
+	}
+
+	template<typename T> bool shadowed(const Node &node, uint32_t i, const T *(Key::*list)() const, uint32_t Key::*count, Reader::Name name) const {
+		while (i--) {
+			auto	&e = node.p[i];
+			if (e.layer->find((e.key->*list)(), e.key->*count, name.p, name.length))
+				return true;
+		}
+		return false;
+	}
+};
+
+} // namespace Snapshot
@@ -1,7 +1,51 @@
+#pragma once
 #include "text.h"
 #include <memory.h>
 #include <stdlib.h>
 #include <wchar.h>
+#include "reg-common.h"
+
+//-----------------------------------------------------------------------------
+//	Wide
+//	the wide string calls REG makes, named explicitly: the CRT's on Windows, reg-posix.h's elsewhere
+//	(where wchar_t is 16 bits and libc's would read 32)
+//	names compare without case as the registry compares them, not as the C locale does
+//-----------------------------------------------------------------------------
+
+namespace Wide {
+#ifdef _WIN32
+using ::wcslen;
+using ::wcschr;
+using ::wcscmp;
+using ::wcstoul;
+using ::wcstoull;
+using ::wcstol;
+using ::wcstoll;
+using ::wcstod;
+#else
+using Posix::wcslen;
+using Posix::wcschr;
+using Posix::wcscmp;
+using Posix::wcstoul;
+using Posix::wcstoull;
+using Posix::wcstol;
+using Posix::wcstoll;
+using Posix::wcstod;
+#endif
+
+inline int wcsnicmp(const wchar_t *a, const wchar_t *b, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		auto	ca = Common::fold(uint16_t(a[i])), cb = Common::fold(uint16_t(b[i]));
+		if (ca != cb || !ca)
+			return int(ca) - int(cb);
+	}
+	return 0;
+}
+inline int wcsicmp(const wchar_t *a, const wchar_t *b) {
+	return wcsnicmp(a, b, ~size_t(0));
+}
+
+} // namespace Wide
 
 //-----------------------------------------------------------------------------
 //	string
@@ -1,14 +1,31 @@
+#ifndef _WIN32
+#include "reg-posix.h"
+#endif
 #include "base.h"
 #include "text.h"
 #include "reg-string.h"
 
+#ifdef _WIN32
 #include <windows.h>
 #include <io.h>
 #include <fcntl.h>
+#endif
 #include <stdio.h>
+#include <atomic>
+
+#include "reg-governor.h"
+#include "reg-lz.h"
+#include "reg-snapshot.h"
+#include "reg-hash.h"
+#include "reg-hive.h"
+#include "reg-index.h"
+#include "reg-perf.h"
+#include "reg-doc.h"
+#include "reg-backend.h"
 
 //static auto& out = std::wcout;
 
+#ifdef _WIN32
 struct WinFile {
 	HANDLE	h;
 	WinFile(HANDLE h) : h(h) {}
@@ -37,68 +54,211 @@ struct WinFileReader : WinFile {
 		return read;
 	}
 };
+#endif
 
 struct FileWriter : TextWriter<wchar_t> {
-	FILE	*h;
-	int		column;
+	FILE	*h		= nullptr;
+	int		column	= 0;
+	LZ::WriteStream	*lz	= nullptr;	// compressed UTF-8, encoded here rather than by the CRT
+	bool	crlf	= false;		// a file encoded here, whose lines end \r\n as the CRT would write them
+	wchar_t	high	= 0;			// pending high surrogate when encoding here
 
 	FileWriter(FILE *h) : h(h) {}
-	FileWriter(const wchar_t *filename) {
-		_wfopen_s(&h, filename, L"w, ccs=UTF-8");
+	// append continues a file previously cut back to a checkpoint
+	// the CRT encodes uncompressed files on Windows; elsewhere, and when compressing, UTF-8 is encoded here
+	FileWriter(const wchar_t *filename, bool compress = false, bool append = false) {
+#ifdef _WIN32
+		if (!compress) {
+			_wfopen_s(&h, filename, append ? L"a, ccs=UTF-8" : L"w, ccs=UTF-8");
+			return;
+		}
+#endif
+		if (_wfopen_s(&h, filename, append ? L"ab" : L"wb") == 0) {
+			crlf = true;
+			if (compress)
+				lz = new LZ::WriteStream(h, !append);
+			if (!append) {
+				put(0xef);
+				put(0xbb);
+				put(0xbf);
+			}
+		}
+	}
+	~FileWriter() {
+		delete lz;
+		if (h) {
+			fflush(h);
+			fclose(h);
+		}
 	}
-	~FileWriter() { fflush(h); fclose(h); }
 	operator FILE*() const { return h; }
 
+	// flush everything written so far and return the offset in the file
+	uint64_t position() {
+		if (lz)
+			lz->flush_block();
+		fflush(h);
+		return _telli64(_fileno(h));
+	}
+
 	size_t write(const wchar_t* buffer, size_t size) {
-		auto n = fwrite(buffer, sizeof(wchar_t), size, h);
-		column += n;
-		return n;
+#ifdef _WIN32
+		if (!lz) {
+			auto n = fwrite(buffer, sizeof(wchar_t), size, h);
+			column += n;
+			return n;
+		}
+#endif
+		encode(buffer, size);
+		column += size;
+		return size;
+	}
+	void put(uint8_t b) {
+		if (lz)
+			lz->put(b);
+		else
+			putc(b, h);
+	}
+	void encode(const wchar_t* buffer, size_t size) {
+		for (auto p = buffer, e = buffer + size; p < e; ++p) {
+			uint32_t	c = *p;
+			if (c >= 0xd800 && c < 0xdc00) {
+				high = c;
+				continue;
+			}
+			if (c >= 0xdc00 && c < 0xe000 && high)
+				c = 0x10000 + ((high - 0xd800) << 10) + (c - 0xdc00);
+			high = 0;
+
+			if (c == '\n' && crlf)
+				put('\r');
+			uint8_t	utf8[4];
+			for (auto b = utf8, e = Common::put_utf8(utf8, c); b < e; ++b)
+				put(*b);
+		}
 	}
 	void flush() { fflush(h); column = 0;}
 };
 
-struct FileReader {
+bool truncate_file(const wchar_t *filename, uint64_t size) {
 	FILE	*h;
+	if (_wfopen_s(&h, filename, L"r+b") != 0)
+		return false;
+	bool	ok = _chsize_s(_fileno(h), size) == 0;
+	fclose(h);
+	return ok;
+}
+
+struct FileReader {
+	enum ENCODING { UTF8, UTF16LE, UTF16BE };
+	FILE	*h			= nullptr;
+	LZ::ReadStream	*lz	= nullptr;		// compressed (EXPORT /z) input
+	ENCODING	encoding	= UTF8;
+	bool	crt			= false;		// decoded by the CRT (uncompressed, on Windows) rather than here
+	mutable int	low		= -1;			// pending low surrogate
+
+#ifdef _WIN32
+	FileReader(FILE *h) : h(h), crt(true) {}
+#else
 	FileReader(FILE *h) : h(h) {}
+#endif
 	FileReader(const wchar_t *filename) {
-		if (_wfopen_s(&h, filename, L"r") == 0) {
-			auto b0 = ::getc(h);
+		if (_wfopen_s(&h, filename, L"rb") != 0)
+			return;
+
+		uint8_t	magic[4];
+		if (fread(magic, 1, 4, h) == 4 && LZ::ReadStream::check_magic(magic)) {
+			lz = new LZ::ReadStream(h);
+			auto b0 = lz->getb();
 			if (b0 == 0xef) {
-				if (::getc(h) == 0xbb && ::getc(h) == 0xbf) {
-					_wfreopen_s(&h, filename, L"r, ccs=UTF-8", h);
-					return;
-				}
+				lz->getb();
+				lz->getb();
 			} else if (b0 == 0xff) {
-				if (::getc(h) == 0xfe) {
-					_wfreopen_s(&h, filename, L"r, ccs=UTF-16LE", h);
-					return;
-				}
-			} else if (b0 == 0xfe) {
-				if (::getc(h) == 0xff) {
-					_wfreopen_s(&h, filename, L"r, ccs=UTF-16BE", h);
-					return;
-				}
+				lz->getb();
+				encoding = UTF16LE;
+			} else if (b0 >= 0) {
+				--lz->pos;
 			}
+			return;
+		}
+		fseek(h, 0, SEEK_SET);
+
+		auto b0 = ::getc(h);
+		if (b0 == 0xef && ::getc(h) == 0xbb && ::getc(h) == 0xbf) {
+			text(filename, L"r, ccs=UTF-8", UTF8);
+		} else if (b0 == 0xff && ::getc(h) == 0xfe) {
+			text(filename, L"r, ccs=UTF-16LE", UTF16LE);
+		} else if (b0 == 0xfe && ::getc(h) == 0xff) {
+			text(filename, L"r, ccs=UTF-16BE", UTF16BE);
+		} else {
 			fseek(h, 0, SEEK_SET);
+			text(filename, L"r", UTF8);
 		}
 	}
-	~FileReader() { if (h) fclose(h); }
-	operator FILE*() const { return h; }
-/*
-	int readbuff(void* buffer, size_t size) {
-		return fread(buffer, 1, size, h);
+	~FileReader() {
+		delete lz;
+		if (h)
+			fclose(h);
 	}
-	template<typename T> bool get(T &t) {
-		return readbuff(&t, sizeof(T)) == sizeof(T);
+	operator FILE*() const { return h; }
+	// a compressed file that was damaged or cut short; what came before the damage has been read
+	bool failed() const { return lz && lz->error; }
+
+	// past the byte order mark: on Windows the CRT reopens the file to decode it, elsewhere it is decoded here
+	void text(const wchar_t *filename, const wchar_t *mode, ENCODING enc) {
+#ifdef _WIN32
+		_wfreopen_s(&h, filename, mode, h);
+		crt = true;
+#else
+		(void)filename;
+		(void)mode;
+#endif
+		encoding = enc;
 	}
-*/
+
 	int getc() const {
-		auto c = fgetwc(h);
-        return c == WEOF ? -1 : c;
+#ifdef _WIN32
+		if (crt) {
+			auto c = fgetwc(h);
+			return c == WEOF ? -1 : c;
+		}
+#endif
+		return decode();
+	}
+	bool eof() const {
+		if (crt)
+			return feof(h);
+		return low < 0 && (lz ? lz->eof() : feof(h));
+	}
+
+	int getb() const {
+		return lz ? lz->getb() : ::getc(h);
+	}
+	int decode() const {
+		if (low >= 0)
+			return exchange(low, -1);
+
+		int	c = getb();
+		if (c < 0)
+			return -1;
+
+		if (encoding != UTF8) {
+			int	c1 = getb();
+			return c1 < 0 ? -1 : encoding == UTF16LE ? c | (c1 << 8) : (c << 8) | c1;
+		}
+
+		if (c >= 0x80) {
+			int	extra = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : 1;
+			c &= 0x3f >> extra;
+			while (extra--)
+				c = (c << 6) | (getb() & 0x3f);
+			if (c >= 0x10000) {
+				low	= 0xdc00 + ((c - 0x10000) & 0x3ff);
+				c	= 0xd800 + ((c - 0x10000) >> 10);
+			}
+		}
+		return c;
 	}
-    bool eof() const {
-        return feof(h);
-    }
 
 };
 
@@ -112,6 +272,33 @@ void waitDebugger() {
 	}
 }
 
+void report_error(int r) {
+	switch (r) {
+		case ERROR_SUCCESS:
+			break;
+		case ERROR_FILE_NOT_FOUND:
+			out << L"ERROR: File not found" << endl;
+			break;
+		case ERROR_ACCESS_DENIED:
+			out << L"ERROR: Access denied" << endl;
+			break;
+		case ERROR_TIMEOUT:
+			out << L"ERROR: Timed out, results are partial" << endl;
+			break;
+		default: {
+#ifdef _WIN32
+			out << L"ERROR " << r << L": ";
+			wchar_t *buffer;
+			FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM|FORMAT_MESSAGE_ALLOCATE_BUFFER, nullptr, r, 0, (LPWSTR)&buffer, 0, nullptr);
+			out << buffer << endl;
+#else
+			out << L"ERROR " << r << endl;
+#endif
+			break;
+		}
+	}
+}
+
 //-----------------------------------------------------------------------------
 // base
 //-----------------------------------------------------------------------------
@@ -235,10 +422,21 @@ enum class OP : uint8_t {
 	DEL,
 	EXPORT,
 	IMPORT,
-	/* COPY, SAVE, RESTORE,*/
+	COPY,
+	/* SAVE,*/
+	SNAPSHOT,
+	RESTORE,
 	LOAD,
 	UNLOAD,
-	/* COMPARE, FLAGS*/
+	COMPARE,
+	HASH,
+	SYNC,
+	STATS,
+	COMPACT,
+	SCAN,
+	PERF,
+	MERGE,
+	/* FLAGS*/
 	NUM
 };
 static const wchar_t* ops[] = {
@@ -247,17 +445,25 @@ static const wchar_t* ops[] = {
 	L"DELETE",
 	L"EXPORT",
 	L"IMPORT",
-//	L"COPY",
+	L"COPY",
 //	L"SAVE",
-//	L"RESTORE",
+	L"SNAPSHOT",
+	L"RESTORE",
 	L"LOAD",
 	L"UNLOAD",
-//	L"COMPARE",
+	L"COMPARE",
+	L"HASH",
+	L"SYNC",
+	L"STATS",
+	L"COMPACT",
+	L"SCAN",
+	L"PERF",
+	L"MERGE",
 //	L"FLAGS"
 };
 OP get_op(const wchar_t *op) {
 	for (auto& i : ops) {
-		if (_wcsicmp(op, i) == 0) {
+		if (Wide::wcsicmp(op, i) == 0) {
 			return OP(&i - &ops[0]);
 		}
 	}
@@ -297,7 +503,7 @@ TYPE get_type(const wchar_t *type) {
 	if (!type)
 		return TYPE::SZ;
 	for (auto &t : types) {
-		if (wcscmp(type, t) == 0)
+		if (Wide::wcscmp(type, t) == 0)
 			return TYPE(&t - types);
 	}
 	return TYPE::NUM;
@@ -329,10 +535,6 @@ HIVE get_hive(const string &hive) {
 	return HIVE::NUM;
 }
 
-HKEY hive_to_hkey(HIVE hive) {
-	return (HKEY)intptr_t(0x80000000 + (int)hive);
-}
-
 enum class OPT : uint8_t {
 //string options
 	key			= 0,
@@ -342,6 +544,26 @@ enum class OPT : uint8_t {
 	data,
 	separator,
 	machine,
+	limit,
+	depth,
+	timeout,
+	rate,
+	inflight,
+	latency,
+	since,
+	mark,
+	include,
+	exclude,
+	checkpoint,
+	base,
+	key2,
+	threads,
+	cache,
+	hive,
+	index,
+	interval,
+	mem,
+	delay,
 
 //bool options
 	all_subkeys	= 0,
@@ -355,6 +577,17 @@ enum class OPT : uint8_t {
 	force,
 	view32,
 	view64,
+	binary,
+	compress,
+	resume,
+	output_all,
+	output_diff,
+	output_same,
+	output_none,
+	dry_run,
+	json,
+	regf,
+	idx,
 
 //flags
 	alternative	= 1 << 6,
@@ -376,6 +609,16 @@ struct OPOptions {
 #define opt_end		{OPT::end,		nullptr, nullptr, nullptr}
 #define opt_key		{OPT::key,		nullptr,	L"KeyName",	L"[\\\\Machine\\]FullKey\nMachine - Name of remote machine, omitting defaults to the current machine. Only HKLM and HKU are available on remote machines\nFullKey - in the form of ROOTKEY\\SubKey name\nROOTKEY - [ HKLM | HKCU | HKCR | HKU | HKCC ]\nSubKey  - The full name of a registry key under the selected ROOTKEY\n"}
 #define opt_reg32	{OPT::view32,	L"reg:32",	nullptr,	L"Specifies the key should be accessed using the 32-bit registry view."}
+#define opt_depth	{OPT::depth,	L"depth",	L"Depth",	L"Limits recursion to Depth levels below the key (implies /s)."}
+#define opt_governor \
+	{OPT::rate,		L"rate",	L"CallsPerSecond",	L"Limits registry calls per second (token bucket)."}, \
+	{OPT::latency,	L"latency",	L"Milliseconds",	L"Backs off while the average call latency is above this target."}
+// only where /threads puts calls in flight together; the other walks make one call at a time
+#define opt_inflight	{OPT::inflight,	L"inflight",L"Count",	L"Limits the number of registry calls in flight at once across the threads."}
+#define opt_mem \
+	{OPT::mem,		L"mem",		L"RegFiles",		L"Works on a tree built in memory from these ;-separated .reg files (applied in order, as IMPORT would) instead of the registry, to measure an operation without the registry's costs, or to run it off Windows. Changes are not saved."}, \
+	{OPT::delay,	L"delay",	L"Microseconds",	L"With /mem, adds this much latency to every call."}
+#define opt_bin		{OPT::binary,	L"bin",		nullptr,	L"Writes a length-prefixed binary record stream (key start, value, key end, summary) with raw value data instead of text."}
 #define opt_reg64	{OPT::view64|OPT::alternative,	L"reg:64",	nullptr,	L"Specifies the key should be accessed using the 64-bit registry view."}
 
 static const OPOptions op_options[] = {
@@ -393,6 +636,16 @@ static const OPOptions op_options[] = {
 	{OPT::type,			L"t",	 	L"Type",		L"Specifies registry value data type.\nValid types are:\nREG_SZ, REG_MULTI_SZ, REG_EXPAND_SZ, REG_DWORD, REG_QWORD, REG_BINARY, REG_NONE\nDefaults to all types."},
 	{OPT::numeric_type,	L"z",	 	nullptr,		L"Verbose: Shows the numeric equivalent for the type of the valuename."},
 	{OPT::separator,	L"se",		L"Separator",	L"Specifies the separator (length of 1 character only) in data string for REG_MULTI_SZ. Defaults to \"\\0\" as the separator."},
+	{OPT::limit,		L"max",		L"Count",		L"Stops after Count matches have been returned."},
+	{OPT::index,		L"index",	L"File",		L"Keeps a trigram index of value names and data in File for repeated /f searches from the same key. Keys whose last write time is unchanged are only read if they could match; File is rewritten after a complete /s search."},
+	{OPT::file,			L"reg",		L"RegFile",		L"Reads KeyName from a .reg file (as written by REG EXPORT or regedit) instead of the registry, as the file would leave it if imported.\nSections are indexed when the file is opened; values are only decoded as they are queried."},
+	{OPT::idx,			L"idx",		nullptr,		L"With /reg, builds RegFile.idx if it is missing or out of date; when it is current, only KeyName's sections are read."},
+	{OPT::hive,			L"hive",	L"HiveFile",	L"Reads KeyName from an offline hive file (as written by REG SAVE) instead of the registry; the first component of KeyName stands for the hive's root.\nHiveFile.LOG1 and HiveFile.LOG2, if present, are replayed over it in memory."},
+	opt_mem,
+	opt_depth,
+	{OPT::timeout,		L"timeout",	L"Milliseconds",L"Stops after the given time and returns partial results with ERROR_TIMEOUT."},
+	opt_governor,
+	opt_bin,
 	opt_reg32,
 	opt_reg64,
 	opt_end
@@ -406,6 +659,7 @@ static const OPOptions op_options[] = {
 	{OPT::separator,	L"s",	 	L"Separator",	L"Specify one character that you use as the separator in your data string for REG_MULTI_SZ. If omitted, use \"\\0\" as the separator."},
 	{OPT::data,			L"d",	 	L"Data",		L"The data to assign to the registry ValueName being added."},
 	{OPT::force,		L"f",	 	nullptr,		L"Force overwriting the existing registry entry without prompt."},
+	opt_mem,
 	opt_reg32,
 	opt_reg64,
 	opt_end
@@ -417,6 +671,7 @@ static const OPOptions op_options[] = {
 	{OPT::def_value|OPT::alternative,	L"ve",		nullptr,		L"delete the value of empty value name (Default)."},
 	{OPT::all_values|OPT::alternative,	L"va",		nullptr,		L"delete all values under this key."},
 	{OPT::force,		L"f",	 	nullptr,		L"Forces the deletion without prompt."},
+	opt_mem,
 	opt_reg32,
 	opt_reg64,
 	opt_end
@@ -426,6 +681,25 @@ static const OPOptions op_options[] = {
 	opt_key,
 	{OPT::file,			nullptr,	L"FileName",	L"The name of the disk file to export."},
 	{OPT::force,		L"y",	 	nullptr,		L"Force overwriting the existing file without prompt."},
+	{OPT::compress,		L"z",		nullptr,		L"Compresses the file block by block; IMPORT detects and decompresses it."},
+	{OPT::regf,			L"regf",	nullptr,		L"Writes FileName as a hive file with KeyName as its root, loadable with REG LOAD. /z, /bin and /checkpoint do not apply."},
+	{OPT::idx,			L"idx",		nullptr,		L"Also writes FileName.idx, the place of each key's section in FileName, for IMPORT /k and QUERY /reg. Not with /z, /bin or /regf."},
+	{OPT::since,		L"since",	L"Time|File",	L"Exports only keys written after Time (yyyy-mm-dd[Thh:mm[:ss]] UTC, or a raw FILETIME), or after the mark stored in File.\nAncestor keys are written as empty sections so the changed keys can be placed."},
+	{OPT::mark,			L"mark",	L"File",		L"Writes the time this export started to File, for use with /since on the next run, so keys written while it ran are exported again."},
+	{OPT::value,		L"v",		L"ValueName",	L"Exports only values whose names match this wildcard pattern."},
+	{OPT::type,			L"t",		L"Type",		L"Exports only values of this type."},
+	{OPT::data,			L"f",		L"Data",		L"Exports only values whose data, written as QUERY shows it, matches this wildcard pattern.\nUnlike QUERY /f, key and value names are not searched; use /v for value names and /include for keys."},
+	{OPT::case_sensitive,L"c",		nullptr,		L"Specifies that /v, /f, /include and /exclude are case sensitive."},
+	{OPT::exact,		L"e",		nullptr,		L"Specifies that /f must match the whole data."},
+	{OPT::include,		L"include",	L"Globs",		L"Exports only keys whose path below KeyName matches one of these ;-separated wildcard patterns.\nSubtrees that cannot match are not opened."},
+	{OPT::exclude,		L"exclude",	L"Globs",		L"Skips keys (and their subtrees) whose path below KeyName matches one of these ;-separated wildcard patterns."},
+	opt_depth,
+	{OPT::checkpoint,	L"checkpoint",L"File",		L"Periodically records the last fully written key and file offset in File; it is deleted when the export completes."},
+	{OPT::resume,		L"resume",	nullptr,		L"Continues an interrupted export from its /checkpoint file, after cutting the output back to the recorded offset."},
+	{OPT::hive,			L"hive",	L"HiveFile",	L"Reads KeyName from an offline hive file (as written by REG SAVE) instead of the registry; the first component of KeyName stands for the hive's root.\nHiveFile.LOG1 and HiveFile.LOG2, if present, are replayed over it in memory."},
+	opt_mem,
+	opt_governor,
+	opt_bin,
 	opt_reg32,
 	opt_reg64,
 	opt_end
@@ -434,6 +708,44 @@ static const OPOptions op_options[] = {
 {(Option[]){
 	{OPT::file,			nullptr, 	L"FileName",	L"The name of the disk file to import."},
 	{OPT::machine,		L"machine",	L"Machine",	    L"The name of the machine to import to."},
+	{OPT::hive,			L"hive",	L"HiveFile",	L"Builds HiveFile from the .reg file instead of writing to the registry, without needing Windows. The first key in the file becomes the hive's root."},
+	{OPT::key,			L"k",		L"KeyName",		L"Imports only KeyName and its subkeys; a [-Key] above KeyName removes KeyName alone.\nThe file is read in place, so it must not be compressed; only KeyName's sections are read when FileName.idx is current."},
+	{OPT::idx,			L"idx",		nullptr,		L"With /k, builds FileName.idx if it is missing or out of date."},
+	opt_mem,
+	opt_reg32,
+	opt_reg64,
+	opt_end
+}},
+//COPY
+{(Option[]){
+	opt_key,
+	{OPT::key2,			nullptr,	L"KeyName2",	L"[\\\\Machine\\]FullKey to copy to; created if needed."},
+	{OPT::all_subkeys,	L"s",		nullptr,		L"Copies all subkeys and values."},
+	{OPT::force,		L"f",		nullptr,		L"Copies even if KeyName2 already exists, overwriting values of the same name."},
+	{OPT::threads,		L"threads",	L"Count",		L"Writes independent subtrees on up to Count threads. Defaults to one per processor."},
+	opt_mem,
+	opt_governor,
+	opt_inflight,
+	opt_reg32,
+	opt_reg64,
+	opt_end
+}},
+//SNAPSHOT
+{(Option[]){
+	opt_key,
+	{OPT::file,			nullptr, 	L"FileName",	L"The snapshot file to write: a compact binary tree that can be memory mapped and searched without parsing."},
+	{OPT::base,			L"base",	L"BaseFile",	L"Writes a delta holding only what changed since BaseFile (a snapshot or delta in the same folder as FileName)."},
+	opt_mem,
+	opt_governor,
+	opt_reg32,
+	opt_reg64,
+	opt_end
+}},
+//RESTORE
+{(Option[]){
+	opt_key,
+	{OPT::file,			nullptr, 	L"FileName",	L"The snapshot or delta file (from REG SNAPSHOT) to write into KeyName; a delta is applied over its chain of bases."},
+	opt_mem,
 	opt_reg32,
 	opt_reg64,
 	opt_end
@@ -451,25 +763,126 @@ static const OPOptions op_options[] = {
 	opt_key,
 	opt_end
 }},
+//COMPARE
+{(Option[]){
+	opt_key,
+	{OPT::key2,			nullptr,	L"KeyName2",	L"[\\\\Machine\\]FullKey to compare with KeyName.\nIf only \\\\Machine is given, the same key on that machine is used."},
+	{OPT::value,		L"v",		L"ValueName",	L"Compares only values whose names match this wildcard pattern."},
+	{OPT::def_value|OPT::alternative,	L"ve",		nullptr,		L"Compares only the empty value name (Default)."},
+	{OPT::all_subkeys,	L"s",		nullptr,		L"Compares all subkeys and values."},
+	opt_depth,
+	{OPT::output_all,	L"oa",		nullptr,		L"Outputs all differences and matches."},
+	{OPT::output_diff|OPT::alternative,	L"od",		nullptr,		L"Outputs only differences (the default)."},
+	{OPT::output_same|OPT::alternative,	L"os",		nullptr,		L"Outputs only matches."},
+	{OPT::output_none|OPT::alternative,	L"on",		nullptr,		L"No output; only the result.\nThe exit code is 0 when the keys are identical, 2 when they differ and 1 if the compare failed."},
+	{OPT::file,			L"f",		L"FileName",	L"Writes a .reg patch which, when imported, makes KeyName2 match KeyName."},
+	opt_mem,
+	opt_governor,
+	opt_reg32,
+	opt_reg64,
+	opt_end
+}},
+//HASH
+{(Option[]){
+	opt_key,
+	{OPT::depth,		L"depth",	L"Depth",		L"Prints the digests of subkeys down to Depth levels below the key. By default only the key itself is printed."},
+	{OPT::threads,		L"threads",	L"Count",		L"Hashes subtrees on up to Count threads. Defaults to one per processor."},
+	{OPT::cache,		L"cache",	L"File",		L"Reuses the value digests of keys whose last write time is unchanged since the run that wrote File, then rewrites File."},
+	{OPT::hive,			L"hive",	L"HiveFile",	L"Reads KeyName from an offline hive file (as written by REG SAVE) instead of the registry; the first component of KeyName stands for the hive's root.\nHiveFile.LOG1 and HiveFile.LOG2, if present, are replayed over it in memory."},
+	opt_mem,
+	opt_governor,
+	opt_inflight,
+	opt_reg32,
+	opt_reg64,
+	opt_end
+}},
+//SYNC
+{(Option[]){
+	opt_key,
+	{OPT::key2,			nullptr,	L"KeyName2",	L"[\\\\Machine\\]FullKey to bring in line with KeyName, including all subkeys.\nOnly differing values are written, and only extra keys and values are deleted."},
+	{OPT::dry_run,		L"n",		nullptr,		L"Prints the changes without making them."},
+	{OPT::mark,			L"mark",	L"File",		L"Records when this sync ran; on the next sync, keys neither side has written since then and whose counts still agree are not read.\nBoth machines' clocks must agree."},
+	opt_mem,
+	opt_governor,
+	opt_reg32,
+	opt_reg64,
+	opt_end
+}},
+//STATS
+{(Option[]){
+	opt_key,
+	{OPT::depth,		L"depth",	L"Depth",		L"Reports subtrees down to Depth levels below the key. Defaults to 1."},
+	{OPT::limit,		L"top",		L"Count",		L"Lists the Count largest subtrees, values and widest keys. Defaults to 20."},
+	{OPT::json,			L"json",	nullptr,		L"Writes the report as JSON."},
+	{OPT::threads,		L"threads",	L"Count",		L"Walks subtrees on up to Count threads. Defaults to one per processor."},
+	{OPT::hive,			L"hive",	L"HiveFile",	L"Reads KeyName from an offline hive file (as written by REG SAVE) instead of the registry; the first component of KeyName stands for the hive's root.\nHiveFile.LOG1 and HiveFile.LOG2, if present, are replayed over it in memory."},
+	opt_mem,
+	opt_governor,
+	opt_inflight,
+	opt_reg32,
+	opt_reg64,
+	opt_end
+}},
+//COMPACT
+{(Option[]){
+	{OPT::hive,			nullptr,	L"HiveFile",	L"The hive file to compact; HiveFile.LOG1 and HiveFile.LOG2, if present, are replayed first."},
+	{OPT::file,			nullptr,	L"NewFile",		L"The hive file to write, holding only live keys and values, laid out breadth first with each key next to its lists and values.\nIdentical security descriptors are shared."},
+	opt_end
+}},
+//SCAN
+{(Option[]){
+	{OPT::hive,			nullptr,	L"HiveFiles",	L"The hive files to search; the name may contain wildcards.\nEach file is read in order, cell by cell, including free cells left by deleted keys and values."},
+	{OPT::data,			L"f",		L"Patterns",	L"The ;-separated strings to find in key names, value names and data, as ASCII/Latin-1 and as UTF-16."},
+	{OPT::case_sensitive,L"c",		nullptr,		L"Specifies that the search is case sensitive."},
+	opt_end
+}},
+//PERF
+{(Option[]){
+	{OPT::key,			L"o",		L"Objects",		L"The ;-separated performance objects to sample, by name or title index. Defaults to the Global set."},
+	{OPT::include,		L"counter",	L"Globs",		L"Reports only counters whose name matches one of these ;-separated wildcard patterns."},
+	{OPT::value,		L"instance",L"Globs",		L"Reports only instances whose name matches one of these ;-separated wildcard patterns."},
+	{OPT::interval,		L"interval",L"Milliseconds",L"Time between samples. Defaults to 1000."},
+	{OPT::limit,		L"n",		L"Count",		L"Takes Count samples. Defaults to 2, as rates and averages need two."},
+	{OPT::all_values,	L"all",		nullptr,		L"Reports every counter in each sample; by default only values that changed since they were last reported are written."},
+	{OPT::case_sensitive,L"c",		nullptr,		L"Specifies that the counter and instance patterns are case sensitive."},
+	{OPT::timeout,		L"timeout",	L"Milliseconds",L"Stops sampling after the given time with ERROR_TIMEOUT."},
+	opt_end
+}},
+//MERGE
+{(Option[]){
+	{OPT::file,			nullptr,	L"OutFile InFiles...",	L"The .reg file to write, followed by the .reg files to merge into it, in the order they would be imported.\nLater values win, and [-Key] and \"Value\"=- remove what came before them; OutFile has one section per key, holding only its final values."},
+	{OPT::threads,		L"threads",	L"Count",		L"Reads the input files on up to Count threads. Defaults to one per processor."},
+	{OPT::compress,		L"z",		nullptr,		L"Compresses the file block by block; IMPORT detects and decompresses it."},
+	opt_end
+}},
 };
 
-wchar_t *get_options(Option *opts, int argc, wchar_t *argv[], wchar_t **string_args, uint32_t &bool_args) {
+// arguments beyond the positional options go to rest, for operations that take a list
+wchar_t *get_options(Option *opts, int argc, wchar_t *argv[], wchar_t **string_args, uint32_t &bool_args, wchar_t **rest = nullptr, int *num_rest = nullptr) {
 	auto arge = argv + argc;
 	while (argv < arge) {
 		auto a = *argv++;
-		if (!opts->sw) {
+		if (!opts->sw && opts->desc) {
 			if (a[0] == '/')
 				return a;
 			string_args[(int)opts++->opt] = a;
 			continue;
 		}
 
+		if (a[0] != '/') {
+			if (rest)
+				rest[(*num_rest)++] = a;
+			else if (!opts->desc)
+				return a;
+			continue;
+		}
+
 		if (a[0] == '/') {
 			bool found = false;
 			for (auto o = opts; o->desc; ++o) {
-				if (wcscmp(a + 1, o->sw) == 0) {
+				if (Wide::wcscmp(a + 1, o->sw) == 0) {
 					if (o->arg) {
-						string_args[(int)o->opt] = (*argv)[0] == '/' ? (wchar_t*)L"" : *argv++;
+						string_args[(int)o->opt] = argv == arge || (*argv)[0] == '/' ? (wchar_t*)L"" : *argv++;
 					} else
 						bool_args |= 1 << (int)o->opt;
 					found = true;
@@ -539,11 +952,11 @@ size_t parse_command_data(wchar_t *data, TYPE type, char separator) {
 			return unescape(data, data, separator) * 2 + 2;
 
 		case TYPE::DWORD:
-			*(DWORD*)data = wcstol(data, nullptr, 10);
+			*(DWORD*)data = Wide::wcstol(data, nullptr, 10);
 			return 4;
 
 		case TYPE::QWORD:
-			*(uint64_t*)data = wcstoll(data, nullptr, 10);
+			*(uint64_t*)data = Wide::wcstoll(data, nullptr, 10);
 			return 8;
 
 		case TYPE::BINARY: {
@@ -600,238 +1013,772 @@ void write_reg_data(FileWriter &out, BYTE *data, DWORD size, TYPE type) {
 	}
 }
 
-growing_block<byte> parse_reg_data(const string &line, TYPE &type) {
-	growing_block<byte>	data;
+//-----------------------------------------------------------------------------
+//	KeyWriter
+//	sink for exported keys; RegWriter writes .reg text, BinWriter records
+//-----------------------------------------------------------------------------
 
-	if (line[0] == '"') {
-		auto end = line.find_last('"');
-		if (end) {
-			type = TYPE::SZ;
-			auto size = unescape(string::view(line.begin() + 1, end), (wchar_t*)data.ensure((end - line) * 2)) * 2 + 2;
-			data.alloc(size);
-		}
+struct KeyWriter {
+	virtual void key_start(string::view name) = 0;
+	virtual void value(string::view name, TYPE type, const BYTE *data, DWORD size) = 0;
+	virtual void key_end() = 0;
+	virtual uint64_t position() = 0;	// flushes, for checkpoints
+	virtual ~KeyWriter() {}
+};
 
-	} else if (line.startsWith(L"dword:")) {
-		type = TYPE::DWORD;
-		*((DWORD*)data.alloc(sizeof(DWORD))) = wcstoul(&line[6], nullptr, 16);
+struct RegWriter : FileWriter, KeyWriter {
+	RegWriter(const wchar_t *filename, bool compress, bool append = false) : FileWriter(filename, compress, append) {}
 
-	} else if (line.startsWith(L"qword:")) {
-		type = TYPE::QWORD;
-		*((uint64_t*)data.alloc(sizeof(uint64_t))) = wcstoull(&line[6], nullptr, 16);
+	void key_start(string::view name) override {
+		*this << L'[' << name << L']' << endl;
+	}
+	void value(string::view name, TYPE type, const BYTE *data, DWORD size) override {
+		if (name.size())
+			*this << L'"' << name << L'"';
+		else
+			*this << L'@';
+		*this << L'=';
+		write_reg_data(*this, (BYTE*)data, size, type);
+	}
+	void key_end() override {
+		*this << endl;
+	}
+	uint64_t position() override {
+		return FileWriter::position();
+	}
+	void remove_key(string::view name) {
+		*this << L"[-" << name << L']' << endl << endl;
+	}
+	void remove_value(string::view name) {
+		if (name.size())
+			*this << L'"' << name << L'"';
+		else
+			*this << L'@';
+		*this << L"=-" << endl;
+	}
+};
 
-	} else if (line.startsWith(L"hex")) {
-		auto p = &line[3];
-	 	type = TYPE::BINARY;
+//-----------------------------------------------------------------------------
+//	BinWriter
+//	framed record stream for /bin; every record is
+//		uint8 kind, uint32 length, payload[length]
+//	all integers little-endian, names UTF-16 as stored (no terminator)
+//		KEY_START	path
+//		VALUE		uint32 type, uint32 name_bytes, name, data
+//		KEY_END		-
+//		SUMMARY		uint32 keys, uint32 values, uint64 data_bytes
+//-----------------------------------------------------------------------------
 
-		if (p[0] == '(') {
-			type = (TYPE)wcstoul(p + 1, (wchar_t**)&p, 16);
-			++p;
-		}
+struct BinWriter : KeyWriter {
+	enum KIND : uint8_t {
+		KEY_START	= 1,
+		VALUE		= 2,
+		KEY_END		= 3,
+		SUMMARY		= 4,
+	};
+	FILE		*h;
+	uint32_t	num_keys = 0, num_values = 0;
+	uint64_t	num_bytes = 0;
 
-		if (p[0] == ':')
-			p++;
+	BinWriter(FILE *h) : h(h) {}
+	BinWriter(const wchar_t *filename, bool append = false) {
+		if (_wfopen_s(&h, filename, append ? L"ab" : L"wb") != 0)
+			h = nullptr;
+	}
+	~BinWriter() { if (h) fflush(h); if (h && h != stdout) fclose(h); }
+	explicit operator bool() const { return !!h; }
 
-		for (;;) {
-			wchar_t	*p2;
-			auto v = wcstoul(p, &p2, 16);
-			if (p == p2)
-				break;
-			*data.alloc(1) = v;
-			p 		= p2;
-			if (*p == ',')
-				++p;
+	void header(KIND kind, uint32_t length) {
+		fwrite(&kind, 1, 1, h);
+		fwrite(&length, sizeof(length), 1, h);
+	}
+	void key_start(string::view name) override {
+		header(KEY_START, name.size() * sizeof(wchar_t));
+		fwrite(name.begin(), sizeof(wchar_t), name.size(), h);
+		++num_keys;
+	}
+	void key_end() override {
+		header(KEY_END, 0);
+	}
+	uint64_t position() override {
+		fflush(h);
+		return _telli64(_fileno(h));
+	}
+	void value(string::view name, TYPE type, const BYTE *data, DWORD size) override {
+		uint32_t	fixed[2] = {(uint32_t)type, uint32_t(name.size() * sizeof(wchar_t))};
+		header(VALUE, sizeof(fixed) + fixed[1] + size);
+		fwrite(fixed, sizeof(fixed), 1, h);
+		fwrite(name.begin(), sizeof(wchar_t), name.size(), h);
+		fwrite(data, 1, size, h);
+		++num_values;
+		num_bytes += size;
+	}
+	void summary() {
+		header(SUMMARY, sizeof(num_keys) + sizeof(num_values) + sizeof(num_bytes));
+		fwrite(&num_keys, sizeof(num_keys), 1, h);
+		fwrite(&num_values, sizeof(num_values), 1, h);
+		fwrite(&num_bytes, sizeof(num_bytes), 1, h);
+	}
+};
+
+// builds a hive file whose root is the key named at construction; keys outside it are ignored
+struct HiveWriter : KeyWriter {
+	Hive::Writer	hive;
+	string			root;
+	uint32_t		current	= 0;
+
+	static string::view last_component(string::view name) {
+		auto	p = name.end();
+		while (p > name.begin() && p[-1] != '\\')
+			--p;
+		return {p, name.end()};
+	}
+
+	HiveWriter(string::view root, uint64_t timestamp) : hive((const char16_t*)last_component(root).begin(), last_component(root).size(), timestamp), root(root) {}
+
+	// the key for a full name, created if needed; Hive::NONE if it is not under the root
+	uint32_t key(string::view name, bool create = true) {
+		if (name.size() < root.length() || Hive::fold_compare((const char16_t*)name.begin(), root.length(), (const char16_t*)root.begin(), root.length()) != 0)
+			return Hive::NONE;
+		if (name.size() == root.length())
+			return hive.root();
+		if (name.begin()[root.length()] != '\\')
+			return Hive::NONE;
+
+		auto	path	= (const char16_t*)name.begin() + root.length() + 1;
+		auto	len		= name.size() - root.length() - 1;
+		if (create)
+			return hive.path(path, len);
+
+		auto	k		= hive.root();
+		for (auto end = path + len; k != Hive::NONE && path < end;) {
+			auto	sep = path;
+			while (sep < end && *sep != '\\')
+				++sep;
+			if (sep > path)
+				k = hive.find_key(k, path, sep - path);
+			path = sep + 1;
 		}
+		return k;
 	}
-	return data;
-}
+	void remove_key(string::view name) {
+		auto	k = key(name, false);
+		if (k != Hive::NONE)
+			hive.remove_key(k);
+	}
+	void remove_value(string::view name) {
+		if (current != Hive::NONE)
+			hive.remove_value(current, (const char16_t*)name.begin(), name.size());
+	}
+
+	void key_start(string::view name) override {
+		current = key(name);
+	}
+	void value(string::view name, TYPE type, const BYTE *data, DWORD size) override {
+		if (current != Hive::NONE)
+			hive.set_value(current, (const char16_t*)name.begin(), name.size(), (uint32_t)type, data, size);
+	}
+	void key_end() override {}
+	uint64_t position() override { return 0; }
+
+	bool write(const wchar_t *filename) {
+		FILE	*f;
+		if (_wfopen_s(&f, filename, L"wb") != 0)
+			return false;
+		bool	ok = hive.write(f, (const char16_t*)(const wchar_t*)last_component(filename).begin());
+		return fclose(f) == 0 && ok;
+	}
+};
 
 //-----------------------------------------------------------------------------
 //	RegKey
 //-----------------------------------------------------------------------------
 
+Governor	*governor = nullptr;	// paces every registry call made through RegKey when set
+
+// the registry REG works on: advapi32 on Windows, and elsewhere a tree held in memory until /mem fills one
+#ifdef _WIN32
+Backend::Win32		local_registry;
+#else
+Backend::Memory		local_registry;
+#endif
+Backend::Registry	*registry = &local_registry;
+
 struct RegKey {
 	struct Info {
-		wchar_t	class_name[MAX_PATH] = L"";		// buffer for class name 
 		DWORD	num_subkeys = 0;				// number of subkeys 
 		DWORD	max_subkey	= 0;				// longest subkey size 
-		DWORD	max_class 	= 0;				// longest class string 
 		DWORD	num_values 	= 0;				// number of values for key 
 		DWORD	max_value 	= 0;				// longest value name 
 		DWORD	max_data 	= 0;				// longest value data 
-		DWORD	cbSecurityDescriptor = 0; 		// size of security descriptor 
-		FILETIME last_write;					// last write time 
-
-		Info(HKEY h) {
-			DWORD	class_size = MAX_PATH;		// size of class string 
-			::RegQueryInfoKey(
-				h,								// key handle 
-				class_name,						// buffer for class name 
-				&class_size,					// size of class string 
-				NULL,							// reserved 
-				&num_subkeys,					// number of subkeys 
-				&max_subkey,					// longest subkey size 
-				&max_class,						// longest class string 
-				&num_values,					// number of values for this key 
-				&max_value,						// longest value name 
-				&max_data,						// longest value data 
-				&cbSecurityDescriptor,			// security descriptor 
-				&last_write			 			// last write time 
-			);
+		uint64_t last_write = 0;				// last write time, as a FILETIME
+
+		Info() {}
+		Info(Backend::Registry &backend, Backend::Key key) {
+			Governor::Call	call(governor);
+			Backend::Info	i;
+			if (backend.info(key, i) == ERROR_SUCCESS) {
+				num_subkeys	= i.num_subkeys;
+				max_subkey	= i.max_subkey;
+				num_values	= i.num_values;
+				max_value	= i.max_value;
+				max_data	= i.max_data;
+				last_write	= i.last_write;
+			}
 		}
 	};
 	struct Value {
 		string	name;
 		TYPE	type	= TYPE::NONE;
 		DWORD 	size	= 0;
+		bool	found	= false;		// an empty value is still there
 
-		Value(const wchar_t *name = L"", TYPE type = TYPE::NONE, DWORD size = 0) : name(name), type(type), size(size) {}
-		explicit constexpr operator bool() const { return size; }
+		Value() {}
+		Value(const wchar_t *name, TYPE type, DWORD size) : name(name), type(type), size(size), found(true) {}
+		explicit operator bool() const { return found; }
 	};
 
+	Backend::Registry	*backend	= nullptr;
+	Backend::Key		bkey		= 0;
 
-	HKEY h = nullptr;
-
-	RegKey(HKEY h = nullptr)	: h(h) {}
-	RegKey(RegKey &&b) 			: h(b.h) { b.h = nullptr; }
-	RegKey(const wchar_t *k, REGSAM sam = KEY_READ) {
-		auto	subkey	= wcschr(k, '\\');
-		auto 	hive	= get_hive(subkey ? string(k, subkey - k) : string(k));
-		auto 	ret = ::RegOpenKeyEx(hive_to_hkey(hive), subkey + !!subkey, 0, sam, &h);
-		if (ret != ERROR_SUCCESS)
-			h = nullptr;
+	RegKey() {}
+	RegKey(RegKey &&b) 			: backend(b.backend), bkey(b.bkey) { b.backend = nullptr; }
+	RegKey(Backend::Registry &backend, Backend::Key key) : backend(&backend), bkey(key) {}
+	RegKey(const RegKey &parent, const wchar_t *subkey, Backend::Access access = Backend::OPEN_READ) {
+		open(parent, subkey, access);
 	}
-	RegKey(HKEY hParent, const wchar_t *subkey, REGSAM sam = KEY_READ) {
-		auto ret = ::RegOpenKeyEx(hParent, subkey, 0, sam, &h);
-		if (ret != ERROR_SUCCESS)
-			h = nullptr;
+	~RegKey() {
+		if (backend)
+			backend->close(bkey);
 	}
-	~RegKey() { if (h) ::RegCloseKey(h); }
 
-	RegKey& operator=(RegKey &&b) { swap(h, b.h); return *this; }
+	RegKey& operator=(RegKey &&b) { swap(backend, b.backend); swap(bkey, b.bkey); return *this; }
+
+	explicit operator bool() const { return !!backend; }
+	auto info() 		const { return backend ? Info(*backend, bkey) : Info(); }
 
-	operator HKEY()		const { return h; }
-	auto info() 		const { return Info(h); }
+	// a null name is the default value
+	static uint32_t	length(const wchar_t *name) { return name ? string_length(name) : 0; }
+
+	// path starts with a predefined key when parent is 0
+	LSTATUS open(Backend::Registry &in, Backend::Key parent, const wchar_t *path, Backend::Access access) {
+		Governor::Call	call(governor);
+		Backend::Key	k;
+		auto	ret = in.open(parent, (const char16_t*)path, string_length(path), access, k);
+		*this = ret == ERROR_SUCCESS ? RegKey(in, k) : RegKey();
+		return ret;
+	}
+	LSTATUS open(const RegKey &parent, const wchar_t *subkey, Backend::Access access = Backend::OPEN_READ) {
+		if (!parent) {
+			*this = RegKey();
+			return ERROR_INVALID_HANDLE;
+		}
+		return open(*parent.backend, parent.bkey, subkey, access);
+	}
+	// opens the key, creating it (and any missing keys on the way) if need be
+	LSTATUS create(Backend::Registry &in, Backend::Key parent, const wchar_t *path, bool *existed = nullptr) {
+		if (existed && (*existed = open(in, parent, path, Backend::OPEN_WRITE) == ERROR_SUCCESS))
+			return ERROR_SUCCESS;
+		return open(in, parent, path, Backend::OPEN_CREATE);
+	}
+	LSTATUS create(const RegKey &parent, const wchar_t *subkey, bool *existed = nullptr) {
+		if (!parent) {
+			*this = RegKey();
+			return ERROR_INVALID_HANDLE;
+		}
+		return create(*parent.backend, parent.bkey, subkey, existed);
+	}
+	// deletes a subkey with everything under it
+	LSTATUS remove_key(const wchar_t *subkey) const {
+		Governor::Call	call(governor);
+		return backend->delete_key(bkey, (const char16_t*)subkey, string_length(subkey));
+	}
 
-	auto value(int i, BYTE *data, DWORD data_size) const {
-		wchar_t	name[MAX_VALUE_NAME];
-		DWORD 	name_size 	= MAX_VALUE_NAME;
-		DWORD	type		= 0;
-		auto 	ret		= ::RegEnumValue(h, i, name, &name_size, NULL, &type, data, &data_size);
-		return ret == ERROR_SUCCESS
-			? Value(name, (TYPE)type, data_size)
+	Value value(int i, BYTE *data, DWORD data_size) const {
+		wchar_t		name[MAX_VALUE_NAME];
+		uint32_t	name_size = MAX_VALUE_NAME, type = 0, size = data_size;
+		Governor::Call	call(governor);
+		return backend->enum_value(bkey, i, (char16_t*)name, name_size, type, data, size) == ERROR_SUCCESS
+			? Value(name, (TYPE)type, size)
 			: Value();
 	}
 
-	auto value(const wchar_t *name, BYTE *data, DWORD data_size) const {
-		DWORD	type		= 0;
-		auto 	ret		= ::RegQueryValueEx(h, name, 0, &type, data, &data_size);
-		return ret == ERROR_SUCCESS
-			? Value(name, (TYPE)type, data_size)
+	Value value(const wchar_t *name, BYTE *data, DWORD data_size) const {
+		uint32_t	type = 0, size = data_size;
+		Governor::Call	call(governor);
+		return backend->query_value(bkey, (const char16_t*)name, length(name), type, data, size) == ERROR_SUCCESS
+			? Value(name, (TYPE)type, size)
 			: Value();
 	}
 
-	auto subkey(int i) const {
-		wchar_t	name[MAX_KEY_LENGTH];
-		DWORD 	name_size	= MAX_KEY_LENGTH;
-		auto 	ret			= ::RegEnumKeyEx(h, i,
-			name, &name_size, NULL,
-			NULL, NULL,	//class
-			NULL//&ftLastWriteTime
-		);
-		return ret == ERROR_SUCCESS ? string(name) : string();
+	string subkey(int i) const {
+		wchar_t		name[MAX_KEY_LENGTH];
+		uint32_t	name_size = MAX_KEY_LENGTH;
+		Governor::Call	call(governor);
+		return backend->enum_key(bkey, i, (char16_t*)name, name_size) == ERROR_SUCCESS ? string(name) : string();
 	}
 
-	auto set_value(const wchar_t *name, TYPE type, BYTE *data, DWORD size) {
-		return ::RegSetValueEx(h, name, 0, (int)type, data, size);
+	// a value's data where a failure matters: size is the room in data, and comes back as the size of the value
+	LSTATUS query(const wchar_t *name, BYTE *data, DWORD &size) const {
+		uint32_t	type = 0, n = size;
+		Governor::Call	call(governor);
+		auto	ret = backend->query_value(bkey, (const char16_t*)name, length(name), type, data, n);
+		size = n;
+		return ret;
 	}
 
-	auto remove_value(const wchar_t *name) {
-		return ::RegDeleteValue(h, name);
+	LSTATUS set_value(const wchar_t *name, TYPE type, const BYTE *data, DWORD size) const {
+		Governor::Call	call(governor);
+		return backend->set_value(bkey, (const char16_t*)name, length(name), (uint32_t)type, data, size);
 	}
-};
 
-//-----------------------------------------------------------------------------
-//	Reg
-//-----------------------------------------------------------------------------
+	LSTATUS remove_value(const wchar_t *name) const {
+		Governor::Call	call(governor);
+		return backend->delete_value(bkey, (const char16_t*)name, length(name));
+	}
+};
 
-struct ParsedKey {
-	string	host;
-	HIVE	hive;
-	string	subkey;
+// the registry orders names ordinally by their upper case, so '_' and '[' sort after the letters rather than
+// before them as they would lower-cased (_wcsicmp)
+inline int compare_names(const wchar_t *a, const wchar_t *b) {
+#ifdef _WIN32
+	return CompareStringOrdinal(a, -1, b, -1, TRUE) - CSTR_EQUAL;
+#else
+	return Common::fold_compare((const char16_t*)a, string_length(a), (const char16_t*)b, string_length(b));
+#endif
+}
 
-	ParsedKey(string::view k) {
-		auto p = k.begin();
-		if (p[0] == '\\' && p[1] == '\\') {
-			auto a = p + 2;
-			p 		= wcschr(a, '\\');
-			host	= string(a, p++);
+// heap sort by moves, for records that own memory
+template<typename T, typename L> void sort_moving(T *p, int n, L less) {
+	auto	trade = [](T &a, T &b) {
+		T	t(static_cast<T&&>(a));
+		a = static_cast<T&&>(b);
+		b = static_cast<T&&>(t);
+	};
+	auto	sift = [&](int i, int end) {
+		for (int c; (c = i * 2 + 1) < end; i = c) {
+			if (c + 1 < end && less(p[c], p[c + 1]))
+				++c;
+			if (!less(p[i], p[c]))
+				break;
+			trade(p[i], p[c]);
 		}
-
-		auto a	= p;
-		p		= wcschr(p, '\\');
-		if (p)
-			subkey = string(p + 1, k.end());
-		else
-			p = k.end();
-
-		hive	= get_hive(string(a, p).toupper());
+	};
+	for (int i = n / 2; i--;)
+		sift(i, n);
+	while (n > 1) {
+		trade(p[0], p[--n]);
+		sift(0, n);
 	}
+}
 
-	HKEY get_rootkey() {
-		auto h = hive_to_hkey(hive);
-		if (!host.empty()) {
-			auto ret = RegConnectRegistry(host, h, &h);
-			if (ret != ERROR_SUCCESS)
-				return nullptr;
+// subkey names in the order the registry keeps them
+struct SortedSubkeys {
+	string	*names;
+	int		count	= 0;
+
+	SortedSubkeys(const RegKey &key, int num_subkeys) : names(new string[num_subkeys]) {
+		for (int i = 0; i < num_subkeys; i++) {
+			auto name = key.subkey(i);
+			if (name.length())
+				names[count++] = static_cast<string&&>(name);
 		}
-		return h;
+		sort_moving(names, count, [](const string &a, const string &b) { return compare_names(a, b) < 0; });
 	}
-	auto get_keyname() {
-		string	key = hives[(int)hive][0];
-		return subkey ? key + L'\\' + subkey : key;
+	~SortedSubkeys()	{ delete[] names; }
+	bool	contains(const wchar_t *name) const {
+		int		a = 0, b = count;
+		while (a < b) {
+			int		m = (a + b) / 2;
+			int		c = compare_names(name, names[m]);
+			if (c == 0)
+				return true;
+			if (c < 0)
+				b = m;
+			else
+				a = m + 1;
+		}
+		return false;
 	}
+	auto	begin() const	{ return names; }
+	auto	end()	const	{ return names + count; }
+};
 
-	auto open_key(REGSAM sam, HKEY *h) {
-		return RegOpenKeyEx(get_rootkey(), subkey, 0, sam, h);
-	}
-	auto delete_key(REGSAM sam) {
-		return RegDeleteKeyEx(get_rootkey(), subkey, sam, 0);
-	}
-	auto create_key(REGSAM sam, HKEY *h) {
-		return RegCreateKeyEx(get_rootkey(), subkey, 0, NULL, REG_OPTION_NON_VOLATILE, sam, NULL, h, NULL);
+// values of a key with their data, in the same order as SortedSubkeys
+struct SortedValues {
+	struct Entry {
+		string	name;
+		TYPE	type;
+		DWORD	size;
+		size_t	offset;		// into data
+	};
+	Entry	*entries;
+	int		count	= 0;
+	BYTE	*data	= nullptr;
+
+	SortedValues(const RegKey &key, const RegKey::Info &info) : entries(new Entry[info.num_values]) {
+		size_t	used	= 0, capacity = 0;
+		auto	space	= (BYTE*)malloc(info.max_data + 1);
+		for (int i = 0; i < info.num_values; i++) {
+			if (auto value = key.value(i, space, info.max_data)) {
+				if (used + value.size > capacity) {
+					capacity	= (used + value.size) * 2;
+					data		= (BYTE*)realloc(data, capacity);
+				}
+				memcpy(data + used, space, value.size);
+				entries[count++] = {static_cast<string&&>(value.name), value.type, value.size, used};
+				used += value.size;
+			}
+		}
+		free(space);
+		sort_moving(entries, count, [](const Entry &a, const Entry &b) { return compare_names(a.name, b.name) < 0; });
 	}
+	~SortedValues()	{ delete[] entries; free(data); }
+	auto	begin() const	{ return entries; }
+	auto	end()	const	{ return entries + count; }
+	auto	get(const Entry &e) const { return data + e.offset; }
 };
 
-struct Reg {
-	union {
-		wchar_t *string_args[7] = {nullptr};
-		struct {
-			wchar_t *key, *value, *file, *type, *data, *sep, *machine;
-		};
-	};
+//-----------------------------------------------------------------------------
+//	times
+//-----------------------------------------------------------------------------
 
-	union {
-		uint32_t	bool_args	= 0;
-		struct {
-			bool all_subkeys 		: 1;
-			bool all_values 		: 1;
-			bool def_value 			: 1;
-			bool numeric_type 		: 1;
-			bool keys_only			: 1;
-			bool data_only			: 1;
+inline uint64_t to_uint64(const FILETIME &ft) {
+	return ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+}
+
+// raw FILETIME, or yyyy-mm-dd[Thh:mm[:ss]] in UTC; 0 if unrecognised
+uint64_t parse_time_text(const wchar_t *text) {
+	auto	end = (wchar_t*)text;
+	auto	raw	= Wide::wcstoull(text, &end, 10);
+	if (end != text && !*end)
+		return raw;
+
+	// y-m-d, then h:m:s after a T or spaces; the date is needed, the time may stop after any part
+	static const wchar_t seps[] = L"--T::";
+	int		parts[6]	= {};
+	int		n			= 0;
+	for (auto p = text; n < 6;) {
+		auto	e = (wchar_t*)p;
+		parts[n] = int(Wide::wcstol(p, &e, 10));
+		if (e == p)
+			break;
+		p = e;
+		if (++n == 6)
+			break;
+		if (seps[n - 1] != 'T') {
+			if (*p++ != seps[n - 1])
+				break;
+		} else {
+			if (*p != 'T' && *p != ' ')
+				break;
+			while (*p == 'T' || *p == ' ')
+				++p;
+		}
+	}
+	if (n < 3)
+		return 0;
+
+	SYSTEMTIME	st	= {};
+	st.wYear	= parts[0];
+	st.wMonth	= parts[1];
+	st.wDay		= parts[2];
+	st.wHour	= parts[3];
+	st.wMinute	= parts[4];
+	st.wSecond	= parts[5];
+
+	FILETIME	ft;
+	return SystemTimeToFileTime(&st, &ft) ? to_uint64(ft) : 0;
+}
+
+// a time, or the name of a file whose first line holds one
+uint64_t parse_time(const wchar_t *arg) {
+	if (auto t = parse_time_text(arg))
+		return t;
+
+	FileReader	reader(arg);
+	if (!reader)
+		return 0;
+	return parse_time_text(string(string::read_to(reader, '\n').trim()));
+}
+
+//-----------------------------------------------------------------------------
+//	Reg
+//-----------------------------------------------------------------------------
+
+// the registry of another machine (\\host\HKLM\...), connected to once and kept for the rest of the run
+Backend::Registry *connect(const string &host) {
+#ifdef _WIN32
+	struct Remote {
+		Remote			*next;
+		Backend::Win32	registry;
+		Remote(Remote *next, const wchar_t *host, REGSAM view) : next(next), registry(host, view) {}
+	};
+	static Remote	*remotes = nullptr;
+	for (auto r = remotes; r; r = r->next) {
+		if (Wide::wcsicmp(r->registry.host, host) == 0)
+			return &r->registry;
+	}
+	remotes = new Remote(remotes, host, local_registry.view);
+	return &remotes->registry;
+#else
+	(void)host;
+	return nullptr;
+#endif
+}
+
+struct ParsedKey {
+	string	host;
+	HIVE	hive;
+	string	root;		// as given
+	string	subkey;
+	Backend::Registry	*backend;	// null if host can't be reached
+
+	// machine, if given, overrides any host in k
+	ParsedKey(string::view k, const wchar_t *machine = nullptr) {
+		auto p = k.begin();
+		if (p[0] == '\\' && p[1] == '\\') {
+			auto a = p + 2;
+			p 		= Wide::wcschr(a, '\\');
+			host	= string(a, p++);
+		}
+		if (machine)
+			host = string(machine);
+
+		auto a	= p;
+		p		= Wide::wcschr(p, '\\');
+		if (p)
+			subkey = string(p + 1, k.end());
+		else
+			p = k.end();
+
+		root	= string(a, p);
+		hive	= get_hive(root.toupper());
+		backend	= host.empty() ? registry : connect(host);
+	}
+
+	// the full name of the key, or as given if its root is not a known one
+	string get_keyname() const {
+		string	key = hive == HIVE::NUM ? string(root) : string(hives[(int)hive][0]);
+		return subkey ? key + L'\\' + subkey : key;
+	}
+
+	LSTATUS open_key(RegKey &key, Backend::Access access = Backend::OPEN_READ) const {
+		if (!backend)
+			return ERROR_BAD_NETPATH;
+		return key.open(*backend, 0, get_keyname(), access);
+	}
+	LSTATUS create_key(RegKey &key, bool *existed = nullptr) const {
+		if (!backend)
+			return ERROR_BAD_NETPATH;
+		return key.create(*backend, 0, get_keyname(), existed);
+	}
+	// with everything under it
+	LSTATUS delete_key() const {
+		if (!backend)
+			return ERROR_BAD_NETPATH;
+		auto	name = get_keyname();
+		Governor::Call	call(governor);
+		return backend->delete_key(0, (const char16_t*)(const wchar_t*)name, name.length());
+	}
+};
+
+// a key or value name from a hive file, cut to MAX_VALUE_NAME
+string hive_name(Hive::Reader::Name name) {
+	wchar_t	buffer[MAX_VALUE_NAME + 1];
+	auto	n = name.length < MAX_VALUE_NAME ? name.length : MAX_VALUE_NAME;
+	for (uint32_t i = 0; i < n; i++)
+		buffer[i] = name[i];
+	return string(buffer, buffer + n);
+}
+
+// maps a hive file and replays the .LOG1/.LOG2 files beside it over it in memory
+int open_hive(Hive::Reader &hive, const MappedFile &file, const wchar_t *filename) {
+	if (!file)
+		return ERROR_FILE_NOT_FOUND;
+	if (!hive.open(file.p, file.size))
+		return ERROR_BADDB;
+
+	// a hive copied from a running system keeps its latest writes in the logs
+	MappedFile	log1(string(filename) + L".LOG1"), log2(string(filename) + L".LOG2");
+	hive.replay(log1.p, log1.size, log2.p, log2.size);
+	return hive ? ERROR_SUCCESS : ERROR_BADDB;
+}
+
+//-----------------------------------------------------------------------------
+// .reg section index
+//	FileName.idx holds the place of each section in FileName, sorted by key, so one key and its subkeys
+//	can be read in place; an index that no longer matches the file is ignored
+//-----------------------------------------------------------------------------
+
+int write_section_index(const RegFile::Document &doc, const wchar_t *filename) {
+	auto	index_name = string(filename) + L".idx";
+	FILE	*f;
+	if (_wfopen_s(&f, index_name, L"wb") != 0) {
+		out << L"Failed to create file: " << index_name << endl;
+		return errno;
+	}
+	bool	ok = RegFile::SectionIndex::write(f, doc);
+	fclose(f);
+	return ok ? ERROR_SUCCESS : ERROR_WRITE_FAULT;
+}
+
+// the sections of keyname, its subkeys and its ancestors through FileName.idx, or else (or with no keyname) every section,
+// (re)building the index if asked
+int open_reg_file(RegFile::Document &doc, const MappedFile &file, const wchar_t *filename, const string &keyname, bool write_index) {
+	if (!file)
+		return ERROR_FILE_NOT_FOUND;
+
+	RegFile::SectionIndex	index;
+	FILE	*f;
+	if (!keyname.empty() && _wfopen_s(&f, string(filename) + L".idx", L"rb") == 0) {
+		bool	loaded = index.load(f);
+		fclose(f);
+		if (loaded && doc.open(file.p, file.size, index, (const char16_t*)(const wchar_t*)keyname, keyname.length()))
+			return ERROR_SUCCESS;
+	}
+
+	if (!doc.open(file.p, file.size))
+		return ERROR_INVALID_DATA;
+	return write_index ? write_section_index(doc, filename) : ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+// SourceKey
+// the key a read-only operation walks: in the registry (which /mem may have replaced), or in a hive file
+// given by /hive, with any .LOG1/.LOG2 beside it replayed over the mapped pages
+//-----------------------------------------------------------------------------
+
+struct SourceKey {
+	MappedFile			*file		= nullptr;
+	Hive::Reader		hive;
+	Backend::HiveFile	*offline	= nullptr;
+	RegKey				key;
+	string				keyname;
+
+	~SourceKey() {
+		key = RegKey();		// closed before its backend goes
+		delete offline;
+		delete file;
+	}
+
+	// with a hive file the first component of the name stands for its root, so HKLM\Software and X\Software are the same
+	int open(const wchar_t *name, const wchar_t *hive_file) {
+		if (!hive_file) {
+			ParsedKey	parsed(name);
+			keyname	= parsed.get_keyname();
+			return parsed.open_key(key);
+		}
+
+		file = new MappedFile(hive_file);
+		if (auto ret = open_hive(hive, *file, hive_file))
+			return ret;
+		offline	= new Backend::HiveFile(hive);
+		keyname	= string(name);
+		return key.open(*offline, 0, name, Backend::OPEN_READ);
+	}
+};
+
+//-----------------------------------------------------------------------------
+// RegFileSource
+// the key QUERY /reg walks: the sections of an uncompressed .reg file, mapped and indexed but not parsed
+//-----------------------------------------------------------------------------
+
+struct RegFileSource {
+	MappedFile			*file	= nullptr;
+	RegFile::Document	doc;
+	uint32_t			section	= RegFile::NONE;
+	string				keyname;
+
+	~RegFileSource() { delete file; }
+
+	int open(const wchar_t *name, const wchar_t *filename, bool write_index) {
+		ParsedKey	parsed(name);
+		keyname	= parsed.get_keyname();
+
+		file = new MappedFile(filename);
+		if (auto ret = open_reg_file(doc, *file, filename, keyname, write_index))
+			return ret;
+
+		section	= doc.find((const char16_t*)(const wchar_t*)keyname, keyname.length());
+		if (section == RegFile::NONE || !doc.live(section))
+			return ERROR_FILE_NOT_FOUND;
+		return ERROR_SUCCESS;
+	}
+};
+
+struct Reg {
+	union {
+		wchar_t *string_args[27] = {nullptr};
+		struct {
+			wchar_t *key, *value, *file, *type, *data, *sep, *machine, *limit, *depth, *timeout, *rate, *inflight, *latency, *since, *mark, *include, *exclude, *checkpoint, *base_file, *key2, *threads, *cache, *hive_file, *index_file, *interval, *mem_files, *delay;
+		};
+	};
+
+	union {
+		uint32_t	bool_args	= 0;
+		struct {
+			bool all_subkeys 		: 1;
+			bool all_values 		: 1;
+			bool def_value 			: 1;
+			bool numeric_type 		: 1;
+			bool keys_only			: 1;
+			bool data_only			: 1;
 			bool case_sensitive		: 1;
 			bool exact	 			: 1;
 			bool force 	 			: 1;
 			bool view32 			: 1;
 			bool view64 			: 1;
+			bool binary				: 1;
+			bool compress			: 1;
+			bool resume				: 1;
+			bool output_all			: 1;
+			bool output_diff		: 1;
+			bool output_same		: 1;
+			bool output_none		: 1;
+			bool dry_run			: 1;
+			bool json				: 1;
+			bool regf				: 1;
+			bool section_index		: 1;
 		};
 	};
+	wchar_t	**inputs	= nullptr;	// MERGE's list of files
+	int		num_inputs	= 0;
 	bool	values_only	= false;
 	TYPE	types_only	= TYPE::NUM;
 	wchar_t separator	= L'\0';
 
 	int		found_keys	= 0, found_values = 0, found_data = 0;
+	BinWriter *bin		= nullptr;
+
+	uint32_t	max_found	= ~0u;
+	uint32_t	max_depth	= ~0u;
+	ULONGLONG	deadline	= 0;
+	uint32_t	num_found	= 0;
+	bool		stopped		= false;
+	int			stop_status	= ERROR_SUCCESS;
+	bool		exit_code	= false;	// the operation returned an exit code of its own and reported any error itself
+	Governor	gov;
+	Backend::Memory	*memory	= nullptr;	// /mem
+	uint64_t	since_time	= 0;
+	uint64_t	export_started = 0;	// FILETIME the export began, carried over a resume
+	size_t		root_length	= 0;
+	int			num_include	= 0, num_exclude = 0;
+	string		resume_key;
+	uint32_t	since_checkpoint = 0;
+
+	static const uint32_t	CHECKPOINT_KEYS = 1024;	// keys written between checkpoints
+
+	~Reg() {
+		if (governor == &gov)
+			governor = nullptr;
+		if (memory) {
+			registry = &local_registry;
+			delete memory;
+		}
+	}
 
+#ifdef _WIN32
 	REGSAM	get_sam() const {
 		REGSAM	sam = 0;
 		if (view32)
@@ -840,6 +1787,44 @@ struct Reg {
 			sam |= KEY_WOW64_64KEY;
 		return sam;
 	}
+#endif
+
+	// where keys are opened: a tree built in memory from the .reg files given by /mem, in order as IMPORT would
+	// apply them and with /delay microseconds added to every call, or else the registry in the view asked for
+	// only the sections of the key, its subkeys and its ancestors are loaded from a file with an index, unless there is a second key
+	int open_registry() {
+#ifdef _WIN32
+		local_registry.view = get_sam();
+#endif
+		if (!mem_files)
+			return ERROR_SUCCESS;
+
+		auto	keyname = key && !key2 ? ParsedKey(key).get_keyname() : string();
+		memory				= new Backend::Memory;
+		memory->delay_us	= delay ? Wide::wcstoul(delay, nullptr, 10) : 0;
+		for (auto p = mem_files; *p;) {
+			auto	e = Wide::wcschr(p, ';');
+			string	filename = e ? string(p, e) : string(p);
+			p		= e ? e + 1 : p + Wide::wcslen(p);
+			if (!filename)
+				continue;
+
+			MappedFile			mapped(filename);
+			RegFile::Document	doc;
+			if (auto ret = open_reg_file(doc, mapped, filename, keyname, false)) {
+				out << (ret == ERROR_INVALID_DATA ? L"Not an uncompressed .reg file: " : L"Failed to open file: ") << filename << endl;
+				return ret;
+			}
+			memory->load(doc);
+		}
+		registry = memory;
+		return ERROR_SUCCESS;
+	}
+
+	// the key the command reads: in the registry or a hive file (/hive)
+	int open_source(SourceKey &source) {
+		return source.open(key, hive_file);
+	}
 
 	bool check_value(const string &name) {
 		return !value || !value[0] || wildcard_check((case_sensitive ? name : name.tolower()), value, true);
@@ -850,7 +1835,191 @@ struct Reg {
 			: wildcard_check((case_sensitive ? name : name.tolower()), data);
 
 	}
-	void query(const RegKey &r, string keyname, bool print_key);
+	void prepare_patterns() {
+		if (!case_sensitive) {
+			for (auto s : {data, value, include, exclude}) {
+				if (s) {
+					for (auto p = s; *p; ++p)
+						*p = tolower(*p);
+				}
+			}
+		}
+		num_include	= split_patterns(include);
+		num_exclude	= split_patterns(exclude);
+	}
+	static int split_patterns(wchar_t *s) {
+		if (!s || !*s)
+			return 0;
+		int	n = 1;
+		for (; *s; ++s) {
+			if (*s == ';') {
+				*s = 0;
+				++n;
+			}
+		}
+		return n;
+	}
+	static bool any_pattern(const wchar_t *patterns, int n, const wchar_t *name) {
+		for (; n--; patterns += string_length(patterns) + 1) {
+			if (wildcard_check(name, patterns, true))
+				return true;
+		}
+		return false;
+	}
+	// could name, or anything below it, match one of the patterns?
+	static bool any_prefix(const wchar_t *patterns, int n, string::view name) {
+		for (; n--; patterns += string_length(patterns) + 1) {
+			auto	p = patterns;
+			auto	i = name.begin();
+			while (*p && *p != '*' && *p != '?' && i != name.end() && *p == *i) {
+				++p;
+				++i;
+			}
+			if (!*p ? i == name.end() : *p == '*' || *p == '?' || i == name.end())
+				return true;
+		}
+		return false;
+	}
+	void write_checkpoint(KeyWriter &out, const string &keyname) {
+		auto		offset	= out.position();
+		FileWriter	cp(checkpoint);
+		cp << offset << endl << keyname << endl << export_started << endl;
+	}
+	bool read_checkpoint(uint64_t &offset) {
+		FileReader	reader(checkpoint);
+		if (!reader)
+			return false;
+		offset		= Wide::wcstoull(string::read_to(reader, '\n'), nullptr, 10);
+		resume_key	= string(string::read_to(reader, '\n').trim());
+		if (auto t = Wide::wcstoull(string::read_to(reader, '\n'), nullptr, 10))
+			export_started = t;	// so /mark covers the keys written before the interruption
+		return !resume_key.empty();
+	}
+	// 0: keyname is not on the way to resume_key, 1: an ancestor of it, 2: resume_key itself
+	int on_resume_path(const string &keyname) const {
+		if (resume_key.empty())
+			return 0;
+		auto	n = keyname.length();
+		if (n > resume_key.length() || Wide::wcsnicmp(keyname, resume_key, n) != 0)
+			return 0;
+		return resume_key[n] == 0 ? 2 : resume_key[n] == '\\' ? 1 : 0;
+	}
+	bool filter_values() const {
+		return (value && *value) || def_value || types_only != TYPE::NUM || data;
+	}
+	string relative_name(const string &keyname) const {
+		return keyname.length() > root_length ? string(keyname.substr(root_length + 1)) : string(L"");
+	}
+
+	void set_limits() {
+		if (limit && *limit) {
+			max_found	= Wide::wcstoul(limit, nullptr, 10);
+			stopped		= max_found == 0;	// add_found only stops after a match
+		}
+		if (depth && *depth) {
+			max_depth	= Wide::wcstoul(depth, nullptr, 10);
+			all_subkeys = true;
+		}
+		if (timeout && *timeout)
+			deadline	= GetTickCount64() + Wide::wcstoul(timeout, nullptr, 10);
+	}
+	void set_governor() {
+		if (rate && *rate)
+			gov.set_rate(Wide::wcstod(rate, nullptr));
+		if (inflight && *inflight)
+			gov.max_inflight = Wide::wcstoul(inflight, nullptr, 10);
+		if (latency && *latency)
+			gov.latency_target = Wide::wcstod(latency, nullptr) / 1000;
+		if (gov.active())
+			governor = &gov;
+	}
+	void report_governor() {
+		if (governor) {
+			auto &s = governor->stats;
+			out << L"Governor: " << s.calls << L" calls, "
+				<< s.rate_waits << L" rate waits, " << s.inflight_waits << L" inflight waits, "
+				<< s.backoffs << L" backoffs, peak inflight " << s.peak_inflight << L", "
+				<< int(s.waited * 1000) << L"ms throttled, "
+				<< int(s.latency * 1000000) << L"us avg latency, "
+				<< int(s.duty * 100) << L"% duty" << endl;
+		}
+	}
+	bool should_stop() {
+		if (!stopped && deadline && GetTickCount64() >= deadline) {
+			stopped		= true;
+			stop_status	= ERROR_TIMEOUT;
+		}
+		return stopped;
+	}
+	void add_found() {
+		if (++num_found >= max_found)
+			stopped = true;
+	}
+	void query(const RegKey &r, string keyname, bool print_key, uint32_t level = 0);
+	void query(const RegFile::Document &doc, uint32_t section, const string &keyname, bool printed_key, uint32_t level = 0);
+	bool query_value(const string &keyname, bool printed_key, const string &name, TYPE type, BYTE *data, DWORD size, string &data_string, bool formatted);
+	bool query_values(const RegKey &r, const RegKey::Info &info, const string &keyname, bool printed_key, Index::Trigrams *trigrams = nullptr);
+	bool query_subkey(const string &keyname, const string &name);
+
+	Index::File		index_in;
+	Index::Builder	index_out;
+	Index::Trigrams	index_query;
+	uint32_t		num_indexed = 0, num_unchanged = 0;
+	static void add_trigrams(Index::Trigrams &t, const string &s) {
+		auto	lower = s.tolower();
+		t.add((const char16_t*)(const wchar_t*)lower, lower.length());
+	}
+	void query_indexed(const RegKey &r, const string &keyname, const string &name, size_t old, bool printed_key, uint32_t level = 0);
+	int query_index(const RegKey &root, const string &keyname);
+	void export_key(KeyWriter &out, const RegKey &key, const string &keyname, struct PendingKey *parent, uint32_t level = 0);
+
+	RegWriter	*patch			= nullptr;
+	uint32_t	num_compared	= 0, num_quick = 0, num_differences = 0;
+	bool compare_name(const string &name) {
+		return def_value ? name.empty() : check_value(name);
+	}
+	void report(wchar_t side, const string &keyname) {
+		if (side == '=' ? output_all || output_same : !output_same && !output_none)
+			out << side << L' ' << keyname << endl;
+	}
+	void report(wchar_t side, const string &keyname, const SortedValues &values, const SortedValues::Entry &v) {
+		if (side == '=' ? output_all || output_same : !output_same && !output_none) {
+			out << side << L' ' << keyname << L"	" << (v.name.length() ? v.name : string(L"(Default)")) << L"	" << types[v.type < TYPE::NUM ? (int)v.type : 0] << L"	";
+			write_command_data(out, (BYTE*)values.get(v), v.size, v.type, (wchar_t*)L"\\0");
+			out << endl;
+		}
+	}
+	void compare_key(const RegKey &a, const RegKey &b, const string &name_a, const string &name_b, uint32_t level = 0);
+	void patch_key(const RegKey &key, const string &keyname, uint32_t level);
+	int compare();
+
+	DigestCache				hash_cache;
+	FILE					*new_cache		= nullptr;
+	std::mutex				cache_lock;
+	std::atomic<int>		spare_threads{0};
+	std::atomic<uint32_t>	num_hashed{0}, num_cached{0};
+	uint32_t				hash_depth		= 0;
+	SHA256::Digest hash_key(const RegKey &key, const string &keyname, uint32_t level, string &lines);
+
+	std::atomic<uint32_t>	num_copied_keys{0}, num_copied_values{0};
+	void copy_worker(struct CopyQueue &queue);
+
+	uint64_t	dst_since	= 0;
+	int			sync_error	= 0;
+	void sync_action(const wchar_t *action, const string &keyname, const wchar_t *value = nullptr, int ret = 0) {
+		++num_differences;
+		out << action << L' ' << keyname;
+		if (value)
+			out << L"	" << (*value ? value : L"(Default)");
+		out << endl;
+		if (ret && !sync_error)
+			sync_error = ret;
+	}
+	void sync_key(const RegKey &src, const RegKey &dst, const string &keyname);
+
+	uint32_t	stats_depth	= 1;
+	struct StatsReport	*stats	= nullptr;
+	void stats_key(const RegKey &key, const string &keyname, uint32_t level, struct TreeStats &result);
 
 
 	int doQUERY();
@@ -858,12 +2027,21 @@ struct Reg {
 	int doDELETE();
 	int doEXPORT();
 	int doIMPORT();
-//	int doCOPY()	{ return 0; }
+	int import_key();
+	int doCOPY();
 //	int doSAVE()	{ return 0; }
-//	int doRESTORE() { return 0; }
+	int doSNAPSHOT();
+	int doRESTORE();
 	int doLOAD();
 	int doUNLOAD();
-//	int doCOMPARE() { return 0; }
+	int doCOMPARE();
+	int doHASH();
+	int doSYNC();
+	int doSTATS();
+	int doCOMPACT();
+	int doSCAN();
+	int doPERF();
+	int doMERGE();
 //	int doFLAGS()	{ return 0; }
 };
 
@@ -871,93 +2049,279 @@ struct Reg {
 // query
 //-----------------------------------------------------------------------------
 
-void Reg::query(const RegKey &r, string keyname, bool printed_key) {
-	auto info 		= r.info();
+// formatted says data_string already holds the data as text
+bool Reg::query_value(const string &keyname, bool printed_key, const string &name, TYPE type, BYTE *data, DWORD size, string &data_string, bool formatted) {
 	auto tab		= L"	";
-	auto space		= (BYTE*)malloc(info.max_data + 1);
 
-	// Enumerate the values
-	if (!data || data_only || values_only) {
-		for (int i = 0; i < info.num_values; i++) {
-			if (auto value = r.value(i, space, info.max_data)) {
-				if (!check_value(value.name))
-					continue;
+	if (!check_value(name))
+		return printed_key;
 
-				if (types_only != TYPE::NUM && value.type != types_only)
-					continue;
+	if (types_only != TYPE::NUM && type != types_only)
+		return printed_key;
 
-				bool values_pass	= !values_only || check_data(value.name);
+	bool values_pass	= !values_only || check_data(name);
 
-				string	data_string;
-				if (data_only || values_pass) {
-					StringBuilder	b(data_string);
-					write_command_data(b, space, value.size, value.type, sep);
-				}
+	if (!formatted && (data_only || (values_pass && !bin))) {
+		StringBuilder	b(data_string);
+		write_command_data(b, data, size, type, sep);
+	}
 
-				bool data_pass		= !data_only || check_data(data_string);
-				
-				if (values_only && data_only ? values_pass || data_pass : values_pass && data_pass) {
-					found_values	+= values_pass;
-					found_data		+= data_pass;
+	bool data_pass		= !data_only || check_data(data_string);
+	
+	if (values_only && data_only ? values_pass || data_pass : values_pass && data_pass) {
+		found_values	+= values_pass;
+		found_data		+= data_pass;
 
-					if (!printed_key) {
-						out << keyname << endl;
-						printed_key = true;
-					}
+		if (!printed_key) {
+			if (bin)
+				bin->key_start(keyname);
+			else
+				out << keyname << endl;
+			printed_key = true;
+		}
+
+		add_found();
+		if (bin) {
+			bin->value(name, type, data, size);
+			return printed_key;
+		}
 
-					out << tab;
-					if (value.name.length())
-						out << value.name;
-					else
-						out << L"(Default)";
-					out << tab << types[value.type < TYPE::NUM ? (int)value.type : 0];
+		out << tab;
+		if (name.length())
+			out << name;
+		else
+			out << L"(Default)";
+		out << tab << types[type < TYPE::NUM ? (int)type : 0];
 
-					if (numeric_type)
-						out << L" (" << (int)value.type << L')';
+		if (numeric_type)
+			out << L" (" << (int)type << L')';
 
-					out << tab << data_string << endl;
-				}
+		out << tab << data_string << endl;
+	}
+	return printed_key;
+}
+
+bool Reg::query_values(const RegKey &r, const RegKey::Info &info, const string &keyname, bool printed_key, Index::Trigrams *trigrams) {
+	bool	show	= !data || data_only || values_only;
+	if (!show && !trigrams)
+		return printed_key;
+
+	auto space		= (BYTE*)malloc(info.max_data + 1);
+
+	for (int i = 0; i < info.num_values && !should_stop(); i++) {
+		if (auto value = r.value(i, space, info.max_data)) {
+			// an indexed key needs every value's name and data, whatever is shown
+			string	data_string;
+			if (trigrams) {
+				StringBuilder	b(data_string);
+				write_command_data(b, space, value.size, value.type, sep);
+				add_trigrams(*trigrams, value.name);
+				add_trigrams(*trigrams, data_string);
 			}
+			if (show)
+				printed_key = query_value(keyname, printed_key, value.name, value.type, space, value.size, data_string, !!trigrams);
 		}
-
-		if (printed_key)
-			out << endl;
 	}
 
+	if (show && printed_key && !bin)
+		out << endl;
+
 	free(space);
+	return printed_key;
+}
+
+bool Reg::query_subkey(const string &keyname, const string &name) {
+	auto check = !keys_only || check_data(name);
+	if (check) {
+		if (bin)
+			bin->key_start(keyname + L"\\" + name);
+		else
+			out << keyname << L'\\' << name << endl;
+		++found_keys;
+		add_found();
+	}
+	return check;
+}
+
+void Reg::query(const RegKey &r, string keyname, bool printed_key, uint32_t level) {
+	auto info 		= r.info();
+
+	// Enumerate the values
+	printed_key = query_values(r, info, keyname, printed_key);
+
+	if (printed_key && bin)
+		bin->key_end();
 
 	// Enumerate the subkeys
-	for (int i = 0; i < info.num_subkeys; i++) {
+	for (int i = 0; i < info.num_subkeys && !should_stop(); i++) {
 		auto name = r.subkey(i);
 		if (name.length()) {
-			auto check = !keys_only || check_data(name);
-			if (check) {
-				out << keyname << L'\\' << name << endl;
-				++found_keys;
-			}
-			if (all_subkeys)
-				query(RegKey(r, name, KEY_READ | get_sam()), keyname + L"\\" + name, check);
+			auto check = query_subkey(keyname, name);
+			if (all_subkeys && level < max_depth && !stopped)
+				query(RegKey(r, name), keyname + L"\\" + name, check, level + 1);
+			else if (check && bin)
+				bin->key_end();
 		}
 	}
 }
 
-int Reg::doQUERY() {
-	ParsedKey	parsed(key);
-	HKEY		h;
-	if (auto ret = parsed.open_key(KEY_READ | get_sam(), &h))
-		return ret;
+//-----------------------------------------------------------------------------
+// query /reg
+//	the same walk over a .reg file: values are taken as the file would leave them, and only decoded once their name passes
+//-----------------------------------------------------------------------------
 
-	if (!case_sensitive) {
-		if (data) {
-			for (auto p = data; *p; ++p)
-				*p = tolower(*p);
+void Reg::query(const RegFile::Document &doc, uint32_t section, const string &keyname, bool printed_key, uint32_t level) {
+	bool	show	= !data || data_only || values_only;
+	if (show) {
+		RegFile::Array<RegFile::Value>	values;
+		RegFile::Array<char16_t>		name;
+		RegFile::Array<uint8_t>			bytes;
+		doc.values(section, values);
+
+		for (uint32_t i = 0; i < values.n && !should_stop(); i++) {
+			doc.name(values[i], name);
+			auto	value_name = name.n ? string((const wchar_t*)name.p, name.n) : string(L"");
+			if (!check_value(value_name))
+				continue;
+			auto	type = doc.data(values[i], bytes);
+			if (type == RegFile::NONE)
+				continue;
+			string	data_string;
+			printed_key = query_value(keyname, printed_key, value_name, (TYPE)type, bytes.p, bytes.n, data_string, false);
 		}
-		if (value) {
-			for (auto p = value; *p; ++p)
-				*p = tolower(*p);
+		if (printed_key && !bin)
+			out << endl;
+	}
+
+	if (printed_key && bin)
+		bin->key_end();
+
+	RegFile::Array<char16_t>	sub;
+	doc.subkeys(section, [&](uint32_t child) {
+		if (should_stop() || !doc.live(child))
+			return;
+		doc.path(child, sub, true);
+		auto	name	= string((const wchar_t*)sub.p, sub.n);
+		auto	check	= query_subkey(keyname, name);
+		if (all_subkeys && level < max_depth && !stopped)
+			query(doc, child, keyname + L"\\" + name, check, level + 1);
+		else if (check && bin)
+			bin->key_end();
+	});
+}
+
+//-----------------------------------------------------------------------------
+// query /index
+//	the tree is walked alongside the previous index: a key whose last write time is unchanged
+//	reuses its trigrams and subkey names, and its values are only read if they could match
+//	(last_write does not cover changes further down, so every key is still opened)
+//-----------------------------------------------------------------------------
+
+void Reg::query_indexed(const RegKey &r, const string &keyname, const string &name, size_t old, bool printed_key, uint32_t level) {
+	auto	info	= r.info();
+	auto	stamp	= info.last_write;
+	bool	descend	= all_subkeys && level < max_depth;
+	auto	flags	= descend ? Index::SUBKEYS : 0;
+
+	Index::Record	prev;
+	bool	known	= index_in.get(old, prev);
+	bool	same	= known && stamp && prev.last_write == stamp;
+	size_t	record;
+	++num_indexed;
+
+	if (same) {
+		++num_unchanged;
+		if (prev.contains(index_query))
+			printed_key = query_values(r, info, keyname, printed_key);
+		record = index_out.begin(stamp, flags | (prev.flags & Index::ALL), (const char16_t*)(const wchar_t*)name, name.length(), prev.trigrams, prev.count);
+	} else {
+		Index::Trigrams	trigrams;
+		printed_key = query_values(r, info, keyname, printed_key, &trigrams);
+		trigrams.finish();
+		record = index_out.begin(stamp, flags, (const char16_t*)(const wchar_t*)name, name.length(), trigrams);
+	}
+
+	if (printed_key && bin)
+		bin->key_end();
+
+	auto	subkey = [&](const string &sub, size_t old_sub) {
+		auto check = query_subkey(keyname, sub);
+		if (descend && !stopped)
+			query_indexed(RegKey(r, sub), keyname + L"\\" + sub, sub, old_sub, check, level + 1);
+		else if (check && bin)
+			bin->key_end();
+	};
+
+	if (same && (prev.flags & Index::SUBKEYS)) {
+		Index::Record	child;
+		for (auto i = prev.end(); i < prev.next && !should_stop() && index_in.get(i, child); i = child.next)
+			subkey(string((const wchar_t*)child.name, child.length), i);
+
+	} else {
+		size_t	cursor	= known ? prev.end() : 0;
+		for (int i = 0; i < info.num_subkeys && !should_stop(); i++) {
+			auto sub = r.subkey(i);
+			if (sub.length())
+				subkey(sub, known ? index_in.find(prev, cursor, (const char16_t*)(const wchar_t*)sub, sub.length()) : Index::NONE);
 		}
 	}
 
+	index_out.end(record);
+}
+
+// the previous index is read whole; a new one is built as the tree is walked, and replaces it if it differs
+int Reg::query_index(const RegKey &root, const string &keyname) {
+	auto	sep16	= (const char16_t*)(const wchar_t*)sep;
+	auto	sep_len	= (uint32_t)string_length(sep);
+	FILE	*f;
+	if (_wfopen_s(&f, index_file, L"rb") == 0) {
+		index_in.load(f, sep16, sep_len);
+		fclose(f);
+	}
+
+	// every literal run of the pattern appears in anything it matches
+	for (auto p = data; *p;) {
+		auto	e = p;
+		while (*e && (exact || (*e != '*' && *e != '?')))
+			++e;
+		add_trigrams(index_query, string(p, e));
+		p = *e ? e + 1 : e;
+	}
+	index_query.finish();
+
+	Index::Record	top;
+	query_indexed(root, keyname, keyname, index_in.get(0, top) && top.same_name((const char16_t*)(const wchar_t*)keyname, keyname.length()) ? 0 : Index::NONE, false);
+
+	// a partial walk would drop whatever it did not reach
+	if (stopped || !all_subkeys || max_depth != ~0u)
+		return 0;
+	if (index_out.size == index_in.size - index_in.records && memcmp(index_out.p, index_in.data + index_in.records, index_out.size) == 0)
+		return 0;
+
+	auto	index_new = string(index_file) + L".new";
+	if (_wfopen_s(&f, index_new, L"wb") != 0) {
+		out << L"Failed to create file: " << index_new << endl;
+		return errno;
+	}
+	bool	ok = index_out.write(f, sep16, sep_len);
+	fclose(f);
+	if (!ok)
+		return ERROR_WRITE_FAULT;
+	if (!MoveFileExW(index_new, index_file, MOVEFILE_REPLACE_EXISTING))
+		return GetLastError();
+	return 0;
+}
+
+int Reg::doQUERY() {
+	set_governor();
+
+	SourceKey		source;
+	RegFileSource	reg_file;
+	if (auto ret = file ? reg_file.open(key, file, section_index) : open_source(source))
+		return ret;
+
+	prepare_patterns();
+
 	if (!sep)
 		sep = (wchar_t*)L"\\0";
 
@@ -967,8 +2331,32 @@ int Reg::doQUERY() {
 
 
 	types_only = type ? get_type(type) : TYPE::NUM;
+	set_limits();
 
-	query(RegKey(h), parsed.get_keyname(), false);
+	// the index only helps a search
+	auto	walk = [&]() {
+		if (file) {
+			query(reg_file.doc, reg_file.section, reg_file.keyname, false);
+			return 0;
+		}
+		if (index_file && data)
+			return query_index(source.key, source.keyname);
+		query(source.key, source.keyname, false);
+		return 0;
+	};
+
+	if (binary) {
+		_setmode(_fileno(stdout), _O_BINARY);
+		BinWriter	writer(stdout);
+		bin = &writer;
+		auto	ret = walk();
+		writer.summary();
+		bin = nullptr;
+		return ret ? ret : stop_status;
+	}
+
+	if (auto ret = walk())
+		return ret;
 
 	if (data) {
 		out << L"End of search: ";
@@ -979,8 +2367,13 @@ int Reg::doQUERY() {
 		if (data_only)
 			out << onlyif(keys_only || values_only, L", ") << found_data << L" values(s)";
 		out << L" found.";
+		if (index_file)
+			out << endl << L"Index: " << num_unchanged << L" of " << num_indexed << L" key(s) unchanged.";
+		if (governor)
+			out << endl;
 	}
-	return 0;
+	report_governor();
+	return stop_status;
 }
 
 //-----------------------------------------------------------------------------
@@ -991,10 +2384,9 @@ int Reg::doADD() {
     //waitDebugger();
 
 	ParsedKey	parsed(key);
-	auto 		access = KEY_ALL_ACCESS | get_sam();
-	HKEY		h;
+	RegKey		r;
 
-	auto ret = parsed.create_key(access, &h);
+	auto ret = parsed.create_key(r);
 	if (ret != ERROR_SUCCESS || (!value && !def_value))
 		return ret;
 
@@ -1010,7 +2402,6 @@ int Reg::doADD() {
 		return 1;
 
 	DWORD	size = parse_command_data(data, itype, separator);
-	RegKey	r(h);
 	return r.set_value(value, itype, (BYTE*)data, size);
 }
 
@@ -1020,20 +2411,17 @@ int Reg::doADD() {
 
 int Reg::doDELETE() {
 	ParsedKey	parsed(key);
-	auto 		access = KEY_ALL_ACCESS | get_sam();
 
 	if (!value && !def_value && !all_values)
-		return parsed.delete_key(access);
+		return parsed.delete_key();
 
-	HKEY		h;
-	if (auto ret = parsed.open_key(access, &h))
+	RegKey		r;
+	if (auto ret = parsed.open_key(r, Backend::OPEN_WRITE))
 		return ret;
 
-	RegKey		r(h);
-
 	if (all_values) {
 		auto 	info	= r.info();
-		for (int i = 0; i < info.num_values; i++) {
+		for (int i = info.num_values; i--;) {		// from the end, as each removal moves the rest down
 			if (auto value = r.value(i, nullptr, 0)) {
 				if (auto ret = r.remove_value(value.name))
 					return ret;
@@ -1057,6 +2445,9 @@ auto win_getline(FileReader &reader) {
 }
 
 int Reg::doIMPORT() {
+	if (key)
+		return import_key();
+
 	FileReader	reader(file);
 	if (!reader) {
 		out << L"Failed to open file: " << file << endl;
@@ -1071,9 +2462,11 @@ int Reg::doIMPORT() {
 		return 1;
 
 	RegKey	key;
-	auto 	access = KEY_ALL_ACCESS | get_sam();
 	bool 	deleted = false;
-	HKEY	h;
+
+	// with /hive the file is built into a hive rooted at its first key, and the registry is not touched
+	HiveWriter	*target = nullptr;
+	int			ret		= 0;
 
 	// Parse key values and subkeys
 	while (!reader.eof()) {
@@ -1095,17 +2488,36 @@ int Reg::doIMPORT() {
 				deleted = line[1] == '-';
 				auto	open	= 1 + deleted;
 				auto	close	= line.find_first(']');
-				ParsedKey	parsed(string::view(line.begin() + open, close));
-                parsed.host = string(machine);
+				auto	name	= string::view(line.begin() + open, close);
+
+				if (hive_file) {
+					if (!target) {
+						FILETIME	now;
+						GetSystemTimeAsFileTime(&now);
+						target = new HiveWriter(name, to_uint64(now));
+					}
+					if (deleted) {
+						target->remove_key(name);
+					} else {
+						target->key_start(name);
+						if (target->current == Hive::NONE) {
+							out << L"Key is outside the hive's root: " << name << endl;
+							ret = ERROR_INVALID_PARAMETER;
+							break;
+						}
+					}
+					continue;
+				}
+
+				ParsedKey	parsed(name, machine);
 
 				if (deleted) {
-					if (auto ret = parsed.delete_key(access))
+					if (auto ret = parsed.delete_key())
 						return ret;
 
 				} else {
-					if (auto ret = parsed.open_key(access, &h))
+					if (auto ret = parsed.create_key(key))
 						return ret;
-					key = RegKey(h);
 				}
 
 			} else if (!deleted) {
@@ -1118,13 +2530,18 @@ int Reg::doIMPORT() {
 						name = string::view(name.begin() + 1, name.end() - 1);
 
 					if (value == L"-") {
-						key.remove_value(string(name));
+						if (target)
+							target->remove_value(name);
+						else
+							key.remove_value(string(name));
 
 					} else {
-						TYPE	type;
-						auto	data	= parse_reg_data(string(value), type);
-						if (data.size() > 0) {	//ignore bad data
-							if (auto ret = key.set_value(string(name), type, data.a, data.p - data.a))
+						RegFile::Array<uint8_t>	data;
+						auto	type	= RegFile::decode((const uint8_t*)value.begin(), (const uint8_t*)value.end(), true, data);
+						if (type != RegFile::NONE) {	//ignore bad data
+							if (target)
+								target->value(name, (TYPE)type, data.p, data.n);
+							else if (auto ret = key.set_value(string(name), (TYPE)type, data.p, data.n))
 								return ret;
 						}
 					}
@@ -1133,85 +2550,1789 @@ int Reg::doIMPORT() {
 		}
 	}
 
-	return 0;
-}
+	if (!ret && reader.failed()) {
+		out << L"Damaged or truncated compressed file: " << file << endl;
+		ret = ERROR_INVALID_DATA;
+	}
+
+	if (target) {
+		if (!ret && !target->write(hive_file)) {
+			out << L"Failed to create file: " << hive_file << endl;
+			ret = errno;
+		}
+		delete target;
+	}
+	return ret;
+}
+
+// IMPORT /k: the file is mapped rather than streamed, and only the sections of one key, its subkeys and its ancestors are applied
+int Reg::import_key() {
+	ParsedKey	parsed(key);
+	auto		keyname	= parsed.get_keyname();
+	auto		key16	= (const char16_t*)(const wchar_t*)keyname;
+
+	MappedFile			mapped(file);
+	RegFile::Document	doc;
+	if (auto ret = open_reg_file(doc, mapped, file, keyname, section_index)) {
+		out << (ret == ERROR_INVALID_DATA ? L"Not an uncompressed .reg file: " : L"Failed to open file: ") << file << endl;
+		return ret;
+	}
+
+	HiveWriter	*target	= nullptr;
+	int			ret		= 0;
+	RegFile::Array<char16_t>	path, name;
+	RegFile::Array<uint8_t>		data;
+
+	for (uint32_t i = 0; i < doc.sections.n && !ret; i++) {
+		auto	&section = doc.sections[i];
+		if (section.implied())
+			continue;
+		doc.path(i, path);
+		bool	inside	= RegFile::under(path.p, path.n, key16, keyname.length());
+		if (!inside && !(section.removed && RegFile::under(key16, keyname.length(), path.p, path.n)))
+			continue;
+
+		// a removed ancestor stands for the key itself
+		auto	keyview	= inside ? string::view((const wchar_t*)path.p, path.n) : string::view(keyname);
+		RegKey	k;
+		if (hive_file) {
+			if (!target) {
+				FILETIME	now;
+				GetSystemTimeAsFileTime(&now);
+				target = new HiveWriter(keyname, to_uint64(now));
+			}
+			if (section.removed) {
+				target->remove_key(keyview);
+				continue;
+			}
+			target->key_start(keyview);
+		} else {
+			ParsedKey	parsed(keyview, machine);
+			if (section.removed) {
+				ret = parsed.delete_key();
+				continue;
+			}
+			if ((ret = parsed.create_key(k)))
+				break;
+		}
+
+		doc.section_values(i, [&](const RegFile::Value &v) {
+			if (ret)
+				return;
+			doc.name(v, name);
+			auto	value_name = string::view((const wchar_t*)name.p, name.n);
+			if (v.removed) {
+				if (target)
+					target->remove_value(value_name);
+				else
+					k.remove_value(string(value_name));
+				return;
+			}
+			auto	type = doc.data(v, data);
+			if (type == RegFile::NONE)	//ignore bad data
+				return;
+			if (target)
+				target->value(value_name, (TYPE)type, data.p, data.n);
+			else
+				ret = k.set_value(string(value_name), (TYPE)type, data.p, data.n);
+		});
+	}
+
+	if (target) {
+		if (!ret && !target->write(hive_file)) {
+			out << L"Failed to create file: " << hive_file << endl;
+			ret = errno;
+		}
+		delete target;
+	}
+	return ret;
+}
 
 //-----------------------------------------------------------------------------
 // export
 //-----------------------------------------------------------------------------
 
-void export_recurse(FileWriter &out, const RegKey &key, string keyname) {
-	out << L'[' << keyname << L']' << endl;
+// ancestors of the current key whose section headers have not been written yet
+struct PendingKey {
+	PendingKey		*parent;
+	const string	&name;
+	bool			written;
+
+	void write(KeyWriter &out) {
+		if (!written) {
+			if (parent)
+				parent->write(out);
+			out.key_start(name);
+			out.key_end();
+			written = true;
+		}
+	}
+};
 
+void Reg::export_key(KeyWriter &out, const RegKey &key, const string &keyname, PendingKey *parent, uint32_t level) {
 	auto info 	= key.info();
-	auto data	= (BYTE*)malloc(info.max_data + 1);
+	auto stamp	= info.last_write;
+
+	auto		resuming = on_resume_path(keyname);		// already written before the checkpoint
+	PendingKey	pending = {parent, keyname, resuming != 0};
+	auto		start	= [&]() {
+		if (!pending.written) {
+			if (parent)
+				parent->write(out);
+			out.key_start(keyname);
+			pending.written = true;
+		}
+	};
 
-	// Enumerate the values
-	for (int i = 0; i < info.num_values; i++) {
-		if (auto value = key.value(i, data, info.max_data)) {
-			if (value.name.length())
-				out << L'"' << value.name << L'"';
+	bool	selected = !resuming && stamp > since_time
+		&& (!num_include || any_pattern(include, num_include, case_sensitive ? relative_name(keyname) : relative_name(keyname).tolower()));
+
+	if (selected) {
+		auto	filtered	= filter_values();
+		auto	space		= (BYTE*)malloc(info.max_data + 1);
+		if (!filtered)
+			start();
+
+		// Enumerate the values
+		for (int i = 0; i < info.num_values; i++) {
+			RegKey::Value	value;
+			if (filtered) {
+				// name and type first, so rejected values never have their data read
+				value = key.value(i, nullptr, 0);
+				if (!value || !compare_name(value.name) || (types_only != TYPE::NUM && value.type != types_only))
+					continue;
+				value = key.value(value.name, space, info.max_data);
+				if (!value)
+					continue;
+				if (data) {
+					string	data_string;
+					{
+						StringBuilder	b(data_string);
+						write_command_data(b, space, value.size, value.type, (wchar_t*)L"\\0");
+					}
+					if (!check_data(data_string))
+						continue;
+				}
+			} else {
+				value = key.value(i, space, info.max_data);
+				if (!value)
+					continue;
+			}
+			start();
+			out.value(value.name, value.type, space, value.size);
+		}
+		free(space);
+
+		if (pending.written) {
+			out.key_end();
+			if (checkpoint && ++since_checkpoint == CHECKPOINT_KEYS) {
+				write_checkpoint(out, keyname);
+				since_checkpoint = 0;
+			}
+		}
+	}
+
+	if (level >= max_depth)
+		return;
+
+	// the next component of the resume path; subkeys sorting before it were finished before the checkpoint
+	string	resume_name;
+	if (resuming == 1) {
+		auto	p = resume_key.begin() + keyname.length() + 1;
+		auto	e = Wide::wcschr(p, '\\');
+		resume_name = e ? string(p, e) : string(p);
+	}
+
+	// Enumerate the subkeys in canonical order, so a resumed export picks up where it stopped
+	for (auto &name : SortedSubkeys(key, info.num_subkeys)) {
+		if (resume_name && compare_names(name, resume_name) < 0)
+			continue;
+
+		auto	subname = keyname + L'\\' + name;
+		if (num_include || num_exclude) {
+			auto	relative = case_sensitive ? relative_name(subname) : relative_name(subname).tolower();
+			if (num_exclude && any_pattern(exclude, num_exclude, relative))
+				continue;
+			if (num_include && !any_prefix(include, num_include, relative))
+				continue;
+		}
+		export_key(out, RegKey(key, name), subname, &pending, level + 1);
+	}
+}
+
+int Reg::doEXPORT() {
+	set_governor();
+	set_limits();
+	prepare_patterns();
+	types_only = type ? get_type(type) : TYPE::NUM;
+
+	if (since) {
+		since_time = parse_time(since);
+		if (!since_time) {
+			out << L"Invalid time: " << since << endl;
+			return ERROR_INVALID_PARAMETER;
+		}
+	}
+
+	FILETIME	now;
+	GetSystemTimeAsFileTime(&now);
+	export_started = to_uint64(now);
+
+	SourceKey	source;
+	if (auto ret = open_source(source))
+		return ret;
+
+	root_length = source.keyname.length();
+
+	// a hive is written whole at the end, so there is nothing to resume
+	if (regf)
+		checkpoint = nullptr;
+
+	if (section_index && (compress || binary || regf)) {
+		out << L"/idx needs an uncompressed .reg file" << endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+
+	uint64_t	offset	= 0;
+	bool		append	= false;
+	if (resume && checkpoint && read_checkpoint(offset)) {
+		if (!truncate_file(file, offset)) {
+			out << L"Failed to truncate file: " << file << endl;
+			return errno;
+		}
+		append = true;
+	}
+
+	if (regf) {
+		HiveWriter	stream(source.keyname, export_started);
+		export_key(stream, source.key, source.keyname, nullptr);
+		if (!stream.write(file)) {
+			out << L"Failed to create file: " << file << endl;
+			return errno;
+		}
+
+	} else if (binary) {
+		BinWriter	stream(file, append);
+		if (!stream) {
+			out << L"Failed to create file: " << file << endl;
+			return errno;
+		}
+		export_key(stream, source.key, source.keyname, nullptr);
+		stream.summary();
+
+	} else {
+		RegWriter	stream(file, compress, append);
+		if (!stream) {
+			out << L"Failed to create file: " << file << endl;
+			return errno;
+		}
+
+		//stream << L'\xfeff';	//BOM
+		if (!append)
+			stream << L"Windows Registry Editor Version 5.00" << endl << endl;
+		export_key(stream, source.key, source.keyname, nullptr);
+	}
+
+	// the finished file is indexed in one pass, rather than flushing to find each section's offset as it is written
+	if (section_index) {
+		MappedFile			mapped(file);
+		RegFile::Document	doc;
+		if (!mapped || !doc.open(mapped.p, mapped.size))
+			return ERROR_INVALID_DATA;
+		if (auto ret = write_section_index(doc, file))
+			return ret;
+	}
+
+	if (checkpoint)
+		_wremove(checkpoint);
+
+	if (mark) {
+		FileWriter	sidecar(mark);
+		if (!sidecar) {
+			out << L"Failed to create file: " << mark << endl;
+			return errno;
+		}
+		sidecar << export_started << endl;
+	}
+
+	report_governor();
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// copy
+//	destination keys are created breadth first: each key handed out by the
+//	queue has its values copied and its subkeys created and queued, so
+//	independent subtrees are written by different threads
+//-----------------------------------------------------------------------------
+
+struct CopyQueue {
+	struct Item {
+		Item	*next;
+		RegKey	src, dst;
+	};
+	std::mutex				m;
+	std::condition_variable	cv;
+	Item		*head	= nullptr, *tail = nullptr;
+	uint32_t	pending	= 0;	// queued or being copied
+	int			error	= 0;
+
+	~CopyQueue() {
+		while (auto i = head) {
+			head = i->next;
+			delete i;
+		}
+	}
+	void push(RegKey &&src, RegKey &&dst) {
+		std::lock_guard<std::mutex>	lock(m);
+		auto	i = new Item{nullptr, static_cast<RegKey&&>(src), static_cast<RegKey&&>(dst)};
+		(tail ? tail->next : head) = i;
+		tail = i;
+		++pending;
+		cv.notify_one();
+	}
+	// nullptr once everything is copied, or after an error
+	Item *pop() {
+		std::unique_lock<std::mutex>	lock(m);
+		cv.wait(lock, [this] { return head || !pending || error; });
+		if (!head || error)
+			return nullptr;
+		auto	i = head;
+		if (!(head = i->next))
+			tail = nullptr;
+		return i;
+	}
+	void done(Item *i, int ret) {
+		delete i;
+		std::lock_guard<std::mutex>	lock(m);
+		if (ret && !error)
+			error = ret;
+		if (--pending == 0 || error)
+			cv.notify_all();
+	}
+};
+
+void Reg::copy_worker(CopyQueue &queue) {
+	BYTE	*data		= nullptr;		// reused for every value this thread copies
+	DWORD	capacity	= 0;
+
+	while (auto item = queue.pop()) {
+		auto	&src	= item->src, &dst = item->dst;
+		auto	info	= src.info();
+		int		ret		= 0;
+
+		if (info.max_data > capacity) {
+			capacity	= info.max_data;
+			data		= (BYTE*)realloc(data, capacity);
+		}
+		for (DWORD i = 0; i < info.num_values && !ret; i++) {
+			if (auto value = src.value(i, data, capacity)) {
+				ret = dst.set_value(value.name, value.type, data, value.size);
+				++num_copied_values;
+			}
+		}
+
+		for (DWORD i = 0; i < info.num_subkeys && all_subkeys && !ret; i++) {
+			auto	sub	= src.subkey(i);
+			if (!sub.length())
+				continue;		// gone since the key was counted; an empty name would open the key itself
+			RegKey	s, d;
+			if (!(ret = s.open(src, sub)) && !(ret = d.create(dst, sub)))
+				queue.push(static_cast<RegKey&&>(s), static_cast<RegKey&&>(d));
+		}
+
+		++num_copied_keys;
+		queue.done(item, ret);
+	}
+	free(data);
+}
+
+int Reg::doCOPY() {
+	if (!key2) {
+		out << L"Missing KeyName2" << endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+	set_governor();
+
+	ParsedKey	src(key), dst(key2);
+	auto		from	= src.get_keyname(), to = dst.get_keyname();
+	bool	same_host = src.host.empty() ? dst.host.empty() : !dst.host.empty() && Wide::wcsicmp(src.host, dst.host) == 0;
+	if (all_subkeys && same_host && to.length() >= from.length()
+		&& Wide::wcsnicmp(to, from, from.length()) == 0 && (to.length() == from.length() || to[from.length()] == '\\')) {
+		out << L"Cannot copy a key into itself" << endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+
+	RegKey	s, d;
+	bool	existed;
+	if (auto ret = src.open_key(s))
+		return ret;
+	if (auto ret = dst.create_key(d, &existed))
+		return ret;
+	if (existed && !force) {
+		out << L"Destination exists; use /f to copy into it" << endl;
+		return ERROR_ALREADY_EXISTS;
+	}
+
+	CopyQueue	queue;
+	queue.push(static_cast<RegKey&&>(s), static_cast<RegKey&&>(d));
+
+	int		n		= threads && *threads ? Wide::wcstoul(threads, nullptr, 10) : std::thread::hardware_concurrency();
+	auto	workers	= new std::thread*[n > 1 ? n - 1 : 0];
+	for (int i = 0; i < n - 1; i++)
+		workers[i] = new std::thread([this, &queue]() { copy_worker(queue); });
+	copy_worker(queue);
+	for (int i = 0; i < n - 1; i++) {
+		workers[i]->join();
+		delete workers[i];
+	}
+	delete[] workers;
+
+	out << L"Copied: " << num_copied_keys.load() << L" key(s), " << num_copied_values.load() << L" value(s)" << endl;
+	report_governor();
+	return queue.error;
+}
+
+//-----------------------------------------------------------------------------
+// sync
+//	like COMPARE, but the differences are written to the destination
+//-----------------------------------------------------------------------------
+
+void Reg::sync_key(const RegKey &src, const RegKey &dst, const string &keyname) {
+	auto	is	= src.info();
+	auto	id	= dst.info();
+	++num_compared;
+
+	// neither side written since the last sync (and the shapes still agree): nothing to read at this level
+	bool	clean	= since_time && is.last_write < since_time && id.last_write < dst_since
+		&& is.num_values == id.num_values && is.max_data == id.max_data && is.num_subkeys == id.num_subkeys;
+
+	if (clean) {
+		++num_quick;
+
+	} else {
+		SortedValues	vs(src, is), vd(dst, id);
+		for (auto i = vs.begin(), j = vd.begin(); i != vs.end() || j != vd.end();) {
+			int		c	= i == vs.end() ? 1 : j == vd.end() ? -1 : compare_names(i->name, j->name);
+			if (c < 0 || (c == 0 && (i->type != j->type || i->size != j->size || memcmp(vs.get(*i), vd.get(*j), i->size) != 0)))
+				sync_action(L"SET   ", keyname, i->name, dry_run ? 0 : dst.set_value(i->name, i->type, (BYTE*)vs.get(*i), i->size));
+			else if (c > 0)
+				sync_action(L"REMOVE", keyname, j->name, dry_run ? 0 : dst.remove_value(j->name));
+			if (c <= 0)
+				++i;
+			if (c >= 0)
+				++j;
+		}
+	}
+
+	SortedSubkeys	ss(src, is.num_subkeys), sd(dst, clean ? 0 : id.num_subkeys);
+	auto	&list_d	= clean ? ss : sd;
+	for (auto i = ss.begin(), j = list_d.begin(); i != ss.end() || j != list_d.end();) {
+		int		c	= i == ss.end() ? 1 : j == list_d.end() ? -1 : compare_names(*i, *j);
+		if (c < 0) {
+			int		ret	= 0;
+			if (!dry_run) {
+				RegKey	s, d;
+				if (!(ret = s.open(src, *i)) && !(ret = d.create(dst, *i))) {
+					CopyQueue	queue;
+					queue.push(static_cast<RegKey&&>(s), static_cast<RegKey&&>(d));
+					copy_worker(queue);
+					ret = queue.error;
+				}
+			}
+			sync_action(L"ADD   ", keyname + L'\\' + *i, nullptr, ret);
+
+		} else if (c > 0) {
+			sync_action(L"DELETE", keyname + L'\\' + *j, nullptr, dry_run ? 0 : dst.remove_key(*j));
+
+		} else {
+			// a dry run only reads the destination, so it works where it could not write
+			RegKey	d(dst, *j, dry_run ? Backend::OPEN_READ : Backend::OPEN_WRITE);
+			if (d)
+				sync_key(RegKey(src, *i), d, keyname + L'\\' + *j);
 			else
-				out << L'@';
-			out << L'=';
+				sync_action(L"FAILED", keyname + L'\\' + *j, nullptr, ERROR_ACCESS_DENIED);
+		}
+		if (c <= 0)
+			++i;
+		if (c >= 0)
+			++j;
+	}
+}
+
+int Reg::doSYNC() {
+	if (!key2) {
+		out << L"Missing KeyName2" << endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+	set_governor();
+	all_subkeys = true;
+
+	// the mark holds the time the last sync started (for the source) and finished (for the destination)
+	if (mark) {
+		FileReader	reader(mark);
+		if (reader) {
+			since_time	= parse_time_text(string(string::read_to(reader, '\n').trim()));
+			dst_since	= parse_time_text(string(string::read_to(reader, '\n').trim()));
+		}
+	}
+	FILETIME	started;
+	GetSystemTimeAsFileTime(&started);
+
+	ParsedKey	src(key), dst(key2);
+	RegKey		s, d;
+	if (auto ret = src.open_key(s))
+		return ret;
+	if (auto ret = dry_run ? dst.open_key(d) : dst.create_key(d))
+		return ret;
 
-			write_reg_data(out, data, value.size, value.type);
+	sync_key(s, d, dst.get_keyname());
+
+	if (mark && !dry_run && !sync_error) {
+		FILETIME	finished;
+		GetSystemTimeAsFileTime(&finished);
+		FileWriter	sidecar(mark);
+		if (!sidecar) {
+			out << L"Failed to create file: " << mark << endl;
+			return errno;
 		}
+		sidecar << to_uint64(started) << endl << to_uint64(finished) << endl;
+	}
+
+	out << (dry_run ? L"Planned: " : L"Synced: ") << num_differences << L" change(s), " << num_compared << L" key(s) compared, "
+		<< num_quick << L" unchanged since the last sync" << endl;
+	report_governor();
+	return sync_error;
+}
+
+//-----------------------------------------------------------------------------
+// snapshot/restore
+//-----------------------------------------------------------------------------
+
+inline uint32_t intern(Snapshot::Writer &out, const wchar_t *s, size_t n) {
+	return out.intern((const char16_t*)s, n);
+}
+inline string to_string(Snapshot::Reader::Name name) {
+	return string((const wchar_t*)name.p, name.length);
+}
+
+uint64_t snapshot_key(Snapshot::Writer &out, const RegKey &key, string::view name) {
+	auto	info	= key.info();
+	auto	data	= (BYTE*)malloc(info.max_data + 1);
+	auto	values	= (Snapshot::Value*)malloc(sizeof(Snapshot::Value) * info.num_values + 1);
+	auto	nv		= 0u;
+
+	for (int i = 0; i < info.num_values; i++) {
+		if (auto value = key.value(i, data, info.max_data))
+			values[nv++] = {intern(out, value.name, value.name.length()), (uint32_t)value.type, value.size, 0, out.blob(data, value.size)};
 	}
 	free(data);
 
-	out << endl;
+	auto	children	= (Snapshot::Child*)malloc(sizeof(Snapshot::Child) * info.num_subkeys + 1);
+	auto	nc			= 0u;
+	for (auto &sub : SortedSubkeys(key, info.num_subkeys))
+		children[nc++] = {intern(out, sub, sub.length()), 0, snapshot_key(out, RegKey(key, sub), sub)};
 
-	// Enumerate the subkeys
-	for (int i = 0; i < info.num_subkeys; i++) {
-		auto name = key.subkey(i);
-		if (name.length())
-			export_recurse(out, RegKey(key.h, name), keyname + L'\\' + name);
+	auto	offset	= out.key(intern(out, name.begin(), name.size()), info.last_write, children, nc, values, nv, Snapshot::COMPLETE);
+	free(children);
+	free(values);
+	return offset;
+}
+
+// writes only what differs from base; returns 0 if nothing under key changed (and !force)
+uint64_t delta_key(Snapshot::Writer &out, const Snapshot::Chain &chain, const Snapshot::Chain::Node &base, const RegKey &key, string::view name, bool force = false) {
+	auto	info	= key.info();
+	// a key the base has no record of is written out as changed
+	auto	changed	= !base || info.last_write != base.last_write();
+	Snapshot::Array<Snapshot::Child>	children;
+	Snapshot::Array<Snapshot::Value>	values;
+
+	if (!changed) {
+		// last_write covers a key's own values and its list of subkeys, but not anything deeper
+		chain.subkeys(base, [&](Snapshot::Reader::Name name) {
+			auto	subname = to_string(name);
+			RegKey	sub(key, subname);
+			if (!sub)
+				children.push({intern(out, subname, name.length), Snapshot::REMOVED, 0});
+			else if (auto offset = delta_key(out, chain, chain.subkey(base, name), sub, subname))
+				children.push({intern(out, subname, name.length), 0, offset});
+		});
+
+	} else {
+		auto	data	= (BYTE*)malloc(info.max_data + 1);
+		for (int i = 0; i < info.num_values; i++) {
+			if (auto value = key.value(i, data, info.max_data)) {
+				auto	prev	= chain.value(base, (const char16_t*)value.name.begin(), value.name.length());
+				auto	same	= prev && prev.value->type == (uint32_t)value.type && prev.value->size == value.size && memcmp(prev.data(), data, value.size) == 0;
+				// unchanged values are kept only to find the removed ones below
+				values.push({intern(out, value.name, value.name.length()), (uint32_t)value.type, value.size, same ? Snapshot::REMOVED : 0u, same ? 0 : out.blob(data, value.size)});
+			}
+		}
+		free(data);
+
+		out.sort(values.p, values.n);
+		Snapshot::Array<Snapshot::Value>	removed;
+		chain.values(base, [&](Snapshot::Reader::Name name, Snapshot::Chain::ValueRef) {
+			if (!out.find(values.p, values.n, name.p, name.length))
+				removed.push({intern(out, (const wchar_t*)name.p, name.length), 0, 0, Snapshot::REMOVED, 0});
+		});
+		uint32_t	nv = 0;
+		for (uint32_t i = 0; i < values.n; i++) {
+			if (!(values.p[i].flags & Snapshot::REMOVED))
+				values.p[nv++] = values.p[i];
+		}
+		values.n = nv;
+		for (uint32_t i = 0; i < removed.n; i++)
+			values.push(removed.p[i]);
+
+		SortedSubkeys	subkeys(key, info.num_subkeys);
+		for (auto &subname : subkeys) {
+			RegKey	sub(key, subname);
+			if (!sub)
+				continue;
+			auto	prev	= chain.subkey(base, (const char16_t*)subname.begin(), subname.length());
+			auto	offset	= prev ? delta_key(out, chain, prev, sub, subname) : snapshot_key(out, sub, subname);
+			if (offset)
+				children.push({intern(out, subname, subname.length()), 0, offset});
+		}
+		chain.subkeys(base, [&](Snapshot::Reader::Name name) {
+			auto	subname = to_string(name);
+			if (!subkeys.contains(subname))
+				children.push({intern(out, subname, name.length), Snapshot::REMOVED, 0});
+		});
 	}
+
+	if (!changed && !children.n && !force)
+		return 0;
+	return out.key(intern(out, name.begin(), name.size()), info.last_write, children.p, children.n, values.p, values.n);
 }
 
-int Reg::doEXPORT() {
-//	 std::wofstream stream(file, std::ios_base::binary|std::ios_base::out);
-	FileWriter	stream(file);
-	if (!stream) {
-		out << L"Failed to create file: " << file << endl;
+int Reg::doSNAPSHOT() {
+	set_governor();
+
+	Snapshot::Chain	*chain = nullptr;
+	if (base_file) {
+		chain = new Snapshot::Chain(base_file);
+		if (!*chain || !chain->root()) {
+			out << L"Cannot use base " << base_file << L": " << (chain->error ? chain->error : *chain ? L"no root key" : L"empty") << endl;
+			delete chain;
+			return ERROR_BADDB;
+		}
+	}
+
+	ParsedKey	parsed(key);
+	RegKey		root;
+	if (auto ret = parsed.open_key(root)) {
+		delete chain;
+		return ret;
+	}
+
+	// written beside the target and moved over it when complete, so a failed write leaves the old file, which may be a base in the chain
+	auto	file_new = string(file) + L".new";
+	FILE	*f;
+	if (_wfopen_s(&f, file_new, L"wb") != 0) {
+		out << L"Failed to create file: " << file_new << endl;
+		delete chain;
 		return errno;
 	}
 
-	//stream.imbue(std::locale(std::locale(), new std::codecvt_utf16<wchar_t, 0x10ffff, std::little_endian>));
+	Snapshot::Writer	writer(f);
+	bool	ok;
+	if (chain) {
+		auto	name = base_file;
+		for (auto p = base_file; *p; ++p) {
+			if (*p == '\\' || *p == '/')
+				name = p + 1;
+		}
+		writer.header.flags		= Snapshot::DELTA;
+		writer.header.base		= intern(writer, name, string_length(name));
+		writer.header.base_size	= chain->files[0]->size;
+		ok = writer.finish(delta_key(writer, *chain, chain->root(), root, parsed.get_keyname(), true));
+		delete chain;
+	} else {
+		ok = writer.finish(snapshot_key(writer, root, parsed.get_keyname()));
+	}
+	if (fclose(f) != 0 || !ok) {
+		out << L"Failed to write file: " << file_new << endl;
+		_wremove(file_new);
+		return ERROR_WRITE_FAULT;
+	}
+	if (!MoveFileExW(file_new, file, MOVEFILE_REPLACE_EXISTING))
+		return GetLastError();
 
-	//stream << L'\xfeff';	//BOM
-	stream << L"Windows Registry Editor Version 5.00" << endl << endl;
+	out << (base_file ? L"Delta: " : L"Snapshot: ") << writer.header.num_keys << L" key(s), " << writer.header.num_values << L" value(s), "
+		<< writer.header.num_strings << L" name(s), " << writer.pos << L" bytes" << endl;
+	report_governor();
+	return 0;
+}
+
+int restore_key(const Snapshot::Chain &chain, const Snapshot::Chain::Node &node, const RegKey &key) {
+	int		ret	= 0;
+	chain.values(node, [&](Snapshot::Reader::Name name, Snapshot::Chain::ValueRef v) {
+		auto	data = v.data();
+		if (!ret)
+			ret = data ? key.set_value(to_string(name), (TYPE)v.value->type, (BYTE*)data, v.value->size) : ERROR_BADDB;
+	});
+
+	chain.subkeys(node, [&](Snapshot::Reader::Name name) {
+		if (ret)
+			return;
+		auto	sub		= chain.subkey(node, name);
+		RegKey	k;
+		if (!sub)
+			ret = ERROR_BADDB;
+		else if (!(ret = k.create(key, to_string(name))))
+			ret = restore_key(chain, sub, k);
+	});
+	return ret;
+}
+
+int Reg::doRESTORE() {
+	Snapshot::Chain	chain(file);
+	auto	root = chain ? chain.root() : Snapshot::Chain::Node();
+	if (!root) {
+		out << L"Cannot read snapshot " << file << L": " << (chain.error ? chain.error : L"bad root") << endl;
+		return ERROR_BADDB;
+	}
 
 	ParsedKey	parsed(key);
-	HKEY h;
-	if (auto ret = parsed.open_key(KEY_READ | get_sam(), &h))
+	RegKey		k;
+	if (auto ret = parsed.create_key(k))
 		return ret;
 
-	export_recurse(stream, h, parsed.get_keyname());
+	return restore_key(chain, root, k);
+}
+
+//-----------------------------------------------------------------------------
+// compare
+//-----------------------------------------------------------------------------
+
+void Reg::compare_key(const RegKey &a, const RegKey &b, const string &name_a, const string &name_b, uint32_t level) {
+	auto	ia	= a.info();
+	auto	ib	= b.info();
+	++num_compared;
+
+	// matching counts, sizes and write time: a key's own values and subkey list are taken as equal
+	// (last_write does not cover changes further down, so subkeys are still visited)
+	bool	quick	= ia.num_subkeys == ib.num_subkeys && ia.num_values == ib.num_values && ia.max_data == ib.max_data
+		&& ia.last_write == ib.last_write;
+
+	if (quick) {
+		++num_quick;
+
+	} else {
+		bool	started	= false;
+		auto	start	= [&]() {
+			if (patch && !started) {
+				patch->key_start(name_b);
+				started = true;
+			}
+		};
+
+		// walk both sorted value lists in step
+		SortedValues	va(a, ia), vb(b, ib);
+		for (auto i = va.begin(), j = vb.begin(); i != va.end() || j != vb.end();) {
+			int		c	= i == va.end() ? 1 : j == vb.end() ? -1 : compare_names(i->name, j->name);
+			auto	&v	= c <= 0 ? *i : *j;
+			if (compare_name(v.name)) {
+				if (c == 0 && i->type == j->type && i->size == j->size && memcmp(va.get(*i), vb.get(*j), i->size) == 0) {
+					report('=', name_a, va, *i);
+				} else {
+					++num_differences;
+					if (c <= 0) {
+						report('<', name_a, va, *i);
+						start();
+						if (patch)
+							patch->value(i->name, i->type, va.get(*i), i->size);
+					}
+					if (c >= 0) {
+						report('>', name_b, vb, *j);
+						if (c > 0) {
+							start();
+							if (patch)
+								patch->remove_value(j->name);
+						}
+					}
+				}
+			}
+			if (c <= 0)
+				++i;
+			if (c >= 0)
+				++j;
+		}
+		if (started)
+			patch->key_end();
+	}
+
+	// walk both sorted subkey lists in step
+	SortedSubkeys	sa(a, ia.num_subkeys), sb(b, quick ? 0 : ib.num_subkeys);
+	auto	&list_b	= quick ? sa : sb;
+	for (auto i = sa.begin(), j = list_b.begin(); i != sa.end() || j != list_b.end();) {
+		int		c	= i == sa.end() ? 1 : j == list_b.end() ? -1 : compare_names(*i, *j);
+		if (c < 0) {
+			++num_differences;
+			report('<', name_a + L'\\' + *i);
+			if (patch)
+				patch_key(RegKey(a, *i), name_b + L'\\' + *i, level + 1);
+		} else if (c > 0) {
+			++num_differences;
+			report('>', name_b + L'\\' + *j);
+			if (patch)
+				patch->remove_key(name_b + L'\\' + *j);
+		} else if (level < max_depth) {
+			compare_key(RegKey(a, *i), RegKey(b, *j), name_a + L'\\' + *i, name_b + L'\\' + *j, level + 1);
+		}
+		if (c <= 0)
+			++i;
+		if (c >= 0)
+			++j;
+	}
+}
+
+// a subtree only KeyName has, written whole into the patch; its values are picked as compare_key picks them,
+// and none of EXPORT's selection (/since, /include, /exclude, /checkpoint) applies
+void Reg::patch_key(const RegKey &key, const string &keyname, uint32_t level) {
+	auto	info	= key.info();
+	auto	space	= (BYTE*)malloc(info.max_data + 1);
+	patch->key_start(keyname);
+	for (int i = 0; i < info.num_values; i++) {
+		auto	value = key.value(i, space, info.max_data);
+		if (value && compare_name(value.name))
+			patch->value(value.name, value.type, space, value.size);
+	}
+	patch->key_end();
+	free(space);
+
+	if (level < max_depth) {
+		for (auto &name : SortedSubkeys(key, info.num_subkeys))
+			patch_key(RegKey(key, name), keyname + L'\\' + name, level + 1);
+	}
+}
+
+// as reg.exe has it: the exit code is 0 when the keys are identical, 2 when they differ and 1 when the compare failed
+int Reg::doCOMPARE() {
+	exit_code = true;
+	if (auto ret = compare()) {
+		report_error(ret);
+		return 1;
+	}
+	return num_differences ? 2 : 0;
+}
+
+int Reg::compare() {
+	if (!key2) {
+		out << L"Missing KeyName2" << endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+	set_governor();
+	set_limits();
+	prepare_patterns();
+	if (!all_subkeys)
+		max_depth = 0;
+
+	// \\Machine alone means the same key on that machine
+	string	other	= key2;
+	if (key2[0] == '\\' && key2[1] == '\\' && !Wide::wcschr(key2 + 2, '\\')) {
+		auto	path = key;
+		if (path[0] == '\\' && path[1] == '\\')
+			path = Wide::wcschr(path + 2, '\\');
+		if (!path) {
+			out << L"Invalid KeyName: " << key << endl;
+			return ERROR_INVALID_PARAMETER;
+		}
+		other = string(key2) + (path[0] == '\\' ? L"" : L"\\") + path;
+	}
+
+	ParsedKey	pa(key), pb(other);
+	RegKey		a, b;
+	if (auto ret = pa.open_key(a))
+		return ret;
+	if (auto ret = pb.open_key(b))
+		return ret;
+
+	if (file) {
+		patch = new RegWriter(file, false);
+		if (!*patch) {
+			out << L"Failed to create file: " << file << endl;
+			delete patch;
+			return errno;
+		}
+		*patch << L"Windows Registry Editor Version 5.00" << endl << endl;
+	}
+
+	compare_key(a, b, pa.get_keyname(), pb.get_keyname());
+	delete patch;
+	patch = nullptr;
+
+	out << L"Result Compared: " << (num_differences ? L"Different" : L"Identical") << endl
+		<< num_compared << L" key(s) compared, " << num_quick << L" matched on write time, " << num_differences << L" difference(s)" << endl;
+	report_governor();
+	return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+// hash
+//	key digest	= SHA256('K', values digest, {uint32 name bytes, name, child digest}...)
+//	values digest	= SHA256({uint32 name bytes, uint32 type, uint32 size, name, data}...)
+//	values and subkeys in SortedValues/SortedSubkeys order, names UTF-16 as stored
+//-----------------------------------------------------------------------------
+
+SHA256::Digest hash_values(const RegKey &key, const RegKey::Info &info) {
+	SortedValues	values(key, info);
+	SHA256			h;
+	for (auto &v : values) {
+		uint32_t	fixed[3] = {uint32_t(v.name.length() * 2), (uint32_t)v.type, v.size};
+		h.add(fixed);
+		h.add((const wchar_t*)v.name, fixed[0]);
+		h.add(values.get(v), v.size);
+	}
+	return h.finish();
+}
+
+SHA256::Digest Reg::hash_key(const RegKey &key, const string &keyname, uint32_t level, string &lines) {
+	auto	info	= key.info();
+	auto	stamp	= info.last_write;
+	++num_hashed;
+
+	// last_write covers the key's own values, but not its subkeys, so only the values digest is cached
+	SHA256::Digest	values;
+	if (hash_cache.find((const char16_t*)(const wchar_t*)keyname, keyname.length(), stamp, values))
+		++num_cached;
+	else
+		values = hash_values(key, info);
+
+	if (new_cache) {
+		std::lock_guard<std::mutex>	lock(cache_lock);
+		DigestCache::write(new_cache, (const char16_t*)(const wchar_t*)keyname, keyname.length(), stamp, values);
+	}
+
+	struct Child {
+		SHA256::Digest	digest;
+		string			lines;
+		std::thread		*thread = nullptr;
+	};
+	SortedSubkeys	subkeys(key, info.num_subkeys);
+	auto	children	= new Child[subkeys.count];
+	for (int i = 0; i < subkeys.count; i++) {
+		auto	&c		= children[i];
+		auto	&name	= subkeys.names[i];
+		auto	task	= [this, &key, &keyname, &c, &name, level]() {
+			c.digest = hash_key(RegKey(key, name), keyname + L'\\' + name, level + 1, c.lines);
+		};
+		// hand the subtree to a new thread while any are spare, otherwise recurse here
+		if (spare_threads.fetch_sub(1) > 0) {
+			c.thread = new std::thread([this, task]() {
+				task();
+				++spare_threads;
+			});
+		} else {
+			++spare_threads;
+			task();
+		}
+	}
+
+	SHA256	h;
+	h.add('K');
+	h.add(values);
+	for (int i = 0; i < subkeys.count; i++) {
+		auto	&c		= children[i];
+		auto	&name	= subkeys.names[i];
+		if (c.thread) {
+			c.thread->join();
+			delete c.thread;
+		}
+		uint32_t	size = uint32_t(name.length() * 2);
+		h.add(size);
+		h.add((const wchar_t*)name, size);
+		h.add(c.digest);
+	}
+	auto	digest	= h.finish();
+
+	if (level <= hash_depth) {
+		StringBuilder	b(lines);
+		for (auto i : digest.b)
+			b << base<16,2>(i);
+		b << L"  " << keyname << endl;
+		for (int i = 0; i < subkeys.count; i++)
+			b << children[i].lines;
+	}
+	delete[] children;
+	return digest;
+}
+
+int Reg::doHASH() {
+	set_governor();
+	if (depth && *depth)
+		hash_depth = Wide::wcstoul(depth, nullptr, 10);
+	int	n = threads && *threads ? Wide::wcstoul(threads, nullptr, 10) : std::thread::hardware_concurrency();
+	spare_threads = n > 1 ? n - 1 : 0;
+
+	SourceKey	source;
+	if (auto ret = open_source(source))
+		return ret;
+
+	// the previous cache is read whole, and a new one written beside it as keys are hashed
+	string	cache_new;
+	if (cache) {
+		FILE	*f;
+		if (_wfopen_s(&f, cache, L"rb") == 0) {
+			hash_cache.load(f);
+			fclose(f);
+		}
+		cache_new = string(cache) + L".new";
+		if (_wfopen_s(&new_cache, cache_new, L"wb") != 0) {
+			out << L"Failed to create file: " << cache_new << endl;
+			return errno;
+		}
+		DigestCache::write_header(new_cache);
+	}
+
+	string	lines;
+	hash_key(source.key, source.keyname, 0, lines);
+	out << lines;
+
+	if (new_cache) {
+		fclose(new_cache);
+		new_cache = nullptr;
+		if (!MoveFileExW(cache_new, cache, MOVEFILE_REPLACE_EXISTING))
+			return GetLastError();
+		out << L"Cache: " << num_cached.load() << L" of " << num_hashed.load() << L" key(s) reused" << endl;
+	}
+	report_governor();
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// stats
+//	counts come from RegQueryInfoKey, and value sizes from RegEnumValue
+//	without data, so no value data is read
+//-----------------------------------------------------------------------------
+
+struct TreeStats {
+	uint64_t	keys	= 0;
+	uint64_t	values	= 0;
+	uint64_t	bytes	= 0;
+	uint64_t	by_type[(int)TYPE::NUM + 1] = {};	// last is any unknown type
+	uint32_t	depth	= 0;						// levels below the key
+
+	void add(const TreeStats &b) {
+		keys	+= b.keys;
+		values	+= b.values;
+		bytes	+= b.bytes;
+		for (int i = 0; i <= (int)TYPE::NUM; i++)
+			by_type[i] += b.by_type[i];
+		if (b.depth + 1 > depth)
+			depth = b.depth + 1;
+	}
+};
+
+// the max highest scoring entries, kept in descending order; shared by all threads
+template<typename T> struct TopN {
+	std::mutex				m;
+	T						*items;
+	int						count	= 0, max;
+	std::atomic<uint64_t>	floor{0};	// lowest score that still gets in, once full
+
+	TopN(int max) : items(new T[max]), max(max) {}
+	~TopN() { delete[] items; }
+
+	// cheap unlocked test, so most candidates are never built
+	bool wants(uint64_t score) const {
+		return max && score > floor;
+	}
+	void add(T &&t) {
+		std::lock_guard<std::mutex>	lock(m);
+		if (count == max && t.score <= items[max - 1].score)
+			return;
+		int		i = count < max ? count++ : max - 1;
+		for (; i > 0 && items[i - 1].score < t.score; --i)
+			items[i] = static_cast<T&&>(items[i - 1]);
+		items[i] = static_cast<T&&>(t);
+		if (count == max)
+			floor = items[max - 1].score;
+	}
+	auto	begin() const	{ return items; }
+	auto	end()	const	{ return items + count; }
+};
+
+struct StatsReport {
+	struct Subtree {
+		uint64_t	score;		// bytes
+		string		keyname;
+		TreeStats	stats;
+	};
+	struct LargeValue {
+		uint64_t	score;		// size
+		string		keyname, name;
+		TYPE		type;
+	};
+	struct WideKey {
+		uint64_t	score;		// subkeys + values
+		string		keyname;
+		uint32_t	subkeys, values;
+	};
+	TopN<Subtree>		subtrees;
+	TopN<LargeValue>	values;
+	TopN<WideKey>		keys;
+
+	StatsReport(int top) : subtrees(top), values(top), keys(top) {}
+};
+
+void Reg::stats_key(const RegKey &key, const string &keyname, uint32_t level, TreeStats &result) {
+	auto	info	= key.info();
+	result.keys		= 1;
+	result.values	= info.num_values;
+	if (stats->keys.wants(uint64_t(info.num_subkeys) + info.num_values))
+		stats->keys.add({uint64_t(info.num_subkeys) + info.num_values, keyname, info.num_subkeys, info.num_values});
+
+	for (int i = 0; i < info.num_values; i++) {
+		if (auto value = key.value(i, nullptr, 0)) {
+			result.bytes += value.size;
+			++result.by_type[value.type < TYPE::NUM ? (int)value.type : (int)TYPE::NUM];
+			if (stats->values.wants(value.size))
+				stats->values.add({value.size, keyname, static_cast<string&&>(value.name), value.type});
+		}
+	}
+
+	struct Child {
+		TreeStats	stats;
+		std::thread	*thread = nullptr;
+	};
+	SortedSubkeys	subkeys(key, info.num_subkeys);
+	auto	children	= new Child[subkeys.count];
+	for (int i = 0; i < subkeys.count; i++) {
+		auto	&c		= children[i];
+		auto	&name	= subkeys.names[i];
+		auto	task	= [this, &key, &keyname, &c, &name, level]() {
+			stats_key(RegKey(key, name), keyname + L'\\' + name, level + 1, c.stats);
+		};
+		// as in HASH: fork while threads are spare
+		if (spare_threads.fetch_sub(1) > 0) {
+			c.thread = new std::thread([this, task]() {
+				task();
+				++spare_threads;
+			});
+		} else {
+			++spare_threads;
+			task();
+		}
+	}
+	for (int i = 0; i < subkeys.count; i++) {
+		auto	&c = children[i];
+		if (c.thread) {
+			c.thread->join();
+			delete c.thread;
+		}
+		result.add(c.stats);
+	}
+	delete[] children;
+
+	if (level > 0 && level <= stats_depth && stats->subtrees.wants(result.bytes + 1))
+		stats->subtrees.add({result.bytes, keyname, result});
+}
+
+// right-aligned in width columns
+void put_column(TextWriter<wchar_t> &w, uint64_t v, int width) {
+	wchar_t	temp[24];
+	auto	p = put_digits<10>(v, end(temp));
+	for (auto n = end(temp) - p; n < width; n++)
+		w << L' ';
+	w.write(p, end(temp) - p);
+}
+
+void put_json(TextWriter<wchar_t> &w, string::view s) {
+	w << L'"';
+	for (auto c : s) {
+		if (c == '"' || c == '\\')
+			w << L'\\' << c;
+		else if (c < 0x20)
+			w << L"\\u" << base<16, 4>((unsigned)c);
+		else
+			w << c;
+	}
+	w << L'"';
+}
+
+void put_json(TextWriter<wchar_t> &w, const TreeStats &s) {
+	w << L"\"keys\": " << s.keys << L", \"values\": " << s.values << L", \"bytes\": " << s.bytes << L", \"depth\": " << s.depth << L", \"types\": {";
+	bool	first = true;
+	for (int i = 0; i <= (int)TYPE::NUM; i++) {
+		if (s.by_type[i]) {
+			w << (first ? L"" : L", ") << L'"' << (i < (int)TYPE::NUM ? types[i] : L"other") << L"\": " << s.by_type[i];
+			first = false;
+		}
+	}
+	w << L'}';
+}
+
+int Reg::doSTATS() {
+	set_governor();
+	if (depth && *depth)
+		stats_depth = Wide::wcstoul(depth, nullptr, 10);
+	int	top	= limit && *limit ? Wide::wcstoul(limit, nullptr, 10) : 20;
+	int	n	= threads && *threads ? Wide::wcstoul(threads, nullptr, 10) : std::thread::hardware_concurrency();
+	spare_threads = n > 1 ? n - 1 : 0;
+
+	SourceKey	source;
+	if (auto ret = open_source(source))
+		return ret;
+
+	StatsReport	report(top);
+	TreeStats	total;
+	auto		&keyname = source.keyname;
+	stats	= &report;
+	stats_key(source.key, keyname, 0, total);
+	stats	= nullptr;
+
+	if (json) {
+		out << L"{\"key\": ";
+		put_json(out, keyname);
+		out << L", ";
+		put_json(out, total);
+		out << L"," << endl << L"\"subtrees\": [";
+		for (auto &i : report.subtrees) {
+			out << (&i == report.subtrees.begin() ? L"" : L",") << endl << L"  {\"key\": ";
+			put_json(out, i.keyname);
+			out << L", ";
+			put_json(out, i.stats);
+			out << L'}';
+		}
+		out << endl << L"]," << endl << L"\"largest_values\": [";
+		for (auto &i : report.values) {
+			out << (&i == report.values.begin() ? L"" : L",") << endl << L"  {\"key\": ";
+			put_json(out, i.keyname);
+			out << L", \"name\": ";
+			put_json(out, i.name);
+			out << L", \"type\": \"" << types[i.type < TYPE::NUM ? (int)i.type : 0] << L"\", \"bytes\": " << i.score << L'}';
+		}
+		out << endl << L"]," << endl << L"\"widest_keys\": [";
+		for (auto &i : report.keys) {
+			out << (&i == report.keys.begin() ? L"" : L",") << endl << L"  {\"key\": ";
+			put_json(out, i.keyname);
+			out << L", \"subkeys\": " << i.subkeys << L", \"values\": " << i.values << L'}';
+		}
+		out << endl << L"]}" << endl;
+
+	} else {
+		out << keyname << L": " << total.keys << L" key(s), " << total.values << L" value(s), " << total.bytes << L" bytes, depth " << total.depth << endl;
+		for (int i = 0; i <= (int)TYPE::NUM; i++) {
+			if (total.by_type[i])
+				out << L"	" << (i < (int)TYPE::NUM ? types[i] : L"other") << L"	" << total.by_type[i] << endl;
+		}
+
+		out << endl << L"Largest subtrees" << endl << L"       Keys     Values         Bytes  Depth  Key" << endl;
+		for (auto &i : report.subtrees) {
+			put_column(out, i.stats.keys, 11);
+			put_column(out, i.stats.values, 11);
+			put_column(out, i.stats.bytes, 14);
+			put_column(out, i.stats.depth, 7);
+			out << L"  " << i.keyname << endl;
+		}
+
+		out << endl << L"Largest values" << endl << L"        Bytes  Type                  Key / Value" << endl;
+		for (auto &i : report.values) {
+			put_column(out, i.score, 13);
+			out << L"  " << types[i.type < TYPE::NUM ? (int)i.type : 0] << L"  " << i.keyname << L"	" << (i.name.length() ? i.name : string(L"(Default)")) << endl;
+		}
+
+		out << endl << L"Widest keys" << endl << L"    Subkeys     Values  Key" << endl;
+		for (auto &i : report.keys) {
+			put_column(out, i.subkeys, 11);
+			put_column(out, i.values, 11);
+			out << L"  " << i.keyname << endl;
+		}
+	}
+	report_governor();
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// compact
+//	the hive is rebuilt from the keys reachable from its root, so free cells,
+//	orphaned cells and duplicate descriptors are dropped, and the writer's
+//	breadth first layout replaces the old one
+//-----------------------------------------------------------------------------
+
+struct CompactScratch {
+	char16_t				name[MAX_VALUE_NAME];
+	Hive::Array<uint8_t>	data;
+};
+
+// copies a name into the scratch buffer, cut to MAX_VALUE_NAME as hive_name does; returns its length
+uint32_t copy_name(Hive::Reader::Name name, CompactScratch &s) {
+	auto	n = name.length < MAX_VALUE_NAME ? name.length : MAX_VALUE_NAME;
+	for (uint32_t i = 0; i < n; i++)
+		s.name[i] = name[i];
+	return n;
+}
+
+void compact_key(const Hive::Reader &in, const Hive::NK *k, Hive::Writer &out, uint32_t dest, CompactScratch &s, uint32_t level = 0) {
+	// fields first: adding subkeys may move the key array
+	out.keys[dest].last_write	= k->last_write;
+	out.keys[dest].flags		= k->flags;
+	uint32_t	n;
+	if (auto sd = in.security(k, n))
+		out.keys[dest].security = out.security(sd, n);
+	if (auto name = in.class_name(k, n))
+		out.set_class(dest, (const char16_t*)name, n);
+
+	for (uint32_t i = 0, count = in.num_values(k); i < count; i++) {
+		auto	v = in.value(k, i);
+		if (!v || in.data_size(v) > in.data_room(v))		// a damaged size; the data is lost anyway
+			continue;
+		auto	n		= copy_name(in.name(v), s);
+		auto	size	= in.data_size(v);
+		s.data.resize(size);
+		if (in.data(v, s.data.p))
+			out.set_value(dest, s.name, n, v->type, s.data.p, size);
+	}
+
+	if (level >= 512)		// the registry's own limit; deeper means a damaged, cyclic hive
+		return;
+	for (uint32_t i = 0, count = in.num_subkeys(k); i < count; i++) {
+		if (auto sub = in.key(in.subkey(k, i))) {
+			auto	n = copy_name(in.name(sub), s);
+			compact_key(in, sub, out, out.key(dest, s.name, n), s, level + 1);
+		}
+	}
+}
+
+void put_fixed2(TextWriter<wchar_t> &w, double v, int width) {
+	auto	hundredths = uint64_t(v * 100 + 0.5);
+	put_column(w, hundredths / 100, width - 3);
+	w << L'.' << (hundredths % 100 < 10 ? L"0" : L"") << hundredths % 100;
+}
+
+int Reg::doCOMPACT() {
+	MappedFile		source(hive_file);
+	Hive::Reader	in;
+	if (auto ret = open_hive(in, source, hive_file))
+		return ret;
+
+	auto	root	= in.key(in.root);
+	auto	scratch	= new CompactScratch;
+	auto	n		= copy_name(in.name(root), *scratch);
+	Hive::Writer	compacted(scratch->name, n, in.header->last_write);
+	compact_key(in, root, compacted, compacted.root(), *scratch);
+	delete scratch;
+
+	FILE	*f;
+	if (_wfopen_s(&f, file, L"wb") != 0) {
+		out << L"Failed to create file: " << file << endl;
+		return errno;
+	}
+	bool	ok = compacted.write(f, in.header->name);
+	if (fclose(f) != 0 || !ok) {
+		out << L"Failed to write file: " << file << endl;
+		return ERROR_WRITE_FAULT;
+	}
+
+	MappedFile		written(file);
+	Hive::Reader	check;
+	if (!written || !check.open(written.p, written.size) || !check)
+		return ERROR_BADDB;
+
+	Hive::Layout	before(in, source.size), after(check, written.size);
+	out << L"                     Before           After" << endl;
+	out << L"File size    ";	put_column(out, before.file_size, 14);	put_column(out, after.file_size, 16);	out << endl;
+	out << L"Used cells   ";	put_column(out, before.used, 14);		put_column(out, after.used, 16);		out << endl;
+	out << L"Free cells   ";	put_column(out, before.free, 14);		put_column(out, after.free, 16);		out << endl;
+	out << L"Keys         ";	put_column(out, before.keys, 14);		put_column(out, after.keys, 16);		out << endl;
+	out << L"Pages/key    ";	put_fixed2(out, before.pages_per_key(), 14); put_fixed2(out, after.pages_per_key(), 16); out << endl;
 	return 0;
 }
 
+//-----------------------------------------------------------------------------
+// scan
+//	raw search of hive files, for sweeping many collected hives for an
+//	indicator without a tree walk; see Hive::Scan
+//-----------------------------------------------------------------------------
+
+int Reg::doSCAN() {
+	if (!data || !*data) {
+		out << L"No patterns given" << endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+
+	Hive::Search	search;
+	search.case_sensitive = case_sensitive;
+	for (auto p = data; *p;) {
+		auto	end = p;
+		while (*end && *end != ';')
+			++end;
+		search.add((const char16_t*)p, uint32_t(end - p));
+		p = *end ? end + 1 : end;
+	}
+
+	static const wchar_t *kinds[] = {L"key", L"value", L"data", L"cell"};
+	auto	dir		= hive_file + string_length(hive_file);
+	while (dir > hive_file && dir[-1] != '\\' && dir[-1] != '/' && dir[-1] != ':')
+		--dir;
+
+	uint32_t	num_files = 0, num_matches = 0;
+	WIN32_FIND_DATAW	found;
+	auto	h = FindFirstFileW(hive_file, &found);
+	if (h == INVALID_HANDLE_VALUE)
+		return ERROR_FILE_NOT_FOUND;
+	do {
+		if (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+		auto			filename = string(hive_file, dir) + found.cFileName;
+		MappedFile		file(filename);
+		Hive::Reader	hive;
+		if (open_hive(hive, file, filename))
+			continue;		// not a hive, or a log beside one
+
+		++num_files;
+		Hive::Scan	scan(hive, search);
+		if (!scan.matches.n)
+			continue;
+
+		out << filename << endl;
+		for (uint32_t i = 0; i < scan.matches.n; i++) {
+			auto	&m			= scan.matches[i];
+			bool	deleted		= m.deleted;
+			wchar_t	path[1024];
+			auto	n			= m.key != Hive::NONE ? scan.path(m.key, (char16_t*)path, 1023, deleted) : 0;
+			out << L"	" << (n ? string(path, path + n) : string(L"?"));
+			if (auto v = m.value != Hive::NONE ? hive.raw<Hive::VK>(m.value, "vk") : nullptr) {
+				auto	name = hive_name(hive.name(v));
+				out << L"	" << (name.length() ? name : string(L"(Default)"));
+			}
+			out << L"	" << kinds[m.kind];
+			if (m.kind == Hive::Scan::OTHER)
+				out << L" 0x" << base<16, 8>(m.cell);
+			auto	&pattern	= search.patterns[m.pattern];
+			out << L"	" << string((const wchar_t*)pattern.s, pattern.n);
+			if (deleted)
+				out << L"	(deleted)";
+			out << endl;
+		}
+		out << endl;
+		num_matches += scan.matches.n;
+	} while (FindNextFileW(h, &found));
+	FindClose(h);
+
+	out << L"End of search: " << num_matches << L" match(es) in " << num_files << L" hive(s)." << endl;
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// perf
+//	HKEY_PERFORMANCE_DATA has no size query, and a read that does not fit fails with ERROR_MORE_DATA,
+//	so one buffer is kept for the whole run and doubled until a sample fits
+//-----------------------------------------------------------------------------
+
+struct PerfBuffer {
+	BYTE	*p			= nullptr;
+	DWORD	capacity	= 0;
+
+	~PerfBuffer() { free(p); }
+
+	LSTATUS	query(const RegKey &key, const wchar_t *what, DWORD &size) {
+		if (!key)
+			return ERROR_FILE_NOT_FOUND;
+		for (;;) {
+			if (!capacity) {
+				capacity	= 1 << 16;
+				p			= (BYTE*)malloc(capacity);
+			}
+			size = capacity;
+			auto	ret = key.query(what, p, size);
+			if (ret != ERROR_MORE_DATA)
+				return ret;
+			capacity	*= 2;
+			p			= (BYTE*)realloc(p, capacity);
+		}
+	}
+};
+
+// three decimals covers percentages, rates and seconds alike
+void put_fixed3(TextWriter<wchar_t> &w, double v) {
+	if (v < 0) {
+		w << L'-';
+		v = -v;
+	}
+	auto	thousandths	= uint64_t(v * 1000 + 0.5);
+	auto	frac		= uint32_t(thousandths % 1000);
+	put_column(w, thousandths / 1000, 0);
+	w << L'.' << wchar_t('0' + frac / 100) << wchar_t('0' + frac / 10 % 10) << wchar_t('0' + frac % 10);
+}
+
+int Reg::doPERF() {
+	prepare_patterns();
+	auto		num_instance	= split_patterns(value);
+	set_limits();
+	uint32_t	samples	= limit && *limit ? max_found : 2;
+	DWORD		period	= interval && *interval ? Wide::wcstoul(interval, nullptr, 10) : 1000;
+
+	// both are only in the Windows registry; the predefined keys themselves are opened, and closed when done
+	RegKey		counters, data;
+	counters.open(*registry, 0, L"HKEY_PERFORMANCE_TEXT", Backend::OPEN_READ);
+	data.open(*registry, 0, L"HKEY_PERFORMANCE_DATA", Backend::OPEN_READ);
+
+	PerfBuffer	text, buffer;
+	Perf::Names	names;
+	DWORD		size;
+	if (text.query(counters, L"Counter", size) == ERROR_SUCCESS)
+		names.parse((const char16_t*)text.p, size / 2);
+
+	// objects are asked for by title index; a name may be shared by several indices, so all are asked for
+	Perf::Array<uint32_t>	wanted;
+	string					what;
+	if (key && *key) {
+		StringBuilder	b(what);
+		for (auto p = key; *p;) {
+			auto	e = p;
+			while (*e && *e != ';')
+				++e;
+			auto	n = wanted.n;
+			if (e > p && *p >= '0' && *p <= '9') {
+				wanted.push() = Wide::wcstoul(p, nullptr, 10);
+			} else {
+				for (auto i = names.find((const char16_t*)p, e - p); i != Perf::NONE; i = names.find((const char16_t*)p, e - p, i + 1))
+					wanted.push() = i;
+			}
+			if (n == wanted.n) {
+				out << L"Unknown performance object: " << string(p, e) << endl;
+				return ERROR_INVALID_PARAMETER;
+			}
+			for (auto i = n; i < wanted.n; i++)
+				b << onlyif(i, L" ") << wanted[i];
+			p = *e ? e + 1 : e;
+		}
+	} else {
+		what = string(L"Global");
+	}
+
+	auto	name = [&](uint32_t index) {
+		string	r;
+		if (auto s = names[index]) {
+			r = string((const wchar_t*)s);
+		} else {
+			StringBuilder	b(r);
+			b << L'#' << index;
+		}
+		return r;
+	};
+	auto	match = [&](const wchar_t *patterns, int n, string::view s) {
+		return !n || any_pattern(patterns, n, case_sensitive ? string(s) : string(s).tolower());
+	};
+
+	Perf::Sample	sample;
+	Perf::History	prev, next;
+	uint64_t		start	= 0;
+	uint64_t		due		= GetTickCount64();
+	int				ret		= 0;
+
+	for (uint32_t n = 0; n < samples && !should_stop(); n++) {
+		// samples are due at fixed times, so querying and printing do not push the later ones back
+		if (n) {
+			due += period;
+			auto	now = GetTickCount64();
+			if (now < due)
+				Sleep(DWORD(due - now));
+			else
+				due = now;		// fell behind: carry on from here rather than sampling in a burst
+		}
+		if ((ret = buffer.query(data, what, size)) != ERROR_SUCCESS)
+			break;
+		if (!sample.parse(buffer.p, size)) {
+			ret = ERROR_INVALID_DATA;
+			break;
+		}
+		if (!n)
+			start = sample.time_100ns;
+
+		next.entries.n = 0;
+		for (uint32_t o = 0; o < sample.objects.n; o++) {
+			auto	&obj	= sample.objects[o];
+			bool	asked	= !wanted.n;
+			for (uint32_t i = 0; i < wanted.n && !asked; i++)
+				asked = wanted[i] == obj.name;
+			if (!asked)
+				continue;
+
+			auto	object_name = name(obj.name);
+			for (uint32_t i = 0; i < obj.num_instances; i++) {
+				auto	&inst	= sample.instances[obj.first_instance + i];
+				auto	instance_name = inst.name ? string((const wchar_t*)inst.name, inst.length) : string();
+				if (inst.name && !match(value, num_instance, instance_name))
+					continue;
+
+				for (uint32_t c = 0; c < obj.num_counters; c++) {
+					auto	&counter = sample.counters[obj.first_counter + c];
+					if (!counter.shown())
+						continue;
+					auto	counter_name = name(counter.name);
+					if (!match(include, num_include, counter_name))
+						continue;
+
+					auto	&e		= next.entries.push();
+					auto	old		= prev.find(e.key = sample.key(obj, c, inst));
+					e.reading		= sample.read(obj, c, inst);
+					e.shown			= old ? old->shown : 0;
+					e.has_shown		= old && old->has_shown;
+
+					double	v;
+					if (Perf::value(counter.type, e.reading, old ? &old->reading : nullptr, v) && (all_values || !e.has_shown || v != e.shown)) {
+						e.shown		= v;
+						e.has_shown	= true;
+						put_fixed3(out, double(sample.time_100ns - start) / 1e7);
+						out << L"	\\" << object_name;
+						if (inst.name) {
+							out << L'(' << instance_name;
+							if (inst.occurrence)
+								out << L'#' << inst.occurrence;
+							out << L')';
+						}
+						out << L'\\' << counter_name << L"	";
+						put_fixed3(out, v);
+						out << endl;
+					}
+				}
+			}
+		}
+		next.sort();
+		prev.swap(next);
+	}
+	return ret ? ret : stop_status;
+}
+
+//-----------------------------------------------------------------------------
+// merge
+//	the inputs are mapped and indexed in parallel, then applied in order to one tree in memory;
+//	value data is only decoded as the merged file is written
+//-----------------------------------------------------------------------------
+
+int Reg::doMERGE() {
+	if (!file || !num_inputs) {
+		out << L"Nothing to merge" << endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+
+	auto	files	= new MappedFile*[num_inputs];
+	auto	docs	= new RegFile::Document[num_inputs];
+	auto	status	= new int[num_inputs];
+	std::atomic<int>	next{0};
+	auto	reader	= [&]() {
+		for (int i; (i = next++) < num_inputs;) {
+			files[i]	= new MappedFile(inputs[i]);
+			status[i]	= !*files[i] ? ERROR_FILE_NOT_FOUND
+						: !docs[i].open(files[i]->p, files[i]->size) ? ERROR_INVALID_DATA
+						: ERROR_SUCCESS;
+		}
+	};
+
+	int		n		= threads && *threads ? Wide::wcstoul(threads, nullptr, 10) : std::thread::hardware_concurrency();
+	if (n > num_inputs)
+		n = num_inputs;
+	auto	workers	= new std::thread*[n > 1 ? n - 1 : 0];
+	for (int i = 0; i < n - 1; i++)
+		workers[i] = new std::thread(reader);
+	reader();
+	for (int i = 0; i < n - 1; i++) {
+		workers[i]->join();
+		delete workers[i];
+	}
+	delete[] workers;
+
+	int		ret	= 0;
+	RegFile::Merged	merged;
+	for (int i = 0; i < num_inputs && !ret; i++) {
+		if ((ret = status[i]))
+			out << (ret == ERROR_FILE_NOT_FOUND ? L"Failed to open file: " : L"Not a .reg file: ") << inputs[i] << endl;
+		else
+			merged.apply(docs[i]);
+	}
+
+	if (!ret) {
+		RegWriter	stream(file, compress);
+		if (!stream) {
+			out << L"Failed to create file: " << file << endl;
+			ret = errno;
+
+		} else {
+			stream << L"Windows Registry Editor Version 5.00" << endl << endl;
+
+			uint32_t	num_keys = 0, num_values = 0, num_removed = 0, num_malformed = 0;
+			RegFile::Array<uint8_t>	data;
+			string		name;
+			merged.each([&](const RegFile::Merged::Node &node, const RegFile::Array<char16_t> &path) {
+				auto	keyname = string::view((const wchar_t*)path.p, path.n);
+				if (node.removed) {
+					stream.remove_key(keyname);
+					++num_removed;
+				}
+				if (!node.present)
+					return;
+
+				stream.key_start(keyname);
+				++num_keys;
+				for (auto e = node.first_value; e != RegFile::NONE; e = merged.entries[e].next) {
+					auto	&entry	= merged.entries[e];
+					// names only escape \ and "
+					name = string(L"");
+					{
+						StringBuilder	b(name);
+						for (auto c = merged.name(entry.name), ce = c + entry.length; c < ce; ++c) {
+							if (*c == '\\' || *c == '"')
+								b << L'\\';
+							b << (wchar_t)*c;
+						}
+					}
+					if (entry.v.removed) {
+						stream.remove_value(name);
+						++num_removed;
+						continue;
+					}
+					auto	type = entry.doc->data(entry.v, data);
+					if (type == RegFile::NONE) {
+						++num_malformed;
+						continue;
+					}
+					stream.value(name, (TYPE)type, data.p, data.n);
+					++num_values;
+				}
+				stream.key_end();
+			});
+
+			out << L"Merged " << num_inputs << L" file(s): " << num_keys << L" key(s), " << num_values << L" value(s), " << num_removed << L" removal(s)";
+			if (num_malformed)
+				out << L"; " << num_malformed << L" malformed value(s) skipped";
+			out << endl;
+		}
+	}
+
+	for (int i = 0; i < num_inputs; i++)
+		delete files[i];
+	delete[] files;
+	delete[] docs;
+	delete[] status;
+	return ret;
+}
+
 //-----------------------------------------------------------------------------
 // load/unload
 //-----------------------------------------------------------------------------
 
 int Reg::doLOAD()	{
-	ParsedKey	parsed(key);
-#if 0
-	return RegLoadKey(parsed.get_rootkey(), parsed.subkey, file);
-#else
-	HKEY	h;
-	if (auto ret = RegLoadAppKey(file, &h, KEY_ALL_ACCESS | get_sam(), 0, 0))
+	ParsedKey		parsed(key);
+	Backend::Key	k;
+	if (!parsed.backend)
+		return ERROR_BAD_NETPATH;
+	if (auto ret = parsed.backend->load_hive((const char16_t*)file, k))
 		return ret;
-	out << L"Loaded: " << parsed.get_keyname() << L"=" << h << endl;
+	out << L"Loaded: " << parsed.get_keyname() << L"=" << (const void*)k << endl;
 	return 0;
-#endif
 }
 
 int Reg::doUNLOAD()	{
 	ParsedKey	parsed(key);
-	return RegUnLoadKey(parsed.get_rootkey(), parsed.subkey);
+	auto		name = parsed.get_keyname();
+	if (!parsed.backend)
+		return ERROR_BAD_NETPATH;
+	return parsed.backend->unload_hive(0, (const char16_t*)(const wchar_t*)name, name.length());
 }
 
 //-----------------------------------------------------------------------------
@@ -1253,7 +4374,7 @@ void print_options(OP op) {
 			out << opt->arg;
 		}
 		auto desc = opt->desc;
-		while (auto p = wcschr(desc, '\n')) {
+		while (auto p = Wide::wcschr(desc, '\n')) {
 			out << L'\t' << string(desc, p + 1);
 			desc = p + 1;
 		}
@@ -1269,7 +4390,7 @@ int wmain(int argc, wchar_t* argv[]) {
 	if (argc < 2) {
 		out << L"** NOTE: this is an unofficial replacement for REG **" << endl << endl
 			<< L"REG Operation [Parameter List]" << endl << endl
-			<< L"Operation  [ QUERY | ADD | DELETE | EXPORT | IMPORT]" << endl << endl
+			<< L"Operation  [ QUERY | ADD | DELETE | EXPORT | IMPORT | COPY | SNAPSHOT | RESTORE | COMPARE | HASH | SYNC | STATS | COMPACT | SCAN | PERF | MERGE ]" << endl << endl
 			<< L"Returns WINERROR code (e.g ERROR_SUCCESS = 0 on sucess)" << endl << endl
 			<< L"For help on a specific operation type:" << endl << endl
 			<< L"REG Operation /?" << endl << endl;
@@ -1288,44 +4409,57 @@ int wmain(int argc, wchar_t* argv[]) {
 	}
 
 	Reg reg;
-	auto err = get_options(op_options[(uint8_t)op].opts, argc - 2, argv + 2, reg.string_args, reg.bool_args);
+	if (op == OP::MERGE)
+		reg.inputs = new wchar_t*[argc];
+	auto err = get_options(op_options[(uint8_t)op].opts, argc - 2, argv + 2, reg.string_args, reg.bool_args, reg.inputs, &reg.num_inputs);
 	if (err) {
 		out << L"Unknown option: " << err << endl;
 		return ERROR_INVALID_FUNCTION;
 	}
 
-	int r = 0;
-	switch (op) {
-		case OP::QUERY: 	r = reg.doQUERY(); 	break;
-		case OP::ADD: 		r = reg.doADD();	break;
-		case OP::DEL: 		r = reg.doDELETE();	break;
-		case OP::EXPORT: 	r = reg.doEXPORT(); break;
-		case OP::IMPORT: 	r = reg.doIMPORT(); break;
-	//	case OP::COPY: 		r = reg.doCOPY();	break;
-	//	case OP::SAVE: 		r = reg.doSAVE();	break;
-	//	case OP::RESTORE: 	r = reg.doRESTORE();break;
-		case OP::LOAD: 		r = reg.doLOAD();	break;
-		case OP::UNLOAD: 	r = reg.doUNLOAD(); break;
-	//	case OP::COMPARE: 	r = reg.doCOMPARE();break;
-	//	case OP::FLAGS: 	r = reg.doFLAGS();	break;
-		default: break;
-	}
-	switch (r) {
-		case ERROR_SUCCESS:
-			break;
-		case ERROR_FILE_NOT_FOUND:
-			out << L"ERROR: File not found" << endl;
-			break;
-		case ERROR_ACCESS_DENIED:
-			out << L"ERROR: Access denied" << endl;
-			break;
-		default: {
-			out << L"ERROR " << r << L": ";
-			wchar_t *buffer;
-			FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM|FORMAT_MESSAGE_ALLOCATE_BUFFER, nullptr, r, 0, (LPWSTR)&buffer, 0, nullptr);
-			out << buffer << endl;
-			break;
+	int r = reg.open_registry();
+	if (r == ERROR_SUCCESS) {
+		switch (op) {
+			case OP::QUERY: 	r = reg.doQUERY(); 	break;
+			case OP::ADD: 		r = reg.doADD();	break;
+			case OP::DEL: 		r = reg.doDELETE();	break;
+			case OP::EXPORT: 	r = reg.doEXPORT(); break;
+			case OP::IMPORT: 	r = reg.doIMPORT(); break;
+			case OP::COPY: 		r = reg.doCOPY();	break;
+		//	case OP::SAVE: 		r = reg.doSAVE();	break;
+			case OP::SNAPSHOT: 	r = reg.doSNAPSHOT();break;
+			case OP::RESTORE: 	r = reg.doRESTORE();break;
+			case OP::LOAD: 		r = reg.doLOAD();	break;
+			case OP::UNLOAD: 	r = reg.doUNLOAD(); break;
+			case OP::COMPARE: 	r = reg.doCOMPARE();break;
+			case OP::HASH: 		r = reg.doHASH();	break;
+			case OP::SYNC: 		r = reg.doSYNC();	break;
+			case OP::STATS: 	r = reg.doSTATS();	break;
+			case OP::COMPACT: 	r = reg.doCOMPACT();break;
+			case OP::SCAN: 		r = reg.doSCAN();	break;
+			case OP::PERF: 		r = reg.doPERF();	break;
+			case OP::MERGE: 	r = reg.doMERGE();	break;
+		//	case OP::FLAGS: 	r = reg.doFLAGS();	break;
+			default: break;
 		}
 	}
+	if (!reg.exit_code && !(reg.binary && op == OP::QUERY))	// don't corrupt a binary stream
+		report_error(r);
 	return r;
 }
+
+#ifndef _WIN32
+// arguments arrive as UTF-8
+int main(int argc, char *argv[]) {
+	auto	args = (wchar_t**)malloc((argc + 1) * sizeof(wchar_t*));
+	for (int i = 0; i < argc; i++)
+		args[i] = Posix::to_utf16(argv[i]);
+	args[argc] = nullptr;
+
+	int		r = wmain(argc, args);
+	for (int i = 0; i < argc; i++)
+		free(args[i]);
+	free(args);
+	return r;
+}
+#endif
@@ -0,0 +1,76 @@
+# writes the HKEY_PERFORMANCE_DATA blobs test-perf.cpp decodes: two samples, one second apart, laid out as winperf.h has them
+#	Processor (238) with instances 0, 1 and _Total: % Processor Time (PERF_100NSEC_TIMER_INV), Interrupts/sec (PERF_COUNTER_COUNTER)
+#	Memory (4), no instances: Available Bytes (PERF_COUNTER_LARGE_RAWCOUNT), System Code Total Bytes (PERF_COUNTER_RAWCOUNT),
+#	% Committed Bytes In Use (PERF_RAW_FRACTION, PERF_RAW_BASE)
+# usage: python3 make-perf-fixtures.py [directory]
+
+import os, struct, sys
+
+def pad8(b):
+	return b + b'\0' * (-len(b) % 8)
+
+def counter(name, type, size, offset):
+	return struct.pack('<IIIIIiIIII', 40, name, 0, name + 1, 0, 0, 100, type, size, offset)
+
+def block(fields):
+	data = b''.join(struct.pack('<Q' if size == 8 else '<I', v) for v, size in fields)
+	return pad8(struct.pack('<I', 0) + data)
+
+def sized_block(fields):
+	b = block(fields)
+	return struct.pack('<I', len(b)) + b[4:]
+
+def instance(name):
+	text = (name + '\0').encode('utf-16-le')
+	return pad8(struct.pack('<IIIiII', 0, 0, 0, -1, 24, len(text)) + text)
+
+def sized_instance(name):
+	b = instance(name)
+	return struct.pack('<I', len(b)) + b[4:]
+
+# instances alternate instance definitions and counter blocks; an object without instances has just one block
+def object(name, counters, instances, time, freq, single = None):
+	defs	= b''.join(counters)
+	body	= b''.join(instances) if instances is not None else single
+	num		= len(instances) // 2 if instances is not None else -1
+	header	= 64
+	total	= header + len(defs) + len(body)
+	return struct.pack('<IIIIIIIIIIiIQQ', total, header + len(defs), header, name, 0, name + 1, 0, 100, len(counters), 0, num, 0, time, freq) + defs + body
+
+def processor(idle, interrupts, time):
+	counters = [
+		counter(6, 0x21510500, 8, 8),
+		counter(148, 0x10410400, 4, 16),
+	]
+	instances = []
+	for name, i, n in zip(['0', '1', '_Total'], idle, interrupts):
+		instances += [sized_instance(name), sized_block([(0, 4), (i, 8), (n, 4)])]
+	return object(238, counters, instances, time, 10000000)
+
+def memory(available, code, committed, limit, time):
+	counters = [
+		counter(1380, 0x00010100, 8, 8),
+		counter(1408, 0x00010000, 4, 16),
+		counter(1406, 0x20020400, 4, 20),
+		counter(1407, 0x40030403, 4, 24),
+	]
+	return object(4, counters, None, time, 10000000, sized_block([(0, 4), (available, 8), (code, 4), (committed, 4), (limit, 4)]))
+
+def blob(objects, time):
+	name	= pad8('TEST'.encode('utf-16-le') + b'\0\0')
+	body	= b''.join(objects)
+	header	= 88 + len(name)
+	systime	= struct.pack('<8H', 2026, 10, 0, 18, 12, 0, 0, 0)
+	return ('PERF'.encode('utf-16-le') + struct.pack('<IIIIIIi', 1, 1, 1, header + len(body), header, len(objects), 238)
+		+ systime + b'\0' * 4 + struct.pack('<QQQII', time, 10000000, time, len(name), 88) + name + body)
+
+T = 133000000000000000
+samples = [
+	blob([processor([1000000000, 2000000000, 3000000000], [1000, 0xffffff00, 5000], T), memory(0x200000000, 0xc0000000, 0x30000000, 0x40000000, T)], T),
+	blob([processor([1007500000, 2005000000, 3006250000], [1500, 0x00000064, 5856], T + 10000000), memory(0x200000000, 0xc0000000, 0x30000000, 0x40000000, T + 10000000)], T + 10000000),
+]
+
+out = sys.argv[1] if len(sys.argv) > 1 else os.path.dirname(os.path.abspath(__file__))
+for i, b in enumerate(samples):
+	with open(os.path.join(out, 'perf-sample%d.bin' % (i + 1)), 'wb') as f:
+		f.write(b)
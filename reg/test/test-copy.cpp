@@ -0,0 +1,105 @@
+// runs COPY on a tree held in memory (as /mem does) and checks what arrives at the destination
+// build: g++ -std=c++17 -fshort-wchar -pthread -I node_modules/@isopodlabs/napi/include reg/test/test-copy.cpp -o reg/test/test-copy
+//        (or clang-cl -std:c++17 -I node_modules\@isopodlabs\napi\include -DUNICODE -D_UNICODE -DWIN32_LEAN_AND_MEAN reg\test\test-copy.cpp /link advapi32.lib)
+// usage: test-copy   (npm test builds and runs it with the others)
+
+#define wmain	reg_wmain
+#define main	reg_main
+#include "../reg.cpp"
+#undef wmain
+#undef main
+#include "test.h"
+
+// cannot list the subkeys of one key, as when that key is deleted while the copy walks it
+struct FlakyMemory : Backend::Memory {
+	Backend::Key	flaky	= 0;
+	int		enum_key(Backend::Key key, uint32_t i, char16_t *name, uint32_t &n) override {
+		return key == flaky ? Backend::KEY_DELETED : Memory::enum_key(key, i, name, n);
+	}
+};
+
+const DWORD	sixteen = 16;
+
+// HKLM\Software\Src, with a default, a string, a DWORD and an empty binary value, Sub1\Deep and an empty Sub2
+void fill(Backend::Memory &mem) {
+	RegKey	src, deep, sub2;
+	src.open(mem, 0, L"HKEY_LOCAL_MACHINE\\Software\\Src", Backend::OPEN_CREATE);
+	src.set_value(L"", TYPE::SZ, (const BYTE*)L"def", 8);
+	src.set_value(L"a", TYPE::SZ, (const BYTE*)L"hello", 12);
+	src.set_value(L"d", TYPE::DWORD, (const BYTE*)&sixteen, 4);
+	src.set_value(L"e", TYPE::BINARY, nullptr, 0);
+	deep.create(src, L"Sub1\\Deep");
+	deep.set_value(L"x", TYPE::SZ, (const BYTE*)L"y", 4);
+	sub2.create(src, L"Sub2");
+}
+
+bool has_value(const RegKey &key, const wchar_t *name, TYPE type, const void *data, DWORD size) {
+	BYTE	buffer[64];
+	auto	v = key.value(name, buffer, sizeof(buffer));
+	return v && v.type == type && v.size == size && memcmp(buffer, data, size) == 0;
+}
+
+bool exists(Backend::Memory &mem, const wchar_t *path) {
+	RegKey	k;
+	return k.open(mem, 0, path, Backend::OPEN_READ) == ERROR_SUCCESS;
+}
+
+int copy(const wchar_t *from, const wchar_t *to, bool force, uint32_t *keys = nullptr, uint32_t *values = nullptr) {
+	Reg		reg;
+	reg.key			= (wchar_t*)from;
+	reg.key2		= (wchar_t*)to;
+	reg.threads		= (wchar_t*)L"4";
+	reg.all_subkeys	= true;
+	reg.force		= force;
+	int		r		= reg.doCOPY();
+	if (keys)
+		*keys = reg.num_copied_keys;
+	if (values)
+		*values = reg.num_copied_values;
+	return r;
+}
+
+int main() {
+	{
+		Backend::Memory	mem;
+		fill(mem);
+		registry = &mem;
+
+		uint32_t	keys = 0, values = 0;
+		check("copy succeeds", copy(L"HKLM\\Software\\Src", L"HKLM\\Software\\Dst", false, &keys, &values) == ERROR_SUCCESS);
+		check("four keys and five values copied", keys == 4 && values == 5);
+
+		RegKey	dst;
+		dst.open(mem, 0, L"HKEY_LOCAL_MACHINE\\Software\\Dst", Backend::OPEN_READ);
+		check("default value", has_value(dst, L"", TYPE::SZ, L"def", 8));
+		check("string value", has_value(dst, L"a", TYPE::SZ, L"hello", 12));
+		check("DWORD value", has_value(dst, L"d", TYPE::DWORD, &sixteen, 4));
+		check("empty binary value kept", has_value(dst, L"e", TYPE::BINARY, "", 0));
+		check("nested value", has_value(RegKey(dst, L"Sub1\\Deep"), L"x", TYPE::SZ, L"y", 4));
+		check("empty subkey", exists(mem, L"HKEY_LOCAL_MACHINE\\Software\\Dst\\Sub2"));
+		check("nothing else in the destination", dst.info().num_values == 4 && dst.info().num_subkeys == 2
+			&& RegKey(dst, L"Sub1").info().num_subkeys == 1);
+
+		check("existing destination needs /f", copy(L"HKLM\\Software\\Src", L"HKLM\\Software\\Dst", false) == ERROR_ALREADY_EXISTS);
+		check("existing destination with /f", copy(L"HKLM\\Software\\Src", L"HKLM\\Software\\Dst", true) == ERROR_SUCCESS);
+		check("copy into itself is refused", copy(L"HKLM\\Software\\Src", L"HKLM\\Software\\Src\\Sub1", true) == ERROR_INVALID_PARAMETER);
+		check("missing source", copy(L"HKLM\\Software\\None", L"HKLM\\Software\\Dst2", false) == ERROR_FILE_NOT_FOUND);
+		check("nothing made for a missing source", !exists(mem, L"HKEY_LOCAL_MACHINE\\Software\\Dst2"));
+	}
+	{
+		FlakyMemory	mem;
+		fill(mem);
+		RegKey	sub1;
+		sub1.open(mem, 0, L"HKEY_LOCAL_MACHINE\\Software\\Src\\Sub1", Backend::OPEN_READ);
+		mem.flaky	= sub1.bkey;
+		registry	= &mem;
+
+		check("copy with a failed listing finishes", copy(L"HKLM\\Software\\Src", L"HKLM\\Software\\Dst", false) == ERROR_SUCCESS);
+		check("the unlisted key's subkeys are skipped", exists(mem, L"HKEY_LOCAL_MACHINE\\Software\\Dst\\Sub1")
+			&& !exists(mem, L"HKEY_LOCAL_MACHINE\\Software\\Dst\\Sub1\\Deep"));
+		check("other subkeys still copied", exists(mem, L"HKEY_LOCAL_MACHINE\\Software\\Dst\\Sub2"));
+	}
+	registry = &local_registry;
+
+	return finish();
+}
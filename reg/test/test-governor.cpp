@@ -0,0 +1,174 @@
+// runs COPY, SYNC, QUERY and EXPORT on a tree held in memory (as /mem does) with /delay, under /rate, /inflight and /latency,
+// and checks that every registry call is paced and that the pacing holds
+// build: g++ -std=c++17 -fshort-wchar -pthread -I node_modules/@isopodlabs/napi/include reg/test/test-governor.cpp -o reg/test/test-governor
+//        (or clang-cl -std:c++17 -I node_modules\@isopodlabs\napi\include -DUNICODE -D_UNICODE -DWIN32_LEAN_AND_MEAN reg\test\test-governor.cpp /link advapi32.lib)
+// usage: test-governor   (npm test builds and runs it with the others)
+
+#define wmain	reg_wmain
+#define main	reg_main
+#include "../reg.cpp"
+#undef wmain
+#undef main
+#include "test.h"
+
+// HKLM\Software\Src\K0..K7, each with four values and two subkeys holding one value
+void fill(Backend::Memory &mem) {
+	RegKey	src;
+	src.open(mem, 0, L"HKEY_LOCAL_MACHINE\\Software\\Src", Backend::OPEN_CREATE);
+	for (int k = 0; k < 8; k++) {
+		wchar_t	name[]	= L"K0";
+		name[1] += k;
+		RegKey	key;
+		key.create(src, name);
+		for (int v = 0; v < 4; v++) {
+			wchar_t	value[] = L"v0";
+			value[1] += v;
+			key.set_value(value, TYPE::DWORD, (const BYTE*)&v, 4);
+		}
+		RegKey	c0, c1;
+		c0.create(key, L"C0");
+		c1.create(key, L"C1");
+		c0.set_value(L"x", TYPE::SZ, (const BYTE*)L"y", 4);
+		c1.set_value(L"x", TYPE::SZ, (const BYTE*)L"y", 4);
+	}
+}
+
+bool exists(Backend::Memory &mem, const wchar_t *path) {
+	RegKey	k;
+	return k.open(mem, 0, path, Backend::OPEN_READ) == ERROR_SUCCESS;
+}
+
+struct Run {
+	int				result;
+	uint64_t		calls;		// made on the registry
+	Governor::Stats	stats;		// as the governor saw them
+	double			seconds;
+};
+
+// one operation with the options set by setup
+template<typename F> Run run(Backend::Memory &mem, int (Reg::*op)(), F setup) {
+	Reg		reg;
+	reg.key		= (wchar_t*)L"HKLM\\Software\\Src";
+	reg.key2	= (wchar_t*)L"HKLM\\Software\\Dst";
+	reg.threads	= (wchar_t*)L"4";
+	reg.all_subkeys	= true;
+	reg.force		= true;
+	setup(reg);
+
+	Run		r;
+	auto	calls	= mem.calls.load();
+	auto	start	= Governor::clock::now();
+	r.result	= (reg.*op)();
+	r.seconds	= Governor::seconds(Governor::clock::now() - start).count();
+	r.calls		= mem.calls - calls;
+	r.stats		= reg.gov.stats;
+	return r;
+}
+
+int main() {
+	Backend::Memory	mem;
+	fill(mem);
+	registry = &mem;
+
+	// concurrency ceiling: four threads with slow calls, never more than two at once
+	mem.delay_us = 200;
+	auto	copy = run(mem, &Reg::doCOPY, [](Reg &reg) { reg.inflight = (wchar_t*)L"2"; });
+	mem.delay_us = 0;
+	check("COPY succeeds", copy.result == ERROR_SUCCESS);
+	check("COPY: every registry call governed", copy.calls > 0 && copy.stats.calls == copy.calls);
+	check("COPY: at most two calls in flight", copy.stats.peak_inflight >= 1 && copy.stats.peak_inflight <= 2);
+
+	// SYNC sets, adds and deletes
+	{
+		RegKey	src;
+		src.open(mem, 0, L"HKEY_LOCAL_MACHINE\\Software\\Src", Backend::OPEN_WRITE);
+		src.remove_key(L"K2");
+		src.set_value(L"new", TYPE::SZ, (const BYTE*)L"v", 4);
+		RegKey	k8;
+		k8.create(src, L"K8\\C0");
+	}
+	auto	sync = run(mem, &Reg::doSYNC, [](Reg &reg) { reg.rate = (wchar_t*)L"1000000"; });
+	check("SYNC succeeds", sync.result == ERROR_SUCCESS);
+	check("SYNC: every registry call governed", sync.calls > 0 && sync.stats.calls == sync.calls);
+	check("SYNC: one call at a time", sync.stats.peak_inflight == 1);
+	check("SYNC: removed key deleted", !exists(mem, L"HKEY_LOCAL_MACHINE\\Software\\Dst\\K2"));
+	check("SYNC: new key added", exists(mem, L"HKEY_LOCAL_MACHINE\\Software\\Dst\\K8\\C0"));
+	{
+		RegKey	dst;
+		dst.open(mem, 0, L"HKEY_LOCAL_MACHINE\\Software\\Dst", Backend::OPEN_READ);
+		BYTE	data[16];
+		check("SYNC: new value set", !!dst.value(L"new", data, sizeof(data)));
+	}
+
+	// token bucket: past the burst, calls come no faster than the rate
+	auto	paced = run(mem, &Reg::doCOPY, [](Reg &reg) { reg.rate = (wchar_t*)L"1000"; });
+	double	least = (paced.calls - (1000 / 10 + 1)) / 1000.0;
+	check("paced COPY succeeds", paced.result == ERROR_SUCCESS);
+	check("paced: every registry call governed", paced.stats.calls == paced.calls);
+	check("paced: waited for tokens", paced.stats.rate_waits > 0);
+	check("paced: no faster than the rate", paced.calls > 101 && paced.seconds >= least * 0.95);
+
+	// latency target: calls slower than the target cut the duty cycle
+	mem.delay_us = 500;
+	auto	slow = run(mem, &Reg::doCOPY, [](Reg &reg) {
+		reg.key			= (wchar_t*)L"HKLM\\Software\\Src\\K0";
+		reg.key2		= (wchar_t*)L"HKLM\\Software\\Dst\\K0";
+		reg.latency		= (wchar_t*)L"0.1";
+	});
+	mem.delay_us = 0;
+	check("slow COPY succeeds", slow.result == ERROR_SUCCESS);
+	check("slow: every registry call governed", slow.stats.calls == slow.calls);
+	check("slow: latency measured", slow.stats.latency >= 0.0005);
+	check("slow: backed off", slow.stats.backoffs > 0 && slow.stats.duty < 1);
+
+	// QUERY and EXPORT walk one call at a time, so only the rate and the latency target apply
+	// a search that matches nothing reads every key and value but prints one line (QUERY lowers the pattern in place)
+	static wchar_t	nothing[] = L"nosuchtext";
+	auto	query = [](const wchar_t *key, const wchar_t *rate, const wchar_t *latency) {
+		return [=](Reg &reg) {
+			reg.key		= (wchar_t*)key;
+			reg.data	= nothing;
+			reg.rate	= (wchar_t*)rate;
+			reg.latency	= (wchar_t*)latency;
+		};
+	};
+	auto	exporting = [](const wchar_t *key, const wchar_t *rate, const wchar_t *latency) {
+		return [=](Reg &reg) {
+			reg.key		= (wchar_t*)key;
+			reg.file	= (wchar_t*)L"test-governor.reg";
+			reg.rate	= (wchar_t*)rate;
+			reg.latency	= (wchar_t*)latency;
+		};
+	};
+
+	mem.delay_us = 50;
+	auto	paced_query = run(mem, &Reg::doQUERY, query(L"HKLM\\Software\\Src", L"500", nullptr));
+	least = (paced_query.calls - (500 / 10 + 1)) / 500.0;
+	check("paced QUERY succeeds", paced_query.result == ERROR_SUCCESS);
+	check("paced QUERY: every registry call governed", paced_query.stats.calls == paced_query.calls);
+	check("paced QUERY: waited for tokens", paced_query.stats.rate_waits > 0);
+	check("paced QUERY: no faster than the rate", paced_query.calls > 51 && paced_query.seconds >= least * 0.95);
+
+	auto	paced_export = run(mem, &Reg::doEXPORT, exporting(L"HKLM\\Software\\Src", L"500", nullptr));
+	least = (paced_export.calls - (500 / 10 + 1)) / 500.0;
+	check("paced EXPORT succeeds", paced_export.result == ERROR_SUCCESS);
+	check("paced EXPORT: every registry call governed", paced_export.stats.calls == paced_export.calls);
+	check("paced EXPORT: waited for tokens", paced_export.stats.rate_waits > 0);
+	check("paced EXPORT: no faster than the rate", paced_export.calls > 51 && paced_export.seconds >= least * 0.95);
+
+	mem.delay_us = 500;
+	auto	slow_query = run(mem, &Reg::doQUERY, query(L"HKLM\\Software\\Src", nullptr, L"0.1"));
+	check("slow QUERY succeeds", slow_query.result == ERROR_SUCCESS);
+	check("slow QUERY: every registry call governed", slow_query.stats.calls == slow_query.calls);
+	check("slow QUERY: backed off", slow_query.stats.backoffs > 0 && slow_query.stats.duty < 1);
+
+	auto	slow_export = run(mem, &Reg::doEXPORT, exporting(L"HKLM\\Software\\Src", nullptr, L"0.1"));
+	check("slow EXPORT succeeds", slow_export.result == ERROR_SUCCESS);
+	check("slow EXPORT: every registry call governed", slow_export.stats.calls == slow_export.calls);
+	check("slow EXPORT: backed off", slow_export.stats.backoffs > 0 && slow_export.stats.duty < 1);
+	mem.delay_us = 0;
+	_wremove(L"test-governor.reg");
+
+	registry = &local_registry;
+	return finish();
+}
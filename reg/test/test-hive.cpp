@@ -0,0 +1,131 @@
+// reads a hive whose key claims far more values and subkeys than its lists hold, as a damaged or hostile hive can,
+// and checks that the reader, the HiveFile backend, EXPORT /hive and COMPACT stay within the lists
+// build: g++ -std=c++17 -fshort-wchar -pthread -I node_modules/@isopodlabs/napi/include reg/test/test-hive.cpp -o reg/test/test-hive
+//        (or clang-cl -std:c++17 -I node_modules\@isopodlabs\napi\include -DUNICODE -D_UNICODE -DWIN32_LEAN_AND_MEAN reg\test\test-hive.cpp /link advapi32.lib)
+// usage: test-hive   (npm test builds and runs it with the others)
+
+#define wmain	reg_wmain
+#define main	reg_main
+#include "../reg.cpp"
+#undef wmain
+#undef main
+#include "test.h"
+
+struct Bytes {
+	uint8_t	*p		= nullptr;
+	size_t	size	= 0;
+
+	bool	read(const char *name) {
+		FILE	*f = fopen(name, "rb");
+		if (!f)
+			return false;
+		fseek(f, 0, SEEK_END);
+		size	= ftell(f);
+		p		= (uint8_t*)malloc(size);
+		fseek(f, 0, SEEK_SET);
+		bool	ok = fread(p, 1, size, f) == size;
+		fclose(f);
+		return ok;
+	}
+	bool	write(const char *name) const {
+		FILE	*f = fopen(name, "wb");
+		bool	ok = f && fwrite(p, 1, size, f) == size;
+		return f && fclose(f) == 0 && ok;
+	}
+	~Bytes() { free(p); }
+};
+
+// ROOT\A with three values and the subkeys B and C
+bool make_hive(const char *name) {
+	Hive::Writer	w(u"ROOT", 4, 1);
+	auto	a = w.path(u"A", 1);
+	w.set_value(a, u"x", 1, uint32_t(TYPE::SZ), u"1", 4);
+	w.set_value(a, u"y", 1, uint32_t(TYPE::SZ), u"2", 4);
+	w.set_value(a, u"z", 1, uint32_t(TYPE::SZ), u"3", 4);
+	w.path(u"A\\B", 3);
+	w.path(u"A\\C", 3);
+	FILE	*f = fopen(name, "wb");
+	bool	ok = f && w.write(f);
+	return f && fclose(f) == 0 && ok;
+}
+
+int main() {
+	Bytes	hive;
+	check("hive written", make_hive("test-hive.dat") && hive.read("test-hive.dat"));
+
+	// A's counts raised to what no list could hold
+	{
+		Hive::Reader	r(hive.p, hive.size);
+		auto	k = r.key(r.lookup(u"A", 1));
+		check("key found", k && r.num_values(k) == 3 && r.num_subkeys(k) == 2);
+		if (!k)
+			return finish();
+		auto	nk		= (uint8_t*)k;
+		uint32_t	huge	= 0xffffffff;
+		memcpy(nk + offsetof(Hive::NK, num_values), &huge, 4);
+		memcpy(nk + offsetof(Hive::NK, num_subkeys), &huge, 4);
+	}
+	check("damaged hive written", hive.write("test-hive.dat"));
+
+	Hive::Reader	r(hive.p, hive.size);
+	auto	k = r.key(r.lookup(u"A", 1));
+	check("damaged key still read", k && k->num_values == 0xffffffff);
+	if (!k)
+		return finish();
+	check("values held to the list", r.num_values(k) == 3);
+	check("subkeys held to the list", r.num_subkeys(k) == 2);
+	check("value far past the list", !r.value(k, 0x40000000) && !r.value(k, 0xfffffffe));
+	check("missing value not found", !r.find_value(k, u"w", 1));
+	check("present value found", !!r.find_value(k, u"z", 1));
+
+	Backend::HiveFile	file(r);
+	Backend::Key		a;
+	Backend::Info		info;
+	check("backend opens the key", file.open(0, u"ROOT\\A", 6, Backend::OPEN_READ, a) == Backend::SUCCESS);
+	check("backend counts what is there", file.info(a, info) == Backend::SUCCESS && info.num_values == 3 && info.num_subkeys == 2);
+	char16_t	name[16];
+	uint32_t	n = 16, type, size = 0;
+	check("no value past the list", file.enum_value(a, 3, name, n, type, nullptr, size) == Backend::NO_MORE_ITEMS);
+	n = 16;
+	check("no subkey past the list", file.enum_key(a, 2, name, n) == Backend::NO_MORE_ITEMS);
+
+	{
+		Reg		reg;
+		reg.key			= (wchar_t*)L"ROOT\\A";
+		reg.hive_file	= (wchar_t*)L"test-hive.dat";
+		reg.file		= (wchar_t*)L"test-hive.reg";
+		reg.all_subkeys	= true;
+		reg.force		= true;
+		check("EXPORT /hive of the damaged key", reg.doEXPORT() == ERROR_SUCCESS);
+	}
+	RegFile::Document	doc;
+	Bytes				exported;
+	uint32_t			sections = 0;
+	if (exported.read("test-hive.reg") && doc.open(exported.p, exported.size)) {
+		for (uint32_t i = 0; i < doc.sections.n; i++)
+			sections += !doc.sections[i].implied();
+	}
+	check("export holds A, B and C", sections == 3);
+
+	Hive::Layout	layout(r, hive.size);
+	check("layout walks only the listed subkeys", layout.keys == 4);
+	{
+		Reg		reg;
+		reg.hive_file	= (wchar_t*)L"test-hive.dat";
+		reg.file		= (wchar_t*)L"test-hive-compact.dat";
+		check("COMPACT of the damaged hive", reg.doCOMPACT() == ERROR_SUCCESS);
+	}
+	Bytes	compacted;
+	bool	repaired = false;
+	if (compacted.read("test-hive-compact.dat")) {
+		Hive::Reader	c(compacted.p, compacted.size);
+		auto	ck = c.key(c.lookup(u"A", 1));
+		repaired = ck && ck->num_values == 3 && ck->num_subkeys == 2;
+	}
+	check("compacted key has its true counts", repaired);
+
+	remove("test-hive.dat");
+	remove("test-hive.reg");
+	remove("test-hive-compact.dat");
+	return finish();
+}
@@ -0,0 +1,113 @@
+// decodes the HKEY_PERFORMANCE_DATA fixtures made by make-perf-fixtures.py and checks the values PERF would show
+// build: g++ -std=c++17 reg/test/test-perf.cpp -o reg/test/test-perf   (or clang-cl -std:c++17)
+// usage: test-perf [directory holding perf-sample1.bin and perf-sample2.bin]
+
+#include "../reg-perf.h"
+#include "test.h"
+#include <stdio.h>
+#include <math.h>
+
+struct Blob {
+	uint8_t	*p		= nullptr;
+	size_t	size	= 0;
+
+	Blob(const char *dir, const char *name) {
+		char	path[1024];
+		snprintf(path, sizeof(path), "%s/%s", dir, name);
+		FILE	*f = fopen(path, "rb");
+		if (!f)
+			return;
+		fseek(f, 0, SEEK_END);
+		auto	n = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		p		= (uint8_t*)malloc(n > 0 ? n : 1);
+		size	= n > 0 && fread(p, 1, n, f) == (size_t)n ? n : 0;
+		fclose(f);
+	}
+	~Blob() { free(p); }
+	explicit operator bool() const { return size; }
+};
+
+// the object with this title index, or null
+const Perf::Object *find_object(const Perf::Sample &s, uint32_t name) {
+	for (uint32_t i = 0; i < s.objects.n; i++) {
+		if (s.objects[i].name == name)
+			return &s.objects[i];
+	}
+	return nullptr;
+}
+
+// the value PERF shows for a counter of an instance (null for an object without instances), or NAN
+double shown(const Perf::Sample &s0, const Perf::Sample &s1, uint32_t object, uint32_t counter, const char *instance) {
+	auto	o0 = find_object(s0, object), o1 = find_object(s1, object);
+	if (!o0 || !o1)
+		return NAN;
+
+	auto	reading = [&](const Perf::Sample &s, const Perf::Object &o, Perf::Reading &r, uint32_t &type) {
+		for (uint32_t c = 0; c < o.num_counters; c++) {
+			auto	&ctr = s.counters[o.first_counter + c];
+			if (ctr.name != counter)
+				continue;
+			for (uint32_t i = 0; i < o.num_instances; i++) {
+				auto	&inst	= s.instances[o.first_instance + i];
+				bool	match	= !instance ? !inst.name : inst.name && inst.length == strlen(instance);
+				for (uint32_t j = 0; match && j < inst.length; j++)
+					match = inst.name[j] == instance[j];
+				if (match) {
+					r		= s.read(o, c, inst);
+					type	= ctr.type;
+					return true;
+				}
+			}
+		}
+		return false;
+	};
+
+	Perf::Reading	r0, r1;
+	uint32_t		type;
+	double			result;
+	if (!reading(s0, *o0, r0, type) || !reading(s1, *o1, r1, type) || !Perf::value(type, r1, &r0, result))
+		return NAN;
+	return result;
+}
+
+bool near(double a, double b) {
+	return fabs(a - b) < 1e-6 * (fabs(b) > 1 ? fabs(b) : 1);
+}
+
+int main(int argc, char *argv[]) {
+	auto	dir = argc > 1 ? argv[1] : "reg/test";
+	Blob	b0(dir, "perf-sample1.bin"), b1(dir, "perf-sample2.bin");
+	if (!b0 || !b1) {
+		printf("fixtures not found in %s\n", dir);
+		return 1;
+	}
+
+	Perf::Sample	s0, s1;
+	check("parse sample 1", s0.parse(b0.p, b0.size));
+	check("parse sample 2", s1.parse(b1.p, b1.size));
+	check("two objects", s0.objects.n == 2);
+	check("three processor instances and one memory block", s0.instances.n == 4);
+
+	// PERF_100NSEC_TIMER_INV: idle time went up by 0.75s, 0.5s and 0.625s of 1s
+	check("% Processor Time, 0", near(shown(s0, s1, 238, 6, "0"), 25));
+	check("% Processor Time, 1", near(shown(s0, s1, 238, 6, "1"), 50));
+	check("% Processor Time, _Total", near(shown(s0, s1, 238, 6, "_Total"), 37.5));
+
+	// PERF_COUNTER_COUNTER: a 32-bit count that wraps between the samples still rises
+	check("Interrupts/sec, 0", near(shown(s0, s1, 238, 148, "0"), 500));
+	check("Interrupts/sec, 1 (wrapped)", near(shown(s0, s1, 238, 148, "1"), 356));
+
+	// raw counts: a 64-bit one past 4GB, and a DWORD with its top bit set, which is unsigned
+	check("Available Bytes", near(shown(s0, s1, 4, 1380, nullptr), 8589934592.0));
+	check("System Code Total Bytes (DWORD, top bit set)", near(shown(s0, s1, 4, 1408, nullptr), 3221225472.0));
+
+	// PERF_RAW_FRACTION over the PERF_RAW_BASE that follows it
+	check("% Committed Bytes In Use", near(shown(s0, s1, 4, 1406, nullptr), 75));
+
+	// a blob cut short parses what it can and says so
+	Perf::Sample	cut;
+	check("truncated blob is rejected", !cut.parse(b0.p, b0.size - 8));
+
+	return finish();
+}
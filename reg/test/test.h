@@ -0,0 +1,19 @@
+#pragma once
+#include <stdio.h>
+
+//-----------------------------------------------------------------------------
+//	what every reg/test program shares: one line per check, and a summary whose result is the exit code
+//-----------------------------------------------------------------------------
+
+inline int	failures = 0;
+
+inline void check(const char *what, bool ok) {
+	printf("%-44s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failures;
+}
+
+inline int finish() {
+	printf("%s\n", failures ? "FAILED" : "passed");
+	return failures ? 1 : 0;
+}
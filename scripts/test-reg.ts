@@ -0,0 +1,32 @@
+// builds and runs every reg/test/test-*.cpp from the repository root, as the Test reg-* tasks do one at a time
+// g++ elsewhere, clang-cl on Windows; CXX picks another compiler of the same kind
+import * as fs from 'fs';
+import * as path from 'path';
+import { spawnSync } from 'child_process';
+
+const dir		= 'reg/test';
+const napi		= path.join('node_modules', '@isopodlabs', 'napi', 'include');
+const windows	= process.platform === 'win32';
+
+function run(command: string, args: string[]) {
+	return spawnSync(command, args, { stdio: 'inherit', shell: windows }).status === 0;
+}
+
+function build(source: string, exe: string) {
+	return windows
+		? run(process.env.CXX ?? 'clang-cl', ['-std:c++17', '-I', napi, '-DUNICODE', '-D_UNICODE', '-DWIN32_LEAN_AND_MEAN', source, '-o', exe, '/link', 'advapi32.lib'])
+		: run(process.env.CXX ?? 'g++', ['-std=c++17', '-fshort-wchar', '-pthread', '-I', napi, source, '-o', exe]);
+}
+
+const failed: string[] = [];
+
+for (const file of fs.readdirSync(dir).filter(f => /^test-.*\.cpp$/.test(f)).sort()) {
+	const name	= file.slice(0, -4);
+	const exe	= path.join(dir, windows ? name + '.exe' : name);
+	console.log(`--- ${name}`);
+	if (!build(path.join(dir, file), exe) || !run(exe, []))
+		failed.push(name);
+}
+
+console.log(failed.length ? `FAILED: ${failed.join(', ')}` : 'all passed');
+process.exit(failed.length ? 1 : 0);
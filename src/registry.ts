@@ -58,6 +58,9 @@ export interface SearchOptions {
 	keys?: 				boolean;	//default: true
 	values?:    		boolean;	//default: true
 	data?: 				boolean;	//default: true
+	max?:				number;		//stop after this many matches
+	depth?:				number;		//maximum recursion depth
+	timeout?:			number;		//milliseconds; partial results reject with cause 1460 (ERROR_TIMEOUT)
 }
 
 function hex_to_bytes(s: string) {
@@ -305,6 +308,45 @@ export function parseOutput(line: string) : [string, Data]|string|undefined {
 		return match[0];
 }
 
+//-----------------------------------------------------------------------------
+// binary output (/bin)
+//-----------------------------------------------------------------------------
+
+export type BinaryRecord =
+	{ kind: 'key_start', path: string }
+  | { kind: 'value', name: string, type: number, data: Uint8Array }
+  | { kind: 'key_end' }
+  | { kind: 'summary', keys: number, values: number, bytes: bigint };
+
+//data is a view onto the input buffer, not a copy
+export function* parseBinaryOutput(buffer: Uint8Array) : Generator<BinaryRecord> {
+	const dv	= new DataView(buffer.buffer, buffer.byteOffset, buffer.byteLength);
+	const utf16	= new TextDecoder('utf-16le');
+	for (let offset = 0; offset + 5 <= buffer.length;) {
+		const kind		= dv.getUint8(offset);
+		const length	= dv.getUint32(offset + 1, true);
+		const start		= offset + 5;
+		offset = start + length;
+		switch (kind) {
+			case 1:
+				yield { kind: 'key_start', path: utf16.decode(buffer.subarray(start, offset)) };
+				break;
+			case 2: {
+				const type		= dv.getUint32(start, true);
+				const name_end	= start + 8 + dv.getUint32(start + 4, true);
+				yield { kind: 'value', name: utf16.decode(buffer.subarray(start + 8, name_end)), type, data: buffer.subarray(name_end, offset) };
+				break;
+			}
+			case 3:
+				yield { kind: 'key_end' };
+				break;
+			case 4:
+				yield { kind: 'summary', keys: dv.getUint32(start, true), values: dv.getUint32(start + 4, true), bytes: dv.getBigUint64(start + 8, true) };
+				break;
+		}
+	}
+}
+
 export class CancellablePromise<T> extends Promise<T> {
     public cancel: (reason?: any) => void;
     constructor(executor: (
@@ -532,6 +574,12 @@ export class KeyPromise implements KeyBase {
 			args.push('/c');
 		if (options?.exact)
 			args.push('/e');
+		if (options?.max !== undefined)
+			args.push('/max', options.max.toString());
+		if (options?.depth !== undefined)
+			args.push('/depth', options.depth.toString());
+		if (options?.timeout !== undefined)
+			args.push('/timeout', options.timeout.toString());
 
 		if (options && (options.keys ?? options.values ?? options.data !== undefined)) {
 			if (options.keys)